@@ -45,6 +45,11 @@
 
 extern int InvGeoTransform(double *gt_in, double *gt_out);
 
+/* Maximum number of generated contour datasources kept by the cache */
+#define MS_CONTOUR_CACHE_MAX   16
+/* Size (in target cells) of the grid the cached source windows snap to */
+#define MS_CONTOUR_CACHE_CHUNK 256
+
 typedef struct {
 
   /* OGR DataSource */
@@ -57,9 +62,28 @@ typedef struct {
   rectObj extent; /* original dataset extent */
   OGRDataSourceH hOGRDS;
   double cellsize;
+  char *cache_key; /* contour cache key of the current window, if caching */
 
 } contourLayerInfo;
 
+typedef struct {
+  char *key;
+  OGRDataSourceH hOGRDS;
+  double cellsize;
+  int ref_count;
+  int last_used;
+} contourCacheEntry;
+
+/*
+** These static structures are protected by the TLOCK_CONTOUR mutex.
+*/
+static contourCacheEntry contourCache[MS_CONTOUR_CACHE_MAX];
+static int contourCacheCount = 0;
+static int contourCacheClock = 0;
+
+static char* msContourGetOption(layerObj *layer, const char *name);
+static void msContourOGRCloseConnection(void *conn_handle);
+
 
 static int msContourLayerInitItemInfo(layerObj *layer)
 {
@@ -121,11 +145,193 @@ static void msContourLayerInfoFree(layerObj *layer)
     return;
 
   freeLayer(&clinfo->ogrLayer);
+  msFree(clinfo->cache_key);
   free(clinfo);
 
   layer->layerinfo = NULL;
 }
 
+/************************************************************************/
+/*                       msContourCacheIsEnabled()                      */
+/*                                                                      */
+/*      Generated contours are only cached on request, with the         */
+/*      CONTOUR_CACHE=ON processing option.                             */
+/************************************************************************/
+
+static int msContourCacheIsEnabled(layerObj *layer)
+{
+  const char *value = CSLFetchNameValue(layer->processing, "CONTOUR_CACHE");
+
+  return (value != NULL && CSLTestBoolean(value));
+}
+
+/************************************************************************/
+/*                        msContourCacheGetKey()                        */
+/*                                                                      */
+/*      Build the cache key for the contours of a source window: the    */
+/*      dataset, band, contour options (resolved for the current        */
+/*      scale) and the source window with its resolution level.         */
+/************************************************************************/
+
+static char *msContourCacheGetKey(layerObj *layer, GDALDatasetH hDS, int band,
+                                  int src_xoff, int src_yoff,
+                                  int src_xsize, int src_ysize,
+                                  int dst_xsize, int dst_ysize)
+{
+  char *interval, *levels, *key;
+  const char *elevItem;
+  char window[256];
+
+  interval = msContourGetOption(layer, "CONTOUR_INTERVAL");
+  levels = msContourGetOption(layer, "CONTOUR_LEVELS");
+  elevItem = CSLFetchNameValue(layer->processing,"CONTOUR_ITEM");
+
+  snprintf(window, sizeof(window), "%d|%d,%d,%d,%d|%d,%d", band,
+           src_xoff, src_yoff, src_xsize, src_ysize, dst_xsize, dst_ysize);
+
+  key = msStrdup(GDALGetDescription(hDS));
+  key = msStringConcatenate(key, "|");
+  key = msStringConcatenate(key, window);
+  key = msStringConcatenate(key, "|");
+  key = msStringConcatenate(key, interval ? interval : "");
+  key = msStringConcatenate(key, "|");
+  key = msStringConcatenate(key, levels ? levels : "");
+  key = msStringConcatenate(key, "|");
+  key = msStringConcatenate(key, elevItem ? elevItem : "");
+
+  msFree(interval);
+  msFree(levels);
+
+  return key;
+}
+
+/************************************************************************/
+/*                        msContourCacheRequest()                       */
+/*                                                                      */
+/*      Return a cached contour datasource matching the key and up      */
+/*      its reference count, or NULL.  OGR layers keep a read state,    */
+/*      so a datasource is only handed out when nobody else uses it.    */
+/************************************************************************/
+
+static OGRDataSourceH msContourCacheRequest(const char *key, double *cellsize)
+{
+  int i;
+  OGRDataSourceH hOGRDS = NULL;
+
+  msAcquireLock(TLOCK_CONTOUR);
+  for (i = 0; i < contourCacheCount; ++i) {
+    contourCacheEntry *entry = contourCache + i;
+    if (entry->ref_count == 0 && strcmp(entry->key, key) == 0) {
+      entry->ref_count++;
+      entry->last_used = ++contourCacheClock;
+      *cellsize = entry->cellsize;
+      hOGRDS = entry->hOGRDS;
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_CONTOUR);
+
+  return hOGRDS;
+}
+
+/************************************************************************/
+/*                          msContourCacheAdd()                         */
+/*                                                                      */
+/*      Hand a freshly generated datasource over to the cache, with a   */
+/*      reference held by the caller.  The least recently used idle     */
+/*      entry is dropped when the cache is full.  Returns MS_FAILURE    */
+/*      if the datasource could not be cached, in which case it         */
+/*      remains owned by the caller.                                    */
+/************************************************************************/
+
+static int msContourCacheAdd(const char *key, OGRDataSourceH hOGRDS,
+                             double cellsize)
+{
+  int i, slot = -1;
+  contourCacheEntry *entry;
+
+  msAcquireLock(TLOCK_CONTOUR);
+
+  for (i = 0; i < contourCacheCount; ++i) {
+    if (strcmp(contourCache[i].key, key) == 0) {
+      /* generated concurrently by another user, keep the existing one */
+      msReleaseLock(TLOCK_CONTOUR);
+      return MS_FAILURE;
+    }
+  }
+
+  if (contourCacheCount < MS_CONTOUR_CACHE_MAX) {
+    slot = contourCacheCount++;
+  } else {
+    for (i = 0; i < contourCacheCount; ++i) {
+      if (contourCache[i].ref_count == 0 &&
+          (slot == -1 || contourCache[i].last_used < contourCache[slot].last_used))
+        slot = i;
+    }
+    if (slot == -1) {
+      msReleaseLock(TLOCK_CONTOUR);
+      return MS_FAILURE;
+    }
+    msContourOGRCloseConnection(contourCache[slot].hOGRDS);
+    msFree(contourCache[slot].key);
+  }
+
+  entry = contourCache + slot;
+  entry->key = msStrdup(key);
+  entry->hOGRDS = hOGRDS;
+  entry->cellsize = cellsize;
+  entry->ref_count = 1;
+  entry->last_used = ++contourCacheClock;
+
+  msReleaseLock(TLOCK_CONTOUR);
+
+  return MS_SUCCESS;
+}
+
+/************************************************************************/
+/*                    msContourCacheReleaseConnection()                 */
+/*                                                                      */
+/*      Connection pool close callback for cached datasources: only     */
+/*      drop our reference, the cache owns the datasource.              */
+/************************************************************************/
+
+static void msContourCacheReleaseConnection(void *conn_handle)
+{
+  int i;
+
+  msAcquireLock(TLOCK_CONTOUR);
+  for (i = 0; i < contourCacheCount; ++i) {
+    if (contourCache[i].hOGRDS == (OGRDataSourceH) conn_handle) {
+      contourCache[i].ref_count--;
+      msReleaseLock(TLOCK_CONTOUR);
+      return;
+    }
+  }
+  msReleaseLock(TLOCK_CONTOUR);
+
+  /* not cached (anymore), we are the last user */
+  msContourOGRCloseConnection(conn_handle);
+}
+
+/************************************************************************/
+/*                           msContourCleanup()                         */
+/*                                                                      */
+/*      Destroy all the cached contour datasources.                     */
+/************************************************************************/
+
+void msContourCleanup(void)
+{
+  int i;
+
+  msAcquireLock(TLOCK_CONTOUR);
+  for (i = 0; i < contourCacheCount; ++i) {
+    msContourOGRCloseConnection(contourCache[i].hOGRDS);
+    msFree(contourCache[i].key);
+  }
+  contourCacheCount = 0;
+  msReleaseLock(TLOCK_CONTOUR);
+}
+
 static int msContourLayerReadRaster(layerObj *layer, rectObj rect)
 {
   mapObj *map = layer->map;  
@@ -343,6 +549,20 @@ static int msContourLayerReadRaster(layerObj *layer, rectObj rect)
     urx = ceil(urx / virtual_grid_step_x) * virtual_grid_step_x + (virtual_grid_step_x*5);
     ury = floor(ury / virtual_grid_step_y) * virtual_grid_step_y - (virtual_grid_step_x*5);
     lly = ceil(lly / virtual_grid_step_y) * virtual_grid_step_y + (virtual_grid_step_x*5);
+
+    /*
+     * When caching, snap the window to a coarser grid of chunks so that
+     * neighbouring tiles and zooms within the same resolution level
+     * end up with the same window, and can share the generated contours.
+     */
+    if (msContourCacheIsEnabled(layer)) {
+      double chunk_x = virtual_grid_step_x * MS_CONTOUR_CACHE_CHUNK;
+      double chunk_y = virtual_grid_step_y * MS_CONTOUR_CACHE_CHUNK;
+      llx = floor(llx / chunk_x) * chunk_x;
+      urx = ceil(urx / chunk_x) * chunk_x;
+      ury = floor(ury / chunk_y) * chunk_y;
+      lly = ceil(lly / chunk_y) * chunk_y;
+    }
     
     src_xoff = MAX(0,(int) floor(llx+0.5));
     src_yoff = MAX(0,(int) floor(ury+0.5));
@@ -382,6 +602,24 @@ static int msContourLayerReadRaster(layerObj *layer, rectObj rect)
       msDebug( "msContourLayerReadRaster(): src=%d,%d,%d,%d, dst=%d,%d,%d,%d\n",
                src_xoff, src_yoff, src_xsize, src_ysize,
                0, 0, dst_xsize, dst_ysize );
+
+    /* Reuse the contours of this window if they have already been generated */
+    if (msContourCacheIsEnabled(layer)) {
+      clinfo->cache_key = msContourCacheGetKey(layer, clinfo->hOrigDS, band,
+                                               src_xoff, src_yoff,
+                                               src_xsize, src_ysize,
+                                               dst_xsize, dst_ysize);
+      clinfo->hOGRDS = msContourCacheRequest(clinfo->cache_key,
+                                             &clinfo->cellsize);
+      if (clinfo->hOGRDS) {
+        char buf[64];
+        if (layer->debug)
+          msDebug("msContourLayerReadRaster(): using cached contours.\n");
+        sprintf(buf, "%lf", clinfo->cellsize);
+        msInsertHashTable(&layer->metadata, "__data_cellsize__", buf);
+        return MS_SUCCESS;
+      }
+    }
   } else {
     src_xoff = 0;
     src_yoff = 0;
@@ -526,6 +764,12 @@ static int msContourLayerGenerateContour(layerObj *layer)
     return MS_FAILURE;
   }
 
+  if (clinfo->hOGRDS) { /* from the contour cache */
+    msConnPoolRegister(&clinfo->ogrLayer, clinfo->hOGRDS,
+                       msContourCacheReleaseConnection);
+    return MS_SUCCESS;
+  }
+
   if (!clinfo->hDS) { /* no overlap */
     return MS_SUCCESS;
   }
@@ -612,7 +856,14 @@ static int msContourLayerGenerateContour(layerObj *layer)
     return MS_FAILURE;
   }
   
-  msConnPoolRegister(&clinfo->ogrLayer, clinfo->hOGRDS, msContourOGRCloseConnection);
+  if (clinfo->cache_key &&
+      msContourCacheAdd(clinfo->cache_key, clinfo->hOGRDS,
+                        clinfo->cellsize) == MS_SUCCESS)
+    msConnPoolRegister(&clinfo->ogrLayer, clinfo->hOGRDS,
+                       msContourCacheReleaseConnection);
+  else
+    msConnPoolRegister(&clinfo->ogrLayer, clinfo->hOGRDS,
+                       msContourOGRCloseConnection);
 
   return MS_SUCCESS;
 
@@ -760,6 +1011,9 @@ int msContourLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
     msConnPoolRelease(&clinfo->ogrLayer, clinfo->hOGRDS);
   
   msLayerClose(&clinfo->ogrLayer);
+  clinfo->hOGRDS = NULL;
+  msFree(clinfo->cache_key);
+  clinfo->cache_key = NULL;
   
   /* Open the raster source */
   if (msContourLayerReadRaster(layer, newRect) != MS_SUCCESS)
@@ -895,6 +1149,8 @@ int msContourLayerInitializeVirtualTable(layerObj *layer)
 }
 
 #else
+void msContourCleanup(void) {}
+
 int msContourLayerInitializeVirtualTable(layerObj *layer)
 {
   msSetError(MS_MISCERR, "Contour Layer needs GDAL support, but it it not compiled in", "msContourLayerInitializeVirtualTable()");
@@ -33,6 +33,7 @@
 #include "maptime.h"
 #include "mapcopy.h"
 #include "mapfile.h"
+#include "mapthread.h"
 
 
 /* msPrepareImage()
@@ -178,6 +179,181 @@ imageObj *msPrepareImage(mapObj *map, int allow_nonsquare)
 }
 
 
+/*
+ * Opens a vector layer and selects the shapes to draw within searchrect
+ * (in layer coordinates). Returns MS_SUCCESS, MS_DONE if nothing overlaps
+ * or MS_FAILURE; the layer is closed unless MS_SUCCESS is returned.
+*/
+static int msDrawVectorLayerWhichShapes(layerObj *layer, rectObj searchrect)
+{
+  int status;
+
+  /* open this layer */
+  status = msLayerOpen(layer);
+  if(status != MS_SUCCESS) return MS_FAILURE;
+
+  /* build item list. STYLEITEM javascript needs the shape attributes */
+  if (layer->styleitem &&
+     (strncasecmp(layer->styleitem, "javascript://", 13) == 0)) {  
+    status = msLayerWhichItems(layer, MS_TRUE, NULL);
+  }
+  else 
+    status = msLayerWhichItems(layer, MS_FALSE, NULL);
+
+  if(status != MS_SUCCESS) {
+    msLayerClose(layer);
+    return MS_FAILURE;
+  }
+
+  status = msLayerWhichShapes(layer, searchrect, MS_FALSE);
+  if(status != MS_SUCCESS)
+    msLayerClose(layer);
+  return status;
+}
+
+/*
+ * Returns the search rectangle, in layer coordinates, used to draw a
+ * vector layer.
+*/
+static rectObj msDrawVectorLayerSearchRect(mapObj *map, layerObj *layer)
+{
+  rectObj searchrect;
+
+  if(layer->transform == MS_TRUE) {
+    searchrect = map->extent;
+#ifdef USE_PROJ
+    if((map->projection.numargs > 0) && (layer->projection.numargs > 0))
+      msProjectRect(&map->projection, &layer->projection, &searchrect); /* project the searchrect to source coords */
+#endif
+  }
+  else {
+    searchrect.minx = searchrect.miny = 0;
+    searchrect.maxx = map->width-1;
+    searchrect.maxy = map->height-1;
+  }
+  return searchrect;
+}
+
+#ifdef USE_THREAD
+typedef struct {
+  layerObj *layer;
+  rectObj searchrect;
+  int status;
+  int errorcode;
+  char routine[ROUTINELENGTH];
+  char message[MESSAGELENGTH];
+} prefetchLayerJobObj;
+
+static void msPrefetchLayerJob(void *pJobData, int iJob)
+{
+  prefetchLayerJobObj *job = ((prefetchLayerJobObj *) pJobData) + iJob;
+
+  job->status = msDrawVectorLayerWhichShapes(job->layer, job->searchrect);
+  if(job->status == MS_FAILURE) {
+    errorObj *ms_error = msGetErrorObj();
+    job->errorcode = ms_error->code;
+    strlcpy(job->routine, ms_error->routine, sizeof(job->routine));
+    strlcpy(job->message, ms_error->message, sizeof(job->message));
+  }
+}
+
+/*
+ * Runs WhichShapes() concurrently for the visible database layers of the
+ * map (CONFIG "MS_PREFETCH_THREADS" sets the number of threads) so their
+ * queries overlap instead of being issued one after the other while
+ * drawing. Each worker gets its own pooled connection. msDrawVectorLayer()
+ * then picks up layer->prefetchstatus instead of querying again.
+ * Search rectangles are computed here since PROJ objects are shared.
+ * A worker may prefetch several layers and is then handed the same pooled
+ * connection for layers sharing it: PostGIS and Oracle keep the results in
+ * the layer, but OGR layers would share the reading state of one OGR layer
+ * handle, so they are not prefetched (their calls are serialized by
+ * TLOCK_OGR anyway).
+ * Prefetched layers hold their connection until they are drawn, so layers
+ * whose pool is bounded by POOL_MAX_CONNECTIONS are not prefetched either:
+ * the workers, or the drawing of a later layer, would wait for connections
+ * that are only released further down the layer order.
+*/
+static int msPrefetchPoolIsBounded(mapObj *map, layerObj *layer)
+{
+  const char *value;
+  int i;
+
+  for(i=0; i<map->numlayers; i++) {
+    layerObj *lp = GET_LAYER(map, i);
+    if(lp->connectiontype != layer->connectiontype || lp->connection == NULL ||
+        strcmp(lp->connection, layer->connection) != 0)
+      continue;
+    value = msLayerGetProcessingKey(lp, "POOL_MAX_CONNECTIONS");
+    if(value && atoi(value) > 0)
+      return MS_TRUE;
+  }
+  return MS_FALSE;
+}
+
+static void msPrefetchLayers(mapObj *map)
+{
+  const char *pszThreads = msGetConfigOption(map, "MS_PREFETCH_THREADS");
+  prefetchLayerJobObj *jobs;
+  int i, nJobs = 0, nThreads;
+
+  nThreads = pszThreads ? atoi(pszThreads) : 0;
+  if(nThreads < 2)
+    return;
+
+  jobs = (prefetchLayerJobObj *) msSmallCalloc(map->numlayers, sizeof(prefetchLayerJobObj));
+  for(i=0; i<map->numlayers; i++) {
+    layerObj *lp;
+    if(map->layerorder[i] == -1)
+      continue;
+    lp = GET_LAYER(map, map->layerorder[i]);
+    if(lp->postlabelcache || !msLayerIsVisible(map, lp) || lp->opacity == 0 ||
+        lp->type == MS_LAYER_RASTER || lp->type == MS_LAYER_CHART ||
+        lp->cluster.region != NULL || msLayerIsOpen(lp))
+      continue;
+    if(lp->connectiontype != MS_POSTGIS && lp->connectiontype != MS_ORACLESPATIAL)
+      continue;
+    if(lp->connection == NULL || msPrefetchPoolIsBounded(map, lp))
+      continue;
+
+    lp->project = MS_TRUE;
+    jobs[nJobs].layer = lp;
+    jobs[nJobs].searchrect = msDrawVectorLayerSearchRect(map, lp);
+    nJobs++;
+  }
+
+  if(nJobs > 1) {
+    if(map->debug >= MS_DEBUGLEVEL_DEBUG)
+      msDebug("msPrefetchLayers(): querying %d layers with up to %d threads.\n", nJobs, nThreads);
+
+    msRunThreadJobs(nJobs, nThreads, msPrefetchLayerJob, jobs);
+
+    for(i=0; i<nJobs; i++) {
+      jobs[i].layer->prefetchstatus = jobs[i].status;
+      /* errors were raised in the worker threads, report them here */
+      if(jobs[i].status == MS_FAILURE)
+        msSetError(jobs[i].errorcode, "%s", jobs[i].routine, jobs[i].message);
+    }
+  }
+
+  msFree(jobs);
+}
+#endif /* USE_THREAD */
+
+/*
+ * Closes layers whose prefetched shapes were not drawn.
+*/
+static void msPrefetchLayersCleanup(mapObj *map)
+{
+  int i;
+  for(i=0; i<map->numlayers; i++) {
+    layerObj *lp = GET_LAYER(map, i);
+    if(lp->prefetchstatus == MS_SUCCESS)
+      msLayerClose(lp);
+    lp->prefetchstatus = -1;
+  }
+}
+
 /*
  * Generic function to render the map file.
  * The type of the image created is based on the imagetype parameter in the map file.
@@ -303,6 +479,12 @@ imageObj *msDrawMap(mapObj *map, int querymap)
 
 #endif /* USE_WMS_LYR || USE_WFS_LYR */
 
+#ifdef USE_THREAD
+  /* Query the database layers concurrently before drawing them in order */
+  if(!querymap)
+    msPrefetchLayers(map);
+#endif
+
   /* OK, now we can start drawing */
   for(i=0; i<map->numlayers; i++) {
 
@@ -332,6 +514,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
                      "or another unexpected result in response to the GetMap request. Also check "
                      "and make sure that the layer's connection URL is valid.",
                      "msDrawMap()", lp->name);
+          msPrefetchLayersCleanup(map);
           msFreeImage(image);
           msHTTPFreeRequestObj(pasOWSReqInfo, numOWSRequests);
           msFree(pasOWSReqInfo);
@@ -341,6 +524,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
 
 #else /* ndef USE_WMS_LYR */
         msSetError(MS_WMSCONNERR, "MapServer not built with WMS Client support, unable to render layer '%s'.", "msDrawMap()", lp->name);
+        msPrefetchLayersCleanup(map);
         msFreeImage(image);
         return(NULL);
 #endif
@@ -351,6 +535,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
           status = msDrawLayer(map, lp, image);
         if(status == MS_FAILURE) {
           msSetError(MS_IMGERR, "Failed to draw layer named '%s'.", "msDrawMap()", lp->name);
+          msPrefetchLayersCleanup(map);
           msFreeImage(image);
 #if defined(USE_WMS_LYR) || defined(USE_WFS_LYR)
           if (pasOWSReqInfo) {
@@ -371,6 +556,9 @@ imageObj *msDrawMap(mapObj *map, int querymap)
     }
   }
 
+  /* in case a prefetched layer ended up not being drawn */
+  msPrefetchLayersCleanup(map);
+
   if(map->scalebar.status == MS_EMBED && !map->scalebar.postlabelcache) {
 
     /* We need to temporarily restore the original extent for drawing */
@@ -842,6 +1030,142 @@ imagedraw_cleanup:
   return(retcode);
 }
 
+/*
+** Bulk drawing of dense point layers (PROCESSING "POINT_SPRITES=ON"). Features of
+** classes with a single plain marker style and no labels are buffered, projected
+** and transformed in batches and drawn by stamping a pre-rendered marker sprite,
+** bypassing the per feature msDrawShape() path.
+*/
+#define MS_POINT_SPRITE_BATCH 1024
+
+typedef struct {
+  markerSpriteObj *sprites; /* one per class */
+  char *usable; /* MS_TRUE if the class can be drawn with its sprite */
+  pointObj *points;
+  int *classes;
+  int numpoints;
+  int reproject;
+} pointSpriteBatchObj;
+
+static void pointSpriteBatchFree(layerObj *layer, pointSpriteBatchObj *batch)
+{
+  int c;
+  if(batch->sprites) {
+    for(c=0; c<layer->numclasses; c++)
+      msFreeMarkerSprite(&batch->sprites[c]);
+  }
+  msFree(batch->sprites);
+  msFree(batch->usable);
+  msFree(batch->points);
+  msFree(batch->classes);
+  memset(batch, 0, sizeof(pointSpriteBatchObj));
+}
+
+/* returns MS_DONE if no class of the layer can use the sprite path */
+static int pointSpriteBatchInit(mapObj *map, layerObj *layer, imageObj *image, int annotate, pointSpriteBatchObj *batch)
+{
+  int c, status, nusable = 0;
+  const char *value;
+
+  memset(batch, 0, sizeof(pointSpriteBatchObj));
+
+  value = msLayerGetProcessingKey(layer, "POINT_SPRITES");
+  if(!value || strcasecmp(value, "ON") != 0)
+    return MS_DONE;
+  if(layer->type != MS_LAYER_POINT || layer->transform != MS_TRUE || layer->styleitem || layer->numclasses == 0)
+    return MS_DONE;
+
+  batch->sprites = (markerSpriteObj*)msSmallCalloc(layer->numclasses, sizeof(markerSpriteObj));
+  batch->usable = (char*)msSmallCalloc(layer->numclasses, sizeof(char));
+  for(c=0; c<layer->numclasses; c++) {
+    classObj *class = layer->class[c];
+    styleObj *style;
+    if(annotate && class->numlabels > 0)
+      continue;
+    if(class->numstyles == 0) {
+      batch->sprites[c].empty = MS_TRUE;
+      batch->usable[c] = MS_TRUE;
+      nusable++;
+      continue;
+    }
+    if(class->numstyles > 1)
+      continue;
+    style = class->styles[0];
+    if(style->numbindings > 0 || style->rangeitem || style->_geomtransform.type != MS_GEOMTRANSFORM_NONE)
+      continue;
+
+    status = msInitMarkerSprite(&batch->sprites[c], map, image, style, layer->scalefactor);
+    if(status == MS_FAILURE) {
+      pointSpriteBatchFree(layer, batch);
+      return MS_FAILURE;
+    }
+    if(status == MS_SUCCESS) {
+      batch->usable[c] = MS_TRUE;
+      nusable++;
+    }
+  }
+  if(nusable == 0) {
+    pointSpriteBatchFree(layer, batch);
+    return MS_DONE;
+  }
+
+  batch->points = (pointObj*)msSmallMalloc(MS_POINT_SPRITE_BATCH * sizeof(pointObj));
+  batch->classes = (int*)msSmallMalloc(MS_POINT_SPRITE_BATCH * sizeof(int));
+#ifdef USE_PROJ
+  batch->reproject = layer->project && msProjectionsDiffer(&(layer->projection), &(map->projection));
+#endif
+  if(layer->debug)
+    msDebug("msDrawVectorLayer(%s): drawing %d of %d classes with point sprites.\n", layer->name, nusable, layer->numclasses);
+  return MS_SUCCESS;
+}
+
+static int pointSpriteBatchFlush(mapObj *map, layerObj *layer, imageObj *image, pointSpriteBatchObj *batch)
+{
+  int i, status;
+  double invcellsize = 1.0 / map->cellsize;
+
+  for(i=0; i<batch->numpoints; i++) {
+    pointObj *point = &batch->points[i];
+    markerSpriteObj *sprite = &batch->sprites[batch->classes[i]];
+#ifdef USE_PROJ
+    if(batch->reproject)
+      msProjectPoint(&layer->projection, &map->projection, point);
+#endif
+    if(!msPointInRect(point, &map->extent)) continue;
+    point->x = MS_MAP2IMAGE_X_IC_DBL(point->x, map->extent.minx, invcellsize);
+    point->y = MS_MAP2IMAGE_Y_IC_DBL(point->y, map->extent.maxy, invcellsize);
+    status = msDrawMarkerSprite(image, sprite, point);
+    if(status == MS_DONE) /* too many distinct subpixel offsets */
+      status = msDrawMarkerSymbol(map, image, point, sprite->style, layer->scalefactor);
+    if(UNLIKELY(status == MS_FAILURE)) {
+      batch->numpoints = 0;
+      return MS_FAILURE;
+    }
+  }
+  batch->numpoints = 0;
+  return MS_SUCCESS;
+}
+
+static int pointSpriteBatchAdd(mapObj *map, layerObj *layer, imageObj *image, pointSpriteBatchObj *batch, shapeObj *shape)
+{
+  int i, j;
+
+  if(batch->sprites[shape->classindex].empty)
+    return MS_SUCCESS;
+  for(j=0; j<shape->numlines; j++) {
+    for(i=0; i<shape->line[j].numpoints; i++) {
+      if(batch->numpoints == MS_POINT_SPRITE_BATCH) {
+        if(pointSpriteBatchFlush(map, layer, image, batch) != MS_SUCCESS)
+          return MS_FAILURE;
+      }
+      batch->points[batch->numpoints] = shape->line[j].point[i];
+      batch->classes[batch->numpoints] = shape->classindex;
+      batch->numpoints++;
+    }
+  }
+  return MS_SUCCESS;
+}
+
 int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
 {
   int         status, retcode=MS_SUCCESS;
@@ -857,7 +1181,9 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   double minfeaturesize = -1;
   int maxfeatures=-1;
   int featuresdrawn=0;
+  pointSpriteBatchObj spritebatch;
 
+  memset(&spritebatch, 0, sizeof(pointSpriteBatchObj));
   if (image)
     maxfeatures=msLayerGetMaxFeaturesToDraw(layer, image->format);
 
@@ -870,43 +1196,17 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   }
 
 
-  /* open this layer */
-  status = msLayerOpen(layer);
-  if(status != MS_SUCCESS) return MS_FAILURE;
-
-  /* build item list. STYLEITEM javascript needs the shape attributes */
-  if (layer->styleitem &&
-     (strncasecmp(layer->styleitem, "javascript://", 13) == 0)) {  
-    status = msLayerWhichItems(layer, MS_TRUE, NULL);
-  }
-  else 
-    status = msLayerWhichItems(layer, MS_FALSE, NULL);
-
-  if(status != MS_SUCCESS) {
-    msLayerClose(layer);
-    return MS_FAILURE;
-  }
-
-  /* identify target shapes */
-  if(layer->transform == MS_TRUE) {
-    searchrect = map->extent;
-#ifdef USE_PROJ
-    if((map->projection.numargs > 0) && (layer->projection.numargs > 0))
-      msProjectRect(&map->projection, &layer->projection, &searchrect); /* project the searchrect to source coords */
-#endif
-  }
-  else {
-    searchrect.minx = searchrect.miny = 0;
-    searchrect.maxx = map->width-1;
-    searchrect.maxy = map->height-1;
+  /* identify target shapes, msPrefetchLayers() may have done it already */
+  if(layer->prefetchstatus != -1) {
+    status = layer->prefetchstatus;
+    layer->prefetchstatus = -1;
+  } else {
+    searchrect = msDrawVectorLayerSearchRect(map, layer);
+    status = msDrawVectorLayerWhichShapes(layer, searchrect);
   }
-
-  status = msLayerWhichShapes(layer, searchrect, MS_FALSE);
   if(status == MS_DONE) { /* no overlap */
-    msLayerClose(layer);
     return MS_SUCCESS;
   } else if(status != MS_SUCCESS) {
-    msLayerClose(layer);
     return MS_FAILURE;
   }
 
@@ -921,6 +1221,12 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   if(layer->minfeaturesize > 0)
     minfeaturesize = Pix2LayerGeoref(map, layer, layer->minfeaturesize);
 
+  if(image && pointSpriteBatchInit(map, layer, image, annotate, &spritebatch) == MS_FAILURE) {
+    msFree(classgroup);
+    msLayerClose(layer);
+    return MS_FAILURE;
+  }
+
   while((status = msLayerNextShape(layer, &shape)) == MS_SUCCESS) {
 
     /* Check if the shape size is ok to be drawn */
@@ -943,6 +1249,24 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
     }
     featuresdrawn++;
 
+    if(spritebatch.usable) {
+      if(spritebatch.usable[shape.classindex]) {
+        if(pointSpriteBatchAdd(map, layer, image, &spritebatch, &shape) != MS_SUCCESS) {
+          msFreeShape(&shape);
+          retcode = MS_FAILURE;
+          break;
+        }
+        msFreeShape(&shape);
+        continue;
+      }
+      /* keep the drawing order of features of other classes */
+      if(spritebatch.numpoints > 0 && pointSpriteBatchFlush(map, layer, image, &spritebatch) != MS_SUCCESS) {
+        msFreeShape(&shape);
+        retcode = MS_FAILURE;
+        break;
+      }
+    }
+
     cache = MS_FALSE;
     if(layer->type == MS_LAYER_LINE && (layer->class[shape.classindex]->numstyles > 1 || (layer->class[shape.classindex]->numstyles == 1 && layer->class[shape.classindex]->styles[0]->outlinewidth > 0))) {
       int i;
@@ -1059,6 +1383,12 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   if (classgroup)
     msFree(classgroup);
 
+  if(spritebatch.usable) {
+    if(status == MS_DONE && retcode == MS_SUCCESS && spritebatch.numpoints > 0)
+      retcode = pointSpriteBatchFlush(map, layer, image, &spritebatch);
+    pointSpriteBatchFree(layer, &spritebatch);
+  }
+
   if(status != MS_DONE || retcode == MS_FAILURE) {
     msLayerClose(layer);
     if(shpcache) {
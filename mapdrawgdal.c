@@ -1683,6 +1683,174 @@ msDrawRasterLayerGDAL_RawMode(
   return 0;
 }
 
+/************************************************************************/
+/*                      msCompileClassIntervals()                       */
+/*                                                                      */
+/*      Try to reduce the classes of a layer to simple intervals on     */
+/*      the pixel value, so that a classification lookup table can      */
+/*      be computed without running the expression parser for every     */
+/*      entry.  Only classes without expression and expressions that    */
+/*      are a conjunction of comparisons between [pixel] and a number   */
+/*      (eg. "([pixel] >= 100 AND [pixel] < 200)") are supported.       */
+/*      Returns MS_FALSE if some class can't be reduced.                */
+/************************************************************************/
+
+typedef struct {
+  int    never;         /* class not in the current classgroup */
+  double min, max;
+  int    min_inclusive, max_inclusive;
+} classIntervalObj;
+
+static int msCompileClassIntervals( layerObj *layer,
+                                    classIntervalObj *intervals )
+
+{
+  int i;
+  char *item_names[4] = { "pixel", "red", "green", "blue" };
+
+  for( i = 0; i < layer->numclasses; i++ ) {
+    classIntervalObj *interval = intervals + i;
+    expressionObj *expression = &(layer->class[i]->expression);
+    tokenListNodeObjPtr node;
+    int numitems = 4, nparens = 0, expect_and = MS_FALSE;
+
+    interval->never = MS_FALSE;
+    interval->min = -HUGE_VAL;
+    interval->max = HUGE_VAL;
+    interval->min_inclusive = interval->max_inclusive = MS_TRUE;
+
+    if ( layer->class[i]->group && layer->classgroup &&
+         strcasecmp(layer->class[i]->group, layer->classgroup) != 0 ) {
+      interval->never = MS_TRUE;
+      continue;
+    }
+
+    /* Empty expression - always matches */
+    if( expression->string == NULL )
+      continue;
+
+    if( expression->type != MS_EXPRESSION )
+      return MS_FALSE;
+
+    /* same tokenization as in msGetClass_String() */
+    if( expression->tokens == NULL )
+      msTokenizeExpression( expression, item_names, &numitems );
+
+    node = expression->tokens;
+    while( node && node->token == '(' ) {
+      nparens++;
+      node = node->next;
+    }
+
+    while( node && node->token != ')' ) {
+      int op;
+      double value;
+      tokenListNodeObjPtr lhs, rhs;
+
+      if( expect_and ) {
+        if( node->token != MS_TOKEN_LOGICAL_AND )
+          return MS_FALSE;
+        node = node->next;
+        expect_and = MS_FALSE;
+        continue;
+      }
+
+      lhs = node;
+      if( !lhs->next || !lhs->next->next )
+        return MS_FALSE;
+      op = lhs->next->token;
+      rhs = lhs->next->next;
+
+      if( lhs->token == MS_TOKEN_BINDING_DOUBLE
+          && strcasecmp(lhs->tokenval.bindval.item, "pixel") == 0
+          && rhs->token == MS_TOKEN_LITERAL_NUMBER ) {
+        value = rhs->tokenval.dblval;
+      } else if( rhs->token == MS_TOKEN_BINDING_DOUBLE
+                 && strcasecmp(rhs->tokenval.bindval.item, "pixel") == 0
+                 && lhs->token == MS_TOKEN_LITERAL_NUMBER ) {
+        /* "number op [pixel]", flip the comparison around */
+        value = lhs->tokenval.dblval;
+        if( op == MS_TOKEN_COMPARISON_LT ) op = MS_TOKEN_COMPARISON_GT;
+        else if( op == MS_TOKEN_COMPARISON_GT ) op = MS_TOKEN_COMPARISON_LT;
+        else if( op == MS_TOKEN_COMPARISON_LE ) op = MS_TOKEN_COMPARISON_GE;
+        else if( op == MS_TOKEN_COMPARISON_GE ) op = MS_TOKEN_COMPARISON_LE;
+      } else
+        return MS_FALSE;
+
+      if( (op == MS_TOKEN_COMPARISON_GT || op == MS_TOKEN_COMPARISON_GE
+           || op == MS_TOKEN_COMPARISON_EQ)
+          && (value > interval->min
+              || (value == interval->min && op == MS_TOKEN_COMPARISON_GT)) ) {
+        interval->min = value;
+        interval->min_inclusive = (op != MS_TOKEN_COMPARISON_GT);
+      }
+      if( (op == MS_TOKEN_COMPARISON_LT || op == MS_TOKEN_COMPARISON_LE
+           || op == MS_TOKEN_COMPARISON_EQ)
+          && (value < interval->max
+              || (value == interval->max && op == MS_TOKEN_COMPARISON_LT)) ) {
+        interval->max = value;
+        interval->max_inclusive = (op != MS_TOKEN_COMPARISON_LT);
+      }
+      if( op != MS_TOKEN_COMPARISON_GT && op != MS_TOKEN_COMPARISON_GE
+          && op != MS_TOKEN_COMPARISON_LT && op != MS_TOKEN_COMPARISON_LE
+          && op != MS_TOKEN_COMPARISON_EQ )
+        return MS_FALSE;
+
+      node = rhs->next;
+      expect_and = MS_TRUE;
+    }
+
+    /* must end with the closing parenthesis matching the opening ones */
+    while( node && node->token == ')' && nparens > 0 ) {
+      nparens--;
+      node = node->next;
+    }
+    if( node != NULL || nparens != 0 || !expect_and )
+      return MS_FALSE;
+  }
+
+  return MS_TRUE;
+}
+
+/************************************************************************/
+/*                       msGetClassFromIntervals()                      */
+/*                                                                      */
+/*      Equivalent of msGetClass_FloatRGB() with intervals prepared     */
+/*      by msCompileClassIntervals().                                   */
+/************************************************************************/
+
+static int msGetClassFromIntervals( layerObj *layer,
+                                    classIntervalObj *intervals,
+                                    float fValue )
+
+{
+  char pixel_value[100];
+  double dfValue;
+  int i;
+
+  /* the expression parser sees the value formatted as by */
+  /* msGetClass_FloatRGB(), apply the same rounding.      */
+  snprintf( pixel_value, sizeof(pixel_value), "%18g", fValue );
+  dfValue = atof( pixel_value );
+
+  for( i = 0; i < layer->numclasses; i++ ) {
+    classIntervalObj *interval = intervals + i;
+
+    if( interval->never )
+      continue;
+    if( dfValue < interval->min
+        || (dfValue == interval->min && !interval->min_inclusive) )
+      continue;
+    if( dfValue > interval->max
+        || (dfValue == interval->max && !interval->max_inclusive) )
+      continue;
+
+    return i;
+  }
+
+  return -1;
+}
+
 /************************************************************************/
 /*              msDrawRasterLayerGDAL_16BitClassifcation()              */
 /*                                                                      */
@@ -1712,6 +1880,7 @@ msDrawRasterLayerGDAL_16BitClassification(
   const char *pszBuckets;
   int  *cmap, c, j, k, bGotNoData = FALSE, bGotFirstValue;
   unsigned char *rb_cmap[4];
+  classIntervalObj *intervals;
   CPLErr eErr;
   rasterBufferObj *mask_rb = NULL;
   if(layer->mask) {
@@ -1869,6 +2038,19 @@ msDrawRasterLayerGDAL_16BitClassification(
   rb_cmap[2] = (unsigned char *) msSmallCalloc(1,nBucketCount);
   rb_cmap[3] = (unsigned char *) msSmallCalloc(1,nBucketCount);
 
+  /* -------------------------------------------------------------------- */
+  /*      With simple range classes we avoid going through the            */
+  /*      expression parser for each bucket.                              */
+  /* -------------------------------------------------------------------- */
+  intervals = (classIntervalObj *)
+              msSmallMalloc(sizeof(classIntervalObj) * MS_MAX(1,layer->numclasses));
+  if( !msCompileClassIntervals( layer, intervals ) ) {
+    free( intervals );
+    intervals = NULL;
+  } else if( layer->debug > 0 )
+    msDebug( "msDrawRasterGDAL_16BitClassification(%s): "
+             "using precompiled class intervals.\n", layer->name );
+
   for(i=0; i < nBucketCount; i++) {
     double dfOriginalValue;
 
@@ -1876,7 +2058,10 @@ msDrawRasterLayerGDAL_16BitClassification(
 
     dfOriginalValue = (i+0.5) / dfScaleRatio + dfScaleMin;
 
-    c = msGetClass_FloatRGB(layer, (float) dfOriginalValue, -1, -1, -1);
+    if( intervals )
+      c = msGetClassFromIntervals(layer, intervals, (float) dfOriginalValue);
+    else
+      c = msGetClass_FloatRGB(layer, (float) dfOriginalValue, -1, -1, -1);
     if( c != -1 ) {
       int s;
 
@@ -1942,6 +2127,7 @@ msDrawRasterLayerGDAL_16BitClassification(
   /* -------------------------------------------------------------------- */
   free( pafRawData );
   free( cmap );
+  msFree( intervals );
   free( rb_cmap[0] );
   free( rb_cmap[1] );
   free( rb_cmap[2] );
@@ -0,0 +1,473 @@
+/**********************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Built-in GeoJSON feature output (for WFS)
+ * Author:   Steve Lime and the MapServer team.
+ *
+ **********************************************************************
+ * Copyright (c) 1996-2014 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **********************************************************************/
+
+/*
+** The GEOJSON output format driver writes the query result sets straight
+** from the shapeObj's to the output stream. Unlike the OGR/ drivers there
+** is no intermediate datasource, so nothing is written to disk or /vsimem/
+** and no OGR feature is built per shape.
+*/
+
+#include <ctype.h>
+
+#include "mapserver.h"
+#include "mapows.h"
+
+
+
+#define MS_FEATURE_OUTPUT_FLUSH 65536
+
+typedef struct {
+  mapObj *map;
+  outputFormatObj *format;
+  bufferObj buffer;    /* pending output, flushed every MS_FEATURE_OUTPUT_FLUSH bytes */
+  int precision;       /* COORDINATE_PRECISION, -1 for 15 significant digits */
+  int numfeatures;     /* features written so far, all layers */
+} featureWriterObj;
+
+static void featureAppend(bufferObj *buffer, const char *data, size_t length)
+{
+  msBufferAppend(buffer, (void *) data, length);
+}
+
+static void featureAppendString(bufferObj *buffer, const char *string)
+{
+  msBufferAppend(buffer, (void *) string, strlen(string));
+}
+
+static void featureFlush(featureWriterObj *writer, int force)
+{
+  if(writer->buffer.size > 0 &&
+      (force || writer->buffer.size >= MS_FEATURE_OUTPUT_FLUSH)) {
+    msIO_fwrite(writer->buffer.data, 1, writer->buffer.size, stdout);
+    writer->buffer.size = 0;
+  }
+}
+
+/************************************************************************/
+/*                          GeoJSON writer                              */
+/************************************************************************/
+
+static void geojsonAppendEscaped(bufferObj *buffer, const char *string)
+{
+  const char *start = string;
+  char escape[8];
+
+  featureAppend(buffer, "\"", 1);
+  for(; *string; string++) {
+    unsigned char ch = (unsigned char) *string;
+    if(ch >= 0x20 && ch != '"' && ch != '\\')
+      continue;
+    featureAppend(buffer, start, string - start);
+    switch(ch) {
+      case '"':
+        featureAppend(buffer, "\\\"", 2);
+        break;
+      case '\\':
+        featureAppend(buffer, "\\\\", 2);
+        break;
+      case '\n':
+        featureAppend(buffer, "\\n", 2);
+        break;
+      case '\r':
+        featureAppend(buffer, "\\r", 2);
+        break;
+      case '\t':
+        featureAppend(buffer, "\\t", 2);
+        break;
+      default:
+        snprintf(escape, sizeof(escape), "\\u%04x", ch);
+        featureAppend(buffer, escape, 6);
+    }
+    start = string + 1;
+  }
+  featureAppend(buffer, start, string - start);
+  featureAppend(buffer, "\"", 1);
+}
+
+static void geojsonAppendNumber(bufferObj *buffer, double value, int precision)
+{
+  char number[512];
+  int len;
+
+  if(msIsNan(value) || msIsNan(value - value)) { /* NaN or infinite, no JSON number */
+    featureAppendString(buffer, "null");
+    return;
+  }
+  if(precision >= 0)
+    len = msFormatDouble(number, sizeof(number), value, precision);
+  else
+    len = snprintf(number, sizeof(number), "%.15g", value);
+  featureAppend(buffer, number, MS_MIN(len, (int) sizeof(number) - 1));
+}
+
+static void geojsonAppendPoint(bufferObj *buffer, pointObj *point, int precision)
+{
+  featureAppend(buffer, "[", 1);
+  geojsonAppendNumber(buffer, point->x, precision);
+  featureAppend(buffer, ",", 1);
+  geojsonAppendNumber(buffer, point->y, precision);
+  featureAppend(buffer, "]", 1);
+}
+
+static void geojsonAppendLine(bufferObj *buffer, lineObj *line, int precision)
+{
+  int i;
+
+  featureAppend(buffer, "[", 1);
+  for(i=0; i<line->numpoints; i++) {
+    if(i > 0) featureAppend(buffer, ",", 1);
+    geojsonAppendPoint(buffer, &(line->point[i]), precision);
+  }
+  featureAppend(buffer, "]", 1);
+}
+
+/* rings of one polygon: the outer ring followed by its holes */
+static void geojsonAppendPolygon(bufferObj *buffer, shapeObj *shape, int outer,
+                                 int *outer_flags, int precision)
+{
+  int *inner_flags, i;
+
+  featureAppend(buffer, "[", 1);
+  geojsonAppendLine(buffer, &(shape->line[outer]), precision);
+  inner_flags = msGetInnerList(shape, outer, outer_flags);
+  for(i=0; i<shape->numlines; i++) {
+    if(!inner_flags[i]) continue;
+    featureAppend(buffer, ",", 1);
+    geojsonAppendLine(buffer, &(shape->line[i]), precision);
+  }
+  free(inner_flags);
+  featureAppend(buffer, "]", 1);
+}
+
+static void geojsonAppendGeometry(bufferObj *buffer, shapeObj *shape, int precision)
+{
+  int i, j, first;
+
+  if(shape->numlines < 1 || shape->type == MS_SHAPE_NULL) {
+    featureAppendString(buffer, "null");
+    return;
+  }
+
+  switch(shape->type) {
+    case MS_SHAPE_POINT:
+      if(shape->numlines == 1 && shape->line[0].numpoints == 1) {
+        featureAppendString(buffer, "{\"type\":\"Point\",\"coordinates\":");
+        geojsonAppendPoint(buffer, &(shape->line[0].point[0]), precision);
+      } else {
+        featureAppendString(buffer, "{\"type\":\"MultiPoint\",\"coordinates\":[");
+        for(i=0, first=MS_TRUE; i<shape->numlines; i++) {
+          for(j=0; j<shape->line[i].numpoints; j++, first=MS_FALSE) {
+            if(!first) featureAppend(buffer, ",", 1);
+            geojsonAppendPoint(buffer, &(shape->line[i].point[j]), precision);
+          }
+        }
+        featureAppend(buffer, "]", 1);
+      }
+      break;
+    case MS_SHAPE_LINE:
+      if(shape->numlines == 1) {
+        featureAppendString(buffer, "{\"type\":\"LineString\",\"coordinates\":");
+        geojsonAppendLine(buffer, &(shape->line[0]), precision);
+      } else {
+        featureAppendString(buffer, "{\"type\":\"MultiLineString\",\"coordinates\":[");
+        for(i=0; i<shape->numlines; i++) {
+          if(i > 0) featureAppend(buffer, ",", 1);
+          geojsonAppendLine(buffer, &(shape->line[i]), precision);
+        }
+        featureAppend(buffer, "]", 1);
+      }
+      break;
+    case MS_SHAPE_POLYGON: {
+      int *outer_flags = msGetOuterList(shape);
+      int numouters = 0;
+
+      for(i=0; i<shape->numlines; i++)
+        if(outer_flags[i]) numouters++;
+
+      if(numouters == 1) {
+        featureAppendString(buffer, "{\"type\":\"Polygon\",\"coordinates\":");
+        for(i=0; i<shape->numlines; i++)
+          if(outer_flags[i])
+            geojsonAppendPolygon(buffer, shape, i, outer_flags, precision);
+      } else {
+        featureAppendString(buffer, "{\"type\":\"MultiPolygon\",\"coordinates\":[");
+        for(i=0, first=MS_TRUE; i<shape->numlines; i++) {
+          if(!outer_flags[i]) continue;
+          if(!first) featureAppend(buffer, ",", 1);
+          first = MS_FALSE;
+          geojsonAppendPolygon(buffer, shape, i, outer_flags, precision);
+        }
+        featureAppend(buffer, "]", 1);
+      }
+      free(outer_flags);
+      break;
+    }
+    default:
+      featureAppendString(buffer, "null");
+      return;
+  }
+  featureAppend(buffer, "}", 1);
+}
+
+/* does value follow the JSON number grammar? */
+static int geojsonIsNumber(const char *value)
+{
+  if(*value == '-') value++;
+  if(!isdigit((unsigned char) *value)) return MS_FALSE;
+  if(*value == '0' && isdigit((unsigned char) value[1])) return MS_FALSE;
+  while(isdigit((unsigned char) *value)) value++;
+  if(*value == '.') {
+    value++;
+    if(!isdigit((unsigned char) *value)) return MS_FALSE;
+    while(isdigit((unsigned char) *value)) value++;
+  }
+  if(*value == 'e' || *value == 'E') {
+    value++;
+    if(*value == '+' || *value == '-') value++;
+    if(!isdigit((unsigned char) *value)) return MS_FALSE;
+    while(isdigit((unsigned char) *value)) value++;
+  }
+  return (*value == '\0');
+}
+
+/* numeric items are written as JSON numbers when they are valid ones */
+static void geojsonAppendValue(bufferObj *buffer, gmlItemObj *item, const char *value)
+{
+  if(item->type && (EQUAL(item->type, "Integer") || EQUAL(item->type, "Real"))) {
+    if(*value == '\0') {
+      featureAppendString(buffer, "null");
+      return;
+    }
+    if(geojsonIsNumber(value)) {
+      featureAppendString(buffer, value);
+      return;
+    }
+  }
+  geojsonAppendEscaped(buffer, value);
+}
+
+static void geojsonStart(featureWriterObj *writer)
+{
+  featureAppendString(&writer->buffer, "{\n\"type\": \"FeatureCollection\",\n");
+#ifdef USE_WFS_SVR
+  {
+    const char *epsg = msOWSGetEPSGProj(&(writer->map->projection), &(writer->map->web.metadata), "FO", MS_TRUE);
+    if(epsg && strncasecmp(epsg, "EPSG:", 5) == 0) {
+      featureAppendString(&writer->buffer, "\"crs\": { \"type\": \"name\", \"properties\": { \"name\": \"urn:ogc:def:crs:EPSG::");
+      featureAppendString(&writer->buffer, epsg+5);
+      featureAppendString(&writer->buffer, "\" } },\n");
+    }
+  }
+#endif
+  featureAppendString(&writer->buffer, "\"features\": [\n");
+}
+
+static void geojsonWriteShape(featureWriterObj *writer, layerObj *layer, shapeObj *shape,
+                              gmlItemListObj *item_list, int featureid_index)
+{
+  bufferObj *buffer = &(writer->buffer);
+  int i, first;
+
+  if(writer->numfeatures > 0)
+    featureAppendString(buffer, ",\n");
+  featureAppendString(buffer, "{ \"type\": \"Feature\", ");
+  if(featureid_index >= 0) {
+    featureAppendString(buffer, "\"id\": ");
+    geojsonAppendEscaped(buffer, shape->values[featureid_index]);
+    featureAppendString(buffer, ", ");
+  }
+
+  featureAppendString(buffer, "\"properties\": { ");
+  for(i=0, first=MS_TRUE; i<item_list->numitems; i++) {
+    gmlItemObj *item = item_list->items + i;
+
+    if(!item->visible) continue;
+    if(!first) featureAppendString(buffer, ", ");
+    first = MS_FALSE;
+    geojsonAppendEscaped(buffer, item->alias ? item->alias : item->name);
+    featureAppendString(buffer, ": ");
+    geojsonAppendValue(buffer, item, shape->values[i]);
+  }
+  featureAppendString(buffer, first ? "}, \"geometry\": " : " }, \"geometry\": ");
+  geojsonAppendGeometry(buffer, shape, writer->precision);
+  featureAppendString(buffer, " }");
+}
+
+static void geojsonEnd(featureWriterObj *writer)
+{
+  featureAppendString(&writer->buffer, "\n]\n}\n");
+}
+
+/************************************************************************/
+/*                   msInitDefaultFeatureOutputFormat()                 */
+/************************************************************************/
+
+int msInitDefaultFeatureOutputFormat(outputFormatObj *format)
+{
+  if(strcasecmp(format->driver, "GEOJSON") == 0) {
+    format->mimetype = msStrdup("application/json; subtype=geojson");
+    format->extension = msStrdup("json");
+  } else {
+    msSetError(MS_MISCERR, "Unknown feature output driver `%s'.",
+               "msInitDefaultFeatureOutputFormat()", format->driver);
+    return MS_FAILURE;
+  }
+  format->imagemode = MS_IMAGEMODE_FEATURE;
+  format->renderer = MS_RENDER_WITH_FEATURES;
+
+  return MS_SUCCESS;
+}
+
+/************************************************************************/
+/*                      msWriteFeaturesFromQuery()                      */
+/*                                                                      */
+/*      Write the result sets of all layers with the GEOJSON driver.    */
+/*      Paging has already been applied to the result caches by the     */
+/*      query, shapes are reprojected to the map projection like the    */
+/*      OGR output does.                                                */
+/*                                                                      */
+/*      What can fail is checked before the first byte is sent, so the  */
+/*      caller can still report an exception. Once the document has     */
+/*      started a failure can only truncate it: the document is closed, */
+/*      the error is logged and MS_SUCCESS is returned.                 */
+/************************************************************************/
+
+int msWriteFeaturesFromQuery(mapObj *map, outputFormatObj *format, int sendheaders)
+{
+  featureWriterObj writer;
+  gmlItemListObj **item_lists;
+  int iLayer, i, status = MS_SUCCESS;
+  const char *value;
+
+  item_lists = (gmlItemListObj **) msSmallCalloc(map->numlayers, sizeof(gmlItemListObj *));
+  for(iLayer = 0; iLayer < map->numlayers; iLayer++) {
+    layerObj *layer = GET_LAYER(map, iLayer);
+
+    if(!layer->resultcache || layer->resultcache->numresults == 0)
+      continue;
+
+    item_lists[iLayer] = msGMLGetItems(layer, "G");
+    if(item_lists[iLayer] == NULL) {
+      status = MS_FAILURE;
+      break;
+    }
+  }
+  if(status != MS_SUCCESS) {
+    for(iLayer = 0; iLayer < map->numlayers; iLayer++)
+      if(item_lists[iLayer]) msGMLFreeItems(item_lists[iLayer]);
+    free(item_lists);
+    return MS_FAILURE;
+  }
+
+  writer.map = map;
+  writer.format = format;
+  writer.numfeatures = 0;
+  msBufferInit(&(writer.buffer));
+  writer.precision = -1;
+  value = msGetOutputFormatOption(format, "COORDINATE_PRECISION", NULL);
+  if(value) writer.precision = atoi(value);
+
+  if(sendheaders) {
+    const char *filename = msGetOutputFormatOption(format, "FILENAME", NULL);
+    if(filename)
+      msIO_setHeader("Content-Disposition", "attachment; filename=%s", filename);
+    if(format->mimetype)
+      msIO_setHeader("Content-Type", "%s", format->mimetype);
+    msIO_sendHeaders();
+  }
+
+  geojsonStart(&writer);
+
+  for(iLayer = 0; iLayer < map->numlayers && status == MS_SUCCESS; iLayer++) {
+    layerObj *layer = GET_LAYER(map, iLayer);
+    gmlItemListObj *item_list = item_lists[iLayer];
+    shapeObj resultshape;
+    int reproject = MS_FALSE;
+    int featureid_index = -1;
+
+    if(item_list == NULL)
+      continue;
+
+    if(layer->transform == MS_TRUE && layer->project &&
+        msProjectionsDiffer(&(layer->projection), &(layer->map->projection)))
+      reproject = MS_TRUE;
+
+    value = msOWSLookupMetadata(&(layer->metadata), "OFG", "featureid");
+    if(value) {
+      for(i=0; i<layer->numitems; i++) {
+        if(strcasecmp(layer->items[i], value) == 0) {
+          featureid_index = i;
+          break;
+        }
+      }
+    }
+
+    msInitShape(&resultshape);
+    for(i=0; i < layer->resultcache->numresults; i++) {
+      msFreeShape(&resultshape); /* init too */
+
+      status = msLayerGetShape(layer, &resultshape, &(layer->resultcache->results[i]));
+      if(status != MS_SUCCESS)
+        break;
+
+      if(reproject) {
+        status = msProjectShape(&layer->projection, &layer->map->projection, &resultshape);
+        if(status != MS_SUCCESS)
+          break;
+      }
+
+      geojsonWriteShape(&writer, layer, &resultshape, item_list, featureid_index);
+      writer.numfeatures++;
+
+      featureFlush(&writer, MS_FALSE);
+    }
+
+    msFreeShape(&resultshape);
+  }
+
+  /* the headers and part of the features are out, close the document */
+  geojsonEnd(&writer);
+  featureFlush(&writer, MS_TRUE);
+
+  if(status != MS_SUCCESS) {
+    char *errormsg = msGetErrorString("; ");
+    msDebug("msWriteFeaturesFromQuery(): output truncated after %d features: %s\n",
+            writer.numfeatures, errormsg ? errormsg : "");
+    msFree(errormsg);
+    msResetErrorList();
+  }
+
+  for(iLayer = 0; iLayer < map->numlayers; iLayer++)
+    if(item_lists[iLayer]) msGMLFreeItems(item_lists[iLayer]);
+  free(item_lists);
+  msBufferFree(&(writer.buffer));
+
+  return MS_SUCCESS;
+}
@@ -3801,6 +3801,7 @@ int initLayer(layerObj *layer, mapObj *map)
 
   layer->mask = NULL;
   layer->maskimage = NULL;
+  layer->prefetchstatus = -1;
 
   initExpression(&(layer->_geomtransform));
   layer->_geomtransform.type = MS_GEOMTRANSFORM_NONE;
@@ -5758,6 +5759,7 @@ int initMap(mapObj *map)
   map->cellsize = 0;
   map->shapepath = NULL;
   map->mappath = NULL;
+  map->mapfile = NULL;
 
   MS_INIT_COLOR(map->imagecolor, 255,255,255,255); /* white */
 
@@ -6444,6 +6446,7 @@ mapObj *msLoadMap(char *filename, char *new_mappath)
     map->mappath = msStrdup(msBuildPath(szPath, szCWDPath, path));
     free( path );
   }
+  map->mapfile = msStrdup(msBuildPath(szPath, szCWDPath, filename));
 
   msyybasepath = map->mappath; /* for INCLUDEs */
 
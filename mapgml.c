@@ -99,6 +99,34 @@ static int gmlWriteBounds_GML3(FILE *stream, rectObj *rect,
   return MS_SUCCESS;
 }
 
+#define MS_GML_COORD_MAXLEN 320
+
+/*
+** Write the vertices of a line as "x<sep>y " tuples (%f precision). The
+** tuples are formatted into a local block that is flushed in one write,
+** instead of going through msIO_fprintf() for every vertex.
+*/
+static void gmlWriteCoordinates(FILE *stream, lineObj *line, char separator)
+{
+  char block[4096];
+  size_t used = 0;
+  int i;
+
+  /* room for two values in the worst case (%f of DBL_MAX is 316 chars) */
+  for(i=0; i<line->numpoints; i++) {
+    if(used + 2*(MS_GML_COORD_MAXLEN+1) > sizeof(block)) {
+      msIO_fwrite(block, 1, used, stream);
+      used = 0;
+    }
+    used += msFormatDouble(block+used, MS_GML_COORD_MAXLEN, line->point[i].x, 6);
+    block[used++] = separator;
+    used += msFormatDouble(block+used, MS_GML_COORD_MAXLEN, line->point[i].y, 6);
+    block[used++] = ' ';
+  }
+  if(used > 0)
+    msIO_fwrite(block, 1, used, stream);
+}
+
 static void gmlStartGeometryContainer(FILE *stream, const char *name,
                                       const char *namespace, const char *tab)
 {
@@ -220,8 +248,7 @@ static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList,
             msIO_fprintf(stream, "%s<gml:LineString>\n", tab);
 
           msIO_fprintf(stream, "%s  <gml:coordinates>", tab);
-          for(j=0; j<shape->line[i].numpoints; j++)
-            msIO_fprintf(stream, "%f,%f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+          gmlWriteCoordinates(stream, &(shape->line[i]), ',');
           msIO_fprintf(stream, "</gml:coordinates>\n");
 
           msIO_fprintf(stream, "%s</gml:LineString>\n", tab);
@@ -242,8 +269,7 @@ static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList,
           msIO_fprintf(stream, "%s    <gml:LineString>\n", tab); /* no srsname at this point */
 
           msIO_fprintf(stream, "%s      <gml:coordinates>", tab);
-          for(i=0; i<shape->line[j].numpoints; i++)
-            msIO_fprintf(stream, "%f,%f ", shape->line[j].point[i].x, shape->line[j].point[i].y);
+          gmlWriteCoordinates(stream, &(shape->line[j]), ',');
           msIO_fprintf(stream, "</gml:coordinates>\n");
           msIO_fprintf(stream, "%s    </gml:LineString>\n", tab);
           msIO_fprintf(stream, "%s  </gml:lineStringMember>\n", tab);
@@ -291,8 +317,7 @@ static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList,
           msIO_fprintf(stream, "%s    <gml:LinearRing>\n", tab);
 
           msIO_fprintf(stream, "%s      <gml:coordinates>", tab);
-          for(j=0; j<shape->line[i].numpoints; j++)
-            msIO_fprintf(stream, "%f,%f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+          gmlWriteCoordinates(stream, &(shape->line[i]), ',');
           msIO_fprintf(stream, "</gml:coordinates>\n");
 
           msIO_fprintf(stream, "%s    </gml:LinearRing>\n", tab);
@@ -304,8 +329,7 @@ static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList,
               msIO_fprintf(stream, "%s    <gml:LinearRing>\n", tab);
 
               msIO_fprintf(stream, "%s      <gml:coordinates>", tab);
-              for(j=0; j<shape->line[k].numpoints; j++)
-                msIO_fprintf(stream, "%f,%f ", shape->line[k].point[j].x, shape->line[k].point[j].y);
+              gmlWriteCoordinates(stream, &(shape->line[k]), ',');
               msIO_fprintf(stream, "</gml:coordinates>\n");
 
               msIO_fprintf(stream, "%s    </gml:LinearRing>\n", tab);
@@ -340,8 +364,7 @@ static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList,
             msIO_fprintf(stream, "%s      <gml:LinearRing>\n", tab);
 
             msIO_fprintf(stream, "%s        <gml:coordinates>", tab);
-            for(j=0; j<shape->line[i].numpoints; j++)
-              msIO_fprintf(stream, "%f,%f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+            gmlWriteCoordinates(stream, &(shape->line[i]), ',');
             msIO_fprintf(stream, "</gml:coordinates>\n");
 
             msIO_fprintf(stream, "%s      </gml:LinearRing>\n", tab);
@@ -353,8 +376,7 @@ static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList,
                 msIO_fprintf(stream, "%s      <gml:LinearRing>\n", tab);
 
                 msIO_fprintf(stream, "%s        <gml:coordinates>", tab);
-                for(j=0; j<shape->line[k].numpoints; j++)
-                  msIO_fprintf(stream, "%f,%f ", shape->line[k].point[j].x, shape->line[k].point[j].y);
+                gmlWriteCoordinates(stream, &(shape->line[k]), ',');
                 msIO_fprintf(stream, "</gml:coordinates>\n");
 
                 msIO_fprintf(stream, "%s      </gml:LinearRing>\n", tab);
@@ -509,8 +531,7 @@ static int gmlWriteGeometry_GML3(FILE *stream, gmlGeometryListObj *geometryList,
           msFree(pszGMLId);
 
           msIO_fprintf(stream, "%s    <gml:posList srsDimension=\"2\">", tab);
-          for(j=0; j<shape->line[i].numpoints; j++)
-            msIO_fprintf(stream, "%f %f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+          gmlWriteCoordinates(stream, &(shape->line[i]), ' ');
           msIO_fprintf(stream, "</gml:posList>\n");
 
           msIO_fprintf(stream, "%s  </gml:LineString>\n", tab);
@@ -535,8 +556,7 @@ static int gmlWriteGeometry_GML3(FILE *stream, gmlGeometryListObj *geometryList,
           msFree(pszGMLId);
 
           msIO_fprintf(stream, "%s        <gml:posList srsDimension=\"2\">", tab);
-          for(j=0; j<shape->line[i].numpoints; j++)
-            msIO_fprintf(stream, "%f %f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+          gmlWriteCoordinates(stream, &(shape->line[i]), ' ');
           msIO_fprintf(stream, "</gml:posList>\n");
           msIO_fprintf(stream, "%s      </gml:LineString>\n", tab);
         }
@@ -587,8 +607,7 @@ static int gmlWriteGeometry_GML3(FILE *stream, gmlGeometryListObj *geometryList,
           msIO_fprintf(stream, "%s      <gml:LinearRing>\n", tab);
 
           msIO_fprintf(stream, "%s        <gml:posList srsDimension=\"2\">", tab);
-          for(j=0; j<shape->line[i].numpoints; j++)
-            msIO_fprintf(stream, "%f %f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+          gmlWriteCoordinates(stream, &(shape->line[i]), ' ');
           msIO_fprintf(stream, "</gml:posList>\n");
 
           msIO_fprintf(stream, "%s      </gml:LinearRing>\n", tab);
@@ -600,8 +619,7 @@ static int gmlWriteGeometry_GML3(FILE *stream, gmlGeometryListObj *geometryList,
               msIO_fprintf(stream, "%s      <gml:LinearRing>\n", tab);
 
               msIO_fprintf(stream, "%s        <gml:posList srsDimension=\"2\">", tab);
-              for(j=0; j<shape->line[k].numpoints; j++)
-                msIO_fprintf(stream, "%f %f ", shape->line[k].point[j].x, shape->line[k].point[j].y);
+              gmlWriteCoordinates(stream, &(shape->line[k]), ' ');
               msIO_fprintf(stream, "</gml:posList>\n");
 
               msIO_fprintf(stream, "%s      </gml:LinearRing>\n", tab);
@@ -644,8 +662,7 @@ static int gmlWriteGeometry_GML3(FILE *stream, gmlGeometryListObj *geometryList,
             msIO_fprintf(stream, "%s          <gml:LinearRing>\n", tab);
 
             msIO_fprintf(stream, "%s            <gml:posList srsDimension=\"2\">", tab);
-            for(j=0; j<shape->line[i].numpoints; j++)
-              msIO_fprintf(stream, "%f %f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+            gmlWriteCoordinates(stream, &(shape->line[i]), ' ');
             msIO_fprintf(stream, "</gml:posList>\n");
 
             msIO_fprintf(stream, "%s          </gml:LinearRing>\n", tab);
@@ -657,8 +674,7 @@ static int gmlWriteGeometry_GML3(FILE *stream, gmlGeometryListObj *geometryList,
                 msIO_fprintf(stream, "%s          <gml:LinearRing>\n", tab);
 
                 msIO_fprintf(stream, "%s            <gml:posList srsDimension=\"2\">", tab);
-                for(j=0; j<shape->line[k].numpoints; j++)
-                  msIO_fprintf(stream, "%f %f ", shape->line[k].point[j].x, shape->line[k].point[j].y);
+                gmlWriteCoordinates(stream, &(shape->line[k]), ' ');
                 msIO_fprintf(stream, "</gml:posList>\n");
 
                 msIO_fprintf(stream, "%s          </gml:LinearRing>\n", tab);
@@ -870,6 +886,7 @@ static void msGMLWriteItem(FILE *stream, gmlItemObj *item,
                            const char *pszFID)
 {
   char *encoded_value = NULL, *tag_name;
+  const char *output_value;
   int add_namespace = MS_TRUE;
   char gmlid[256];
   gmlid[0] = 0;
@@ -914,13 +931,13 @@ static void msGMLWriteItem(FILE *stream, gmlItemObj *item,
       }
   }
 
-  if( encoded_value == NULL )
-  {
-    if(item->encode == MS_TRUE)
-      encoded_value = msEncodeHTMLEntities(value);
-    else
-      encoded_value = msStrdup(value);
-  }
+  /* only values that actually contain markup characters need a copy */
+  if( encoded_value != NULL )
+    output_value = encoded_value;
+  else if(item->encode == MS_TRUE && value && strpbrk(value, "&<>\"'") != NULL)
+    output_value = encoded_value = msEncodeHTMLEntities(value);
+  else
+    output_value = value;
 
   if(!item->template) { /* build the tag from pieces */
 
@@ -928,14 +945,14 @@ static void msGMLWriteItem(FILE *stream, gmlItemObj *item,
       msIO_fprintf(stream, "<!-- WARNING: The value '%s' is not valid in a XML tag context. -->\n", tag_name);
 
     if(add_namespace == MS_TRUE)
-      msIO_fprintf(stream, "%s<%s:%s%s>%s</%s:%s>\n", tab, namespace, tag_name, gmlid, encoded_value, namespace, tag_name);
+      msIO_fprintf(stream, "%s<%s:%s%s>%s</%s:%s>\n", tab, namespace, tag_name, gmlid, output_value, namespace, tag_name);
     else
-      msIO_fprintf(stream, "%s<%s%s>%s</%s>\n", tab, tag_name, gmlid, encoded_value, tag_name);
+      msIO_fprintf(stream, "%s<%s%s>%s</%s>\n", tab, tag_name, gmlid, output_value, tag_name);
   } else {
     char *tag = NULL;
 
     tag = msStrdup(item->template);
-    tag = msReplaceSubstring(tag, "$value", encoded_value);
+    tag = msReplaceSubstring(tag, "$value", output_value);
     if(namespace) tag = msReplaceSubstring(tag, "$namespace", namespace);
     msIO_fprintf(stream, "%s%s\n", tab, tag);
     free(tag);
@@ -1468,6 +1485,219 @@ void msGMLWriteWFSBounds(mapObj *map, FILE *stream, const char *tab,
 
 #endif
 
+#ifdef USE_WFS_SVR
+/*
+** Per layer state used by msGMLWriteWFSQuery() and the WFS query stream
+** while writing the features of one layer.
+*/
+typedef struct {
+  layerObj *lp;
+  char *layerName;
+  const char *namespace_prefix;
+  int featureIdIndex; /* -1 if no feature id */
+  char *srs;
+  int bOutputGMLIdOnly;
+  gmlGroupListObj *groupList;
+  gmlItemListObj *itemList;
+  gmlConstantListObj *constantList;
+  gmlGeometryListObj *geometryList;
+} gmlWFSLayerObj;
+
+static void msGMLFreeWFSLayer(gmlWFSLayerObj *wfslayer)
+{
+  msFree(wfslayer->srs);
+  msFree(wfslayer->layerName);
+  if(wfslayer->groupList) msGMLFreeGroups(wfslayer->groupList);
+  if(wfslayer->constantList) msGMLFreeConstants(wfslayer->constantList);
+  if(wfslayer->itemList) msGMLFreeItems(wfslayer->itemList);
+  if(wfslayer->geometryList) msGMLFreeGeometries(wfslayer->geometryList);
+  memset(wfslayer, 0, sizeof(gmlWFSLayerObj));
+}
+
+/*
+** Setup the item, group and geometry metadata of a layer, writes warnings
+** about the layer configuration to stream.
+*/
+static int msGMLInitWFSLayer(mapObj *map, layerObj *lp, FILE *stream,
+                             const char *default_namespace_prefix, OWSGMLVersion outputformat,
+                             int bUseURN, int bGetPropertyValueRequest, gmlWFSLayerObj *wfslayer)
+{
+  int j;
+  const char *value;
+
+  memset(wfslayer, 0, sizeof(gmlWFSLayerObj));
+  wfslayer->lp = lp;
+  wfslayer->featureIdIndex = -1;
+
+  /* setup namespace, a layer can override the default */
+  wfslayer->namespace_prefix = msOWSLookupMetadata(&(lp->metadata), "OFG", "namespace_prefix");
+  if(!wfslayer->namespace_prefix) wfslayer->namespace_prefix = default_namespace_prefix;
+
+  value = msOWSLookupMetadata(&(lp->metadata), "OFG", "featureid");
+  if(value) { /* find the featureid amongst the items for this layer */
+    for(j=0; j<lp->numitems; j++) {
+      if(strcasecmp(lp->items[j], value) == 0) { /* found it */
+        wfslayer->featureIdIndex = j;
+        break;
+      }
+    }
+
+    /* Produce a warning if a featureid was set but the corresponding item is not found. */
+    if (wfslayer->featureIdIndex == -1)
+      msIO_fprintf(stream, "<!-- WARNING: FeatureId item '%s' not found in typename '%s'. -->\n", value, lp->name);
+  }
+  else if( outputformat == OWS_GML32 )
+      msIO_fprintf(stream, "<!-- WARNING: No featureid defined for typename '%s'. Output will not validate. -->\n", lp->name);
+
+  /* populate item and group metadata structures */
+  wfslayer->itemList = msGMLGetItems(lp, "G");
+  wfslayer->constantList = msGMLGetConstants(lp, "G");
+  wfslayer->groupList = msGMLGetGroups(lp, "G");
+  wfslayer->geometryList = msGMLGetGeometries(lp, "GFO", MS_FALSE);
+  if (wfslayer->itemList == NULL || wfslayer->constantList == NULL ||
+      wfslayer->groupList == NULL || wfslayer->geometryList == NULL) {
+    msSetError(MS_MISCERR, "Unable to populate item and group metadata structures", "msGMLWriteWFSQuery()");
+    msGMLFreeWFSLayer(wfslayer);
+    return MS_FAILURE;
+  }
+
+  if( bGetPropertyValueRequest )
+  {
+    const char* value = msOWSLookupMetadata(&(lp->metadata), "G", "include_items");
+    if( value != NULL && strcmp(value, "@gml:id") == 0 )
+        wfslayer->bOutputGMLIdOnly = MS_TRUE;
+  }
+
+  if (wfslayer->namespace_prefix) {
+    wfslayer->layerName = (char *) msSmallMalloc(strlen(wfslayer->namespace_prefix)+strlen(lp->name)+2);
+    sprintf(wfslayer->layerName, "%s:%s", wfslayer->namespace_prefix, lp->name);
+  } else {
+    wfslayer->layerName = msStrdup(lp->name);
+  }
+
+#ifdef USE_PROJ
+  if( bUseURN )
+  {
+      wfslayer->srs = msOWSGetProjURN(&(map->projection), NULL, "FGO", MS_TRUE);
+      if (!wfslayer->srs)
+        wfslayer->srs = msOWSGetProjURN(&(map->projection), &(map->web.metadata), "FGO", MS_TRUE);
+      if (!wfslayer->srs)
+        wfslayer->srs = msOWSGetProjURN(&(lp->projection), &(lp->metadata), "FGO", MS_TRUE);
+  }
+  else
+  {
+      const char* constsrs;
+      constsrs = msOWSGetEPSGProj(&(map->projection), NULL, "FGO", MS_TRUE);
+      if (!constsrs)
+        constsrs = msOWSGetEPSGProj(&(map->projection), &(map->web.metadata), "FGO", MS_TRUE);
+      if (!constsrs)
+        constsrs = msOWSGetEPSGProj(&(lp->projection), &(lp->metadata), "FGO", MS_TRUE);
+      if (constsrs)
+        wfslayer->srs = msStrdup(constsrs);
+  }
+#endif
+
+  return MS_SUCCESS;
+}
+
+/*
+** Write a single feature, the shape must already be in the map projection.
+*/
+static void msGMLWriteWFSFeature(FILE *stream, gmlWFSLayerObj *wfslayer, shapeObj *shape,
+                                 OWSGMLVersion outputformat, int nWFSVersion, int bSwapAxis,
+                                 int bGetPropertyValueRequest)
+{
+  int k;
+  char* pszFID;
+  const char *layerName = wfslayer->layerName;
+  const char *namespace_prefix = wfslayer->namespace_prefix;
+  gmlItemListObj *itemList = wfslayer->itemList;
+  gmlConstantListObj *constantList = wfslayer->constantList;
+  gmlGroupListObj *groupList = wfslayer->groupList;
+  gmlGeometryListObj *geometryList = wfslayer->geometryList;
+
+  if(wfslayer->featureIdIndex != -1) {
+      pszFID = (char*) msSmallMalloc( strlen(wfslayer->lp->name) + 1 + strlen(shape->values[wfslayer->featureIdIndex]) + 1 );
+      sprintf(pszFID, "%s.%s", wfslayer->lp->name, shape->values[wfslayer->featureIdIndex]);
+  }
+  else
+      pszFID = msStrdup("");
+
+
+  if( wfslayer->bOutputGMLIdOnly )
+  {
+      msIO_fprintf(stream, "    <wfs:member>%s</wfs:member>\n", pszFID);
+      msFree(pszFID);
+      return;
+  }
+
+  /*
+  ** start this feature
+  */
+  if( nWFSVersion == OWS_2_0_0 )
+      msIO_fprintf(stream, "    <wfs:member>\n");
+  else
+      msIO_fprintf(stream, "    <gml:featureMember>\n");
+  if(msIsXMLTagValid(layerName) == MS_FALSE)
+      msIO_fprintf(stream, "<!-- WARNING: The value '%s' is not valid in a XML tag context. -->\n", layerName);
+  if(wfslayer->featureIdIndex != -1) {
+      if( !bGetPropertyValueRequest )
+      {
+          if(outputformat == OWS_GML2)
+              msIO_fprintf(stream, "      <%s fid=\"%s\">\n", layerName, pszFID);
+          else  /* OWS_GML3 or OWS_GML32 */
+              msIO_fprintf(stream, "      <%s gml:id=\"%s\">\n", layerName, pszFID);
+      }
+  } else {
+      if( !bGetPropertyValueRequest )
+          msIO_fprintf(stream, "      <%s>\n", layerName);
+  }
+
+  if (bSwapAxis)
+    msAxisSwapShape(shape);
+
+  /* write the feature geometry and bounding box */
+  if(!(geometryList && geometryList->numgeometries == 1 &&
+      strcasecmp(geometryList->geometries[0].name, "none") == 0)) {
+    if( !bGetPropertyValueRequest )
+      gmlWriteBounds(stream, outputformat, &(shape->bounds), wfslayer->srs, "        ", "gml");
+    gmlWriteGeometry(stream, geometryList, outputformat, shape, wfslayer->srs,
+                     namespace_prefix, "        ", pszFID);
+  }
+
+  /* write any item/values */
+  for(k=0; k<itemList->numitems; k++) {
+    gmlItemObj *item = &(itemList->items[k]);
+    if(msItemInGroups(item->name, groupList) == MS_FALSE)
+      msGMLWriteItem(stream, item, shape->values[k], namespace_prefix,
+                     "        ", outputformat, pszFID);
+  }
+
+  /* write any constants */
+  for(k=0; k<constantList->numconstants; k++) {
+    gmlConstantObj *constant = &(constantList->constants[k]);
+    if(msItemInGroups(constant->name, groupList) == MS_FALSE)
+      msGMLWriteConstant(stream, constant, namespace_prefix, "        ");
+  }
+
+  /* write any groups */
+  for(k=0; k<groupList->numgroups; k++)
+    msGMLWriteGroup(stream, &(groupList->groups[k]), shape, itemList,
+                    constantList, namespace_prefix, "        ", outputformat, pszFID);
+
+  if( !bGetPropertyValueRequest )
+      /* end this feature */
+      msIO_fprintf(stream, "      </%s>\n", layerName);
+
+  if( nWFSVersion == OWS_2_0_0 )
+    msIO_fprintf(stream, "    </wfs:member>\n");
+  else
+    msIO_fprintf(stream, "    </gml:featureMember>\n");
+
+  msFree(pszFID);
+}
+#endif /* USE_WFS_SVR */
+
 /*
 ** msGMLWriteWFSQuery()
 **
@@ -1479,18 +1709,10 @@ int msGMLWriteWFSQuery(mapObj *map, FILE *stream, const char *default_namespace_
 {
 #ifdef USE_WFS_SVR
   int status;
-  int i,j,k;
+  int i,j;
   layerObj *lp=NULL;
   shapeObj shape;
-
-  gmlGroupListObj *groupList=NULL;
-  gmlItemListObj *itemList=NULL;
-  gmlConstantListObj *constantList=NULL;
-  gmlGeometryListObj *geometryList=NULL;
-  gmlItemObj *item=NULL;
-  gmlConstantObj *constant=NULL;
-
-  const char *namespace_prefix=NULL;
+  gmlWFSLayerObj wfslayer;
   int bSwapAxis;
 
   msInitShape(&shape);
@@ -1508,88 +1730,15 @@ int msGMLWriteWFSQuery(mapObj *map, FILE *stream, const char *default_namespace_
     lp = GET_LAYER(map, map->layerorder[i]);
 
     if(lp->resultcache && lp->resultcache->numresults > 0)  { /* found results */
-      char *layerName;
-      const char *value;
-      int featureIdIndex=-1; /* no feature id */
-      char* srs = NULL;
-      int bOutputGMLIdOnly = MS_FALSE;
-
-      /* setup namespace, a layer can override the default */
-      namespace_prefix = msOWSLookupMetadata(&(lp->metadata), "OFG", "namespace_prefix");
-      if(!namespace_prefix) namespace_prefix = default_namespace_prefix;
-
-      value = msOWSLookupMetadata(&(lp->metadata), "OFG", "featureid");
-      if(value) { /* find the featureid amongst the items for this layer */
-        for(j=0; j<lp->numitems; j++) {
-          if(strcasecmp(lp->items[j], value) == 0) { /* found it */
-            featureIdIndex = j;
-            break;
-          }
-        }
-
-        /* Produce a warning if a featureid was set but the corresponding item is not found. */
-        if (featureIdIndex == -1)
-          msIO_fprintf(stream, "<!-- WARNING: FeatureId item '%s' not found in typename '%s'. -->\n", value, lp->name);
-      }
-      else if( outputformat == OWS_GML32 )
-          msIO_fprintf(stream, "<!-- WARNING: No featureid defined for typename '%s'. Output will not validate. -->\n", lp->name);
 
-      /* populate item and group metadata structures */
-      itemList = msGMLGetItems(lp, "G");
-      constantList = msGMLGetConstants(lp, "G");
-      groupList = msGMLGetGroups(lp, "G");
-      geometryList = msGMLGetGeometries(lp, "GFO", MS_FALSE);
-      if (itemList == NULL || constantList == NULL || groupList == NULL || geometryList == NULL) {
-        msSetError(MS_MISCERR, "Unable to populate item and group metadata structures", "msGMLWriteWFSQuery()");
+      if(msGMLInitWFSLayer(map, lp, stream, default_namespace_prefix, outputformat,
+                           bUseURN, bGetPropertyValueRequest, &wfslayer) != MS_SUCCESS)
         return MS_FAILURE;
-      }
-      
-      if( bGetPropertyValueRequest )
-      {
-        const char* value = msOWSLookupMetadata(&(lp->metadata), "G", "include_items");
-        if( value != NULL && strcmp(value, "@gml:id") == 0 )
-            bOutputGMLIdOnly = MS_TRUE;
-      }
-
-      if (namespace_prefix) {
-        layerName = (char *) msSmallMalloc(strlen(namespace_prefix)+strlen(lp->name)+2);
-        sprintf(layerName, "%s:%s", namespace_prefix, lp->name);
-      } else {
-        layerName = msStrdup(lp->name);
-      }
-
-#ifdef USE_PROJ
-      if( bUseURN )
-      {
-          srs = msOWSGetProjURN(&(map->projection), NULL, "FGO", MS_TRUE);
-          if (!srs)
-            srs = msOWSGetProjURN(&(map->projection), &(map->web.metadata), "FGO", MS_TRUE);
-          if (!srs)
-            srs = msOWSGetProjURN(&(lp->projection), &(lp->metadata), "FGO", MS_TRUE);
-      }
-      else
-      {
-          const char* constsrs;
-          constsrs = msOWSGetEPSGProj(&(map->projection), NULL, "FGO", MS_TRUE);
-          if (!constsrs)
-            constsrs = msOWSGetEPSGProj(&(map->projection), &(map->web.metadata), "FGO", MS_TRUE);
-          if (!constsrs)
-            constsrs = msOWSGetEPSGProj(&(lp->projection), &(lp->metadata), "FGO", MS_TRUE);
-          if (constsrs)
-            srs = msStrdup(constsrs);
-      }
-#endif
 
       for(j=0; j<lp->resultcache->numresults; j++) {
-        char* pszFID;
-
         status = msLayerGetShape(lp, &shape, &(lp->resultcache->results[j]));
         if(status != MS_SUCCESS) {
-          msGMLFreeGroups(groupList);
-          msGMLFreeConstants(constantList);
-          msGMLFreeItems(itemList);
-          msGMLFreeGeometries(geometryList);
-          msFree(layerName);
+          msGMLFreeWFSLayer(&wfslayer);
           return(status);
         }
 
@@ -1599,113 +1748,159 @@ int msGMLWriteWFSQuery(mapObj *map, FILE *stream, const char *default_namespace_
           msProjectShape(&lp->projection, &map->projection, &shape);
 #endif
 
-        if(featureIdIndex != -1) {
-            pszFID = (char*) msSmallMalloc( strlen(lp->name) + 1 + strlen(shape.values[featureIdIndex]) + 1 );
-            sprintf(pszFID, "%s.%s", lp->name, shape.values[featureIdIndex]);
-        }
-        else
-            pszFID = msStrdup("");
+        msGMLWriteWFSFeature(stream, &wfslayer, &shape, outputformat, nWFSVersion,
+                             bSwapAxis, bGetPropertyValueRequest);
 
+        msFreeShape(&shape); /* init too */
+      }
 
-        if( bOutputGMLIdOnly )
-        {
-            msIO_fprintf(stream, "    <wfs:member>%s</wfs:member>\n", pszFID);
-            msFree(pszFID);
-            msFreeShape(&shape); /* init too */
-            continue;
-        }
+      /* done with this layer, do a little clean-up */
+      msGMLFreeWFSLayer(&wfslayer);
 
-        /*
-        ** start this feature
-        */
-        if( nWFSVersion == OWS_2_0_0 )
-            msIO_fprintf(stream, "    <wfs:member>\n");
-        else
-            msIO_fprintf(stream, "    <gml:featureMember>\n");
-        if(msIsXMLTagValid(layerName) == MS_FALSE)
-            msIO_fprintf(stream, "<!-- WARNING: The value '%s' is not valid in a XML tag context. -->\n", layerName);
-        if(featureIdIndex != -1) {
-            if( !bGetPropertyValueRequest )
-            {
-                if(outputformat == OWS_GML2)
-                    msIO_fprintf(stream, "      <%s fid=\"%s\">\n", layerName, pszFID);
-                else  /* OWS_GML3 or OWS_GML32 */
-                    msIO_fprintf(stream, "      <%s gml:id=\"%s\">\n", layerName, pszFID);
-            }
-        } else {
-            if( !bGetPropertyValueRequest )
-                msIO_fprintf(stream, "      <%s>\n", layerName);
-        }
+      /* msLayerClose(lp); */
+    }
 
-        if (bSwapAxis)
-          msAxisSwapShape(&shape);
+  } /* next layer */
 
-        /* write the feature geometry and bounding box */
-        if(!(geometryList && geometryList->numgeometries == 1 &&
-            strcasecmp(geometryList->geometries[0].name, "none") == 0)) {
-          if( !bGetPropertyValueRequest )
-            gmlWriteBounds(stream, outputformat, &(shape.bounds), srs, "        ", "gml");
-          gmlWriteGeometry(stream, geometryList, outputformat, &(shape), srs,
-                           namespace_prefix, "        ", pszFID);
-        }
+  return(MS_SUCCESS);
 
-        /* write any item/values */
-        for(k=0; k<itemList->numitems; k++) {
-          item = &(itemList->items[k]);
-          if(msItemInGroups(item->name, groupList) == MS_FALSE)
-            msGMLWriteItem(stream, item, shape.values[k], namespace_prefix,
-                           "        ", outputformat, pszFID);
-        }
+#else /* Stub for mapscript */
+  msSetError(MS_MISCERR, "WFS server support not enabled", "msGMLWriteWFSQuery()");
+  return MS_FAILURE;
+#endif /* USE_WFS_SVR */
+}
 
-        /* write any constants */
-        for(k=0; k<constantList->numconstants; k++) {
-          constant = &(constantList->constants[k]);
-          if(msItemInGroups(constant->name, groupList) == MS_FALSE)
-            msGMLWriteConstant(stream, constant, namespace_prefix, "        ");
-        }
+#ifdef USE_WFS_SVR
+/*
+** WFS query streams: features are encoded as the query produces them (see
+** queryObj.resultcallback) into a temporary spool file, so that neither the
+** ids of the results nor the shapes need to be kept in memory and no second
+** read of the features is required. Once the query is done and the feature
+** count and bounds are known, msGMLWriteWFSQueryStream() writes the same
+** output as msGMLWriteWFSQuery().
+*/
+struct gmlWFSQueryStreamObj {
+  FILE *spool;
+  char *default_namespace_prefix;
+  OWSGMLVersion outputformat;
+  int nWFSVersion;
+  int bUseURN;
+  int bSwapAxis;
+  gmlWFSLayerObj wfslayer; /* layer of the features being written */
+  int numfeatures;
+  long lastfeatureoffset; /* spool offset before the last feature */
+};
 
-        /* write any groups */
-        for(k=0; k<groupList->numgroups; k++)
-          msGMLWriteGroup(stream, &(groupList->groups[k]), &shape, itemList,
-                          constantList, namespace_prefix, "        ", outputformat, pszFID);
+gmlWFSQueryStreamObj *msGMLCreateWFSQueryStream(mapObj *map, const char *default_namespace_prefix,
+                                                OWSGMLVersion outputformat, int nWFSVersion, int bUseURN)
+{
+  gmlWFSQueryStreamObj *qs;
+  FILE *spool = tmpfile();
 
-        if( !bGetPropertyValueRequest )
-            /* end this feature */
-            msIO_fprintf(stream, "      </%s>\n", layerName);
+  if(!spool) {
+    msSetError(MS_IOERR, "Unable to create temporary spool file.", "msGMLCreateWFSQueryStream()");
+    return NULL;
+  }
 
-        if( nWFSVersion == OWS_2_0_0 )
-          msIO_fprintf(stream, "    </wfs:member>\n");
-        else
-          msIO_fprintf(stream, "    </gml:featureMember>\n");
+  qs = (gmlWFSQueryStreamObj *) msSmallCalloc(1, sizeof(gmlWFSQueryStreamObj));
+  qs->spool = spool;
+  if(default_namespace_prefix)
+    qs->default_namespace_prefix = msStrdup(default_namespace_prefix);
+  qs->outputformat = outputformat;
+  qs->nWFSVersion = nWFSVersion;
+  qs->bUseURN = bUseURN;
+  return qs;
+}
 
+/*
+** queryObj.resultcallback implementation, shape is in the map projection.
+*/
+int msGMLWFSQueryStreamAddShape(mapObj *map, layerObj *lp, shapeObj *shape, void *data)
+{
+  gmlWFSQueryStreamObj *qs = (gmlWFSQueryStreamObj *) data;
 
-        msFree(pszFID);
-        pszFID = NULL;
-        msFreeShape(&shape); /* init too */
-      }
+  qs->lastfeatureoffset = ftell(qs->spool);
 
-      msFree(srs);
+  if(qs->wfslayer.lp != lp) {
+    /* the output SRS is only applied by the query */
+    qs->bSwapAxis = msIsAxisInvertedProj(&(map->projection));
+    msGMLFreeWFSLayer(&(qs->wfslayer));
+    if(msGMLInitWFSLayer(map, lp, qs->spool, qs->default_namespace_prefix, qs->outputformat,
+                         qs->bUseURN, MS_FALSE, &(qs->wfslayer)) != MS_SUCCESS)
+      return MS_FAILURE;
+  }
 
-      /* done with this layer, do a little clean-up */
-      msFree(layerName);
+  msGMLWriteWFSFeature(qs->spool, &(qs->wfslayer), shape, qs->outputformat, qs->nWFSVersion,
+                       qs->bSwapAxis, MS_FALSE);
+  qs->numfeatures++;
 
-      msGMLFreeGroups(groupList);
-      msGMLFreeConstants(constantList);
-      msGMLFreeItems(itemList);
-      msGMLFreeGeometries(geometryList);
+  if(ferror(qs->spool)) {
+    msSetError(MS_IOERR, "Error writing to temporary spool file.", "msGMLWFSQueryStreamAddShape()");
+    return MS_FAILURE;
+  }
+  return MS_SUCCESS;
+}
 
-      /* msLayerClose(lp); */
-    }
+/*
+** Called once the query is done, before any output is sent: spool write
+** errors still pending in the stdio buffers are reported here, while an
+** exception can still be returned instead of the collection.
+*/
+int msGMLFinishWFSQueryStream(gmlWFSQueryStreamObj *qs)
+{
+  if(fflush(qs->spool) != 0 || ferror(qs->spool)) {
+    msSetError(MS_IOERR, "Error writing to temporary spool file.", "msGMLFinishWFSQueryStream()");
+    return MS_FAILURE;
+  }
+  return MS_SUCCESS;
+}
 
-  } /* next layer */
+/*
+** Write the bounds of the query results followed by the spooled features. The
+** result count may have been decremented by one after the query (the extra
+** feature fetched to detect further results), that feature is dropped then.
+*/
+int msGMLWriteWFSQueryStream(mapObj *map, FILE *stream, gmlWFSQueryStreamObj *qs)
+{
+  int i, numresults = 0;
+  long length;
+  char buffer[65536];
 
-  return(MS_SUCCESS);
+  msGMLWriteWFSBounds(map, stream, "      ", qs->outputformat, qs->nWFSVersion, qs->bUseURN);
 
-#else /* Stub for mapscript */
-  msSetError(MS_MISCERR, "WFS server support not enabled", "msGMLWriteWFSQuery()");
-  return MS_FAILURE;
-#endif /* USE_WFS_SVR */
+  for(i=0; i<map->numlayers; i++) {
+    layerObj *lp = GET_LAYER(map, i);
+    if(lp->resultcache)
+      numresults += lp->resultcache->numresults;
+  }
+
+  length = ftell(qs->spool);
+  if(numresults < qs->numfeatures)
+    length = qs->lastfeatureoffset;
+
+  rewind(qs->spool);
+  while(length > 0) {
+    size_t nRead = fread(buffer, 1, MS_MIN(length, (long)sizeof(buffer)), qs->spool);
+    if(nRead == 0) {
+      msSetError(MS_IOERR, "Error reading temporary spool file.", "msGMLWriteWFSQueryStream()");
+      return MS_FAILURE;
+    }
+    msIO_fwrite(buffer, 1, nRead, stream);
+    length -= nRead;
+  }
+
+  return MS_SUCCESS;
+}
+
+void msGMLFreeWFSQueryStream(gmlWFSQueryStreamObj *qs)
+{
+  if(!qs) return;
+  msGMLFreeWFSLayer(&(qs->wfslayer));
+  if(qs->spool) fclose(qs->spool);
+  msFree(qs->default_namespace_prefix);
+  msFree(qs);
 }
+#endif /* USE_WFS_SVR */
 
 
 #ifdef USE_LIBXML2
@@ -42,10 +42,14 @@
 
 
 #include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #ifndef _WIN32
 #include <sys/time.h>
 #include <unistd.h>
-
+#include <dirent.h>
+#else
+#include <windows.h>
 #endif
 
 /*
@@ -69,6 +73,57 @@
  **********************************************************************/
 static int gbCurlInitialized = MS_FALSE;
 
+/* Process-wide libcurl share handle.  Every easy handle is attached to
+ * it so DNS lookups and TLS sessions survive from one
+ * msHTTPExecuteRequests() call to the next instead of being torn down
+ * with the multi handle.  Connections are not shared: a shared
+ * connection cache isn't safe with easy handles driven by several multi
+ * handles in different threads.
+ */
+static CURLSH *gpsCurlShare = NULL;
+
+/* Number of transfers done and how many of them reused a connection */
+static int gnHTTPRequests = 0;
+static int gnHTTPReused = 0;
+
+/**********************************************************************
+ *                          msHTTPShareLock()
+ *                          msHTTPShareUnlock()
+ *
+ * Lock callbacks for the share handle.  libcurl may hold locks on
+ * different data types at the same time so each one gets its own mutex.
+ **********************************************************************/
+#ifdef USE_THREAD
+static int msHTTPShareLockId(curl_lock_data data)
+{
+  switch (data) {
+    case CURL_LOCK_DATA_DNS:
+      return TLOCK_HTTPDNS;
+    case CURL_LOCK_DATA_SSL_SESSION:
+      return TLOCK_HTTPSSL;
+    default:
+      return TLOCK_HTTPSHARE;
+  }
+}
+
+static void msHTTPShareLock(CURL *handle, curl_lock_data data,
+                            curl_lock_access access, void *userptr)
+{
+  (void)handle;
+  (void)access;
+  (void)userptr;
+  msAcquireLock(msHTTPShareLockId(data));
+}
+
+static void msHTTPShareUnlock(CURL *handle, curl_lock_data data,
+                              void *userptr)
+{
+  (void)handle;
+  (void)userptr;
+  msReleaseLock(msHTTPShareLockId(data));
+}
+#endif /* USE_THREAD */
+
 int msHTTPInit()
 {
   /* curl_global_init() should only be called once (no matter how
@@ -87,6 +142,21 @@ int msHTTPInit()
 
   gbCurlInitialized = MS_TRUE;
 
+  /* A missing share handle isn't fatal, requests just won't share
+   * DNS lookups and TLS sessions.
+   */
+  if (gpsCurlShare == NULL) {
+    gpsCurlShare = curl_share_init();
+    if (gpsCurlShare != NULL) {
+#ifdef USE_THREAD
+      curl_share_setopt(gpsCurlShare, CURLSHOPT_LOCKFUNC, msHTTPShareLock);
+      curl_share_setopt(gpsCurlShare, CURLSHOPT_UNLOCKFUNC, msHTTPShareUnlock);
+#endif
+      curl_share_setopt(gpsCurlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+      curl_share_setopt(gpsCurlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+  }
+
   msReleaseLock(TLOCK_OWS);
   return MS_SUCCESS;
 }
@@ -99,6 +169,13 @@ int msHTTPInit()
 void msHTTPCleanup()
 {
   msAcquireLock(TLOCK_OWS);
+  msHTTPCacheCleanup();
+
+  /* All easy handles are gone by now */
+  if (gpsCurlShare != NULL)
+    curl_share_cleanup(gpsCurlShare);
+  gpsCurlShare = NULL;
+
   if (gbCurlInitialized)
     curl_global_cleanup();
 
@@ -107,6 +184,23 @@ void msHTTPCleanup()
 }
 
 
+/**********************************************************************
+ *                          msHTTPGetConnectionStats()
+ *
+ * Returns the number of HTTP transfers done by this process and how
+ * many of them went over an already open connection.
+ **********************************************************************/
+void msHTTPGetConnectionStats(int *pnRequests, int *pnReused)
+{
+  msAcquireLock(TLOCK_HTTPSHARE);
+  if (pnRequests)
+    *pnRequests = gnHTTPRequests;
+  if (pnReused)
+    *pnReused = gnHTTPReused;
+  msReleaseLock(TLOCK_HTTPSHARE);
+}
+
+
 /**********************************************************************
  *                          msHTTPInitRequestObj()
  *
@@ -149,6 +243,10 @@ void msHTTPInitRequestObj(httpRequestObj *pasReqInfo, int numRequests)
     pasReqInfo[i].result_data = NULL;
     pasReqInfo[i].result_size = 0;
     pasReqInfo[i].result_buf_size = 0;
+    pasReqInfo[i].nResponseMaxAge = -1;
+    pasReqInfo[i].bResponseNoStore = MS_FALSE;
+    pasReqInfo[i].nCacheMaxAge = 0;
+    pasReqInfo[i].pszCacheDir = NULL;
   }
 }
 
@@ -193,6 +291,10 @@ void msHTTPFreeRequestObj(httpRequestObj *pasReqInfo, int numRequests)
       free(pasReqInfo[i].pszHTTPCookieData);
     pasReqInfo[i].pszHTTPCookieData = NULL;
 
+    if (pasReqInfo[i].pszCacheDir)
+      free(pasReqInfo[i].pszCacheDir);
+    pasReqInfo[i].pszCacheDir = NULL;
+
     pasReqInfo[i].curl_handle = NULL;
 
     free( pasReqInfo[i].result_data );
@@ -266,6 +368,582 @@ static size_t msHTTPWriteFct(void *buffer, size_t size, size_t nmemb,
   }
 }
 
+/**********************************************************************
+ *                          msHTTPHeaderFct()
+ *
+ * CURLOPT_HEADERFUNCTION callback: records the caching headers of the
+ * response (Cache-Control and Expires) so that msHTTPCacheStore() can
+ * honour them.
+ **********************************************************************/
+static size_t msHTTPHeaderFct(void *buffer, size_t size, size_t nmemb,
+                              void *reqInfo)
+{
+  httpRequestObj *psReq = (httpRequestObj *)reqInfo;
+  size_t nLen = size*nmemb;
+  char *pszLine;
+
+  pszLine = (char *) msSmallMalloc(nLen+1);
+  memcpy(pszLine, buffer, nLen);
+  pszLine[nLen] = '\0';
+  msStringTrim(pszLine);
+
+  if (strncasecmp(pszLine, "HTTP/", 5) == 0) {
+    /* New response (e.g. after a redirect), forget previous headers */
+    psReq->nResponseMaxAge = -1;
+    psReq->bResponseNoStore = MS_FALSE;
+  } else if (strncasecmp(pszLine, "Cache-Control:", 14) == 0) {
+    char **papszTokens;
+    int i, nTokens = 0;
+
+    papszTokens = msStringSplit(pszLine+14, ',', &nTokens);
+    for (i=0; i<nTokens; i++) {
+      msStringTrim(papszTokens[i]);
+      if (strcasecmp(papszTokens[i], "no-store") == 0 ||
+          strcasecmp(papszTokens[i], "no-cache") == 0 ||
+          strcasecmp(papszTokens[i], "private") == 0)
+        psReq->bResponseNoStore = MS_TRUE;
+      else if (strncasecmp(papszTokens[i], "max-age=", 8) == 0)
+        psReq->nResponseMaxAge = atoi(papszTokens[i]+8);
+      else if (strncasecmp(papszTokens[i], "s-maxage=", 9) == 0)
+        psReq->nResponseMaxAge = atoi(papszTokens[i]+9);
+    }
+    msFreeCharArray(papszTokens, nTokens);
+  } else if (strncasecmp(pszLine, "Expires:", 8) == 0 &&
+             psReq->nResponseMaxAge < 0) {
+    /* max-age takes precedence over Expires */
+    time_t nExpires = curl_getdate(pszLine+8, NULL);
+    time_t nNow = time(NULL);
+    psReq->nResponseMaxAge = (nExpires > nNow) ? (int)(nExpires - nNow) : 0;
+  }
+
+  msFree(pszLine);
+  return nLen;
+}
+
+/**********************************************************************
+ *                          Response cache
+ *
+ * Successful responses of requests with nCacheMaxAge > 0 are kept in a
+ * process-wide LRU list, keyed on the normalized request URL plus the
+ * credentials, proxy settings and cookie sent with it, so identical
+ * upstream requests (typically tile-aligned cascaded GetMap) are only
+ * fetched once.
+ *
+ * When pszCacheDir is set entries are also spilled to that directory,
+ * one file per key, written to a temporary name and renamed into place
+ * so several processes (e.g. FastCGI workers) can share it.  The files
+ * hold the key in clear, so requests sending a password are only cached
+ * in memory.  Expired files are removed from the directory every
+ * MS_HTTP_CACHE_PRUNE_INTERVAL seconds.
+ **********************************************************************/
+#define MS_HTTP_CACHE_MAX_BYTES (32*1024*1024)
+#define MS_HTTP_CACHE_MAGIC "MSHTTPCACHE1"
+#define MS_HTTP_CACHE_EXTENSION ".mshttp"
+#define MS_HTTP_CACHE_PRUNE_INTERVAL 300
+
+typedef struct httpCacheEntry_t {
+  char *key;
+  char *content_type;
+  char *data;
+  int size;
+  time_t expires;
+  struct httpCacheEntry_t *next;
+} httpCacheEntryObj;
+
+static httpCacheEntryObj *gpsHTTPCache = NULL;
+static int gnHTTPCacheBytes = 0;
+static time_t gnHTTPCacheLastPrune = 0;
+
+static void msHTTPCacheFreeEntry(httpCacheEntryObj *entry)
+{
+  msFree(entry->key);
+  msFree(entry->content_type);
+  msFree(entry->data);
+  msFree(entry);
+}
+
+static int msHTTPCacheCompareParams(const void *a, const void *b)
+{
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static char *msHTTPCacheAppendKey(char *pszKey, const char *pszValue)
+{
+  if (pszValue)
+    pszKey = msStringConcatenate(pszKey, pszValue);
+  return msStringConcatenate(pszKey, "\n");
+}
+
+/*
+** Builds the cache key: the URL with a lowercased scheme and host and
+** with its query parameters sorted, followed by whatever else goes
+** into the request and may change the response.
+*/
+static char *msHTTPCacheKey(httpRequestObj *psReq)
+{
+  const char *pszUrl = psReq->pszGetUrl;
+  const char *pszQuery = strchr(pszUrl, '?');
+  const char *pszHostEnd;
+  char szSettings[128];
+  char *pszKey;
+  int nBaseLen;
+
+  nBaseLen = pszQuery ? (int)(pszQuery - pszUrl) : (int)strlen(pszUrl);
+  pszKey = (char *) msSmallMalloc(nBaseLen+1);
+  strlcpy(pszKey, pszUrl, nBaseLen+1);
+
+  pszHostEnd = strstr(pszKey, "://");
+  pszHostEnd = strchr(pszHostEnd ? pszHostEnd+3 : pszKey, '/');
+  if (pszHostEnd) {
+    char chSaved = *pszHostEnd;
+    *((char *)pszHostEnd) = '\0';
+    msStringToLower(pszKey);
+    *((char *)pszHostEnd) = chSaved;
+  } else
+    msStringToLower(pszKey);
+
+  if (pszQuery) {
+    char **papszParams;
+    int i, nParams = 0;
+
+    papszParams = msStringSplit(pszQuery+1, '&', &nParams);
+    qsort(papszParams, nParams, sizeof(char*), msHTTPCacheCompareParams);
+    pszKey = msStringConcatenate(pszKey, "?");
+    for (i=0; i<nParams; i++) {
+      if (papszParams[i][0] == '\0')
+        continue;
+      pszKey = msStringConcatenate(pszKey, papszParams[i]);
+      pszKey = msStringConcatenate(pszKey, "&");
+    }
+    msFreeCharArray(papszParams, nParams);
+  }
+
+  snprintf(szSettings, sizeof(szSettings), "\n%d\n%d\n%d\n%ld\n",
+           (int)psReq->eHttpAuthType, (int)psReq->eProxyType,
+           (int)psReq->eProxyAuthType, psReq->nProxyPort);
+  pszKey = msStringConcatenate(pszKey, szSettings);
+  pszKey = msHTTPCacheAppendKey(pszKey, psReq->pszHttpUsername);
+  pszKey = msHTTPCacheAppendKey(pszKey, psReq->pszHttpPassword);
+  pszKey = msHTTPCacheAppendKey(pszKey, psReq->pszProxyAddress);
+  pszKey = msHTTPCacheAppendKey(pszKey, psReq->pszProxyUsername);
+  pszKey = msHTTPCacheAppendKey(pszKey, psReq->pszProxyPassword);
+  pszKey = msHTTPCacheAppendKey(pszKey, psReq->pszHTTPCookieData);
+
+  return pszKey;
+}
+
+/*
+** Spilled files hold the key in clear, don't write passwords to disk.
+*/
+static int msHTTPCacheUseDir(httpRequestObj *psReq)
+{
+  return psReq->pszCacheDir != NULL && psReq->pszHttpPassword == NULL &&
+         psReq->pszProxyPassword == NULL;
+}
+
+static char *msHTTPCacheFilename(const char *pszCacheDir, const char *pszKey)
+{
+  char szPath[MS_MAXPATHLEN];
+  char *pszHash, *pszFilename;
+  const char *pszPath;
+
+  pszHash = msHashString(pszKey);
+  pszHash = msStringConcatenate(pszHash, MS_HTTP_CACHE_EXTENSION);
+  pszPath = msBuildPath(szPath, pszCacheDir, pszHash);
+  pszFilename = pszPath ? msStrdup(pszPath) : NULL;
+  msFree(pszHash);
+  return pszFilename;
+}
+
+/*
+** Adds an entry at the head of the in-memory list and trims the list to
+** MS_HTTP_CACHE_MAX_BYTES.  Takes ownership of entry.
+** Must be called with TLOCK_HTTPCACHE held.
+*/
+static void msHTTPCacheInsert(httpCacheEntryObj *entry)
+{
+  httpCacheEntryObj **ppsCur;
+
+  if (entry->size > MS_HTTP_CACHE_MAX_BYTES/4) {
+    msHTTPCacheFreeEntry(entry);
+    return;
+  }
+
+  for (ppsCur = &gpsHTTPCache; *ppsCur; ppsCur = &((*ppsCur)->next)) {
+    if (strcmp((*ppsCur)->key, entry->key) == 0) {
+      httpCacheEntryObj *old = *ppsCur;
+      *ppsCur = old->next;
+      gnHTTPCacheBytes -= old->size;
+      msHTTPCacheFreeEntry(old);
+      break;
+    }
+  }
+
+  entry->next = gpsHTTPCache;
+  gpsHTTPCache = entry;
+  gnHTTPCacheBytes += entry->size;
+
+  while (gnHTTPCacheBytes > MS_HTTP_CACHE_MAX_BYTES && gpsHTTPCache->next) {
+    for (ppsCur = &gpsHTTPCache; (*ppsCur)->next; ppsCur = &((*ppsCur)->next));
+    gnHTTPCacheBytes -= (*ppsCur)->size;
+    msHTTPCacheFreeEntry(*ppsCur);
+    *ppsCur = NULL;
+  }
+}
+
+/*
+** Reads a spilled entry back.  Returns NULL if there is none or if it is
+** stale or belongs to another key.
+*/
+static httpCacheEntryObj *msHTTPCacheReadFile(const char *pszFilename,
+    const char *pszKey)
+{
+  FILE *fp;
+  char szHeader[128];
+  long nExpires;
+  int nKeyLen, nTypeLen, nSize;
+  httpCacheEntryObj *entry = NULL;
+
+  fp = fopen(pszFilename, "rb");
+  if (fp == NULL)
+    return NULL;
+
+  if (fgets(szHeader, sizeof(szHeader), fp) != NULL &&
+      sscanf(szHeader, MS_HTTP_CACHE_MAGIC " %ld %d %d %d",
+             &nExpires, &nKeyLen, &nTypeLen, &nSize) == 4 &&
+      nExpires > (long)time(NULL) && nKeyLen == (int)strlen(pszKey) &&
+      nTypeLen >= 0 && nSize >= 0) {
+    char *pszFileKey = (char *) msSmallMalloc(nKeyLen+1);
+
+    if (fread(pszFileKey, 1, nKeyLen, fp) == (size_t)nKeyLen &&
+        memcmp(pszFileKey, pszKey, nKeyLen) == 0) {
+      entry = (httpCacheEntryObj *) msSmallCalloc(1, sizeof(httpCacheEntryObj));
+      entry->key = msStrdup(pszKey);
+      entry->content_type = (char *) msSmallMalloc(nTypeLen+1);
+      entry->data = (char *) msSmallMalloc(nSize+1);
+      entry->size = nSize;
+      entry->expires = (time_t)nExpires;
+      if (fread(entry->content_type, 1, nTypeLen, fp) != (size_t)nTypeLen ||
+          fread(entry->data, 1, nSize, fp) != (size_t)nSize) {
+        msHTTPCacheFreeEntry(entry);
+        entry = NULL;
+      } else {
+        entry->content_type[nTypeLen] = '\0';
+        entry->data[nSize] = '\0';
+      }
+    }
+    msFree(pszFileKey);
+  }
+
+  fclose(fp);
+  return entry;
+}
+
+static void msHTTPCacheWriteFile(const char *pszFilename,
+                                 httpCacheEntryObj *entry)
+{
+  FILE *fp;
+  char *pszTmpName, *pszTmpFilename;
+  int bOK;
+
+  pszTmpName = msTmpFilename("tmp");
+  pszTmpFilename = msStrdup(pszFilename);
+  pszTmpFilename = msStringConcatenate(pszTmpFilename, ".");
+  pszTmpFilename = msStringConcatenate(pszTmpFilename, pszTmpName);
+  msFree(pszTmpName);
+
+  fp = fopen(pszTmpFilename, "wb");
+  if (fp == NULL) {
+    msFree(pszTmpFilename);
+    return;
+  }
+
+  bOK = fprintf(fp, MS_HTTP_CACHE_MAGIC " %ld %d %d %d\n",
+                (long)entry->expires, (int)strlen(entry->key),
+                (int)strlen(entry->content_type), entry->size) > 0;
+  bOK = bOK && fwrite(entry->key, 1, strlen(entry->key), fp) == strlen(entry->key);
+  bOK = bOK && fwrite(entry->content_type, 1, strlen(entry->content_type), fp) == strlen(entry->content_type);
+  bOK = bOK && fwrite(entry->data, 1, entry->size, fp) == (size_t)entry->size;
+  if (fclose(fp) != 0)
+    bOK = MS_FALSE;
+
+  if (!bOK || rename(pszTmpFilename, pszFilename) != 0)
+    unlink(pszTmpFilename);
+
+  msFree(pszTmpFilename);
+}
+
+/*
+** Expired spilled files are removed by msHTTPCachePruneDir(), along with
+** the temporary files of writes that were interrupted.  A file whose
+** header can't be read is garbage: complete files are renamed into place.
+*/
+static int msHTTPCacheFileExpired(const char *pszFilename, time_t nNow)
+{
+  FILE *fp;
+  char szHeader[128];
+  long nExpires = 0;
+
+  fp = fopen(pszFilename, "rb");
+  if (fp == NULL)
+    return MS_FALSE; /* removed meanwhile */
+  if (fgets(szHeader, sizeof(szHeader), fp) == NULL ||
+      sscanf(szHeader, MS_HTTP_CACHE_MAGIC " %ld", &nExpires) != 1)
+    nExpires = 0;
+  fclose(fp);
+
+  return nExpires <= (long)nNow;
+}
+
+static void msHTTPCachePruneFile(const char *pszCacheDir, const char *pszName,
+                                 time_t nNow)
+{
+  char szPath[MS_MAXPATHLEN];
+  const char *pszExtension = strstr(pszName, MS_HTTP_CACHE_EXTENSION);
+  const char *pszFilename;
+  struct stat sStat;
+
+  if (pszExtension == NULL)
+    return;
+  pszFilename = msBuildPath(szPath, pszCacheDir, pszName);
+  if (pszFilename == NULL)
+    return;
+
+  if (pszExtension[strlen(MS_HTTP_CACHE_EXTENSION)] == '\0') {
+    if (msHTTPCacheFileExpired(pszFilename, nNow))
+      unlink(pszFilename);
+  } else if (stat(pszFilename, &sStat) == 0 &&
+             nNow - sStat.st_mtime > MS_HTTP_CACHE_PRUNE_INTERVAL) {
+    unlink(pszFilename); /* left behind by msHTTPCacheWriteFile() */
+  }
+}
+
+/*
+** Scans the cache directory at most every MS_HTTP_CACHE_PRUNE_INTERVAL
+** seconds per process.  Other processes pruning the same directory at the
+** same time are harmless.
+*/
+static void msHTTPCachePruneDir(const char *pszCacheDir)
+{
+  time_t nNow = time(NULL);
+#ifdef _WIN32
+  char szPath[MS_MAXPATHLEN];
+  const char *pszPattern;
+  WIN32_FIND_DATAA sFindData;
+  HANDLE hFind;
+#else
+  DIR *psDir;
+  struct dirent *psEntry;
+#endif
+
+  msAcquireLock(TLOCK_HTTPCACHE);
+  if (nNow - gnHTTPCacheLastPrune < MS_HTTP_CACHE_PRUNE_INTERVAL) {
+    msReleaseLock(TLOCK_HTTPCACHE);
+    return;
+  }
+  gnHTTPCacheLastPrune = nNow;
+  msReleaseLock(TLOCK_HTTPCACHE);
+
+#ifdef _WIN32
+  pszPattern = msBuildPath(szPath, pszCacheDir, "*" MS_HTTP_CACHE_EXTENSION "*");
+  if (pszPattern == NULL)
+    return;
+  hFind = FindFirstFileA(pszPattern, &sFindData);
+  if (hFind == INVALID_HANDLE_VALUE)
+    return;
+  do {
+    msHTTPCachePruneFile(pszCacheDir, sFindData.cFileName, nNow);
+  } while (FindNextFileA(hFind, &sFindData));
+  FindClose(hFind);
+#else
+  psDir = opendir(pszCacheDir);
+  if (psDir == NULL)
+    return;
+  while ((psEntry = readdir(psDir)) != NULL)
+    msHTTPCachePruneFile(pszCacheDir, psEntry->d_name, nNow);
+  closedir(psDir);
+#endif
+}
+
+/*
+** Looks the request up in the cache and, on a hit, fills in its result
+** exactly as a download would have.  Returns MS_TRUE on a hit.
+*/
+static int msHTTPCacheFetch(httpRequestObj *psReq)
+{
+  httpCacheEntryObj **ppsCur, *entry = NULL;
+  char *pszKey, *pszData = NULL, *pszContentType = NULL;
+  int nSize = 0;
+  time_t nNow = time(NULL);
+
+  pszKey = msHTTPCacheKey(psReq);
+
+  msAcquireLock(TLOCK_HTTPCACHE);
+  for (ppsCur = &gpsHTTPCache; *ppsCur; ppsCur = &((*ppsCur)->next)) {
+    if (strcmp((*ppsCur)->key, pszKey) == 0) {
+      entry = *ppsCur;
+      *ppsCur = entry->next;
+      if (entry->expires <= nNow) {
+        gnHTTPCacheBytes -= entry->size;
+        msHTTPCacheFreeEntry(entry);
+        entry = NULL;
+      } else {
+        /* move to front */
+        entry->next = gpsHTTPCache;
+        gpsHTTPCache = entry;
+      }
+      break;
+    }
+  }
+  if (entry) {
+    pszData = (char *) msSmallMalloc(entry->size+1);
+    memcpy(pszData, entry->data, entry->size+1);
+    nSize = entry->size;
+    pszContentType = msStrdup(entry->content_type);
+  }
+  msReleaseLock(TLOCK_HTTPCACHE);
+
+  if (entry == NULL && msHTTPCacheUseDir(psReq)) {
+    char *pszFilename = msHTTPCacheFilename(psReq->pszCacheDir, pszKey);
+    if (pszFilename)
+      entry = msHTTPCacheReadFile(pszFilename, pszKey);
+    msFree(pszFilename);
+    if (entry) {
+      pszData = (char *) msSmallMalloc(entry->size+1);
+      memcpy(pszData, entry->data, entry->size+1);
+      nSize = entry->size;
+      pszContentType = msStrdup(entry->content_type);
+
+      msAcquireLock(TLOCK_HTTPCACHE);
+      msHTTPCacheInsert(entry);
+      msReleaseLock(TLOCK_HTTPCACHE);
+    }
+  }
+  msFree(pszKey);
+
+  if (pszData == NULL)
+    return MS_FALSE;
+
+  if (psReq->pszOutputFile) {
+    FILE *fp = fopen(psReq->pszOutputFile, "wb");
+    if (fp == NULL || fwrite(pszData, 1, nSize, fp) != (size_t)nSize) {
+      if (fp)
+        fclose(fp);
+      msFree(pszData);
+      msFree(pszContentType);
+      return MS_FALSE;
+    }
+    fclose(fp);
+    msFree(pszData);
+    psReq->result_size = nSize;
+  } else {
+    msFree(psReq->result_data);
+    psReq->result_data = pszData;
+    psReq->result_size = nSize;
+    psReq->result_buf_size = nSize+1;
+  }
+
+  psReq->pszContentType = pszContentType;
+  return MS_TRUE;
+}
+
+/*
+** Stores a successful response in the cache, unless the server said
+** not to or the response is an OGC exception report.
+*/
+static void msHTTPCacheStore(httpRequestObj *psReq)
+{
+  httpCacheEntryObj *entry;
+  int nMaxAge = psReq->nCacheMaxAge;
+  char *pszData = NULL;
+  int nSize = 0;
+
+  if (psReq->bResponseNoStore)
+    return;
+  if (psReq->nResponseMaxAge >= 0 && psReq->nResponseMaxAge < nMaxAge)
+    nMaxAge = psReq->nResponseMaxAge;
+  if (nMaxAge <= 0)
+    return;
+
+  if (psReq->pszOutputFile) {
+    FILE *fp = fopen(psReq->pszOutputFile, "rb");
+    if (fp == NULL)
+      return;
+    nSize = psReq->result_size;
+    pszData = (char *) msSmallMalloc(nSize+1);
+    if (fread(pszData, 1, nSize, fp) != (size_t)nSize) {
+      fclose(fp);
+      msFree(pszData);
+      return;
+    }
+    fclose(fp);
+  } else {
+    if (psReq->result_data == NULL)
+      return;
+    nSize = psReq->result_size;
+    pszData = (char *) msSmallMalloc(nSize+1);
+    memcpy(pszData, psReq->result_data, nSize);
+  }
+  pszData[nSize] = '\0';
+
+  /* Servers report exceptions with a 200 status, don't keep those */
+  if (psReq->pszContentType && strstr(psReq->pszContentType, "xml")) {
+    char chSaved = '\0';
+    int bException;
+    if (nSize > 1024) {
+      chSaved = pszData[1024];
+      pszData[1024] = '\0';
+    }
+    bException = strstr(pszData, "ExceptionReport") != NULL;
+    if (nSize > 1024)
+      pszData[1024] = chSaved;
+    if (bException) {
+      msFree(pszData);
+      return;
+    }
+  }
+
+  entry = (httpCacheEntryObj *) msSmallCalloc(1, sizeof(httpCacheEntryObj));
+  entry->key = msHTTPCacheKey(psReq);
+  entry->content_type = msStrdup(psReq->pszContentType ? psReq->pszContentType : "");
+  entry->data = pszData;
+  entry->size = nSize;
+  entry->expires = time(NULL) + nMaxAge;
+
+  if (msHTTPCacheUseDir(psReq)) {
+    char *pszFilename = msHTTPCacheFilename(psReq->pszCacheDir, entry->key);
+    if (pszFilename)
+      msHTTPCacheWriteFile(pszFilename, entry);
+    msFree(pszFilename);
+    msHTTPCachePruneDir(psReq->pszCacheDir);
+  }
+
+  if (psReq->debug)
+    msDebug("HTTP: cached response of request id=%d for %d seconds.\n",
+            psReq->nLayerId, nMaxAge);
+
+  msAcquireLock(TLOCK_HTTPCACHE);
+  msHTTPCacheInsert(entry);
+  msReleaseLock(TLOCK_HTTPCACHE);
+}
+
+/**********************************************************************
+ *                          msHTTPCacheCleanup()
+ *
+ * Empties the in-memory response cache.
+ **********************************************************************/
+void msHTTPCacheCleanup()
+{
+  msAcquireLock(TLOCK_HTTPCACHE);
+  while (gpsHTTPCache) {
+    httpCacheEntryObj *next = gpsHTTPCache->next;
+    msHTTPCacheFreeEntry(gpsHTTPCache);
+    gpsHTTPCache = next;
+  }
+  gnHTTPCacheBytes = 0;
+  msReleaseLock(TLOCK_HTTPCACHE);
+}
+
 /**********************************************************************
  *                          msGetCURLAuthType()
  *
@@ -530,6 +1208,19 @@ int msHTTPExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
       }
     }
 
+    /* Check the response cache, only GET requests are cached */
+    pasReqInfo[i].nResponseMaxAge = -1;
+    pasReqInfo[i].bResponseNoStore = MS_FALSE;
+    if (pasReqInfo[i].nCacheMaxAge > 0 &&
+        pasReqInfo[i].pszPostRequest == NULL &&
+        msHTTPCacheFetch(&(pasReqInfo[i]))) {
+      if (pasReqInfo[i].debug)
+        msDebug("HTTP request: id=%d, found in response cache, skipping.\n",
+                pasReqInfo[i].nLayerId);
+      pasReqInfo[i].nStatus = 242;
+      continue;
+    }
+
     /* Alloc curl handle */
     http_handle = curl_easy_init();
     if (http_handle == NULL) {
@@ -540,6 +1231,10 @@ int msHTTPExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
 
     pasReqInfo[i].curl_handle = http_handle;
 
+    /* Pick up cached DNS lookups and TLS sessions */
+    if (gpsCurlShare != NULL)
+      curl_easy_setopt(http_handle, CURLOPT_SHARE, gpsCurlShare);
+
     /* set URL, note that curl keeps only a ref to our string buffer */
     curl_easy_setopt(http_handle, CURLOPT_URL, pasReqInfo[i].pszGetUrl );
 
@@ -667,6 +1362,11 @@ int msHTTPExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
     curl_easy_setopt(http_handle, CURLOPT_WRITEDATA, &(pasReqInfo[i]));
     curl_easy_setopt(http_handle, CURLOPT_WRITEFUNCTION, msHTTPWriteFct);
 
+    if (pasReqInfo[i].nCacheMaxAge > 0) {
+      curl_easy_setopt(http_handle, CURLOPT_HEADERDATA, &(pasReqInfo[i]));
+      curl_easy_setopt(http_handle, CURLOPT_HEADERFUNCTION, msHTTPHeaderFct);
+    }
+
     /* Provide a buffer where libcurl can write human readable error msgs
      */
     if (pasReqInfo[i].pszErrBuf == NULL)
@@ -726,6 +1426,17 @@ int msHTTPExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
   while(CURLM_CALL_MULTI_PERFORM ==
         curl_multi_perform(multi_handle, &still_running));
 
+#if LIBCURL_VERSION_NUM >= 0x071C00
+  /* curl_multi_wait() polls the transfer sockets itself, which avoids
+   * the FD_SETSIZE limit and the Windows select() problem below.
+   */
+  while(still_running) {
+    if (curl_multi_wait(multi_handle, NULL, 0, 100, NULL) != CURLM_OK)
+      break;
+
+    curl_multi_perform(multi_handle, &still_running);
+  }
+#else
   while(still_running) {
     struct timeval timeout;
     int rc; /* select() return code */
@@ -769,6 +1480,7 @@ int msHTTPExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
         break;
     }
   }
+#endif
 
   if (debug)
     msDebug("HTTP: After download loop\n");
@@ -891,6 +1603,30 @@ int msHTTPExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
       }
     }
 
+#if LIBCURL_VERSION_NUM >= 0x070C03
+    /* A transfer that didn't need a new connection went over a pooled one */
+    if (psReq->nStatus != 0) {
+      long nNewConnections = 0;
+      int bReused = (curl_easy_getinfo(http_handle, CURLINFO_NUM_CONNECTS,
+                                       &nNewConnections) == CURLE_OK &&
+                     nNewConnections == 0);
+
+      msAcquireLock(TLOCK_HTTPSHARE);
+      gnHTTPRequests++;
+      if (bReused)
+        gnHTTPReused++;
+      msReleaseLock(TLOCK_HTTPSHARE);
+
+      if (psReq->debug && bReused)
+        msDebug("HTTP: request id=%d reused an existing connection.\n",
+                psReq->nLayerId);
+    }
+#endif
+
+    if (psReq->nStatus == 200 && psReq->nCacheMaxAge > 0 &&
+        psReq->pszPostRequest == NULL)
+      msHTTPCacheStore(psReq);
+
     /* Report download times foreach handle, in debug mode */
     if (psReq->debug) {
       double dConnectTime=0.0, dTotalTime=0.0, dStartTfrTime=0.0;
@@ -922,6 +1658,13 @@ int msHTTPExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
   /* Cleanup multi handle, each handle had to be cleaned up individually */
   curl_multi_cleanup(multi_handle);
 
+  if (debug) {
+    int nRequests, nReused;
+    msHTTPGetConnectionStats(&nRequests, &nReused);
+    msDebug("HTTP: %d of %d requests so far in this process reused a connection.\n",
+            nReused, nRequests);
+  }
+
   return nStatus;
 }
 
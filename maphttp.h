@@ -83,6 +83,10 @@ extern "C" {
     char    *pszHttpUsername;   /* HTTP Authentication username              */
     char    *pszHttpPassword;   /* HTTP Authentication password              */
 
+    /* Response cache */
+    int     nCacheMaxAge;       /* Cache response up to N seconds, 0=never */
+    char    *pszCacheDir;       /* Optional on-disk cache directory          */
+
     /* For debugging/profiling */
     int         debug;         /* Debug mode?  MS_TRUE/MS_FALSE */
 
@@ -94,6 +98,9 @@ extern "C" {
     int       result_size;
     int       result_buf_size;
 
+    int       nResponseMaxAge; /* Server freshness lifetime, -1 if none */
+    int       bResponseNoStore;/* Server disallowed shared caching */
+
   } httpRequestObj;
 
 #ifdef USE_CURL
@@ -108,6 +115,8 @@ extern "C" {
   int  msHTTPGetFile(const char *pszGetUrl, const char *pszOutputFile,
                      int *pnHTTPStatus, int nTimeout, int bCheckLocalCache,
                      int bDebug, int nMaxBytes);
+  void msHTTPGetConnectionStats(int *pnRequests, int *pnReused);
+  void msHTTPCacheCleanup(void);
 
   int msHTTPAuthProxySetup(hashTableObj *mapmd, hashTableObj *lyrmd,
                            httpRequestObj *pasReqInfo, int numRequests,
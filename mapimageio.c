@@ -554,40 +554,60 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
 #endif /* SEEK_SET */
 
 
-int readPNG(char *path, rasterBufferObj *rb)
+typedef struct {
+  const unsigned char *data;
+  size_t size;
+  size_t offset;
+} msPNGMemorySource;
+
+static void png_read_data_from_buffer(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+  msPNGMemorySource *src = (msPNGMemorySource*)png_get_io_ptr(png_ptr);
+  if(src->offset + length > src->size)
+    png_error(png_ptr, "read past end of buffer");
+  memcpy(data, src->data + src->offset, length);
+  src->offset += length;
+}
+
+/*
+ * decode a PNG image into a premultiplied RGBA buffer, reading either from
+ * an open stream or from a memory buffer if stream is NULL
+ */
+static int readPNGFromStreamOrBuffer(FILE *stream, msPNGMemorySource *src, rasterBufferObj *rb)
 {
   png_uint_32 width,height;
   unsigned char *a,*r,*g,*b;
   int bit_depth,color_type,i;
-  unsigned char **row_pointers;
+  unsigned char ** volatile row_pointers = NULL;
   png_structp png_ptr = NULL;
   png_infop info_ptr = NULL;
 
-  FILE *stream = fopen(path,"rb");
-  if(!stream)
-    return MS_FAILURE;
+  rb->data.rgba.pixels = NULL;
 
   /* could pass pointers to user-defined error handlers instead of NULLs: */
   png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
   if (!png_ptr) {
-    fclose(stream);
     return MS_FAILURE;   /* out of memory */
   }
 
   info_ptr = png_create_info_struct(png_ptr);
   if (!info_ptr) {
     png_destroy_read_struct(&png_ptr, NULL, NULL);
-    fclose(stream);
     return MS_FAILURE;   /* out of memory */
   }
 
   if(setjmp(png_jmpbuf(png_ptr))) {
     png_destroy_read_struct(&png_ptr,&info_ptr,NULL);
-    fclose(stream);
+    free(row_pointers);
+    free(rb->data.rgba.pixels);
+    rb->data.rgba.pixels = NULL;
     return MS_FAILURE;
   }
 
-  png_init_io(png_ptr,stream);
+  if(stream)
+    png_init_io(png_ptr,stream);
+  else
+    png_set_read_fn(png_ptr,src,png_read_data_from_buffer);
   png_read_info(png_ptr,info_ptr);
   png_get_IHDR(png_ptr, info_ptr, &width, &height,
                &bit_depth, &color_type,
@@ -657,11 +677,138 @@ int readPNG(char *path, rasterBufferObj *rb)
     r+=4;
   }
 
-  fclose(stream);
   return MS_SUCCESS;
 
 }
 
+int readPNG(char *path, rasterBufferObj *rb)
+{
+  int ret;
+  FILE *stream = fopen(path,"rb");
+  if(!stream)
+    return MS_FAILURE;
+  ret = readPNGFromStreamOrBuffer(stream, NULL, rb);
+  fclose(stream);
+  return ret;
+}
+
+/*
+ * libjpeg error and source managers used to decode JPEG images held in
+ * memory. Errors longjmp back to readJPEGBuffer() instead of exiting.
+ */
+typedef struct {
+  struct jpeg_error_mgr pub;
+  jmp_buf setjmp_buffer;
+} ms_jpeg_error_mgr;
+
+static void jpeg_error_exit_longjmp(j_common_ptr cinfo)
+{
+  longjmp(((ms_jpeg_error_mgr*)cinfo->err)->setjmp_buffer, 1);
+}
+
+static void jpeg_output_message_quiet(j_common_ptr cinfo)
+{
+  (void)cinfo;
+}
+
+static void jpeg_buffer_init_source(j_decompress_ptr cinfo)
+{
+  (void)cinfo;
+}
+
+static boolean jpeg_buffer_fill_input_buffer(j_decompress_ptr cinfo)
+{
+  /* truncated image: insert a fake EOI marker */
+  static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+  cinfo->src->next_input_byte = eoi;
+  cinfo->src->bytes_in_buffer = 2;
+  return TRUE;
+}
+
+static void jpeg_buffer_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
+{
+  if(num_bytes <= 0)
+    return;
+  if((size_t)num_bytes > cinfo->src->bytes_in_buffer) {
+    jpeg_buffer_fill_input_buffer(cinfo);
+  } else {
+    cinfo->src->next_input_byte += num_bytes;
+    cinfo->src->bytes_in_buffer -= num_bytes;
+  }
+}
+
+static void jpeg_buffer_term_source(j_decompress_ptr cinfo)
+{
+  (void)cinfo;
+}
+
+static int readJPEGBuffer(const unsigned char *data, size_t size, rasterBufferObj *rb)
+{
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_source_mgr src;
+  ms_jpeg_error_mgr jerr;
+  JSAMPLE * volatile rowdata = NULL;
+  unsigned int row, col;
+
+  rb->data.rgba.pixels = NULL;
+
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = jpeg_error_exit_longjmp;
+  jerr.pub.output_message = jpeg_output_message_quiet;
+  if(setjmp(jerr.setjmp_buffer)) {
+    jpeg_destroy_decompress(&cinfo);
+    free(rowdata);
+    free(rb->data.rgba.pixels);
+    rb->data.rgba.pixels = NULL;
+    return MS_FAILURE;
+  }
+  jpeg_create_decompress(&cinfo);
+
+  src.next_input_byte = data;
+  src.bytes_in_buffer = size;
+  src.init_source = jpeg_buffer_init_source;
+  src.fill_input_buffer = jpeg_buffer_fill_input_buffer;
+  src.skip_input_data = jpeg_buffer_skip_input_data;
+  src.resync_to_restart = jpeg_resync_to_restart;
+  src.term_source = jpeg_buffer_term_source;
+  cinfo.src = &src;
+
+  jpeg_read_header(&cinfo, TRUE);
+  cinfo.out_color_space = JCS_RGB;
+  jpeg_start_decompress(&cinfo);
+
+  rb->width = cinfo.output_width;
+  rb->height = cinfo.output_height;
+  rb->type = MS_BUFFER_BYTE_RGBA;
+  rb->data.rgba.pixels = (unsigned char*)malloc(rb->width*rb->height*4*sizeof(unsigned char));
+  rb->data.rgba.pixel_step=4;
+  rb->data.rgba.row_step = rb->width*4;
+  rb->data.rgba.b = &rb->data.rgba.pixels[0];
+  rb->data.rgba.g = &rb->data.rgba.pixels[1];
+  rb->data.rgba.r = &rb->data.rgba.pixels[2];
+  rb->data.rgba.a = &rb->data.rgba.pixels[3];
+  rowdata = (JSAMPLE*)malloc(rb->width*cinfo.output_components*sizeof(JSAMPLE));
+
+  for(row=0; row<rb->height; row++) {
+    JSAMPLE *pixptr = rowdata;
+    unsigned char *pixel = rb->data.rgba.pixels + row*rb->data.rgba.row_step;
+    JSAMPROW rowptr = rowdata;
+    jpeg_read_scanlines(&cinfo, &rowptr, 1);
+    for(col=0; col<rb->width; col++) {
+      pixel[2] = *(pixptr++);
+      pixel[1] = *(pixptr++);
+      pixel[0] = *(pixptr++);
+      pixel[3] = 255;
+      pixel += 4;
+    }
+  }
+
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  free(rowdata);
+  return MS_SUCCESS;
+}
+
 int msSaveRasterBuffer(mapObj *map, rasterBufferObj *rb, FILE *stream,
                        outputFormatObj *format)
 {
@@ -1054,3 +1201,22 @@ int msLoadMSRasterBufferFromFile(char *path, rasterBufferObj *rb)
   }
   return ret;
 }
+
+/*
+ * decode a PNG or JPEG image held in memory, without going through a
+ * temporary file
+ */
+int msLoadMSRasterBufferFromMemory(const unsigned char *data, int size, rasterBufferObj *rb)
+{
+  if(size >= 8 && png_sig_cmp((png_bytep)data,0,8) == 0) {
+    msPNGMemorySource src;
+    src.data = data;
+    src.size = size;
+    src.offset = 0;
+    return readPNGFromStreamOrBuffer(NULL, &src, rb);
+  } else if(size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) {
+    return readJPEGBuffer(data, size, rb);
+  }
+  msSetError(MS_MISCERR,"unsupported image format","msLoadMSRasterBufferFromMemory()");
+  return MS_FAILURE;
+}
@@ -666,28 +666,52 @@ void KmlRenderer::renderPolygon(imageObj*, shapeObj *p, colorObj *color)
 
 }
 
+/* append "<sep>value" with %.8f precision to a coordinates buffer */
+static void kmlAppendCoord(bufferObj *buffer, char sep, double value)
+{
+  char valueBuf[512];
+  int len;
+
+  valueBuf[0] = sep;
+  len = msFormatDouble(valueBuf+1, sizeof(valueBuf)-1, value, 8);
+  msBufferAppend(buffer, valueBuf, 1 + MS_MIN(len, (int) sizeof(valueBuf) - 2));
+}
+
 void KmlRenderer::addCoordsNode(xmlNodePtr parentNode, pointObj *pts, int numPts)
 {
-  char lineBuf[128];
+  bufferObj coords;
 
   xmlNodePtr coordsNode = xmlNewChild(parentNode, NULL, BAD_CAST "coordinates", NULL);
-  xmlNodeAddContent(coordsNode, BAD_CAST "\n");
+
+  /* the whole tuple list is built first and added as a single text node */
+  msBufferInit(&coords);
+  coords._next_allocation_size = numPts*32 + 16;
+  msBufferAppend(&coords, (void *) "\n", 1);
 
   for (int i=0; i<numPts; i++) {
     if( mElevationFromAttribute ) {
-      sprintf(lineBuf, "\t%.8f,%.8f,%.8f\n", pts[i].x, pts[i].y, mCurrentElevationValue);
+      kmlAppendCoord(&coords, '\t', pts[i].x);
+      kmlAppendCoord(&coords, ',', pts[i].y);
+      kmlAppendCoord(&coords, ',', mCurrentElevationValue);
     } else if (AltitudeMode == relativeToGround || AltitudeMode == absolute) {
 #ifdef USE_POINT_Z_M
-      sprintf(lineBuf, "\t%.8f,%.8f,%.8f\n", pts[i].x, pts[i].y, pts[i].z);
+      kmlAppendCoord(&coords, '\t', pts[i].x);
+      kmlAppendCoord(&coords, ',', pts[i].y);
+      kmlAppendCoord(&coords, ',', pts[i].z);
 #else
       msSetError(MS_MISCERR, "Z coordinates support not available  (mapserver not compiled with USE_POINT_Z_M option)", "KmlRenderer::addCoordsNode()");
+      continue;
 #endif
-    } else
-      sprintf(lineBuf, "\t%.8f,%.8f\n", pts[i].x, pts[i].y);
-
-    xmlNodeAddContent(coordsNode, BAD_CAST lineBuf);
+    } else {
+      kmlAppendCoord(&coords, '\t', pts[i].x);
+      kmlAppendCoord(&coords, ',', pts[i].y);
+    }
+    msBufferAppend(&coords, (void *) "\n", 1);
   }
-  xmlNodeAddContent(coordsNode, BAD_CAST "\t");
+  msBufferAppend(&coords, (void *) "\t", 1);
+
+  xmlNodeAddContentLen(coordsNode, BAD_CAST coords.data, (int) coords.size);
+  msBufferFree(&coords);
 }
 
 void KmlRenderer::renderGlyphs(imageObj *img, pointObj *labelpnt, char *text, double angle, colorObj *clr, colorObj *olcolor, int olwidth)
@@ -91,6 +91,7 @@ void msFreeMap(mapObj *map)
   msFree(map->name);
   msFree(map->shapepath);
   msFree(map->mappath);
+  msFree(map->mapfile);
 
   msFreeProjection(&(map->projection));
   msFreeProjection(&(map->latlon));
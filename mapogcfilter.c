@@ -299,6 +299,10 @@ char *FLTGetExpressionForValuesRanges(layerObj *lp, const char *item, const char
 
 #ifdef USE_OGR
 
+static int FLTIsSQLFilter(FilterEncodingNode *psNode, layerObj *lp);
+static char *FLTGetSpatialSQLExpression(FilterEncodingNode *psNode, layerObj *lp);
+static int FLTApplySQLFilter(FilterEncodingNode *psNode, mapObj *map,
+                             int iLayerIndex, char *pszSQLExpression);
 
 int FLTogrConvertGeometry(OGRGeometryH hGeometry, shapeObj *psShape,
                           OGRwkbGeometryType nType)
@@ -400,6 +404,20 @@ int FLTIsSimpleFilterNoSpatial(FilterEncodingNode *psNode)
 
 int FLTApplySimpleSQLFilter(FilterEncodingNode *psNode, mapObj *map,
                             int iLayerIndex)
+{
+  return FLTApplySQLFilter(psNode, map, iLayerIndex, NULL);
+}
+
+/************************************************************************/
+/*                         FLTApplySQLFilter()                          */
+/*                                                                      */
+/*      FLTApplySimpleSQLFilter() with the SQL expression of the        */
+/*      filter for database layers already built by the caller, or     */
+/*      NULL. Takes ownership of pszSQLExpression.                      */
+/************************************************************************/
+
+static int FLTApplySQLFilter(FilterEncodingNode *psNode, mapObj *map,
+                             int iLayerIndex, char *pszSQLExpression)
 {
   layerObj *lp = NULL;
   char *szExpression = NULL;
@@ -439,8 +457,10 @@ int FLTApplySimpleSQLFilter(FilterEncodingNode *psNode, mapObj *map,
   /* if there is no class, create at least one, so that query by rect
      would work*/
   if (lp->numclasses == 0) {
-    if (msGrowLayerClasses(lp) == NULL)
+    if (msGrowLayerClasses(lp) == NULL) {
+      msFree(pszSQLExpression);
       return MS_FAILURE;
+    }
     initClass(lp->class[0]);
   }
 
@@ -448,7 +468,8 @@ int FLTApplySimpleSQLFilter(FilterEncodingNode *psNode, mapObj *map,
   bHasAWhere = 0;
   if (lp->connectiontype == MS_POSTGIS || lp->connectiontype ==  MS_ORACLESPATIAL ||
       lp->connectiontype == MS_SDE || lp->connectiontype == MS_PLUGIN) {
-    szExpression = FLTGetSQLExpression(psNode, lp);
+    szExpression = pszSQLExpression ? pszSQLExpression : FLTGetSQLExpression(psNode, lp);
+    pszSQLExpression = NULL;
     if (szExpression) {
       pszTmp = msStrdup("(");
       pszTmp = msStringConcatenate(pszTmp, szExpression);
@@ -479,6 +500,7 @@ int FLTApplySimpleSQLFilter(FilterEncodingNode *psNode, mapObj *map,
     szExpression = FLTGetCommonExpression(psNode, lp);
 
   }
+  msFree(pszSQLExpression); /* only used by database layers */
 
 
   if (szExpression) {
@@ -640,6 +662,19 @@ int FLTLayerApplyCondSQLFilterToLayer(FilterEncodingNode *psNode, mapObj *map,
     return FLTApplySimpleSQLFilter(psNode, map, iLayerIndex);
   }
 
+  /* ==================================================================== */
+  /*      PostGIS can also evaluate the spatial operators, so a filter    */
+  /*      mixing them with attribute queries (in any and/or/not          */
+  /*      combination) is sent as one SQL expression rather than being   */
+  /*      evaluated with GEOS on every shape of the layer extent. Only   */
+  /*      do it if the whole tree could be translated.                   */
+  /* ==================================================================== */
+  if (FLTIsSQLFilter(psNode, lp)) {
+    char *pszSQLExpression = FLTGetSQLExpression(psNode, lp);
+    if (pszSQLExpression)
+      return FLTApplySQLFilter(psNode, map, iLayerIndex, pszSQLExpression);
+  }
+
   return FLTLayerApplyPlainFilterToLayer(psNode, map, iLayerIndex);
 }
 
@@ -2136,7 +2171,9 @@ char *FLTGetSQLExpression(FilterEncodingNode *psFilterNode, layerObj *lp)
   }
 
   else if (psFilterNode->eType == FILTER_NODE_TYPE_SPATIAL) {
-    /* TODO */
+    /* a BBOX is always applied through the query rectangle */
+    if (!FLTIsBBoxFilter(psFilterNode))
+      pszExpression = FLTGetSpatialSQLExpression(psFilterNode, lp);
   } else if (psFilterNode->eType == FILTER_NODE_TYPE_FEATUREID) {
 #if defined(USE_WMS_SVR) || defined (USE_WFS_SVR) || defined (USE_WCS_SVR) || defined(USE_SOS_SVR)
     if (psFilterNode->pszValue) {
@@ -2202,6 +2239,116 @@ char *FLTGetSQLExpression(FilterEncodingNode *psFilterNode, layerObj *lp)
   return pszExpression;
 }
 
+/************************************************************************/
+/*                        FLTGetSpatialSQLExpression                    */
+/*                                                                      */
+/*      Build an SQL expression for a spatial (non BBOX) filter         */
+/*      node. Only PostGIS layers are supported.                        */
+/************************************************************************/
+static char *FLTGetSpatialSQLExpression(FilterEncodingNode *psNode, layerObj *lp)
+{
+  shapeObj *psQueryShape = NULL;
+  shapeObj sTmpShape;
+  projectionObj sProjTmp;
+  double dfDistance = -1;
+  int nUnit = -1, nLayerUnit = -1;
+  char *pszWKT = NULL;
+  char *pszTmp = NULL;
+  char *pszExpression = NULL;
+
+  if (lp->connectiontype != MS_POSTGIS)
+    return NULL;
+
+  psQueryShape = FLTGetShape(psNode, &dfDistance, &nUnit);
+  if (!psQueryShape)
+    return NULL;
+
+  /* reproject a copy, the node shape may be used again by the caller */
+  msInitShape(&sTmpShape);
+  msCopyShape(psQueryShape, &sTmpShape);
+
+  if (lp->projection.numargs > 0) {
+    if (psNode->pszSRS) {
+      msInitProjection(&sProjTmp);
+      /* Use the non EPSG variant since axis swapping is done in FLTDoAxisSwappingIfNecessary */
+      if (msLoadProjectionString(&sProjTmp, psNode->pszSRS) == 0)
+        msProjectShape(&sProjTmp, &lp->projection, &sTmpShape);
+      msFreeProjection(&sProjTmp);
+    } else if (lp->map->projection.numargs > 0)
+      msProjectShape(&lp->map->projection, &lp->projection, &sTmpShape);
+  }
+
+  /* the distance is evaluated in the layer coordinate system */
+  if (dfDistance > 0 && nUnit >= 0) {
+    if (lp->projection.numargs > 0)
+      nLayerUnit = GetMapserverUnitUsingProj(&lp->projection);
+    else
+      nLayerUnit = lp->map->units;
+    if (nLayerUnit >= 0 && nUnit != nLayerUnit)
+      dfDistance *= msInchesPerUnit(nUnit,0)/msInchesPerUnit(nLayerUnit,0);
+  }
+
+  pszWKT = msShapeToWKT(&sTmpShape);
+  msFreeShape(&sTmpShape);
+  if (!pszWKT)
+    return NULL;
+
+  pszTmp = msPostGISBuildSQLSpatialFilter(lp, psNode->pszValue, pszWKT, dfDistance);
+  msFree(pszWKT);
+  if (!pszTmp)
+    return NULL;
+
+  pszExpression = msStringConcatenate(pszExpression, " (");
+  pszExpression = msStringConcatenate(pszExpression, pszTmp);
+  pszExpression = msStringConcatenate(pszExpression, ") ");
+  msFree(pszTmp);
+
+  return pszExpression;
+}
+
+/************************************************************************/
+/*                              FLTIsSQLFilter                          */
+/*                                                                      */
+/*      Check if all the nodes of a filter can be translated to SQL     */
+/*      for a PostGIS layer. The only BBOX allowed is the one that      */
+/*      can be used as query rectangle (see FLTValidForBBoxFilter).     */
+/************************************************************************/
+static int FLTIsSQLFilterNode(FilterEncodingNode *psNode, layerObj *lp)
+{
+  if (!psNode)
+    return MS_TRUE;
+
+  switch (psNode->eType) {
+    case FILTER_NODE_TYPE_LOGICAL:
+      return FLTIsSQLFilterNode(psNode->psLeftNode, lp) &&
+             FLTIsSQLFilterNode(psNode->psRightNode, lp);
+
+    case FILTER_NODE_TYPE_COMPARISON:
+    case FILTER_NODE_TYPE_FEATUREID:
+    case FILTER_NODE_TYPE_TEMPORAL:
+      return MS_TRUE;
+
+    case FILTER_NODE_TYPE_SPATIAL:
+      return psNode->pszValue != NULL;
+
+    default:
+      break;
+  }
+
+  return MS_FALSE;
+}
+
+static int FLTIsSQLFilter(FilterEncodingNode *psNode, layerObj *lp)
+{
+  if (!psNode || !lp || lp->connectiontype != MS_POSTGIS)
+    return MS_FALSE;
+
+  if (!FLTValidForBBoxFilter(psNode))
+    return MS_FALSE;
+
+  return FLTIsSQLFilterNode(psNode, lp);
+}
+
 /************************************************************************/
 /*                            FLTGetNodeExpression                      */
 /*                                                                      */
@@ -3062,6 +3209,10 @@ char *FLTGetIsLikeComparisonSQLExpression(FilterEncodingNode *psFilterNode,
       } else if (c == '\\') {
         pszEscapedStr[j++] = '\\';
         pszEscapedStr[j++] = '\\';
+      } else if ((c == '%' || c == '_') && lp->connectiontype != MS_OGR) {
+        /* literal SQL wildcard: escape it so it is not used as a pattern */
+        pszEscapedStr[j++] = pszEscape[0];
+        pszEscapedStr[j++] = c;
       } else
         pszEscapedStr[j++] = c;
     } else if  (c == pszSingle[0]) {
@@ -3082,7 +3233,13 @@ char *FLTGetIsLikeComparisonSQLExpression(FilterEncodingNode *psFilterNode,
     }
   }
   pszEscapedStr[j++] = 0;
-  strlcat(szBuffer, pszEscapedStr, bufferSize);
+  if (strlcat(szBuffer, pszEscapedStr, bufferSize) >= bufferSize) {
+    /* a truncated pattern would silently change the query */
+    msSetError(MS_MISCERR, "PropertyIsLike value is too long.",
+               "FLTGetIsLikeComparisonSQLExpression()");
+    msFree(pszEscapedStr);
+    return NULL;
+  }
   msFree(pszEscapedStr);
 
   strlcat(szBuffer, "'", bufferSize);
@@ -29,6 +29,7 @@
 #include "mapogcsld.h"
 #include "mapogcfilter.h"
 #include "mapserver.h"
+#include "mapthread.h"
 
 #ifdef USE_OGR
 #include "cpl_string.h"
@@ -131,6 +132,231 @@ int msSLDApplySLDURL(mapObj *map, char *szURL, int iLayer,
 
 }
 
+/************************************************************************/
+/*                              SLD cache                               */
+/*                                                                      */
+/*      With "wms_sld_cache" "true" in the WEB metadata, the layers     */
+/*      parsed from an SLD document are kept in a small process wide    */
+/*      cache, keyed by the document and the map's symbol set.  A       */
+/*      repeated SLD_BODY (or SLD URL content) is then copied onto the  */
+/*      request's map instead of being parsed again.                    */
+/************************************************************************/
+#if defined(USE_OGR) && (defined(USE_WMS_SVR) || defined (USE_WFS_SVR) || defined (USE_WCS_SVR) || defined(USE_SOS_SVR))
+
+#define MS_SLD_CACHE_MAX_ENTRIES 16
+
+typedef struct sldCacheEntryObj {
+  char *key;
+  unsigned int hash;
+  int numlayers;
+  layerObj *layers;
+  int numsymbols; /* symbols the parser added to the map */
+  symbolObj **symbols;
+  struct sldCacheEntryObj *next;
+} sldCacheEntryObj;
+
+static sldCacheEntryObj *sldCache = NULL; /* most recently used first */
+
+static void msSLDFreeCacheEntry(sldCacheEntryObj *entry)
+{
+  int i;
+
+  for (i=0; i<entry->numlayers; i++)
+    freeLayer(&entry->layers[i]);
+  msFree(entry->layers);
+  for (i=0; i<entry->numsymbols; i++) {
+    msFreeSymbol(entry->symbols[i]);
+    msFree(entry->symbols[i]);
+  }
+  msFree(entry->symbols);
+  msFree(entry->key);
+  msFree(entry);
+}
+
+/*
+** The parsed classes refer to symbols by index, so the key covers the
+** symbols known to the map on top of the map itself and the document.
+*/
+static char *msSLDCacheKey(mapObj *map, const char *psSLDXML, unsigned int *hash)
+{
+  char szTmp[32];
+  char *key = NULL;
+  const char *p;
+  int i;
+
+  key = msStringConcatenate(key, map->mappath ? map->mappath : "");
+  key = msStringConcatenate(key, "|");
+  key = msStringConcatenate(key, map->name ? map->name : "");
+  snprintf(szTmp, sizeof(szTmp), "|%d|", map->symbolset.numsymbols);
+  key = msStringConcatenate(key, szTmp);
+  for (i=0; i<map->symbolset.numsymbols; i++) {
+    if (map->symbolset.symbol[i]->name)
+      key = msStringConcatenate(key, map->symbolset.symbol[i]->name);
+    key = msStringConcatenate(key, "|");
+  }
+  key = msStringConcatenate(key, (char *) psSLDXML);
+
+  *hash = 5381;
+  for (p=key; *p; p++)
+    *hash = *hash * 33 + (unsigned char) *p;
+
+  return key;
+}
+
+static layerObj *msSLDCopyLayers(mapObj *map, layerObj *pasSrc, int nLayers)
+{
+  layerObj *pasLayers;
+  int i;
+
+  pasLayers = (layerObj *)msSmallMalloc(sizeof(layerObj)*nLayers);
+  for (i=0; i<nLayers; i++) {
+    initLayer(&pasLayers[i], map);
+    msCopyLayer(&pasLayers[i], &pasSrc[i]);
+  }
+
+  return pasLayers;
+}
+
+/*
+** msSLDParseSLD() going through the SLD cache when it is enabled.
+*/
+static layerObj *msSLDParseSLDCached(mapObj *map, char *psSLDXML, int *pnLayers)
+{
+  const char *value;
+  char *key;
+  unsigned int hash;
+  sldCacheEntryObj *entry, *prev;
+  layerObj *pasLayers;
+  int i, nLayers = 0, nSymbols;
+  int bCacheable = MS_TRUE;
+
+  value = msOWSLookupMetadata(&(map->web.metadata), "MO", "sld_cache");
+  if (value == NULL || strcasecmp(value, "true") != 0 || psSLDXML == NULL)
+    return msSLDParseSLD(map, psSLDXML, pnLayers);
+
+  key = msSLDCacheKey(map, psSLDXML, &hash);
+
+  msAcquireLock(TLOCK_SLDCACHE);
+  for (prev=NULL, entry=sldCache; entry; prev=entry, entry=entry->next) {
+    if (entry->hash == hash && strcmp(entry->key, key) == 0)
+      break;
+  }
+
+  if (entry) {
+    if (prev) {
+      prev->next = entry->next;
+      entry->next = sldCache;
+      sldCache = entry;
+    }
+
+    /* the map has the same symbols as when parsing, so these get the same ids */
+    for (i=0; i<entry->numsymbols; i++) {
+      symbolObj *psSymbol = msGrowSymbolSet(&(map->symbolset));
+      if (psSymbol == NULL)
+        break;
+      msCopySymbol(psSymbol, entry->symbols[i], map);
+      map->symbolset.numsymbols++;
+    }
+
+    if (i < entry->numsymbols) {
+      msReleaseLock(TLOCK_SLDCACHE);
+      msFree(key);
+      return NULL;
+    }
+
+    nLayers = entry->numlayers;
+    pasLayers = msSLDCopyLayers(map, entry->layers, nLayers);
+    msReleaseLock(TLOCK_SLDCACHE);
+
+    if (pnLayers)
+      *pnLayers = nLayers;
+    if (map->debug >= MS_DEBUGLEVEL_V)
+      msDebug("msSLDParseSLDCached(): reused %d cached SLD layers.\n", nLayers);
+    msFree(key);
+    return pasLayers;
+  }
+  msReleaseLock(TLOCK_SLDCACHE);
+
+  nSymbols = map->symbolset.numsymbols;
+  pasLayers = msSLDParseSLD(map, psSLDXML, &nLayers);
+  if (pnLayers)
+    *pnLayers = nLayers;
+  if (pasLayers == NULL || nLayers <= 0) {
+    msFree(key);
+    return pasLayers;
+  }
+
+  /* spatial filters are consumed when applied, and external graphics */
+  /* are downloaded to temporary files: parse those again every time  */
+  for (i=0; i<nLayers; i++) {
+    if (pasLayers[i].layerinfo)
+      bCacheable = MS_FALSE;
+  }
+  for (i=nSymbols; i<map->symbolset.numsymbols; i++) {
+    if (map->symbolset.symbol[i]->type == MS_SYMBOL_PIXMAP)
+      bCacheable = MS_FALSE;
+  }
+  if (!bCacheable) {
+    msFree(key);
+    return pasLayers;
+  }
+
+  entry = (sldCacheEntryObj *) msSmallCalloc(1, sizeof(sldCacheEntryObj));
+  entry->key = key;
+  entry->hash = hash;
+  entry->numlayers = nLayers;
+  entry->layers = msSLDCopyLayers(NULL, pasLayers, nLayers);
+  entry->numsymbols = map->symbolset.numsymbols - nSymbols;
+  if (entry->numsymbols > 0) {
+    entry->symbols = (symbolObj **) msSmallMalloc(sizeof(symbolObj *)*entry->numsymbols);
+    for (i=0; i<entry->numsymbols; i++) {
+      entry->symbols[i] = (symbolObj *) msSmallMalloc(sizeof(symbolObj));
+      msCopySymbol(entry->symbols[i], map->symbolset.symbol[nSymbols+i], NULL);
+    }
+  }
+
+  msAcquireLock(TLOCK_SLDCACHE);
+  entry->next = sldCache;
+  sldCache = entry;
+
+  /* drop the least recently used entries */
+  for (i=1, prev=sldCache; prev->next; prev=prev->next, i++) {
+    if (i == MS_SLD_CACHE_MAX_ENTRIES) {
+      sldCacheEntryObj *drop = prev->next;
+      prev->next = NULL;
+      while (drop) {
+        entry = drop->next;
+        msSLDFreeCacheEntry(drop);
+        drop = entry;
+      }
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_SLDCACHE);
+
+  return pasLayers;
+}
+
+#endif
+
+/************************************************************************/
+/*                          msSLDCacheCleanup()                         */
+/*                                                                      */
+/*      Free the SLD cache, called from msCleanup().                    */
+/************************************************************************/
+void msSLDCacheCleanup(void)
+{
+#if defined(USE_OGR) && (defined(USE_WMS_SVR) || defined (USE_WFS_SVR) || defined (USE_WCS_SVR) || defined(USE_SOS_SVR))
+  msAcquireLock(TLOCK_SLDCACHE);
+  while (sldCache) {
+    sldCacheEntryObj *next = sldCache->next;
+    msSLDFreeCacheEntry(sldCache);
+    sldCache = next;
+  }
+  msReleaseLock(TLOCK_SLDCACHE);
+#endif
+}
+
 /************************************************************************/
 /*                              msSLDApplySLD                           */
 /*                                                                      */
@@ -166,7 +392,7 @@ int msSLDApplySLD(mapObj *map, char *psSLDXML, int iLayer,
   FilterEncodingNode *psExpressionNode =NULL;
   int bFailedExpression=0;
 
-  pasLayers = msSLDParseSLD(map, psSLDXML, &nLayers);
+  pasLayers = msSLDParseSLDCached(map, psSLDXML, &nLayers);
   /* -------------------------------------------------------------------- */
   /*      If the same layer is given more that once, we need to           */
   /*      duplicate it.                                                   */
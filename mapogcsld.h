@@ -33,6 +33,7 @@ MS_DLL_EXPORT int msSLDApplySLDURL(mapObj *map, char *szURL, int iLayer,
                                    char *pszStyleLayerName, char **ppszLayerNames);
 MS_DLL_EXPORT int msSLDApplySLD(mapObj *map, char *psSLDXML, int iLayer,
                                 char *pszStyleLayerName, char **ppszLayerNames);
+MS_DLL_EXPORT void msSLDCacheCleanup(void);
 
 #ifdef USE_OGR
 
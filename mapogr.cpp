@@ -48,6 +48,9 @@
 #ifdef USE_OGR
 
 #include "ogr_api.h"
+#if GDAL_VERSION_NUM >= 3060000
+#include "ogr_recordbatch.h"
+#endif
 
 typedef struct ms_ogr_file_info_t {
   char        *pszFname;
@@ -61,9 +64,23 @@ typedef struct ms_ogr_file_info_t {
 
   struct ms_ogr_file_info_t *poCurTile; /* exists on tile index, -> tiles */
   rectObj     rect;                     /* set by WhichShapes */
+  int         bAttributeFilter;         /* set by WhichShapes */
 
   int         last_record_index_read;
 
+#if GDAL_VERSION_NUM >= 3060000
+  int         bArrowAllowed;            /* set by WhichShapes when drawing */
+  int         bArrowStream;             /* features read from sArrowStream */
+  struct ArrowArrayStream sArrowStream;
+  struct ArrowSchema sArrowSchema;
+  struct ArrowArray sArrowBatch;        /* current record batch */
+  int64_t     nArrowRow;                /* next row of sArrowBatch */
+  int         nArrowFIDChild;
+  int         nArrowGeomChild;
+  int         *panArrowItemChild;       /* batch column of each item */
+  int         *panArrowItemPrecision;   /* -1 for reals without width */
+#endif
+
 } msOGRFileInfo;
 
 static int msOGRLayerIsOpen(layerObj *layer);
@@ -71,6 +88,9 @@ static int msOGRLayerInitItemInfo(layerObj *layer);
 static int msOGRLayerGetAutoStyle(mapObj *map, layerObj *layer, classObj *c,
                                   shapeObj* shape);
 static void msOGRCloseConnection( void *conn_handle );
+#if GDAL_VERSION_NUM >= 3060000
+static void msOGRFileStopArrowStream( msOGRFileInfo *psInfo );
+#endif
 
 /* ==================================================================
  * Geometry conversion functions
@@ -211,9 +231,21 @@ static int ogrGeomPoints(OGRGeometryH hGeom, shapeObj *outshp)
                       outshp->numlines-1, &(outshp->bounds));
   } else if( eGType == wkbLineString
              || eGType == wkbLinearRing ) {
+#if GDAL_VERSION_NUM >= 1900
+    /* Fetch all the points at once, then just update the bounds */
+    OGR_G_GetPoints(hGeom,
+                    &(line->point[line->numpoints].x), sizeof(pointObj),
+                    &(line->point[line->numpoints].y), sizeof(pointObj),
+                    NULL, 0);
+    for(i=0; i<numpoints; i++)
+      ogrPointsAddPoint(line, line->point[line->numpoints].x,
+                        line->point[line->numpoints].y,
+                        outshp->numlines-1, &(outshp->bounds));
+#else
     for(i=0; i<numpoints; i++)
       ogrPointsAddPoint(line, OGR_G_GetX(hGeom, i), OGR_G_GetY(hGeom, i),
                         outshp->numlines-1, &(outshp->bounds));
+#endif
   } else if( eGType == wkbMultiPoint ) {
     for(i=0; i<numpoints; i++) {
       OGRGeometryH hPoint = OGR_G_GetGeometryRef( hGeom, i );
@@ -228,14 +260,43 @@ static int ogrGeomPoints(OGRGeometryH hGeom, shapeObj *outshp)
 }
 
 
+/**********************************************************************
+ *                     ogrGeomLineCount()
+ *
+ * Count the parts ogrGeomLine() will turn into lines, so the line array
+ * of the shape can be allocated once instead of growing part by part.
+ **********************************************************************/
+static int ogrGeomLineCount(OGRGeometryH hGeom)
+{
+  if (hGeom == NULL)
+    return 0;
+
+  OGRwkbGeometryType eGType =  wkbFlatten( OGR_G_GetGeometryType( hGeom ) );
+
+  if ( eGType == wkbPolygon
+       || eGType == wkbGeometryCollection
+       || eGType == wkbMultiLineString
+       || eGType == wkbMultiPolygon ) {
+    int nCount = 0;
+    for (int iGeom=0; iGeom < OGR_G_GetGeometryCount( hGeom ); iGeom++ )
+      nCount += ogrGeomLineCount( OGR_G_GetGeometryRef( hGeom, iGeom ) );
+    return nCount;
+  }
+
+  return ( eGType == wkbLineString ) ? 1 : 0;
+}
+
 /**********************************************************************
  *                     ogrGeomLine()
  *
  * Recursively convert any OGRGeometry into a shapeObj.  Each part becomes
  * a line in the overall shapeObj.
+ *
+ * nMaxLines is the number of lines already allocated in outshp->line
+ * by the caller (see ogrGeomLineCount()), or 0.
  **********************************************************************/
 static int ogrGeomLine(OGRGeometryH hGeom, shapeObj *outshp,
-                       int bCloseRings)
+                       int bCloseRings, int nMaxLines)
 {
   if (hGeom == NULL)
     return 0;
@@ -256,7 +317,7 @@ static int ogrGeomLine(OGRGeometryH hGeom, shapeObj *outshp,
     /* Treat it as GeometryCollection */
     for (int iGeom=0; iGeom < OGR_G_GetGeometryCount( hGeom ); iGeom++ ) {
       if( ogrGeomLine( OGR_G_GetGeometryRef( hGeom, iGeom ),
-                       outshp, bCloseRings ) == -1 )
+                       outshp, bCloseRings, nMaxLines ) == -1 )
         return -1;
     }
   }
@@ -326,7 +387,11 @@ static int ogrGeomLine(OGRGeometryH hGeom, shapeObj *outshp,
       line.numpoints++;
     }
 
-    msAddLineDirectly(outshp, &line);
+    if (outshp->numlines < nMaxLines) {
+      outshp->line[outshp->numlines++] = line;
+    } else {
+      msAddLineDirectly(outshp, &line);
+    }
   } else {
     msSetError(MS_OGRERR,
                "OGRGeometry type `%s' not supported.",
@@ -355,12 +420,35 @@ static int ogrConvertGeometry(OGRGeometryH hGeom, shapeObj *outshp,
    * Process geometry according to layer type
    * ------------------------------------------------------------------ */
   int nStatus = MS_SUCCESS;
+  int nMaxLines = 0;
 
   if (hGeom == NULL) {
     // Empty geometry... this is not an error... we'll just skip it
     return MS_SUCCESS;
   }
 
+  /* ------------------------------------------------------------------
+   * Multi-part geometries headed for ogrGeomLine(): allocate all the
+   * lines at once.
+   * ------------------------------------------------------------------ */
+  if (layertype != MS_LAYER_POINT && outshp->numlines == 0 && outshp->line == NULL) {
+    OGRwkbGeometryType eGType =  wkbFlatten( OGR_G_GetGeometryType( hGeom ) );
+    if (eGType == wkbPolygon || eGType == wkbGeometryCollection
+        || eGType == wkbMultiLineString || eGType == wkbMultiPolygon) {
+      nMaxLines = ogrGeomLineCount(hGeom);
+      if (nMaxLines > 1) {
+        outshp->line = (lineObj *) malloc(sizeof(lineObj) * nMaxLines);
+        if (outshp->line == NULL) {
+          msSetError(MS_MEMERR, "Unable to allocate line array.",
+                     "ogrConvertGeometry()");
+          return MS_FAILURE;
+        }
+      } else {
+        nMaxLines = 0;
+      }
+    }
+  }
+
   switch(layertype) {
       /* ------------------------------------------------------------------
        *      POINT layer - Any geometry can be converted to point/multipoint
@@ -374,7 +462,7 @@ static int ogrConvertGeometry(OGRGeometryH hGeom, shapeObj *outshp,
        *      LINE layer
        * ------------------------------------------------------------------ */
     case MS_LAYER_LINE:
-      if(ogrGeomLine(hGeom, outshp, MS_FALSE) == -1) {
+      if(ogrGeomLine(hGeom, outshp, MS_FALSE, nMaxLines) == -1) {
         nStatus = MS_FAILURE; // Error message already produced.
       }
       if (outshp->type != MS_SHAPE_LINE && outshp->type != MS_SHAPE_POLYGON)
@@ -384,7 +472,7 @@ static int ogrConvertGeometry(OGRGeometryH hGeom, shapeObj *outshp,
        *      POLYGON layer
        * ------------------------------------------------------------------ */
     case MS_LAYER_POLYGON:
-      if(ogrGeomLine(hGeom, outshp, MS_TRUE) == -1) {
+      if(ogrGeomLine(hGeom, outshp, MS_TRUE, nMaxLines) == -1) {
         nStatus = MS_FAILURE; // Error message already produced.
       }
       if (outshp->type != MS_SHAPE_POLYGON)
@@ -407,7 +495,7 @@ static int ogrConvertGeometry(OGRGeometryH hGeom, shapeObj *outshp,
         default:
           // Handle any non-point types as lines/polygons ... ogrGeomLine()
           // will decide the shape type
-          if(ogrGeomLine(hGeom, outshp, MS_FALSE) == -1) {
+          if(ogrGeomLine(hGeom, outshp, MS_FALSE, nMaxLines) == -1) {
             nStatus = MS_FAILURE; // Error message already produced.
           }
       }
@@ -1021,6 +1109,171 @@ void msOGRInitialize(void)
 
 #ifdef USE_OGR
 
+/* ==================================================================
+ * Schema cache
+ *
+ * Layer extents and PROJECTION AUTO definitions can be expensive to
+ * obtain (GetExtent() may scan the whole layer, the SRS may need to be
+ * read from the datasource and exported).  For datasources that are
+ * plain files we keep them across requests, keyed on file name and
+ * layer, and forget them as soon as the size or modification time of
+ * the file or of its sidecar files changes.  Writes within the same
+ * second may not change either, so entries also expire after
+ * MSOGR_SCHEMA_CACHE_TTL seconds.  The cache is protected by
+ * TLOCK_OGRSCHEMA.
+ * ================================================================== */
+
+#define MSOGR_SCHEMA_CACHE_SIZE 100
+#define MSOGR_SCHEMA_CACHE_TTL  60
+
+/* The file itself, the write-ahead log of SQLite based formats such as
+   GeoPackage, and the .prj of shapefiles */
+#define MSOGR_SCHEMA_CACHE_FILES 3
+
+typedef struct ms_ogr_schema_cache_t {
+  char        *pszKey;      /* datasource name + "," + layer definition */
+  time_t      anMTime[MSOGR_SCHEMA_CACHE_FILES];
+  vsi_l_offset anSize[MSOGR_SCHEMA_CACHE_FILES]; /* 0 if the file is missing */
+  time_t      nCreated;
+
+  int         bExtentValid;
+  rectObj     sExtent;
+  char        *pszProj4;    /* NULL if unknown, "" if the layer has no SRS */
+
+  struct ms_ogr_schema_cache_t *psNext;
+} msOGRSchemaCacheEntry;
+
+static msOGRSchemaCacheEntry *psOGRSchemaCache = NULL;
+
+static void msOGRSchemaCacheFreeEntry( msOGRSchemaCacheEntry *psEntry )
+{
+  msFree( psEntry->pszKey );
+  msFree( psEntry->pszProj4 );
+  msFree( psEntry );
+}
+
+/**********************************************************************
+ *                     msOGRSchemaCacheStat()
+ *
+ * Fetch the modification time and size of the files of a datasource,
+ * the first one being the datasource itself.  Returns MS_FALSE if the
+ * datasource is not a plain file.
+ **********************************************************************/
+static int msOGRSchemaCacheStat( const char *pszFname, time_t *panMTime,
+                                 vsi_l_offset *panSize )
+{
+  VSIStatBufL sStat;
+  char *pszSidecar;
+  int i;
+
+  if( VSIStatL( pszFname, &sStat ) != 0 || !VSI_ISREG( sStat.st_mode ) )
+    return MS_FALSE;
+  panMTime[0] = sStat.st_mtime;
+  panSize[0] = sStat.st_size;
+
+  for( i = 1; i < MSOGR_SCHEMA_CACHE_FILES; i++ ) {
+    if( i == 1 )
+      pszSidecar = msStringConcatenate( msStrdup( pszFname ), "-wal" );
+    else
+      pszSidecar = msStrdup( CPLResetExtension( pszFname, "prj" ) );
+    if( VSIStatL( pszSidecar, &sStat ) == 0 ) {
+      panMTime[i] = sStat.st_mtime;
+      panSize[i] = sStat.st_size;
+    } else {
+      panMTime[i] = 0;
+      panSize[i] = 0;
+    }
+    msFree( pszSidecar );
+  }
+
+  return MS_TRUE;
+}
+
+/**********************************************************************
+ *                     msOGRSchemaCacheGet()
+ *
+ * Return the cache entry for this layer, creating it if needed, or
+ * NULL if the layer cannot be cached.  Stale entries are reset.  Must
+ * be called with TLOCK_OGRSCHEMA held.
+ **********************************************************************/
+static msOGRSchemaCacheEntry *msOGRSchemaCacheGet( msOGRFileInfo *psInfo )
+{
+  msOGRSchemaCacheEntry *psEntry, *psPrev = NULL;
+  time_t anMTime[MSOGR_SCHEMA_CACHE_FILES], nNow = time( NULL );
+  vsi_l_offset anSize[MSOGR_SCHEMA_CACHE_FILES];
+  char *pszKey;
+  int nEntries = 0;
+
+  /* SQL results and anything that is not a file are not cached */
+  if( psInfo->nLayerIndex == -1 || psInfo->pszFname == NULL
+      || !msOGRSchemaCacheStat( psInfo->pszFname, anMTime, anSize ) )
+    return NULL;
+
+  pszKey = msStringConcatenate( msStrdup( psInfo->pszFname ), "," );
+  pszKey = msStringConcatenate( pszKey, psInfo->pszLayerDef );
+
+  for( psEntry = psOGRSchemaCache; psEntry != NULL;
+       psPrev = psEntry, psEntry = psEntry->psNext ) {
+    nEntries++;
+    if( strcmp( psEntry->pszKey, pszKey ) == 0 )
+      break;
+  }
+
+  if( psEntry != NULL ) {
+    msFree( pszKey );
+    /* move to the front so the least recently used entries go first */
+    if( psPrev != NULL ) {
+      psPrev->psNext = psEntry->psNext;
+      psEntry->psNext = psOGRSchemaCache;
+      psOGRSchemaCache = psEntry;
+    }
+  } else {
+    /* drop the last entry if the cache is full */
+    if( nEntries >= MSOGR_SCHEMA_CACHE_SIZE ) {
+      msOGRSchemaCacheEntry **ppsLast = &psOGRSchemaCache;
+      while( (*ppsLast)->psNext != NULL )
+        ppsLast = &((*ppsLast)->psNext);
+      msOGRSchemaCacheFreeEntry( *ppsLast );
+      *ppsLast = NULL;
+    }
+
+    psEntry = (msOGRSchemaCacheEntry *) msSmallCalloc( 1, sizeof(msOGRSchemaCacheEntry) );
+    psEntry->pszKey = pszKey;
+    memcpy( psEntry->anMTime, anMTime, sizeof(anMTime) );
+    memcpy( psEntry->anSize, anSize, sizeof(anSize) );
+    psEntry->nCreated = nNow;
+    psEntry->psNext = psOGRSchemaCache;
+    psOGRSchemaCache = psEntry;
+  }
+
+  if( memcmp( psEntry->anMTime, anMTime, sizeof(anMTime) ) != 0
+      || memcmp( psEntry->anSize, anSize, sizeof(anSize) ) != 0
+      || nNow - psEntry->nCreated > MSOGR_SCHEMA_CACHE_TTL ) {
+    memcpy( psEntry->anMTime, anMTime, sizeof(anMTime) );
+    memcpy( psEntry->anSize, anSize, sizeof(anSize) );
+    psEntry->nCreated = nNow;
+    psEntry->bExtentValid = MS_FALSE;
+    msFree( psEntry->pszProj4 );
+    psEntry->pszProj4 = NULL;
+  }
+
+  return psEntry;
+}
+
+/**********************************************************************
+ *                     msOGRSchemaCacheCleanup()
+ **********************************************************************/
+static void msOGRSchemaCacheCleanup( void )
+{
+  msAcquireLock( TLOCK_OGRSCHEMA );
+  while( psOGRSchemaCache != NULL ) {
+    msOGRSchemaCacheEntry *psNext = psOGRSchemaCache->psNext;
+    msOGRSchemaCacheFreeEntry( psOGRSchemaCache );
+    psOGRSchemaCache = psNext;
+  }
+  msReleaseLock( TLOCK_OGRSCHEMA );
+}
+
 /**********************************************************************
  *                     msOGRFileOpen()
  *
@@ -1212,6 +1465,7 @@ msOGRFileOpen(layerObj *layer, const char *connection )
   psInfo->poCurTile = NULL;
   psInfo->rect.minx = psInfo->rect.maxx = 0;
   psInfo->rect.miny = psInfo->rect.maxy = 0;
+  psInfo->bAttributeFilter = MS_FALSE;
   psInfo->last_record_index_read = -1;
 
   return psInfo;
@@ -1252,6 +1506,9 @@ static int msOGRFileClose(layerObj *layer, msOGRFileInfo *psInfo )
   ACQUIRE_OGR_LOCK;
   if (psInfo->hLastFeature)
     OGR_F_Destroy( psInfo->hLastFeature );
+#if GDAL_VERSION_NUM >= 3060000
+  msOGRFileStopArrowStream( psInfo );
+#endif
 
   /* If nLayerIndex == -1 then the layer is an SQL result ... free it */
   if( psInfo->nLayerIndex == -1 )
@@ -1342,6 +1599,378 @@ static void msOGRSplitFilter(layerObj *layer,
     }
 }
 
+/**********************************************************************
+ *                     msOGRFileSetIgnoredFields()
+ *
+ * Tell OGR which attribute fields (and whether the style string) we are
+ * not going to look at, so drivers can skip decoding them while reading
+ * features.  When bAllFields is set, or items are not known yet, nothing
+ * is ignored.  The items of a tiled layer refer to the fields of the
+ * tiles, so nothing is ignored on the tile index itself.  Must be called
+ * with the OGR lock held.
+ **********************************************************************/
+static void msOGRFileSetIgnoredFields(layerObj *layer, msOGRFileInfo *psInfo,
+                                      int bAllFields)
+{
+#if GDAL_VERSION_NUM >= 1800
+  OGRFeatureDefnH hDefn = OGR_L_GetLayerDefn( psInfo->hLayer );
+  int *itemindexes = (int*)layer->iteminfo;
+  char **papszIgnored = NULL;
+  int bNeedStyle = MS_FALSE;
+  int i, iField;
+
+  /* SQL result sets already only carry what was asked for */
+  if( bAllFields || hDefn == NULL || psInfo->nLayerIndex == -1
+      || (layer->tileindex != NULL && psInfo == layer->layerinfo)
+      || (layer->numitems > 0 && itemindexes == NULL) ) {
+    OGR_L_SetIgnoredFields( psInfo->hLayer, NULL );
+    return;
+  }
+
+  if( layer->styleitem && EQUAL(layer->styleitem, "AUTO") )
+    bNeedStyle = MS_TRUE;
+  for( i = 0; i < layer->numitems; i++ ) {
+    if( itemindexes[i] < 0 )
+      bNeedStyle = MS_TRUE;
+  }
+
+  for( iField = 0; iField < OGR_FD_GetFieldCount( hDefn ); iField++ ) {
+    for( i = 0; i < layer->numitems; i++ ) {
+      if( itemindexes[i] == iField )
+        break;
+    }
+    if( i == layer->numitems )
+      papszIgnored = CSLAddString( papszIgnored,
+                                   OGR_Fld_GetNameRef( OGR_FD_GetFieldDefn( hDefn, iField ) ) );
+  }
+  if( !bNeedStyle )
+    papszIgnored = CSLAddString( papszIgnored, "OGR_STYLE" );
+
+  if( OGR_L_SetIgnoredFields( psInfo->hLayer, (const char **) papszIgnored ) != OGRERR_NONE
+      && layer->debug >= MS_DEBUGLEVEL_VVV )
+    msDebug("msOGRFileSetIgnoredFields: driver does not support ignoring fields.\n");
+
+  CSLDestroy( papszIgnored );
+#endif /* GDAL_VERSION_NUM >= 1800 */
+}
+
+#if GDAL_VERSION_NUM >= 3060000
+/**********************************************************************
+ *                     msOGRFileStopArrowStream()
+ *
+ * Release the Arrow stream of a file, if one is open.  Must be called
+ * with the OGR lock held.
+ **********************************************************************/
+static void msOGRFileStopArrowStream( msOGRFileInfo *psInfo )
+{
+  if( !psInfo->bArrowStream )
+    return;
+
+  if( psInfo->sArrowBatch.release )
+    psInfo->sArrowBatch.release( &psInfo->sArrowBatch );
+  if( psInfo->sArrowSchema.release )
+    psInfo->sArrowSchema.release( &psInfo->sArrowSchema );
+  psInfo->sArrowStream.release( &psInfo->sArrowStream );
+  msFree( psInfo->panArrowItemChild );
+  msFree( psInfo->panArrowItemPrecision );
+  psInfo->panArrowItemChild = NULL;
+  psInfo->panArrowItemPrecision = NULL;
+  psInfo->bArrowStream = MS_FALSE;
+}
+
+/**********************************************************************
+ *                     msOGRArrowFindChild()
+ *
+ * Returns the index of the named column of a record batch, or -1.
+ **********************************************************************/
+static int msOGRArrowFindChild( struct ArrowSchema *psSchema,
+                                const char *pszName )
+{
+  for( int i = 0; i < psSchema->n_children; i++ ) {
+    if( psSchema->children[i]->name
+        && EQUAL( psSchema->children[i]->name, pszName ) )
+      return i;
+  }
+  return -1;
+}
+
+/**********************************************************************
+ *                     msOGRFileStartArrowStream()
+ *
+ * Read the features selected by msOGRFileWhichShapes() as Arrow record
+ * batches when the driver implements that natively (GeoPackage,
+ * FlatGeobuf, Parquet...), which saves building an OGRFeature for each
+ * feature.  This is only done when every item is a plain attribute
+ * field of a type msOGRArrowGetValue() formats like
+ * OGR_F_GetFieldAsString(), and the style string is not needed.
+ * Otherwise features are read one by one.  Must be called with the OGR
+ * lock held.
+ **********************************************************************/
+static void msOGRFileStartArrowStream( layerObj *layer, msOGRFileInfo *psInfo )
+{
+  OGRFeatureDefnH hDefn = OGR_L_GetLayerDefn( psInfo->hLayer );
+  struct ArrowSchema *psSchema = &psInfo->sArrowSchema;
+  const char *pszName;
+  int bUsable, i;
+
+  if( hDefn == NULL
+      || (layer->styleitem && EQUAL(layer->styleitem, "AUTO"))
+      || !OGR_L_TestCapability( psInfo->hLayer, OLCFastGetArrowStream ) )
+    return;
+
+  if( !OGR_L_GetArrowStream( psInfo->hLayer, &psInfo->sArrowStream, NULL ) )
+    return;
+
+  psInfo->bArrowStream = MS_TRUE;
+  psInfo->sArrowBatch.release = NULL;
+  psInfo->nArrowRow = 0;
+  psInfo->panArrowItemChild = (int *) msSmallMalloc( sizeof(int) * (layer->numitems + 1) );
+  psInfo->panArrowItemPrecision = (int *) msSmallMalloc( sizeof(int) * (layer->numitems + 1) );
+
+  if( psInfo->sArrowStream.get_schema( &psInfo->sArrowStream, psSchema ) != 0 ) {
+    psSchema->release = NULL;
+    msOGRFileStopArrowStream( psInfo );
+    return;
+  }
+
+  /* Default column names of the generic OGR implementation */
+  pszName = OGR_L_GetFIDColumn( psInfo->hLayer );
+  psInfo->nArrowFIDChild = msOGRArrowFindChild( psSchema, (pszName && pszName[0]) ? pszName : "OGC_FID" );
+  pszName = OGR_L_GetGeometryColumn( psInfo->hLayer );
+  psInfo->nArrowGeomChild = msOGRArrowFindChild( psSchema, (pszName && pszName[0]) ? pszName : "wkb_geometry" );
+
+  bUsable = psInfo->nArrowFIDChild >= 0 && psInfo->nArrowGeomChild >= 0
+            && EQUAL( psSchema->children[psInfo->nArrowFIDChild]->format, "l" )
+            && (EQUAL( psSchema->children[psInfo->nArrowGeomChild]->format, "z" )
+                || EQUAL( psSchema->children[psInfo->nArrowGeomChild]->format, "Z" ));
+
+  for( i = 0; bUsable && i < layer->numitems; i++ ) {
+    int iField = OGR_FD_GetFieldIndex( hDefn, layer->items[i] );
+    int iChild = msOGRArrowFindChild( psSchema, layer->items[i] );
+    const char *pszFormat;
+
+    if( iField < 0 || iChild < 0 || psSchema->children[iChild]->dictionary ) {
+      bUsable = MS_FALSE;
+      break;
+    }
+    pszFormat = psSchema->children[iChild]->format;
+    if( strlen( pszFormat ) != 1 || strchr( "bcsilguU", pszFormat[0] ) == NULL ) {
+      bUsable = MS_FALSE;
+      break;
+    }
+
+    OGRFieldDefnH hFieldDefn = OGR_FD_GetFieldDefn( hDefn, iField );
+    psInfo->panArrowItemChild[i] = iChild;
+    psInfo->panArrowItemPrecision[i] = OGR_Fld_GetWidth( hFieldDefn ) != 0 ?
+                                       OGR_Fld_GetPrecision( hFieldDefn ) : -1;
+  }
+
+  if( !bUsable ) {
+    msOGRFileStopArrowStream( psInfo );
+    return;
+  }
+
+  if( layer->debug >= MS_DEBUGLEVEL_VV )
+    msDebug("msOGRFileStartArrowStream: reading %s as Arrow record batches.\n",
+            psInfo->pszFname );
+}
+
+/**********************************************************************
+ *                     msOGRArrowGetValue()
+ *
+ * Returns row iRow of an attribute column as a newly allocated string,
+ * formatted as OGR_F_GetFieldAsString() does.  nPrecision is that of
+ * the field if it has a width, -1 otherwise.
+ **********************************************************************/
+static char *msOGRArrowGetValue( struct ArrowSchema *psSchema,
+                                 struct ArrowArray *psArray,
+                                 int64_t iRow, int nPrecision )
+{
+  const GByte *pabyValidity = (const GByte *) psArray->buffers[0];
+  char szValue[128];
+
+  iRow += psArray->offset;
+  if( psArray->null_count != 0 && pabyValidity != NULL
+      && !(pabyValidity[iRow / 8] & (1 << (iRow % 8))) )
+    return msStrdup("");
+
+  switch( psSchema->format[0] ) {
+    case 'b':
+      snprintf( szValue, sizeof(szValue), "%d",
+                (((const GByte *) psArray->buffers[1])[iRow / 8] >> (iRow % 8)) & 1 );
+      break;
+    case 'c':
+      snprintf( szValue, sizeof(szValue), "%d", ((const int8_t *) psArray->buffers[1])[iRow] );
+      break;
+    case 's':
+      snprintf( szValue, sizeof(szValue), "%d", ((const int16_t *) psArray->buffers[1])[iRow] );
+      break;
+    case 'i':
+      snprintf( szValue, sizeof(szValue), "%d", ((const int32_t *) psArray->buffers[1])[iRow] );
+      break;
+    case 'l':
+      snprintf( szValue, sizeof(szValue), "%lld",
+                (long long) ((const int64_t *) psArray->buffers[1])[iRow] );
+      break;
+    case 'g':
+      if( nPrecision >= 0 )
+        snprintf( szValue, sizeof(szValue), "%.*f", nPrecision,
+                  ((const double *) psArray->buffers[1])[iRow] );
+      else
+        snprintf( szValue, sizeof(szValue), "%.15g",
+                  ((const double *) psArray->buffers[1])[iRow] );
+      break;
+    case 'u':
+    case 'U': {
+      int64_t nStart, nEnd;
+      char *pszValue;
+
+      if( psSchema->format[0] == 'u' ) {
+        nStart = ((const int32_t *) psArray->buffers[1])[iRow];
+        nEnd = ((const int32_t *) psArray->buffers[1])[iRow + 1];
+      } else {
+        nStart = ((const int64_t *) psArray->buffers[1])[iRow];
+        nEnd = ((const int64_t *) psArray->buffers[1])[iRow + 1];
+      }
+      pszValue = (char *) msSmallMalloc( nEnd - nStart + 1 );
+      memcpy( pszValue, (const char *) psArray->buffers[2] + nStart, nEnd - nStart );
+      pszValue[nEnd - nStart] = '\0';
+      return pszValue;
+    }
+    default:
+      szValue[0] = '\0';
+      break;
+  }
+
+  return msStrdup( szValue );
+}
+
+/**********************************************************************
+ *                     msOGRArrowGetGeometry()
+ *
+ * Returns the geometry of row iRow of a WKB column, or NULL.
+ **********************************************************************/
+static OGRGeometryH msOGRArrowGetGeometry( struct ArrowSchema *psSchema,
+                                           struct ArrowArray *psArray,
+                                           int64_t iRow )
+{
+  const GByte *pabyValidity = (const GByte *) psArray->buffers[0];
+  OGRGeometryH hGeom = NULL;
+  int64_t nStart, nEnd;
+
+  iRow += psArray->offset;
+  if( psArray->null_count != 0 && pabyValidity != NULL
+      && !(pabyValidity[iRow / 8] & (1 << (iRow % 8))) )
+    return NULL;
+
+  if( psSchema->format[0] == 'z' ) {
+    nStart = ((const int32_t *) psArray->buffers[1])[iRow];
+    nEnd = ((const int32_t *) psArray->buffers[1])[iRow + 1];
+  } else {
+    nStart = ((const int64_t *) psArray->buffers[1])[iRow];
+    nEnd = ((const int64_t *) psArray->buffers[1])[iRow + 1];
+  }
+  if( nEnd <= nStart
+      || OGR_G_CreateFromWkb( (unsigned char *) psArray->buffers[2] + nStart, NULL,
+                              &hGeom, (int) (nEnd - nStart) ) != OGRERR_NONE )
+    return NULL;
+
+  return hGeom;
+}
+
+/**********************************************************************
+ *                     msOGRFileNextArrowShape()
+ *
+ * msOGRFileNextShape() for files read through an Arrow stream.  Must be
+ * called with the OGR lock held.
+ **********************************************************************/
+static int msOGRFileNextArrowShape( layerObj *layer, shapeObj *shape,
+                                    msOGRFileInfo *psInfo )
+{
+  struct ArrowSchema *psSchema = &psInfo->sArrowSchema;
+  struct ArrowArray *psBatch = &psInfo->sArrowBatch;
+  struct ArrowArray *psFID = NULL;
+  OGRGeometryH hGeom;
+  int64_t iRow;
+  int i, nStatus;
+
+  while( shape->type == MS_SHAPE_NULL ) {
+    if( psBatch->release == NULL || psInfo->nArrowRow >= psBatch->length ) {
+      if( psBatch->release ) {
+        psBatch->release( psBatch );
+        psBatch->release = NULL;
+      }
+      if( psInfo->sArrowStream.get_next( &psInfo->sArrowStream, psBatch ) != 0 ) {
+        const char *pszError = psInfo->sArrowStream.get_last_error( &psInfo->sArrowStream );
+        psBatch->release = NULL;
+        msSetError(MS_OGRERR, "%s", "msOGRFileNextShape()",
+                   pszError ? pszError : "Failed to read Arrow record batch." );
+        return MS_FAILURE;
+      }
+      if( psBatch->release == NULL ) {
+        psInfo->last_record_index_read = -1;
+        msOGRFileStopArrowStream( psInfo );
+        if (layer->debug >= MS_DEBUGLEVEL_VV)
+          msDebug("msOGRFileNextShape: Returning MS_DONE (no more shapes)\n" );
+        return MS_DONE;  // No more features to read
+      }
+      psInfo->nArrowRow = 0;
+      continue;
+    }
+
+    iRow = psBatch->offset + psInfo->nArrowRow++;
+    psInfo->last_record_index_read++;
+
+    if(layer->numitems > 0) {
+      shape->values = (char **) msSmallMalloc( sizeof(char *) * layer->numitems );
+      shape->numvalues = layer->numitems;
+      for( i = 0; i < layer->numitems; i++ ) {
+        int iChild = psInfo->panArrowItemChild[i];
+        shape->values[i] = msOGRArrowGetValue( psSchema->children[iChild],
+                                               psBatch->children[iChild], iRow,
+                                               psInfo->panArrowItemPrecision[i] );
+      }
+    }
+
+    if( (layer->filter.string && EQUALN(layer->filter.string,"WHERE ",6))
+        || msEvalExpression(layer, shape, &(layer->filter), layer->filteritemindex) == MS_TRUE ) {
+      hGeom = msOGRArrowGetGeometry( psSchema->children[psInfo->nArrowGeomChild],
+                                     psBatch->children[psInfo->nArrowGeomChild], iRow );
+      nStatus = ogrConvertGeometry( hGeom, shape, layer->type );
+      if( hGeom )
+        OGR_G_DestroyGeometry( hGeom );
+      if( nStatus != MS_SUCCESS ) {
+        msFreeShape(shape);
+        return MS_FAILURE; // Error message already produced.
+      }
+      if (shape->type != MS_SHAPE_NULL)
+        break; // Shape is ready to be returned!
+    }
+
+    // Feature rejected... free shape to clear attributes values.
+    msFreeShape(shape);
+    shape->type = MS_SHAPE_NULL;
+  }
+
+  psFID = psBatch->children[psInfo->nArrowFIDChild];
+  shape->index = (long) ((const int64_t *) psFID->buffers[1])[psFID->offset + iRow];
+  shape->resultindex = psInfo->last_record_index_read;
+  shape->tileindex = psInfo->nTileId;
+
+  if (layer->debug >= MS_DEBUGLEVEL_VVV)
+    msDebug("msOGRFileNextShape: Returning shape=%ld, tile=%d\n",
+            shape->index, shape->tileindex );
+
+  // No feature to take the style from, the style string is not used.
+  if (psInfo->hLastFeature) {
+    OGR_F_Destroy( psInfo->hLastFeature );
+    psInfo->hLastFeature = NULL;
+  }
+
+  return MS_SUCCESS;
+}
+#endif /* GDAL_VERSION_NUM >= 3060000 */
+
 /**********************************************************************
  *                     msOGRFileWhichShapes()
  *
@@ -1361,6 +1990,13 @@ static int msOGRFileWhichShapes(layerObj *layer, rectObj rect,
   
   char* pszOGRFilter = NULL;
   char* pszMSFilter = NULL;
+
+#if GDAL_VERSION_NUM >= 3060000
+  ACQUIRE_OGR_LOCK;
+  msOGRFileStopArrowStream( psInfo );
+  RELEASE_OGR_LOCK;
+#endif
+
   /* In case we have an odd filter combining both a OGR filter and MapServer */
   /* filter, then separate things */
   msOGRSplitFilter(layer, &pszOGRFilter, &pszMSFilter);
@@ -1509,6 +2145,14 @@ static int msOGRFileWhichShapes(layerObj *layer, rectObj rect,
    * filter is clear.
    * ------------------------------------------------------------------ */
 
+  /* ------------------------------------------------------------------
+   * Only have OGR decode the fields we use.  An attribute filter
+   * evaluated by OGR needs the fields it references, so keep them all
+   * in that case, and when the MapServer filter was just rewritten.
+   * ------------------------------------------------------------------ */
+  msOGRFileSetIgnoredFields( layer, psInfo,
+                             pszOGRFilter != NULL || pszMSFilter != NULL );
+
   if( pszMSFilter != NULL ) {
     msLoadExpressionString(&layer->filter, pszMSFilter);
     if(layer->filter.type == MS_EXPRESSION) msTokenizeExpression(&(layer->filter), layer->items, &(layer->numitems));
@@ -1526,11 +2170,15 @@ static int msOGRFileWhichShapes(layerObj *layer, rectObj rect,
                  CPLGetLastErrorMsg() );
       RELEASE_OGR_LOCK;
       msFree(pszOGRFilter);
+      psInfo->bAttributeFilter = MS_TRUE; /* state unknown */
       return MS_FAILURE;
     }
     msFree(pszOGRFilter);
-  } else
+    psInfo->bAttributeFilter = MS_TRUE;
+  } else {
     OGR_L_SetAttributeFilter( psInfo->hLayer, NULL );
+    psInfo->bAttributeFilter = MS_FALSE;
+  }
 
   /* ------------------------------------------------------------------
    * Reset current feature pointer
@@ -1538,6 +2186,18 @@ static int msOGRFileWhichShapes(layerObj *layer, rectObj rect,
   OGR_L_ResetReading( psInfo->hLayer );
   psInfo->last_record_index_read = -1;
 
+#if GDAL_VERSION_NUM >= 3060000
+  /* ------------------------------------------------------------------
+   * Features that are only drawn can come in Arrow record batches.
+   * Queries fetch shapes again by result index, which is only valid
+   * for features read one by one.  The tile index itself is read by
+   * msOGRFileReadTile().
+   * ------------------------------------------------------------------ */
+  if( ((msOGRFileInfo *) layer->layerinfo)->bArrowAllowed
+      && !(layer->tileindex != NULL && psInfo == layer->layerinfo) )
+    msOGRFileStartArrowStream( layer, psInfo );
+#endif
+
   RELEASE_OGR_LOCK;
 
   return MS_SUCCESS;
@@ -1721,6 +2381,13 @@ msOGRFileNextShape(layerObj *layer, shapeObj *shape,
   shape->type = MS_SHAPE_NULL;
 
   ACQUIRE_OGR_LOCK;
+#if GDAL_VERSION_NUM >= 3060000
+  if( psInfo->bArrowStream ) {
+    int nStatus = msOGRFileNextArrowShape( layer, shape, psInfo );
+    RELEASE_OGR_LOCK;
+    return nStatus;
+  }
+#endif
   while (shape->type == MS_SHAPE_NULL) {
     if( hFeature )
       OGR_F_Destroy( hFeature );
@@ -1826,10 +2493,16 @@ msOGRFileGetShape(layerObj *layer, shapeObj *shape, long record,
   shape->type = MS_SHAPE_NULL;
 
   /* -------------------------------------------------------------------- */
-  /*      Support reading feature by fid.                                 */
+  /*      Support reading feature by fid.  The ignored fields may have    */
+  /*      been set up by another layer sharing this OGR layer, so read    */
+  /*      them all.                                                       */
   /* -------------------------------------------------------------------- */
   if( record_is_fid ) {
     ACQUIRE_OGR_LOCK;
+#if GDAL_VERSION_NUM >= 3060000
+    msOGRFileStopArrowStream( psInfo );
+#endif
+    msOGRFileSetIgnoredFields( layer, psInfo, MS_TRUE );
     if( (hFeature = OGR_L_GetFeature( psInfo->hLayer, record )) == NULL ) {
       RELEASE_OGR_LOCK;
       return MS_FAILURE;
@@ -1842,6 +2515,10 @@ msOGRFileGetShape(layerObj *layer, shapeObj *shape, long record,
   /* -------------------------------------------------------------------- */
   else {
     ACQUIRE_OGR_LOCK;
+#if GDAL_VERSION_NUM >= 3060000
+    msOGRFileStopArrowStream( psInfo );
+#endif
+    msOGRFileSetIgnoredFields( layer, psInfo, MS_TRUE );
     if( record <= psInfo->last_record_index_read
         || psInfo->last_record_index_read == -1 ) {
       OGR_L_ResetReading( psInfo->hLayer );
@@ -2001,6 +2678,14 @@ NextFile:
     return MS_FAILURE;
 
   psTileInfo->nTileId = nFeatureId;
+  psInfo->poCurTile = psTileInfo;
+
+  /* -------------------------------------------------------------------- */
+  /*      Update the iteminfo in case this layer has a different field    */
+  /*      list.  This must happen before the spatial query, which tells   */
+  /*      OGR which fields of the tile can be ignored.                    */
+  /* -------------------------------------------------------------------- */
+  msOGRLayerInitItemInfo( layer );
 
   /* -------------------------------------------------------------------- */
   /*      Initialize the spatial query on this file.                      */
@@ -2011,14 +2696,6 @@ NextFile:
       return status;
   }
 
-  psInfo->poCurTile = psTileInfo;
-
-  /* -------------------------------------------------------------------- */
-  /*      Update the iteminfo in case this layer has a different field    */
-  /*      list.                                                           */
-  /* -------------------------------------------------------------------- */
-  msOGRLayerInitItemInfo( layer );
-
   return MS_SUCCESS;
 }
 
@@ -2119,6 +2796,35 @@ int msOGRLayerOpen(layerObj *layer, const char *pszOverrideConnection)
 #ifdef USE_PROJ
   if (layer->projection.numargs > 0 &&
       EQUAL(layer->projection.args[0], "auto")) {
+    msOGRSchemaCacheEntry *psEntry;
+    char *pszProj4 = NULL;
+
+    /* Reuse the definition found by a previous request, if any */
+    msAcquireLock( TLOCK_OGRSCHEMA );
+    psEntry = msOGRSchemaCacheGet( psInfo );
+    if( psEntry != NULL && psEntry->pszProj4 != NULL )
+      pszProj4 = msStrdup( psEntry->pszProj4 );
+    msReleaseLock( TLOCK_OGRSCHEMA );
+
+    if( pszProj4 != NULL ) {
+      int nStatus = MS_SUCCESS;
+
+      msFreeProjection( &(layer->projection) );
+      if( pszProj4[0] != '\0'
+          && msLoadProjectionString( &(layer->projection), pszProj4 ) != 0 )
+        nStatus = MS_FAILURE;
+      if( layer->debug )
+        msDebug( "AUTO = %s (cached)\n", pszProj4 );
+      msFree( pszProj4 );
+
+      if( nStatus != MS_SUCCESS ) {
+        msOGRFileClose( layer, psInfo );
+        layer->layerinfo = NULL;
+        return(MS_FAILURE);
+      }
+      return MS_SUCCESS;
+    }
+
     ACQUIRE_OGR_LOCK;
     OGRSpatialReferenceH hSRS = OGR_L_GetSpatialRef( psInfo->hLayer );
 
@@ -2140,6 +2846,18 @@ int msOGRLayerOpen(layerObj *layer, const char *pszOverrideConnection)
       return(MS_FAILURE);
     }
     RELEASE_OGR_LOCK;
+
+    pszProj4 = layer->projection.numargs > 0 ?
+               msGetProjectionString( &(layer->projection) ) : msStrdup( "" );
+    msAcquireLock( TLOCK_OGRSCHEMA );
+    psEntry = msOGRSchemaCacheGet( psInfo );
+    if( psEntry != NULL ) {
+      msFree( psEntry->pszProj4 );
+      psEntry->pszProj4 = pszProj4;
+      pszProj4 = NULL;
+    }
+    msReleaseLock( TLOCK_OGRSCHEMA );
+    msFree( pszProj4 );
   }
 #endif
 
@@ -2237,6 +2955,10 @@ int msOGRLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
     return(MS_FAILURE);
   }
 
+#if GDAL_VERSION_NUM >= 3060000
+  psInfo->bArrowAllowed = !isQuery;
+#endif
+
   status = msOGRFileWhichShapes( layer, rect, psInfo );
 
   if( status != MS_SUCCESS || layer->tileindex == NULL )
@@ -2582,6 +3304,23 @@ int msOGRLayerGetExtent(layerObj *layer, rectObj *extent)
     return(MS_FAILURE);
   }
 
+  /* ------------------------------------------------------------------
+   * Use the extent from a previous request if the file did not change.
+   * OGR_L_GetExtent() honours the attribute filter, so the extent is
+   * only cached for the layer without one.
+   * ------------------------------------------------------------------ */
+  msOGRSchemaCacheEntry *psEntry = NULL;
+
+  msAcquireLock( TLOCK_OGRSCHEMA );
+  if( !psInfo->bAttributeFilter )
+    psEntry = msOGRSchemaCacheGet( psInfo );
+  if( psEntry != NULL && psEntry->bExtentValid ) {
+    *extent = psEntry->sExtent;
+    msReleaseLock( TLOCK_OGRSCHEMA );
+    return MS_SUCCESS;
+  }
+  msReleaseLock( TLOCK_OGRSCHEMA );
+
   /* ------------------------------------------------------------------
    * Call OGR's GetExtent()... note that for some formats this will
    * result in a scan of the whole layer and can be an expensive call.
@@ -2603,6 +3342,15 @@ int msOGRLayerGetExtent(layerObj *layer, rectObj *extent)
   extent->maxx = oExtent.MaxX;
   extent->maxy = oExtent.MaxY;
 
+  msAcquireLock( TLOCK_OGRSCHEMA );
+  if( !psInfo->bAttributeFilter )
+    psEntry = msOGRSchemaCacheGet( psInfo );
+  if( psEntry != NULL ) {
+    psEntry->sExtent = *extent;
+    psEntry->bExtentValid = MS_TRUE;
+  }
+  msReleaseLock( TLOCK_OGRSCHEMA );
+
   return MS_SUCCESS;
 #else
   /* ------------------------------------------------------------------
@@ -3170,6 +3918,8 @@ void msOGRCleanup( void )
 
 {
 #if defined(USE_OGR)
+  msOGRSchemaCacheCleanup();
+
   ACQUIRE_OGR_LOCK;
   if( bOGRDriversRegistered == MS_TRUE ) {
     CPLPopErrorHandler();
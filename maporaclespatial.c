@@ -173,6 +173,7 @@ static int ERROR( char *routine, msOracleSpatialHandler *hand, msOracleSpatialDa
 static void msSplitLogin( char *connection, mapObj *map, char **username, char **password, char **dblink );
 static int msSplitData( char *data, char **geometry_column_name, char **table_name, char **unique, char **srid, int *function, int * version);
 static void msOCICloseConnection( void *layerinfo );
+static int msOCIValidateConnection( void *hand );
 static msOracleSpatialHandler *msOCISetHandlers( char *username, char *password, char *dblink );
 static int msOCISetDataHandlers( msOracleSpatialHandler *hand, msOracleSpatialDataHandler *dthand );
 static void msOCICloseDataHandlers ( msOracleSpatialDataHandler *dthand );
@@ -1636,6 +1637,20 @@ static void msOCICloseConnection( void *hand )
   msOCICloseHandlers( (msOracleSpatialHandler *)hand );
 }
 
+/* checks a pooled connection is still alive before it is reused */
+static int msOCIValidateConnection( void *hand )
+{
+  msOracleSpatialHandler *h = (msOracleSpatialHandler *)hand;
+
+  h->last_oci_status = MS_SUCCESS;
+  h->last_oci_error[0] = (text)'\0';
+#if defined(OCI_MAJOR_VERSION) && (OCI_MAJOR_VERSION > 10 || (OCI_MAJOR_VERSION == 10 && OCI_MINOR_VERSION >= 2))
+  return TRY( h, OCIPing( h->svchp, h->errhp, (ub4)OCI_DEFAULT ) );
+#else
+  return MS_TRUE;
+#endif
+}
+
 /* opens a layer by connecting to db with username/password@database stored in layer->connection */
 int msOracleSpatialLayerOpen( layerObj *layer )
 {
@@ -1703,7 +1718,7 @@ int msOracleSpatialLayerOpen( layerObj *layer )
     if ( layer->debug )
       msDebug("msOracleSpatialLayerOpen. Shared connection not available. Creating one.\n");
 
-    msConnPoolRegister( layer, hand, msOCICloseConnection );
+    msConnPoolRegisterValidated( layer, hand, msOCICloseConnection, msOCIValidateConnection );
   } else {
     hand->ref_count++;
     hand->last_oci_status = MS_SUCCESS;
@@ -328,6 +328,12 @@ outputFormatObj *msCreateDefaultOutputFormat( mapObj *map,
     format->renderer = MS_RENDER_WITH_IMAGEMAP;
   }
 
+  else if( strcasecmp(driver,"GEOJSON") == 0 ) {
+    if(!name) name="geojson";
+    format = msAllocOutputFormat( map, name, driver );
+    msInitDefaultFeatureOutputFormat( format );
+  }
+
   else if( strcasecmp(driver,"template") == 0 ) {
     if(!name) name="template";
     format = msAllocOutputFormat( map, name, driver );
@@ -30,6 +30,7 @@
 #include "mapserver.h"
 #include "maptime.h"
 #include "maptemplate.h"
+#include "mapthread.h"
 
 #if defined(USE_LIBXML2)
 #include "maplibxml2.h"
@@ -40,6 +41,8 @@
 #include "mapowscommon.h"
 
 #include <ctype.h> /* isalnum() */
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <stdarg.h>
 #include <assert.h>
 
@@ -202,6 +205,343 @@ static int msOWSPreParseRequest(cgiRequestObj *request,
   return MS_SUCCESS;
 }
 
+/*
+** GetCapabilities cache.
+**
+** With "ows_capabilities_cache" "true" in the WEB metadata, GetCapabilities
+** documents and their content type are kept in memory for the lifetime of
+** the process, the least recently used ones are dropped beyond
+** MS_OWS_CAPABILITIES_CACHE_MAX. They are keyed on the mapfile (full path,
+** size and modification time), the server environment used to build the
+** online resource and all request parameters (sorted, with names upper
+** cased), which covers service, version, language, sections,
+** updatesequence, etc. "ows_capabilities_cache_dir" also stores them as
+** files in that directory, and reads them back from there. Issuing the
+** GetCapabilities requests once at deployment time thus precomputes them
+** for all processes.
+**
+** Changes to INCLUDEd files or to the map made at runtime (mapscript,
+** map.* parameters of mapserv) are not noticed: restart the processes and
+** empty the directory after changing those.
+*/
+#define MS_OWS_CAPABILITIES_CACHE_MAX 64
+#define MS_OWS_CAPABILITIES_FILE_SIGNATURE "MSCAPS2"
+
+typedef struct owsCapabilitiesCacheEntry_t {
+  char *key;
+  char *content_type;
+  unsigned char *data;
+  int size;
+  struct owsCapabilitiesCacheEntry_t *next;
+} owsCapabilitiesCacheEntry;
+
+static owsCapabilitiesCacheEntry *capabilitiesCache = NULL; /* most recently used first */
+
+static int msOWSCapabilitiesCacheEnabled(mapObj *map, cgiRequestObj *request,
+    owsRequestObj *ows_request)
+{
+  const char *value;
+  msIOContext *context;
+
+  if(ows_request->service == NULL || ows_request->request == NULL)
+    return MS_FALSE;
+  if(!EQUAL(ows_request->request, "GetCapabilities") &&
+      !EQUAL(ows_request->request, "capabilities")) /* WMS 1.0.0 */
+    return MS_FALSE;
+
+  /* POSTed XML requests are not part of the key */
+  if(request->type != MS_GET_REQUEST)
+    return MS_FALSE;
+
+  value = msOWSLookupMetadata(&(map->web.metadata), "O", "capabilities_cache");
+  if((value == NULL || strcasecmp(value, "true") != 0) &&
+      msOWSLookupMetadata(&(map->web.metadata), "O", "capabilities_cache_dir") == NULL)
+    return MS_FALSE;
+
+  /* apache module headers don't go through the stdout context */
+  context = msIO_getHandler(stdout);
+  if(context == NULL || strcmp(context->label, "apache") == 0)
+    return MS_FALSE;
+
+  return MS_TRUE;
+}
+
+static int msOWSCompareCacheKeyParams(const void *a, const void *b)
+{
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+** Parameter names are case insensitive and their order is irrelevant, so
+** the key holds NAME=value pairs with upper cased names, in sorted order.
+** SERVICE and REQUEST values are case insensitive as well.
+*/
+static char *msOWSGetCapabilitiesCacheKey(mapObj *map, cgiRequestObj *request)
+{
+  static const char *env_vars[] = { "SERVER_NAME", "SERVER_PORT", "SCRIPT_NAME", "HTTPS", NULL };
+  char *key = NULL;
+  char **params;
+  const char *value;
+  int i;
+
+  if(map->mapfile) {
+    char stamp[64];
+    struct stat mapstat;
+
+    key = msStringConcatenate(key, map->mapfile);
+    if(stat(map->mapfile, &mapstat) == 0) {
+      snprintf(stamp, sizeof(stamp), "\n%ld_%ld", (long) mapstat.st_size, (long) mapstat.st_mtime);
+      key = msStringConcatenate(key, stamp);
+    }
+  } else { /* loaded from a string */
+    key = msStringConcatenate(key, map->mappath ? map->mappath : "");
+  }
+  key = msStringConcatenate(key, "\n");
+  key = msStringConcatenate(key, map->name ? map->name : "");
+  for(i=0; env_vars[i] != NULL; i++) {
+    value = getenv(env_vars[i]);
+    key = msStringConcatenate(key, "\n");
+    key = msStringConcatenate(key, value ? value : "");
+  }
+
+  params = (char **) msSmallMalloc(sizeof(char *) * (request->NumParams + 1));
+  for(i=0; i<request->NumParams; i++) {
+    char *param = msStrdup(request->ParamNames[i]);
+    msStringToUpper(param);
+    param = msStringConcatenate(param, "=");
+    param = msStringConcatenate(param, request->ParamValues[i]);
+    if(strncmp(param, "SERVICE=", 8) == 0 || strncmp(param, "REQUEST=", 8) == 0)
+      msStringToUpper(param);
+    params[i] = param;
+  }
+  qsort(params, request->NumParams, sizeof(char *), msOWSCompareCacheKeyParams);
+
+  for(i=0; i<request->NumParams; i++) {
+    key = msStringConcatenate(key, "\n");
+    key = msStringConcatenate(key, params[i]);
+    free(params[i]);
+  }
+  free(params);
+
+  return key;
+}
+
+/* cache files are named after a hash of the key, dir is relative to the mapfile */
+static char *msOWSGetCapabilitiesCacheFilename(mapObj *map, const char *dir, const char *key)
+{
+  char *hash, *filename;
+  char path[MS_MAXPATHLEN];
+
+  hash = msHashString(key);
+  hash = msStringConcatenate(hash, ".caps");
+  filename = msStrdup(msBuildPath3(path, map->mappath, dir, hash));
+  free(hash);
+
+  return filename;
+}
+
+/*
+** Read a cached document back from disk. The file holds the full key, so
+** hash collisions and partially written files are treated as misses.
+*/
+static unsigned char *msOWSReadCapabilitiesFile(const char *filename, const char *key,
+    char **content_type, int *size)
+{
+  FILE *fp;
+  char signature[16];
+  int keylen, typelen, datalen;
+  char *filekey;
+  unsigned char *data = NULL;
+
+  fp = fopen(filename, "rb");
+  if(fp == NULL)
+    return NULL;
+
+  if(fscanf(fp, "%15s %d %d %d", signature, &keylen, &typelen, &datalen) != 4 ||
+      fgetc(fp) != '\n' || strcmp(signature, MS_OWS_CAPABILITIES_FILE_SIGNATURE) != 0 ||
+      keylen != (int) strlen(key) || typelen <= 0 || typelen > 1024 || datalen <= 0) {
+    fclose(fp);
+    return NULL;
+  }
+
+  filekey = (char *) msSmallMalloc(keylen);
+  *content_type = (char *) msSmallMalloc(typelen + 1);
+  if(fread(filekey, 1, keylen, fp) == (size_t) keylen && memcmp(filekey, key, keylen) == 0 &&
+      fread(*content_type, 1, typelen, fp) == (size_t) typelen) {
+    (*content_type)[typelen] = '\0';
+    data = (unsigned char *) msSmallMalloc(datalen);
+    if(fread(data, 1, datalen, fp) != (size_t) datalen) {
+      free(data);
+      data = NULL;
+    }
+  }
+  free(filekey);
+  fclose(fp);
+
+  if(data == NULL) {
+    free(*content_type);
+    *content_type = NULL;
+  }
+  *size = datalen;
+  return data;
+}
+
+/*
+** Written to a temporary file renamed into place, so that concurrent
+** readers never see a partial document.
+*/
+static void msOWSWriteCapabilitiesFile(const char *filename, const char *key,
+                                       const char *content_type,
+                                       const unsigned char *data, int size)
+{
+  FILE *fp;
+  char *tmpname, *tmpfilename;
+  int ok;
+
+  tmpname = msTmpFilename("tmp");
+  tmpfilename = msStrdup(filename);
+  tmpfilename = msStringConcatenate(tmpfilename, ".");
+  tmpfilename = msStringConcatenate(tmpfilename, tmpname);
+  free(tmpname);
+
+  fp = fopen(tmpfilename, "wb");
+  if(fp == NULL) {
+    msDebug("msOWSWriteCapabilitiesFile(): failed to create %s.\n", tmpfilename);
+    free(tmpfilename);
+    return;
+  }
+  ok = fprintf(fp, "%s %d %d %d\n", MS_OWS_CAPABILITIES_FILE_SIGNATURE, (int) strlen(key),
+               (int) strlen(content_type), size) > 0;
+  ok = ok && fwrite(key, 1, strlen(key), fp) == strlen(key);
+  ok = ok && fwrite(content_type, 1, strlen(content_type), fp) == strlen(content_type);
+  ok = ok && fwrite(data, 1, size, fp) == (size_t) size;
+  if(fclose(fp) != 0)
+    ok = MS_FALSE;
+
+  if(!ok || rename(tmpfilename, filename) != 0) {
+    msDebug("msOWSWriteCapabilitiesFile(): failed to write %s.\n", filename);
+    unlink(tmpfilename);
+  }
+  free(tmpfilename);
+}
+
+/* takes ownership of content_type and data */
+static void msOWSStoreCachedCapabilities(const char *key, char *content_type,
+    unsigned char *data, int size)
+{
+  owsCapabilitiesCacheEntry *entry, *prev;
+  int count;
+
+  msAcquireLock(TLOCK_OWS);
+
+  for(entry = capabilitiesCache; entry != NULL; entry = entry->next) {
+    if(strcmp(entry->key, key) == 0) { /* stored meanwhile by another thread */
+      msReleaseLock(TLOCK_OWS);
+      free(content_type);
+      free(data);
+      return;
+    }
+  }
+
+  entry = (owsCapabilitiesCacheEntry *) msSmallMalloc(sizeof(owsCapabilitiesCacheEntry));
+  entry->key = msStrdup(key);
+  entry->content_type = content_type;
+  entry->data = data;
+  entry->size = size;
+  entry->next = capabilitiesCache;
+  capabilitiesCache = entry;
+
+  /* drop the least recently used entry beyond the limit */
+  for(count = 1, prev = capabilitiesCache; prev->next != NULL; prev = prev->next, count++) {
+    if(count == MS_OWS_CAPABILITIES_CACHE_MAX) {
+      entry = prev->next;
+      prev->next = NULL;
+      free(entry->key);
+      free(entry->content_type);
+      free(entry->data);
+      free(entry);
+      break;
+    }
+  }
+
+  msReleaseLock(TLOCK_OWS);
+}
+
+/*
+** Write out the cached response for key. Returns MS_SUCCESS if it was
+** found, MS_DONE otherwise.
+*/
+static int msOWSWriteCachedCapabilities(mapObj *map, const char *key)
+{
+  owsCapabilitiesCacheEntry *entry, *prev = NULL;
+  char *content_type = NULL;
+  unsigned char *data = NULL;
+  int size = 0;
+  const char *dir;
+
+  msAcquireLock(TLOCK_OWS);
+  for(entry = capabilitiesCache; entry != NULL; prev = entry, entry = entry->next) {
+    if(strcmp(entry->key, key) == 0) {
+      if(prev != NULL) { /* move to the front */
+        prev->next = entry->next;
+        entry->next = capabilitiesCache;
+        capabilitiesCache = entry;
+      }
+      /* copied so the entry may be dropped while we write */
+      content_type = msStrdup(entry->content_type);
+      data = (unsigned char *) msSmallMalloc(entry->size);
+      memcpy(data, entry->data, entry->size);
+      size = entry->size;
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_OWS);
+
+  if(data == NULL && (dir = msOWSLookupMetadata(&(map->web.metadata), "O", "capabilities_cache_dir")) != NULL) {
+    char *filename = msOWSGetCapabilitiesCacheFilename(map, dir, key);
+    data = msOWSReadCapabilitiesFile(filename, key, &content_type, &size);
+    free(filename);
+    if(data != NULL) {
+      unsigned char *copy = (unsigned char *) msSmallMalloc(size);
+      memcpy(copy, data, size);
+      msOWSStoreCachedCapabilities(key, msStrdup(content_type), copy, size);
+    }
+  }
+
+  if(data == NULL)
+    return MS_DONE;
+
+  if(map->debug >= MS_DEBUGLEVEL_V)
+    msDebug("msOWSWriteCachedCapabilities(): serving %d cached bytes.\n", size);
+
+  msIO_setHeader("Content-Type", "%s", content_type);
+  msIO_sendHeaders();
+  msIO_fwrite(data, 1, size, stdout);
+  free(content_type);
+  free(data);
+
+  return MS_SUCCESS;
+}
+
+/*
+** Release the in memory GetCapabilities cache, called from msCleanup().
+*/
+void msOWSCapabilitiesCacheCleanup(void)
+{
+  owsCapabilitiesCacheEntry *entry;
+
+  msAcquireLock(TLOCK_OWS);
+  while(capabilitiesCache != NULL) {
+    entry = capabilitiesCache;
+    capabilitiesCache = entry->next;
+    free(entry->key);
+    free(entry->content_type);
+    free(entry->data);
+    free(entry);
+  }
+  msReleaseLock(TLOCK_OWS);
+}
+
 /*
 ** msOWSDispatch() is the entry point for any OWS request (WMS, WFS, ...)
 ** - If this is a valid request then it is processed and MS_SUCCESS is returned
@@ -216,6 +556,9 @@ int msOWSDispatch(mapObj *map, cgiRequestObj *request, int ows_mode)
 {
   int status = MS_DONE, force_ows_mode = 0;
   owsRequestObj ows_request;
+  msIOContext *old_context = NULL;
+  char *cache_key = NULL;
+  int body_offset;
 
   if (!request) {
     return status;
@@ -233,6 +576,17 @@ int msOWSDispatch(mapObj *map, cgiRequestObj *request, int ows_mode)
       status = MS_DONE;
   }
 
+  /* serve GetCapabilities from the cache, or capture it to fill the cache */
+  if (msOWSCapabilitiesCacheEnabled(map, request, &ows_request)) {
+    cache_key = msOWSGetCapabilitiesCacheKey(map, request);
+    if (msOWSWriteCachedCapabilities(map, cache_key) == MS_SUCCESS) {
+      free(cache_key);
+      msOWSClearRequestObj(&ows_request);
+      return MS_SUCCESS;
+    }
+    old_context = msIO_pushStdoutToBufferAndGetOldContext();
+  }
+
   if (ows_request.service == NULL) {
 
 #ifdef USE_WFS_SVR
@@ -290,6 +644,50 @@ int msOWSDispatch(mapObj *map, cgiRequestObj *request, int ows_mode)
     status = MS_FAILURE;
   }
 
+  if (old_context != NULL) {
+    msIOBuffer *buffer = (msIOBuffer *) msIO_getHandler(stdout)->cbData;
+    unsigned char *data = buffer->data;
+    int size = buffer->data_offset;
+
+    buffer->data = NULL; /* keep the captured output past the restore */
+    msIO_restoreOldStdoutContext(old_context);
+
+    if (size > 0)
+      msIO_fwrite(data, 1, size, stdout);
+
+    /* only a lone Content-Type header is expected, the body is cached */
+    body_offset = -1;
+    if (status == MS_SUCCESS && size > 14 && strncasecmp((char *) data, "Content-Type: ", 14) == 0) {
+      int i;
+      for (i = 14; i + 3 < size; i++) {
+        if (data[i] == '\r' || data[i] == '\n') {
+          if (memcmp(data + i, "\r\n\r\n", 4) == 0)
+            body_offset = i + 4;
+          break;
+        }
+      }
+    }
+
+    if (body_offset > 0 && body_offset < size) {
+      const char *dir = msOWSLookupMetadata(&(map->web.metadata), "O", "capabilities_cache_dir");
+      char *content_type = (char *) msSmallMalloc(body_offset - 4 - 14 + 1);
+      int body_size = size - body_offset;
+
+      memcpy(content_type, data + 14, body_offset - 4 - 14);
+      content_type[body_offset - 4 - 14] = '\0';
+      memmove(data, data + body_offset, body_size);
+
+      if (dir != NULL) {
+        char *filename = msOWSGetCapabilitiesCacheFilename(map, dir, cache_key);
+        msOWSWriteCapabilitiesFile(filename, cache_key, content_type, data, body_size);
+        free(filename);
+      }
+      msOWSStoreCachedCapabilities(cache_key, content_type, data, body_size);
+    } else
+      free(data);
+    free(cache_key);
+  }
+
   msOWSClearRequestObj(&ows_request);
   return status;
 }
@@ -122,6 +122,7 @@ typedef struct {
 } owsRequestObj;
 
 MS_DLL_EXPORT int msOWSDispatch(mapObj *map, cgiRequestObj *request, int ows_mode);
+void msOWSCapabilitiesCacheCleanup(void);
 
 MS_DLL_EXPORT const char * msOWSLookupMetadata(hashTableObj *metadata,
     const char *namespaces, const char *name);
@@ -387,11 +388,13 @@ typedef struct {
 } gmlNamespaceListObj;
 
 
+/* also used by the OGR and built-in feature output drivers */
+MS_DLL_EXPORT gmlItemListObj *msGMLGetItems(layerObj *layer, const char *metadata_namespaces);
+MS_DLL_EXPORT void msGMLFreeItems(gmlItemListObj *itemList);
+
 #if defined(USE_WMS_SVR) || defined (USE_WFS_SVR)
 
 MS_DLL_EXPORT int msItemInGroups(const char *name, gmlGroupListObj *groupList);
-MS_DLL_EXPORT gmlItemListObj *msGMLGetItems(layerObj *layer, const char *metadata_namespaces);
-MS_DLL_EXPORT void msGMLFreeItems(gmlItemListObj *itemList);
 MS_DLL_EXPORT gmlConstantListObj *msGMLGetConstants(layerObj *layer, const char *metadata_namespaces);
 MS_DLL_EXPORT void msGMLFreeConstants(gmlConstantListObj *constantList);
 MS_DLL_EXPORT gmlGeometryListObj *msGMLGetGeometries(layerObj *layer, const char *metadata_namespaces, int bWithDefaultGeom);
@@ -414,6 +417,15 @@ void msGMLWriteWFSBounds(mapObj *map, FILE *stream, const char *tab,
 MS_DLL_EXPORT int msGMLWriteWFSQuery(mapObj *map, FILE *stream, const char *wfs_namespace,
                                      OWSGMLVersion outputformat, int nWFSVersion, int bUseURN,
                                      int bGetPropertyValueRequest);
+
+typedef struct gmlWFSQueryStreamObj gmlWFSQueryStreamObj;
+
+gmlWFSQueryStreamObj *msGMLCreateWFSQueryStream(mapObj *map, const char *wfs_namespace,
+                                                OWSGMLVersion outputformat, int nWFSVersion, int bUseURN);
+int msGMLWFSQueryStreamAddShape(mapObj *map, layerObj *lp, shapeObj *shape, void *data);
+int msGMLFinishWFSQueryStream(gmlWFSQueryStreamObj *qs);
+int msGMLWriteWFSQueryStream(mapObj *map, FILE *stream, gmlWFSQueryStreamObj *qs);
+void msGMLFreeWFSQueryStream(gmlWFSQueryStreamObj *qs);
 #endif
 
 
@@ -510,6 +522,7 @@ int msWFSLayerGetItems(layerObj *layer);
 int msWFSLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery);
 int msWFSLayerClose(layerObj *lp);
 MS_DLL_EXPORT char *msWFSExecuteGetFeature(layerObj *lp);
+void msWFSSchemaCacheCleanup(void);
 
 /*====================================================================
  *   mapcontext.c
@@ -129,12 +129,44 @@ o The connection pooling API will let a connection be used/referenced multiple
   between different threads concurrently.  But if a connection is released
   by one thread, it is available for use by another thread.
 
+o Connections are looked up through a small hash table keyed on the
+  connection type and (case folded) connection string, so long running
+  processes with many pooled connections do not pay a linear scan per
+  layer open.
+
+o With CLOSE_CONNECTION=DEFER the PROCESSING option POOL_IDLE_TIMEOUT=n
+  closes a pooled connection once it has been unreferenced for n seconds,
+  instead of keeping it until msCleanup().  Idle connections are reaped
+  lazily when the pool is next used.
+
+o In threaded builds POOL_MAX_CONNECTIONS=n limits how many connections
+  may be open for a given connection string.  When the limit is reached
+  msConnPoolRequest() waits for another thread to release one, for at most
+  POOL_WAIT_TIMEOUT seconds (default 5), after which it returns NULL and
+  the driver opens an extra connection as usual rather than deadlocking.
+
+o A driver may register its connections with msConnPoolRegisterValidated()
+  and provide a callback returning MS_TRUE if the handle is still usable.
+  It is called (without the pool lock held) whenever an idle connection is
+  handed out; connections failing validation are closed and the request
+  falls through to the next candidate or a fresh connection.
+
+o msConnPoolGetStats() returns counters on pool usage for monitoring.
+
  ****************************************************************************/
 
 #include "mapserver.h"
 #include "mapthread.h"
 
+#include <ctype.h>
 
+#ifdef USE_THREAD
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#endif
 
 /* defines for lifetime.
    A positive number is a time-from-last use in seconds */
@@ -143,10 +175,19 @@ o The connection pooling API will let a connection be used/referenced multiple
 #define MS_LIFE_ZEROREF       -2
 #define MS_LIFE_SINGLE        -3
 
+/* number of hash buckets used to look up connections by key */
+#define MS_POOL_HASH_SIZE     64
+
+/* default number of seconds to wait when POOL_MAX_CONNECTIONS is reached */
+#define MS_POOL_WAIT_TIMEOUT  5
+
 typedef struct {
   enum MS_CONNECTION_TYPE connectiontype;
   char *connection;
 
+  unsigned int key_hash;
+  int   next;       /* next connection in the same hash bucket, or -1 */
+
   int   lifespan;
   int   ref_count;
   int   thread_id;
@@ -157,6 +198,7 @@ typedef struct {
   void  *conn_handle;
 
   void  (*close)( void * );
+  int   (*validate)( void * );
 } connectionObj;
 
 /*
@@ -166,20 +208,81 @@ typedef struct {
 static int connectionCount = 0;
 static int connectionMax = 0;
 static connectionObj *connections = NULL;
+static int connectionBuckets[MS_POOL_HASH_SIZE];
+static connPoolStatsObj poolStats;
+static time_t lastReap = 0;
 
 /************************************************************************/
-/*                         msConnPoolRegister()                         */
+/*                           msConnPoolHash()                           */
 /*                                                                      */
-/*      Register a new connection with the connection pool tracker.     */
+/*      Hash the connection key.  Connection strings are compared       */
+/*      case insensitively so they are folded here as well.             */
 /************************************************************************/
 
-void msConnPoolRegister( layerObj *layer,
-                         void *conn_handle,
-                         void (*close_func)( void * ) )
+static unsigned int msConnPoolHash( enum MS_CONNECTION_TYPE connectiontype,
+                                    const char *connection )
+
+{
+  unsigned int hash = 5381 + (unsigned int) connectiontype;
+
+  for( ; *connection != '\0'; connection++ )
+    hash = hash * 33 + (unsigned int) tolower( (unsigned char) *connection );
+
+  return hash;
+}
+
+/************************************************************************/
+/*                          msConnPoolRelink()                          */
+/*                                                                      */
+/*      Make the hash chain entry pointing at old_index point at        */
+/*      new_index instead.  new_index == -1 unlinks old_index.          */
+/************************************************************************/
+
+static void msConnPoolRelink( int old_index, int new_index )
+
+{
+  int *link = connectionBuckets
+              + connections[old_index].key_hash % MS_POOL_HASH_SIZE;
+
+  while( *link != -1 ) {
+    if( *link == old_index ) {
+      *link = (new_index == -1) ? connections[old_index].next : new_index;
+      return;
+    }
+    link = &(connections[*link].next);
+  }
+}
+
+/************************************************************************/
+/*                         msConnPoolMatches()                          */
+/************************************************************************/
+
+static int msConnPoolMatches( connectionObj *conn, layerObj *layer,
+                              unsigned int key_hash )
+
+{
+  return conn->key_hash == key_hash
+         && conn->connectiontype == layer->connectiontype
+         && strcasecmp( conn->connection, layer->connection ) == 0;
+}
+
+/************************************************************************/
+/*                    msConnPoolRegisterValidated()                     */
+/*                                                                      */
+/*      Register a new connection with the connection pool tracker,     */
+/*      with an optional callback used to check it is still usable      */
+/*      before it is handed out again.                                  */
+/************************************************************************/
+
+void msConnPoolRegisterValidated( layerObj *layer,
+                                  void *conn_handle,
+                                  void (*close_func)( void * ),
+                                  int (*validate_func)( void * ) )
 
 {
   const char *close_connection = NULL;
   connectionObj *conn = NULL;
+  int i;
 
   if( layer->debug )
     msDebug( "msConnPoolRegister(%s,%s,%p)\n",
@@ -211,6 +314,11 @@ void msConnPoolRegister( layerObj *layer,
   /* -------------------------------------------------------------------- */
   msAcquireLock( TLOCK_POOL );
 
+  if( connectionMax == 0 ) {
+    for( i = 0; i < MS_POOL_HASH_SIZE; i++ )
+      connectionBuckets[i] = -1;
+  }
+
   if( connectionCount == connectionMax ) {
     connectionMax += 10;
     connections = (connectionObj *)
@@ -218,6 +326,7 @@ void msConnPoolRegister( layerObj *layer,
                           sizeof(connectionObj) * connectionMax );
     if( connections == NULL ) {
       msSetError(MS_MEMERR, NULL, "msConnPoolRegister()");
+      connectionCount = connectionMax = 0;
       msReleaseLock( TLOCK_POOL );
       return;
     }
@@ -228,17 +337,22 @@ void msConnPoolRegister( layerObj *layer,
   /* -------------------------------------------------------------------- */
   conn = connections + connectionCount;
 
-  connectionCount++;
-
   conn->connectiontype = layer->connectiontype;
   conn->connection = msStrdup( layer->connection );
   conn->close = close_func;
+  conn->validate = validate_func;
   conn->ref_count = 1;
   conn->thread_id = msGetThreadId();
   conn->last_used = time(NULL);
   conn->conn_handle = conn_handle;
   conn->debug = layer->debug;
 
+  conn->key_hash = msConnPoolHash( conn->connectiontype, conn->connection );
+  conn->next = connectionBuckets[conn->key_hash % MS_POOL_HASH_SIZE];
+  connectionBuckets[conn->key_hash % MS_POOL_HASH_SIZE] = connectionCount;
+
+  connectionCount++;
+
   /* -------------------------------------------------------------------- */
   /*      Categorize the connection handling information.                 */
   /* -------------------------------------------------------------------- */
@@ -250,9 +364,14 @@ void msConnPoolRegister( layerObj *layer,
 
   if( strcasecmp(close_connection,"NORMAL") == 0 )
     conn->lifespan = MS_LIFE_ZEROREF;
-  else if( strcasecmp(close_connection,"DEFER") == 0 )
+  else if( strcasecmp(close_connection,"DEFER") == 0 ) {
+    const char *idle_timeout =
+      msLayerGetProcessingKey( layer, "POOL_IDLE_TIMEOUT" );
+
     conn->lifespan = MS_LIFE_FOREVER;
-  else if( strcasecmp(close_connection,"ALWAYS") == 0 )
+    if( idle_timeout != NULL && atoi(idle_timeout) > 0 )
+      conn->lifespan = atoi(idle_timeout);
+  } else if( strcasecmp(close_connection,"ALWAYS") == 0 )
     conn->lifespan = MS_LIFE_SINGLE;
   else {
     msDebug("msConnPoolRegister(): "
@@ -268,6 +387,20 @@ void msConnPoolRegister( layerObj *layer,
   msReleaseLock( TLOCK_POOL );
 }
 
+/************************************************************************/
+/*                         msConnPoolRegister()                         */
+/*                                                                      */
+/*      Register a new connection with the connection pool tracker.     */
+/************************************************************************/
+
+void msConnPoolRegister( layerObj *layer,
+                         void *conn_handle,
+                         void (*close_func)( void * ) )
+
+{
+  msConnPoolRegisterValidated( layer, conn_handle, close_func, NULL );
+}
+
 /************************************************************************/
 /*                          msConnPoolClose()                           */
 /*                                                                      */
@@ -304,17 +437,52 @@ static void msConnPoolClose( int conn_index )
   /* free malloced() stuff in this connection */
   free( conn->connection );
 
+  msConnPoolRelink( conn_index, -1 );
+
   connectionCount--;
   if( connectionCount == 0 ) {
     /* if there are no connections left we will "cleanup".  */
     connectionMax = 0;
     free( connections );
     connections = NULL;
-  } else {
+  } else if( conn_index != connectionCount ) {
     /* move the last connection in place of our now closed one */
     memcpy( connections + conn_index,
             connections + connectionCount,
             sizeof(connectionObj) );
+    msConnPoolRelink( connectionCount, conn_index );
+  }
+}
+
+/************************************************************************/
+/*                         msConnPoolReapIdle()                         */
+/*                                                                      */
+/*      Close unreferenced connections that have outlived their         */
+/*      POOL_IDLE_TIMEOUT.  Checked at most once a second.  We          */
+/*      assume the caller has already acquired the pool lock.           */
+/************************************************************************/
+
+static void msConnPoolReapIdle( void )
+
+{
+  int i;
+  time_t now = time(NULL);
+
+  if( now == lastReap )
+    return;
+  lastReap = now;
+
+  for( i = connectionCount - 1; i >= 0; i-- ) {
+    connectionObj *conn = connections + i;
+
+    if( conn->ref_count == 0 && conn->lifespan > 0
+        && now - conn->last_used >= conn->lifespan ) {
+      if( conn->debug )
+        msDebug( "msConnPoolReapIdle(): %s idle for %d seconds.\n",
+                 conn->connection, (int) (now - conn->last_used) );
+      poolStats.reaped++;
+      msConnPoolClose( i );
+    }
   }
 }
 
@@ -330,8 +498,11 @@ static void msConnPoolClose( int conn_index )
 void *msConnPoolRequest( layerObj *layer )
 
 {
-  int  i;
   const char* close_connection;
+  const char* value;
+  unsigned int key_hash;
+  int max_connections = 0, wait_timeout = MS_POOL_WAIT_TIMEOUT;
+  time_t wait_start = 0;
 
   if( layer->connection == NULL )
     return NULL;
@@ -341,15 +512,42 @@ void *msConnPoolRequest( layerObj *layer )
   if( close_connection && strcasecmp(close_connection,"ALWAYS") == 0 )
     return NULL;
 
+  if( (value = msLayerGetProcessingKey( layer, "POOL_MAX_CONNECTIONS" )) != NULL )
+    max_connections = atoi(value);
+  if( (value = msLayerGetProcessingKey( layer, "POOL_WAIT_TIMEOUT" )) != NULL )
+    wait_timeout = atoi(value);
+
+  key_hash = msConnPoolHash( layer->connectiontype, layer->connection );
+
   msAcquireLock( TLOCK_POOL );
-  for( i = 0; i < connectionCount; i++ ) {
-    connectionObj *conn = connections + i;
 
-    if( layer->connectiontype == conn->connectiontype
-        && strcasecmp( layer->connection, conn->connection ) == 0
-        && (conn->ref_count == 0 || conn->thread_id == msGetThreadId())
-        && conn->lifespan != MS_LIFE_SINGLE) {
-      void *conn_handle = NULL;
+  poolStats.requests++;
+  msConnPoolReapIdle();
+
+  for( ;; ) {
+    int  i, key_count = 0;
+    connectionObj *conn = NULL;
+
+    i = (connectionCount > 0) ? connectionBuckets[key_hash % MS_POOL_HASH_SIZE] : -1;
+    for( ; i != -1; i = connections[i].next ) {
+      connectionObj *candidate = connections + i;
+
+      if( !msConnPoolMatches( candidate, layer, key_hash )
+          || candidate->lifespan == MS_LIFE_SINGLE )
+        continue;
+
+      key_count++;
+      if( candidate->ref_count == 0
+          || candidate->thread_id == msGetThreadId() ) {
+        conn = candidate;
+        break;
+      }
+    }
+
+    if( conn != NULL ) {
+      void *conn_handle = conn->conn_handle;
+      int (*validate_func)( void * ) =
+        (conn->ref_count == 0) ? conn->validate : NULL;
 
       conn->ref_count++;
       conn->thread_id = msGetThreadId();
@@ -361,11 +559,68 @@ void *msConnPoolRequest( layerObj *layer )
         conn->debug = layer->debug;
       }
 
-      conn_handle = conn->conn_handle;
-
+      poolStats.hits++;
       msReleaseLock( TLOCK_POOL );
-      return conn_handle;
+
+      /* The connection is ours now, validate it without holding the */
+      /* lock since that may involve a round trip to the server.      */
+      if( validate_func == NULL || validate_func( conn_handle ) )
+        return conn_handle;
+
+      msAcquireLock( TLOCK_POOL );
+      poolStats.hits--;
+      poolStats.invalid++;
+
+      for( i = connectionBuckets[key_hash % MS_POOL_HASH_SIZE];
+           i != -1; i = connections[i].next ) {
+        if( connections[i].conn_handle == conn_handle ) {
+          if( layer->debug )
+            msDebug( "msConnPoolRequest(%s,%s) -> %p failed validation.\n",
+                     layer->name, layer->connection, conn_handle );
+          connections[i].ref_count = 0;
+          msConnPoolClose( i );
+          break;
+        }
+      }
+      continue;
+    }
+
+#ifdef USE_THREAD
+    /* Wait for another thread to release a connection if this key */
+    /* already has as many as POOL_MAX_CONNECTIONS allows.          */
+    if( max_connections > 0 && key_count >= max_connections ) {
+      time_t now = time(NULL);
+
+      if( wait_start == 0 ) {
+        wait_start = now;
+        poolStats.waits++;
+        if( layer->debug )
+          msDebug( "msConnPoolRequest(%s): waiting, %d connections in use.\n",
+                   layer->name, key_count );
+      }
+
+      if( now - wait_start < wait_timeout ) {
+        msReleaseLock( TLOCK_POOL );
+#ifdef _WIN32
+        Sleep( 10 );
+#else
+        usleep( 10000 );
+#endif
+        msAcquireLock( TLOCK_POOL );
+        continue;
+      }
+
+      poolStats.timeouts++;
+      if( layer->debug )
+        msDebug( "msConnPoolRequest(%s): no connection released after %d seconds, "
+                 "opening a new one.\n", layer->name, wait_timeout );
     }
+#else
+    (void) max_connections;
+    (void) wait_timeout;
+    (void) wait_start;
+#endif
+    break;
   }
 
   msReleaseLock( TLOCK_POOL );
@@ -386,6 +641,7 @@ void msConnPoolRelease( layerObj *layer, void *conn_handle )
 
 {
   int  i;
+  unsigned int key_hash;
 
   if( layer->debug )
     msDebug( "msConnPoolRelease(%s,%s,%p)\n",
@@ -394,12 +650,14 @@ void msConnPoolRelease( layerObj *layer, void *conn_handle )
   if( layer->connection == NULL )
     return;
 
+  key_hash = msConnPoolHash( layer->connectiontype, layer->connection );
+
   msAcquireLock( TLOCK_POOL );
-  for( i = 0; i < connectionCount; i++ ) {
+  i = (connectionCount > 0) ? connectionBuckets[key_hash % MS_POOL_HASH_SIZE] : -1;
+  for( ; i != -1; i = connections[i].next ) {
     connectionObj *conn = connections + i;
 
-    if( layer->connectiontype == conn->connectiontype
-        && strcasecmp( layer->connection, conn->connection ) == 0
+    if( msConnPoolMatches( conn, layer, key_hash )
         && conn->conn_handle == conn_handle ) {
       conn->ref_count--;
       conn->last_used = time(NULL);
@@ -410,6 +668,8 @@ void msConnPoolRelease( layerObj *layer, void *conn_handle )
       if( conn->ref_count == 0 && (conn->lifespan == MS_LIFE_ZEROREF || conn->lifespan == MS_LIFE_SINGLE) )
         msConnPoolClose( i );
 
+      msConnPoolReapIdle();
+
       msReleaseLock( TLOCK_POOL );
       return;
     }
@@ -427,6 +687,28 @@ void msConnPoolRelease( layerObj *layer, void *conn_handle )
               layer->name );
 }
 
+/************************************************************************/
+/*                         msConnPoolGetStats()                         */
+/*                                                                      */
+/*      Return a snapshot of the pool usage counters.                   */
+/************************************************************************/
+
+void msConnPoolGetStats( connPoolStatsObj *stats )
+
+{
+  int  i;
+
+  msAcquireLock( TLOCK_POOL );
+  *stats = poolStats;
+  stats->open = connectionCount;
+  stats->busy = 0;
+  for( i = 0; i < connectionCount; i++ ) {
+    if( connections[i].ref_count > 0 )
+      stats->busy++;
+  }
+  msReleaseLock( TLOCK_POOL );
+}
+
 /************************************************************************/
 /*                   msConnPoolMapCloseUnreferenced()                   */
 /*                                                                      */
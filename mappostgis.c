@@ -63,6 +63,7 @@
 #include <math.h>
 #include "mapserver.h"
 #include "maptime.h"
+#include "mapthread.h"
 #include "mappostgis.h"
 
 #define FP_EPSILON 1e-12
@@ -76,7 +77,47 @@
 
 #ifdef USE_POSTGIS
 
+/*
+** Prepared statements only live as long as the connection they were
+** created on, so we keep track of the ones created on each pooled
+** connection. Entries are dropped when the connection is closed or reset.
+** The list is protected by TLOCK_POSTGIS.
+*/
+#define MS_POSTGIS_MAX_PREPARED 64
+
+typedef struct msPostGISPreparedObj {
+  PGconn *pgconn;
+  char   *name;
+  char   *sql;
+  struct msPostGISPreparedObj *next;
+} msPostGISPreparedObj;
 
+static msPostGISPreparedObj *postgisPrepared = NULL;
+
+/*
+** msPostGISForgetPrepared()
+**
+** Drop the prepared statement records of a connection.
+*/
+static void msPostGISForgetPrepared(PGconn *pgconn)
+{
+  msPostGISPreparedObj **link;
+
+  msAcquireLock(TLOCK_POSTGIS);
+  link = &postgisPrepared;
+  while (*link) {
+    msPostGISPreparedObj *prepared = *link;
+    if (prepared->pgconn == pgconn) {
+      *link = prepared->next;
+      free(prepared->name);
+      free(prepared->sql);
+      free(prepared);
+    } else {
+      link = &(prepared->next);
+    }
+  }
+  msReleaseLock(TLOCK_POSTGIS);
+}
 
 /*
 ** msPostGISCloseConnection()
@@ -86,9 +127,167 @@
 */
 void msPostGISCloseConnection(void *pgconn)
 {
+  msPostGISForgetPrepared((PGconn*)pgconn);
   PQfinish((PGconn*)pgconn);
 }
 
+/*
+** msPostGISValidateConnection()
+**
+** Handler registered with msConnPoolRegisterValidated so that a pooled
+** connection is checked before it is handed out again. PQconsumeInput()
+** does not block and notices a backend that went away while the
+** connection sat idle, in which case we try to reset it.
+*/
+static int msPostGISValidateConnection(void *pgconn)
+{
+  PGconn *conn = (PGconn*)pgconn;
+
+  if (PQstatus(conn) == CONNECTION_OK && PQconsumeInput(conn))
+    return MS_TRUE;
+
+  msPostGISForgetPrepared(conn);
+  PQreset(conn);
+  return PQstatus(conn) == CONNECTION_OK;
+}
+
+/*
+** msPostGISExecPrepared()
+**
+** Run sql as a named prepared statement on the layer connection,
+** preparing it first if this connection has not seen it yet, so
+** repeated requests skip parsing and planning. Once a connection holds
+** MS_POSTGIS_MAX_PREPARED statements the least recently used one is
+** deallocated to make room. Returns NULL without setting an error if
+** the statement could not be prepared, in which case the caller should
+** run it as a plain parameterized query.
+*/
+static PGresult *msPostGISExecPrepared(layerObj *layer, const char *sql, int nParams,
+                                       const Oid *paramTypes, const char * const *paramValues,
+                                       int resultFormat)
+{
+  msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo *)layer->layerinfo;
+  msPostGISPreparedObj *prepared, **link, **oldest = NULL, *evicted = NULL;
+  PGresult *pgresult;
+  char *hash = msHashString(sql);
+  char *name = msStringConcatenate(msStrdup("msps_"), hash);
+  int count = 0, found = MS_FALSE, usable = MS_FALSE;
+
+  free(hash);
+
+  /* The list is kept in most recently used order */
+  msAcquireLock(TLOCK_POSTGIS);
+  for (link = &postgisPrepared; *link; link = &((*link)->next)) {
+    prepared = *link;
+    if (prepared->pgconn != layerinfo->pgconn)
+      continue;
+    count++;
+    if (strcmp(prepared->name, name) == 0) {
+      found = MS_TRUE;
+      /* a name clash between two different queries: don't prepare either */
+      usable = (strcmp(prepared->sql, sql) == 0);
+      if (usable && link != &postgisPrepared) {
+        *link = prepared->next;
+        prepared->next = postgisPrepared;
+        postgisPrepared = prepared;
+      }
+      break;
+    }
+    oldest = link;
+  }
+  if (!found && count >= MS_POSTGIS_MAX_PREPARED && oldest) {
+    evicted = *oldest;
+    *oldest = evicted->next;
+  }
+  msReleaseLock(TLOCK_POSTGIS);
+
+  if (found && !usable) {
+    free(name);
+    return NULL;
+  }
+
+  if (evicted) {
+    char *deallocate = msStringConcatenate(msStrdup("DEALLOCATE \""), evicted->name);
+    deallocate = msStringConcatenate(deallocate, "\"");
+    pgresult = PQexec(layerinfo->pgconn, deallocate);
+    if (layer->debug)
+      msDebug("msPostGISExecPrepared(): deallocated %s (%s).\n", evicted->name,
+              pgresult ? PQresStatus(PQresultStatus(pgresult)) : PQerrorMessage(layerinfo->pgconn));
+    if (pgresult) PQclear(pgresult);
+    free(deallocate);
+    free(evicted->name);
+    free(evicted->sql);
+    free(evicted);
+  }
+
+  if (!found) {
+    pgresult = PQprepare(layerinfo->pgconn, name, sql, nParams, paramTypes);
+    if (!pgresult || PQresultStatus(pgresult) != PGRES_COMMAND_OK) {
+      if (layer->debug)
+        msDebug("msPostGISExecPrepared(): Unable to prepare statement (%s), running it unprepared.\n", PQerrorMessage(layerinfo->pgconn));
+      if (pgresult) PQclear(pgresult);
+      free(name);
+      return NULL;
+    }
+    PQclear(pgresult);
+
+    if (layer->debug)
+      msDebug("msPostGISExecPrepared(): prepared %s.\n", name);
+
+    prepared = (msPostGISPreparedObj *)msSmallMalloc(sizeof(msPostGISPreparedObj));
+    prepared->pgconn = layerinfo->pgconn;
+    prepared->name = msStrdup(name);
+    prepared->sql = msStrdup(sql);
+    msAcquireLock(TLOCK_POSTGIS);
+    prepared->next = postgisPrepared;
+    postgisPrepared = prepared;
+    msReleaseLock(TLOCK_POSTGIS);
+  }
+
+  pgresult = PQexecPrepared(layerinfo->pgconn, name, nParams, paramValues, NULL, NULL, resultFormat);
+  free(name);
+  return pgresult;
+}
+
+/*
+** msPostGISAddParam()
+**
+** While building the SQL of a prepared statement, append value to the
+** query parameters and return its parameter number. Returns 0 when the
+** value should be written into the SQL instead.
+*/
+static int msPostGISAddParam(msPostGISLayerInfo *layerinfo, Oid type, const char *value)
+{
+  if ( !layerinfo || layerinfo->parambase < 0 )
+    return 0;
+
+  layerinfo->paramvalues = (char**)msSmallRealloc(layerinfo->paramvalues, sizeof(char*) * (layerinfo->paramcount + 1));
+  layerinfo->paramtypes = (Oid*)msSmallRealloc(layerinfo->paramtypes, sizeof(Oid) * (layerinfo->paramcount + 1));
+  layerinfo->paramvalues[layerinfo->paramcount] = msStrdup(value);
+  layerinfo->paramtypes[layerinfo->paramcount] = type;
+  layerinfo->paramcount++;
+
+  return layerinfo->parambase + layerinfo->paramcount;
+}
+
+/*
+** msPostGISFreeParams()
+**
+** Release the query parameters collected by msPostGISAddParam().
+*/
+static void msPostGISFreeParams(msPostGISLayerInfo *layerinfo)
+{
+  int i;
+
+  for (i = 0; i < layerinfo->paramcount; i++)
+    free(layerinfo->paramvalues[i]);
+  free(layerinfo->paramvalues);
+  free(layerinfo->paramtypes);
+  layerinfo->paramvalues = NULL;
+  layerinfo->paramtypes = NULL;
+  layerinfo->paramcount = 0;
+}
+
 /*
 ** msPostGISCreateLayerInfo()
 */
@@ -107,6 +306,14 @@ msPostGISLayerInfo *msPostGISCreateLayerInfo(void)
   layerinfo->version = 0;
   layerinfo->paging = MS_TRUE;
   layerinfo->force2d = MS_TRUE;
+  layerinfo->prepare = MS_FALSE;
+  layerinfo->parambase = -1;
+  layerinfo->paramcount = 0;
+  layerinfo->paramvalues = NULL;
+  layerinfo->paramtypes = NULL;
+  layerinfo->simplify = MS_POSTGIS_SIMPLIFY_NONE;
+  layerinfo->simplifytolerance = 0.0;
+  layerinfo->simplifycellsize = 0.0;
   return layerinfo;
 }
 
@@ -124,6 +331,7 @@ void msPostGISFreeLayerInfo(layerObj *layer)
   if ( layerinfo->fromsource ) free(layerinfo->fromsource);
   if ( layerinfo->pgresult ) PQclear(layerinfo->pgresult);
   if ( layerinfo->pgconn ) msConnPoolRelease(layer, layerinfo->pgconn);
+  msPostGISFreeParams(layerinfo);
   free(layerinfo);
   layer->layerinfo = NULL;
 }
@@ -1556,56 +1764,147 @@ int msPostGISBase64Decode(unsigned char *dest, const char *src, int srclen)
 }
 
 /*
-** msPostGISBuildSQLBox()
+** msPostGISBuildBoxWKT()
 **
 ** Returns malloc'ed char* that must be freed by caller.
 */
+static char *msPostGISBuildBoxWKT(rectObj *rect)
+{
+  static char *strWKTTemplate = "POLYGON((%.15g %.15g,%.15g %.15g,%.15g %.15g,%.15g %.15g,%.15g %.15g))";
+  /* 10 doubles + template characters */
+  size_t sz = 10 * 22 + strlen(strWKTTemplate);
+  char *strWKT = (char*)msSmallMalloc(sz+1); /* add space for terminating NULL */
+
+  if ( sz <= snprintf(strWKT, sz, strWKTTemplate,
+                      rect->minx, rect->miny,
+                      rect->minx, rect->maxy,
+                      rect->maxx, rect->maxy,
+                      rect->maxx, rect->miny,
+                      rect->minx, rect->miny) ) {
+    msSetError(MS_MISCERR,"Bounding box digits truncated.","msPostGISBuildBoxWKT");
+    free(strWKT);
+    return NULL;
+  }
+  return strWKT;
+}
+
+/*
+** msPostGISBuildSQLBox()
+**
+** Returns malloc'ed char* that must be freed by caller. When the layer
+** is running a prepared statement the box is referenced as a parameter
+** instead of being written out.
+*/
 char *msPostGISBuildSQLBox(layerObj *layer, rectObj *rect, char *strSRID)
 {
 
   char *strBox = NULL;
+  char *strWKT = NULL;
+  char strParam[16];
+  msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo *)layer->layerinfo;
   size_t sz;
 
   if (layer->debug) {
     msDebug("msPostGISBuildSQLBox called.\n");
   }
 
+  strWKT = msPostGISBuildBoxWKT(rect);
+  if ( ! strWKT ) {
+    return NULL;
+  }
+
+  if ( layerinfo && layerinfo->parambase >= 0 ) {
+    snprintf(strParam, sizeof(strParam), "$%d", msPostGISAddParam(layerinfo, 25 /* TEXTOID */, strWKT));
+    free(strWKT);
+    strWKT = NULL;
+  }
+
   if ( strSRID ) {
-    static char *strBoxTemplate = "ST_GeomFromText('POLYGON((%.15g %.15g,%.15g %.15g,%.15g %.15g,%.15g %.15g,%.15g %.15g))',%s)";
-    /* 10 doubles + 1 integer + template characters */
-    sz = 10 * 22 + strlen(strSRID) + strlen(strBoxTemplate);
+    static char *strBoxTemplate = "ST_GeomFromText('%s',%s)";
+    static char *strParamTemplate = "ST_GeomFromText(%s,%s)";
+    sz = (strWKT ? strlen(strWKT) : strlen(strParam)) + strlen(strSRID) + strlen(strBoxTemplate);
     strBox = (char*)msSmallMalloc(sz+1); /* add space for terminating NULL */
-    if ( sz <= snprintf(strBox, sz, strBoxTemplate,
-                        rect->minx, rect->miny,
-                        rect->minx, rect->maxy,
-                        rect->maxx, rect->maxy,
-                        rect->maxx, rect->miny,
-                        rect->minx, rect->miny,
-                        strSRID)) {
-      msSetError(MS_MISCERR,"Bounding box digits truncated.","msPostGISBuildSQLBox");
-      return NULL;
-    }
+    if ( strWKT )
+      snprintf(strBox, sz, strBoxTemplate, strWKT, strSRID);
+    else
+      snprintf(strBox, sz, strParamTemplate, strParam, strSRID);
   } else {
-    static char *strBoxTemplate = "ST_GeomFromText('POLYGON((%.15g %.15g,%.15g %.15g,%.15g %.15g,%.15g %.15g,%.15g %.15g))')";
-    /* 10 doubles + template characters */
-    sz = 10 * 22 + strlen(strBoxTemplate);
+    static char *strBoxTemplate = "ST_GeomFromText('%s')";
+    static char *strParamTemplate = "ST_GeomFromText(%s)";
+    sz = (strWKT ? strlen(strWKT) : strlen(strParam)) + strlen(strBoxTemplate);
     strBox = (char*)msSmallMalloc(sz+1); /* add space for terminating NULL */
-    if ( sz <= snprintf(strBox, sz, strBoxTemplate,
-                        rect->minx, rect->miny,
-                        rect->minx, rect->maxy,
-                        rect->maxx, rect->maxy,
-                        rect->maxx, rect->miny,
-                        rect->minx, rect->miny) ) {
-      msSetError(MS_MISCERR,"Bounding box digits truncated.","msPostGISBuildSQLBox");
-      return NULL;
-    }
+    if ( strWKT )
+      snprintf(strBox, sz, strBoxTemplate, strWKT);
+    else
+      snprintf(strBox, sz, strParamTemplate, strParam);
   }
 
+  free(strWKT);
   return strBox;
 
 }
 
 
+/*
+** msPostGISBuildSQLGeomColumn()
+**
+** Returns the geometry column expression to select, wrapped in the
+** SIMPLIFY function when drawing. Geometries the simplification collapses
+** away are sent as is. The tolerance and grid origin are query parameters
+** of prepared statements, so panning and zooming reuse the same statement.
+** Returns malloc'ed char* that must be freed by caller.
+*/
+static char *msPostGISBuildSQLGeomColumn(layerObj *layer)
+{
+  msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo *)layer->layerinfo;
+  double tolerance = layerinfo->simplifycellsize * layerinfo->simplifytolerance;
+  char strTolerance[32], strOriginX[32], strOriginY[32];
+  char *strColumn = NULL;
+  size_t sz;
+  int param;
+
+  sz = 2 * strlen(layerinfo->geomcolumn) + 5 * 25 + 64;
+  strColumn = (char*)msSmallMalloc(sz);
+
+  if ( layerinfo->simplify == MS_POSTGIS_SIMPLIFY_NONE || tolerance <= 0.0 ) {
+    snprintf(strColumn, sz, "\"%s\"", layerinfo->geomcolumn);
+    return strColumn;
+  }
+
+  snprintf(strTolerance, sizeof(strTolerance), "%.15g", tolerance);
+  if ( (param = msPostGISAddParam(layerinfo, 701 /* FLOAT8OID */, strTolerance)) > 0 )
+    snprintf(strTolerance, sizeof(strTolerance), "$%d", param);
+
+  if ( layerinfo->simplify == MS_POSTGIS_SIMPLIFY_SNAPTOGRID ) {
+    /*
+    ** Align the grid on the output pixels when we are not reprojecting.
+    ** Any grid node is a valid origin, the one nearest to zero keeps the
+    ** SQL text the same while panning at a given scale.
+    */
+    if ( layer->map && !msProjectionsDiffer(&(layer->projection), &(layer->map->projection)) ) {
+      snprintf(strOriginX, sizeof(strOriginX), "%.15g", fmod(layer->map->extent.minx, tolerance));
+      snprintf(strOriginY, sizeof(strOriginY), "%.15g", fmod(layer->map->extent.maxy, tolerance));
+      if ( (param = msPostGISAddParam(layerinfo, 701 /* FLOAT8OID */, strOriginX)) > 0 )
+        snprintf(strOriginX, sizeof(strOriginX), "$%d", param);
+      if ( (param = msPostGISAddParam(layerinfo, 701 /* FLOAT8OID */, strOriginY)) > 0 )
+        snprintf(strOriginY, sizeof(strOriginY), "$%d", param);
+      snprintf(strColumn, sz, "COALESCE(ST_SnapToGrid(\"%s\",%s,%s,%s,%s),\"%s\")",
+               layerinfo->geomcolumn, strOriginX, strOriginY,
+               strTolerance, strTolerance, layerinfo->geomcolumn);
+    } else
+      snprintf(strColumn, sz, "COALESCE(ST_SnapToGrid(\"%s\",%s),\"%s\")",
+               layerinfo->geomcolumn, strTolerance, layerinfo->geomcolumn);
+  } else if ( layerinfo->simplify == MS_POSTGIS_SIMPLIFY_SIMPLIFY ) {
+    snprintf(strColumn, sz, "COALESCE(ST_Simplify(\"%s\",%s),\"%s\")",
+             layerinfo->geomcolumn, strTolerance, layerinfo->geomcolumn);
+  } else {
+    snprintf(strColumn, sz, "ST_RemoveRepeatedPoints(\"%s\",%s)",
+             layerinfo->geomcolumn, strTolerance);
+  }
+
+  return strColumn;
+}
+
 /*
 ** msPostGISBuildSQLItems()
 **
@@ -1651,10 +1950,11 @@ char *msPostGISBuildSQLItems(layerObj *layer)
     ** need, saving transfer and encode/decode time.
     */
     char *force2d = "";
+    char *strGeomColumn = NULL;
 #if TRANSFER_ENCODING == 64
-    static char *strGeomTemplate = "encode(ST_AsBinary(%s(\"%s\"),'%s'),'base64') as geom,\"%s\"";
+    static char *strGeomTemplate = "encode(ST_AsBinary(%s(%s),'%s'),'base64') as geom,\"%s\"";
 #else
-    static char *strGeomTemplate = "encode(ST_AsBinary(%s(\"%s\"),'%s'),'hex') as geom,\"%s\"";
+    static char *strGeomTemplate = "encode(ST_AsBinary(%s(%s),'%s'),'hex') as geom,\"%s\"";
 #endif
     if( layerinfo->force2d ) {
       if( layerinfo->version >= 20100 )
@@ -1662,8 +1962,10 @@ char *msPostGISBuildSQLItems(layerObj *layer)
       else
         force2d = "ST_Force_2D";
     }
-    strGeom = (char*)msSmallMalloc(strlen(strGeomTemplate) + strlen(force2d) + strlen(strEndian) + strlen(layerinfo->geomcolumn) + strlen(layerinfo->uid) + 1);
-    sprintf(strGeom, strGeomTemplate, force2d, layerinfo->geomcolumn, strEndian, layerinfo->uid);
+    strGeomColumn = msPostGISBuildSQLGeomColumn(layer);
+    strGeom = (char*)msSmallMalloc(strlen(strGeomTemplate) + strlen(force2d) + strlen(strEndian) + strlen(strGeomColumn) + strlen(layerinfo->uid) + 1);
+    sprintf(strGeom, strGeomTemplate, force2d, strGeomColumn, strEndian, layerinfo->uid);
+    free(strGeomColumn);
   }
 
   if( layer->debug > 1 ) {
@@ -1913,19 +2215,37 @@ char *msPostGISBuildSQLWhere(layerObj *layer, rectObj *rect, long *uid)
     return NULL;
   }
 
-  /* Populate strLimit, if necessary. */
+  /*
+  ** Populate strLimit and strOffset, if necessary. Prepared statements
+  ** take them as parameters so paging through results reuses one plan.
+  */
   if ( layerinfo->paging && layer->maxfeatures >= 0 ) {
     static char *strLimitTemplate = " limit %d";
+    static char *strLimitParamTemplate = " limit $%d";
+    char strValue[12];
+    int param;
+    snprintf(strValue, sizeof(strValue), "%d", layer->maxfeatures);
+    param = msPostGISAddParam(layerinfo, 23 /* INT4OID */, strValue);
     strLimit = msSmallMalloc(strlen(strLimitTemplate) + 12);
-    sprintf(strLimit, strLimitTemplate, layer->maxfeatures);
+    if ( param > 0 )
+      sprintf(strLimit, strLimitParamTemplate, param);
+    else
+      sprintf(strLimit, strLimitTemplate, layer->maxfeatures);
     strLimitLength = strlen(strLimit);
   }
 
-  /* Populate strOffset, if necessary. */
   if ( layerinfo->paging && layer->startindex > 0 ) {
     static char *strOffsetTemplate = " offset %d";
+    static char *strOffsetParamTemplate = " offset $%d";
+    char strValue[12];
+    int param;
+    snprintf(strValue, sizeof(strValue), "%d", layer->startindex-1);
+    param = msPostGISAddParam(layerinfo, 23 /* INT4OID */, strValue);
     strOffset = msSmallMalloc(strlen(strOffsetTemplate) + 12);
-    sprintf(strOffset, strOffsetTemplate, layer->startindex-1);
+    if ( param > 0 )
+      sprintf(strOffset, strOffsetParamTemplate, param);
+    else
+      sprintf(strOffset, strOffsetTemplate, layer->startindex-1);
     strOffsetLength = strlen(strOffset);
   }
 
@@ -2261,6 +2581,8 @@ int msPostGISLayerOpen(layerObj *layer)
   msPostGISLayerInfo  *layerinfo;
   int order_test = 1;
   const char* force2d_processing;
+  const char* prepare_processing;
+  const char* simplify_processing;
 
   assert(layer != NULL);
 
@@ -2351,11 +2673,13 @@ int msPostGISLayerOpen(layerObj *layer)
     PQsetNoticeProcessor(layerinfo->pgconn, postresqlNoticeHandler, (void *) layer);
 
     /* Save this connection in the pool for later. */
-    msConnPoolRegister(layer, layerinfo->pgconn, msPostGISCloseConnection);
+    msConnPoolRegisterValidated(layer, layerinfo->pgconn, msPostGISCloseConnection,
+                                msPostGISValidateConnection);
   } else {
     /* Connection in the pool should be tested to see if backend is alive. */
     if( PQstatus(layerinfo->pgconn) != CONNECTION_OK ) {
       /* Uh oh, bad connection. Can we reset it? */
+      msPostGISForgetPrepared(layerinfo->pgconn);
       PQreset(layerinfo->pgconn);
       if( PQstatus(layerinfo->pgconn) != CONNECTION_OK ) {
         /* Nope, time to bail out. */
@@ -2387,6 +2711,38 @@ int msPostGISLayerOpen(layerObj *layer)
   if (layer->debug)
     msDebug("msPostGISLayerOpen: Forcing 2D geometries: %s.\n", (layerinfo->force2d)?"yes":"no");
 
+  prepare_processing = msLayerGetProcessingKey( layer, "PREPARED_STATEMENTS" );
+  if(prepare_processing && !strcasecmp(prepare_processing,"yes")) {
+    layerinfo->prepare = MS_TRUE;
+  }
+
+  /*
+  ** SIMPLIFY lets the database reduce the geometry to what can be seen
+  ** at the current scale before transferring it. Only used when drawing.
+  */
+  simplify_processing = msLayerGetProcessingKey( layer, "SIMPLIFY" );
+  if(simplify_processing) {
+    if(!strcasecmp(simplify_processing,"snaptogrid")) {
+      layerinfo->simplify = MS_POSTGIS_SIMPLIFY_SNAPTOGRID;
+      layerinfo->simplifytolerance = 1.0;
+    } else if(!strcasecmp(simplify_processing,"simplify")) {
+      layerinfo->simplify = MS_POSTGIS_SIMPLIFY_SIMPLIFY;
+      layerinfo->simplifytolerance = 0.5;
+    } else if(!strcasecmp(simplify_processing,"removerepeatedpoints") && layerinfo->version >= 20200) {
+      layerinfo->simplify = MS_POSTGIS_SIMPLIFY_REMOVEREPEATED;
+      layerinfo->simplifytolerance = 0.5;
+    } else if (layer->debug) {
+      msDebug("msPostGISLayerOpen: Ignoring unsupported SIMPLIFY value '%s'.\n", simplify_processing);
+    }
+
+    simplify_processing = msLayerGetProcessingKey( layer, "SIMPLIFY_TOLERANCE" );
+    if(simplify_processing && layerinfo->simplify != MS_POSTGIS_SIMPLIFY_NONE) {
+      layerinfo->simplifytolerance = atof(simplify_processing);
+      if(layerinfo->simplifytolerance <= 0.0)
+        layerinfo->simplify = MS_POSTGIS_SIMPLIFY_NONE;
+    }
+  }
+
   /* Save the layerinfo in the layerObj. */
   layer->layerinfo = (void*)layerinfo;
 
@@ -2563,10 +2919,36 @@ int msPostGISLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
   */
   layerinfo = (msPostGISLayerInfo*) layer->layerinfo;
 
+  /*
+  ** With PREPARED_STATEMENTS the search box and paging values are passed
+  ** as parameters after the bind values, so the statement text stays the
+  ** same from one request to the next.
+  */
+  if ( layerinfo->prepare ) {
+    layerinfo->parambase = num_bind_values;
+  }
+
+  /*
+  ** Work out the cell size in layer units if the geometry is only going
+  ** to be drawn, so SIMPLIFY can be applied. Queries get exact geometry.
+  */
+  if ( layerinfo->simplify != MS_POSTGIS_SIMPLIFY_NONE && !isQuery
+       && layer->map && layer->map->width > 0 ) {
+    if ( !msProjectionsDiffer(&(layer->projection), &(layer->map->projection)) )
+      layerinfo->simplifycellsize = layer->map->cellsize;
+    else
+      layerinfo->simplifycellsize = (rect.maxx - rect.minx) / layer->map->width;
+  }
+
   /* Build a SQL query based on our current state. */
   strSQL = msPostGISBuildSQL(layer, &rect, NULL);
+  layerinfo->parambase = -1;
+  layerinfo->simplifycellsize = 0.0;
   if ( ! strSQL ) {
     msSetError(MS_QUERYERR, "Failed to build query SQL.", "msPostGISLayerWhichShapes()");
+    msPostGISFreeParams(layerinfo);
+    free(bind_key);
+    free(layer_bind_values);
     return MS_FAILURE;
   }
 
@@ -2574,7 +2956,21 @@ int msPostGISLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
     msDebug("msPostGISLayerWhichShapes query: %s\n", strSQL);
   }
 
-  if(num_bind_values > 0) {
+  if ( layerinfo->prepare ) {
+    int i, num_params = num_bind_values + layerinfo->paramcount;
+    Oid *param_types = (Oid*)msSmallCalloc(num_params + 1, sizeof(Oid));
+    layer_bind_values = (char**)msSmallRealloc(layer_bind_values, sizeof(char*) * (num_params + 1));
+    for (i = 0; i < layerinfo->paramcount; i++) {
+      param_types[num_bind_values + i] = layerinfo->paramtypes[i];
+      layer_bind_values[num_bind_values + i] = layerinfo->paramvalues[i];
+    }
+    pgresult = msPostGISExecPrepared(layer, strSQL, num_params, param_types, (const char**)layer_bind_values, num_bind_values > 0 ? 1 : 0);
+    if (!pgresult) {
+      pgresult = PQexecParams(layerinfo->pgconn, strSQL, num_params, param_types, (const char**)layer_bind_values, NULL, NULL, num_bind_values > 0 ? 1 : 0);
+    }
+    free(param_types);
+    msPostGISFreeParams(layerinfo);
+  } else if(num_bind_values > 0) {
     pgresult = PQexecParams(layerinfo->pgconn, strSQL, num_bind_values, NULL, (const char**)layer_bind_values, NULL, NULL, 1);
   } else {
     pgresult = PQexecParams(layerinfo->pgconn, strSQL,0, NULL, NULL, NULL, NULL, 0);
@@ -3475,6 +3871,121 @@ char *msPostGISEscapeSQLParam(layerObj *layer, const char *pszString)
 #endif
 }
 
+/*
+** msPostGISBuildSQLSpatialFilter()
+**
+** Translate an OGC filter spatial operator (Intersects, Within, DWithin,
+** ...) against a WKT geometry, already expressed in the layer projection,
+** into a predicate on the layer geometry column so that it can be
+** evaluated by the database instead of by GEOS on every returned shape.
+**
+** Returns malloc'ed char* that must be freed by caller, or NULL if the
+** operator is not supported.
+*/
+char *msPostGISBuildSQLSpatialFilter(layerObj *layer, const char *pszOperator,
+                                     const char *pszWKT, double dfDistance)
+{
+#ifdef USE_POSTGIS
+  msPostGISLayerInfo *layerinfo = NULL;
+  const char *pszFunction = NULL;
+  char *strSRID = NULL;
+  char *strWKT = NULL;
+  char *strFilter = NULL;
+  int bDistance = MS_FALSE;
+  int bNegate = MS_FALSE;
+  size_t sz;
+
+  if (layer->debug) {
+    msDebug("msPostGISBuildSQLSpatialFilter called.\n");
+  }
+
+  if (!pszOperator || !pszWKT)
+    return NULL;
+
+  if (strcasecmp(pszOperator, "BBOX") == 0 ||
+      strcasecmp(pszOperator, "Intersect") == 0 ||
+      strcasecmp(pszOperator, "Intersects") == 0)
+    pszFunction = "ST_Intersects";
+  else if (strcasecmp(pszOperator, "Equals") == 0)
+    pszFunction = "ST_Equals";
+  else if (strcasecmp(pszOperator, "Disjoint") == 0)
+    pszFunction = "ST_Disjoint";
+  else if (strcasecmp(pszOperator, "Touches") == 0)
+    pszFunction = "ST_Touches";
+  else if (strcasecmp(pszOperator, "Crosses") == 0)
+    pszFunction = "ST_Crosses";
+  else if (strcasecmp(pszOperator, "Within") == 0)
+    pszFunction = "ST_Within";
+  else if (strcasecmp(pszOperator, "Contains") == 0)
+    pszFunction = "ST_Contains";
+  else if (strcasecmp(pszOperator, "Overlaps") == 0)
+    pszFunction = "ST_Overlaps";
+  else if (strcasecmp(pszOperator, "DWithin") == 0) {
+    pszFunction = "ST_DWithin";
+    bDistance = MS_TRUE;
+  } else if (strcasecmp(pszOperator, "Beyond") == 0) {
+    pszFunction = "ST_DWithin";
+    bDistance = MS_TRUE;
+    bNegate = MS_TRUE;
+  } else
+    return NULL;
+
+  if (bDistance && dfDistance < 0)
+    return NULL;
+
+  if(!msPostGISLayerIsOpen(layer)) {
+    if (msPostGISLayerOpen(layer) != MS_SUCCESS)
+      return NULL;
+  }
+
+  assert( layer->layerinfo != NULL);
+
+  layerinfo = (msPostGISLayerInfo *)layer->layerinfo;
+
+  if ( ! layerinfo->geomcolumn ) {
+    if ( msPostGISParseData(layer) != MS_SUCCESS)
+      return NULL;
+  }
+
+  strSRID = msPostGISBuildSQLSRID(layer);
+  if ( ! strSRID )
+    return NULL;
+
+  strWKT = msPostGISEscapeSQLParam(layer, pszWKT);
+  if ( ! strWKT ) {
+    free(strSRID);
+    return NULL;
+  }
+
+  /* function + column + WKT + SRID + distance + template characters */
+  sz = strlen(pszFunction) + strlen(layerinfo->geomcolumn) + strlen(strWKT) +
+       strlen(strSRID) + 22 + 64;
+  strFilter = (char*)msSmallMalloc(sz+1);
+  if ( bDistance ) {
+    snprintf(strFilter, sz, "%s%s(%s,ST_GeomFromText('%s',%s),%.15g)",
+             bNegate ? "NOT " : "", pszFunction, layerinfo->geomcolumn,
+             strWKT, strSRID, dfDistance);
+  } else {
+    snprintf(strFilter, sz, "%s(%s,ST_GeomFromText('%s',%s))",
+             pszFunction, layerinfo->geomcolumn, strWKT, strSRID);
+  }
+
+  free(strWKT);
+  free(strSRID);
+
+  if (layer->debug > 1) {
+    msDebug("msPostGISBuildSQLSpatialFilter: %s\n", strFilter);
+  }
+
+  return strFilter;
+#else
+  msSetError( MS_MISCERR,
+              "PostGIS support is not available.",
+              "msPostGISBuildSQLSpatialFilter()");
+  return NULL;
+#endif
+}
+
 void msPostGISEnablePaging(layerObj *layer, int value)
 {
 #ifdef USE_POSTGIS
@@ -47,6 +47,12 @@
 #define BOXTOKEN "!BOX!"
 #define BOXTOKENLENGTH 5
 
+/* Server side simplification methods, see the SIMPLIFY processing option */
+#define MS_POSTGIS_SIMPLIFY_NONE 0
+#define MS_POSTGIS_SIMPLIFY_SNAPTOGRID 1
+#define MS_POSTGIS_SIMPLIFY_SIMPLIFY 2
+#define MS_POSTGIS_SIMPLIFY_REMOVEREPEATED 3
+
 /*
 ** msPostGISLayerInfo
 **
@@ -65,6 +71,14 @@ typedef struct {
   int         version;     /* PostGIS version of the database */
   int         paging;      /* Driver handling of pagination, enabled by default */
   int         force2d;     /* Pass geometry through ST_Force2D */
+  int         prepare;     /* Run WhichShapes queries as prepared statements */
+  int         parambase;   /* Bind values ahead of the query parameters, -1 to inline values */
+  int         paramcount;  /* Number of query parameters added while building the SQL */
+  char        **paramvalues; /* Values of the query parameters */
+  Oid         *paramtypes; /* Types of the query parameters */
+  int         simplify;    /* Server side simplification method used when drawing */
+  double      simplifytolerance; /* Simplification tolerance, in pixels */
+  double      simplifycellsize;  /* Cell size in layer units for the current draw, 0 for exact geometry */
 }
 msPostGISLayerInfo;
 
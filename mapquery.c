@@ -28,6 +28,7 @@
  ****************************************************************************/
 
 #include "mapserver.h"
+#include "mapthread.h"
 
 
 
@@ -55,6 +56,8 @@ int msInitQuery(queryObj *query)
   query->maxfeatures = -1;
   query->startindex = -1;
   query->only_cache_result_count = 0;
+  query->resultcallback = NULL;
+  query->resultcallbackdata = NULL;
   
   query->item = query->str = NULL;
   query->filter = NULL;
@@ -142,6 +145,18 @@ int msIsLayerQueryable(layerObj *lp)
   return MS_FALSE;
 }
 
+/* account for a result without storing it, see queryObj.resultcallback */
+static void countResult(resultCacheObj *cache, shapeObj *shape)
+{
+  cache->numresults++;
+
+  cache->previousBounds = cache->bounds;
+  if(cache->numresults == 1)
+    cache->bounds = shape->bounds;
+  else
+    msMergeRect(&(cache->bounds), &(shape->bounds));
+}
+
 static int addResult(resultCacheObj *cache, shapeObj *shape)
 {
   int i;
@@ -164,17 +179,360 @@ static int addResult(resultCacheObj *cache, shapeObj *shape)
   cache->results[i].tileindex = shape->tileindex;
   cache->results[i].shapeindex = shape->index;
   cache->results[i].resultindex = shape->resultindex;
-  cache->numresults++;
-
-  cache->previousBounds = cache->bounds;
-  if(cache->numresults == 1)
-    cache->bounds = shape->bounds;
-  else
-    msMergeRect(&(cache->bounds), &(shape->bounds));
+  countResult(cache, shape);
 
   return(MS_SUCCESS);
 }
 
+/*
+** Query result cache: the complete (unpaged) result set of a rect or filter
+** query on a layer, kept in process memory and keyed by everything that
+** determines the result, so that paged requests (WFS STARTINDEX/COUNT,
+** RESULTTYPE=hits, ...) on the same selection slice the stored results
+** instead of running the query again. Point queries (GetFeatureInfo) are
+** not paged, their results are cached as they are. Enabled per layer with
+** PROCESSING "QUERY_CACHE_TTL=<seconds>". Cached results are fetched back
+** with msLayerGetShape() by shape index, like results loaded from a
+** QUERYFILE. Result sets larger than MS_QUERY_CACHE_MAX_RESULTS are not
+** cached: collecting them stops there and the layer is queried again
+** without the cache.
+*/
+#define MS_QUERY_CACHE_MAX_ENTRIES 32
+#define MS_QUERY_CACHE_MAX_RESULTS 1000000
+
+typedef struct queryCacheEntryObj {
+  char *key;
+  time_t expires;
+  int numresults;
+  long *shapeindex;
+  int *classindex;
+  int *tileindex; /* NULL when no result has a tile index */
+  rectObj *bounds;
+  struct queryCacheEntryObj *next;
+} queryCacheEntryObj;
+
+static queryCacheEntryObj *queryCache = NULL; /* most recently used first */
+
+static void msFreeQueryCacheEntry(queryCacheEntryObj *entry)
+{
+  msFree(entry->key);
+  msFree(entry->shapeindex);
+  msFree(entry->classindex);
+  msFree(entry->tileindex);
+  msFree(entry->bounds);
+  msFree(entry);
+}
+
+void msQueryCacheCleanup(void)
+{
+  msAcquireLock(TLOCK_QUERYCACHE);
+  while(queryCache) {
+    queryCacheEntryObj *next = queryCache->next;
+    msFreeQueryCacheEntry(queryCache);
+    queryCache = next;
+  }
+  msReleaseLock(TLOCK_QUERYCACHE);
+}
+
+/*
+** Paging parameters put aside while the complete result set of a layer is
+** collected for the cache. They are restored on every way out of the layer.
+*/
+typedef struct {
+  int saved;
+  int startindex, maxfeatures, layermaxfeatures, onlycount;
+} queryCachePagingObj;
+
+static void msQueryCacheSavePaging(mapObj *map, layerObj *lp, queryCachePagingObj *paging)
+{
+  paging->saved = MS_TRUE;
+  paging->startindex = map->query.startindex;
+  paging->maxfeatures = map->query.maxfeatures;
+  paging->layermaxfeatures = lp->maxfeatures;
+  paging->onlycount = map->query.only_cache_result_count;
+  map->query.startindex = -1;
+  map->query.maxfeatures = -1;
+  lp->maxfeatures = -1;
+  map->query.only_cache_result_count = MS_FALSE;
+}
+
+static void msQueryCacheRestorePaging(mapObj *map, layerObj *lp, queryCachePagingObj *paging)
+{
+  if(!paging->saved) return;
+  map->query.startindex = paging->startindex;
+  map->query.maxfeatures = paging->maxfeatures;
+  lp->maxfeatures = paging->layermaxfeatures;
+  map->query.only_cache_result_count = paging->onlycount;
+  paging->saved = MS_FALSE;
+}
+
+static int msQueryCacheTTL(mapObj *map, layerObj *lp)
+{
+  const char *ttl;
+
+  if(map->query.resultcallback) return 0; /* results are streamed, nothing to store */
+  if(lp->connectiontype == MS_INLINE) return 0;
+
+  ttl = msLayerGetProcessingKey(lp, "QUERY_CACHE_TTL");
+  if(!ttl) return 0;
+  return MS_MAX(0, atoi(ttl));
+}
+
+static char *msQueryCacheAppendKey(char *key, const char *value)
+{
+  key = msStringConcatenate(key, value ? value : "");
+  return msStringConcatenate(key, "\n");
+}
+
+static char *msQueryCacheKey(mapObj *map, layerObj *lp, rectObj *rect)
+{
+  char *key = NULL, *proj;
+  char szTmp[256];
+  int i;
+
+  key = msQueryCacheAppendKey(key, map->mappath);
+  key = msQueryCacheAppendKey(key, map->name);
+  snprintf(szTmp, sizeof(szTmp), "%d %d %.15g %.15g %.15g %.15g %.15g",
+           lp->index, map->query.type, rect->minx, rect->miny, rect->maxx, rect->maxy,
+           map->scaledenom);
+  key = msQueryCacheAppendKey(key, szTmp);
+  key = msQueryCacheAppendKey(key, map->query.filter ? map->query.filter->string : NULL);
+
+  proj = msGetProjectionString(&(map->projection));
+  key = msQueryCacheAppendKey(key, proj);
+  msFree(proj);
+  proj = msGetProjectionString(&(lp->projection));
+  key = msQueryCacheAppendKey(key, proj);
+  msFree(proj);
+
+  key = msQueryCacheAppendKey(key, lp->name);
+  key = msQueryCacheAppendKey(key, lp->connection);
+  key = msQueryCacheAppendKey(key, lp->data);
+  key = msQueryCacheAppendKey(key, lp->tileindex);
+  key = msQueryCacheAppendKey(key, lp->filter.string);
+  key = msQueryCacheAppendKey(key, lp->filteritem);
+  key = msQueryCacheAppendKey(key, lp->classitem);
+  key = msQueryCacheAppendKey(key, lp->classgroup);
+  key = msQueryCacheAppendKey(key, lp->template);
+  for(i=0; i<lp->numclasses; i++) {
+    snprintf(szTmp, sizeof(szTmp), "%d", lp->class[i]->status);
+    key = msQueryCacheAppendKey(key, szTmp);
+    key = msQueryCacheAppendKey(key, lp->class[i]->expression.string);
+    key = msQueryCacheAppendKey(key, lp->class[i]->group);
+    key = msQueryCacheAppendKey(key, lp->class[i]->template);
+  }
+  for(i=0; i<lp->sortBy.nProperties; i++) {
+    key = msQueryCacheAppendKey(key, lp->sortBy.properties[i].item);
+    key = msQueryCacheAppendKey(key, lp->sortBy.properties[i].sortOrder == SORT_DESC ? "DESC" : "ASC");
+  }
+  /* NATIVE_FILTER and friends change what the data source returns */
+  for(i=0; i<lp->numprocessing; i++)
+    key = msQueryCacheAppendKey(key, lp->processing[i]);
+
+  return key;
+}
+
+/*
+** Point queries also depend on the query mode and result limits, rect is
+** the tolerance box around the query point.
+*/
+static char *msQueryCachePointKey(mapObj *map, layerObj *lp, rectObj *rect)
+{
+  char *key;
+  char szTmp[64];
+
+  key = msQueryCacheKey(map, lp, rect);
+  snprintf(szTmp, sizeof(szTmp), "%d %d %d", map->query.mode, map->query.maxresults, lp->maxfeatures);
+  return msQueryCacheAppendKey(key, szTmp);
+}
+
+/*
+** Rebuild the layer result cache from a complete result set, applying the
+** startindex/maxfeatures of the current query exactly as the query loops do.
+*/
+static int msQueryCacheApply(mapObj *map, layerObj *lp, queryCacheEntryObj *entry, int countmaxfeatures)
+{
+  shapeObj shape;
+  int i;
+
+  lp->resultcache = (resultCacheObj *)malloc(sizeof(resultCacheObj));
+  MS_CHECK_ALLOC(lp->resultcache, sizeof(resultCacheObj), MS_FAILURE);
+  initResultCache(lp->resultcache);
+
+  msInitShape(&shape);
+  for(i=0; i<entry->numresults; i++) {
+    if(map->query.startindex > 1) {
+      --map->query.startindex;
+      continue;
+    }
+
+    if(map->query.only_cache_result_count)
+      lp->resultcache->numresults++;
+    else {
+      shape.index = entry->shapeindex[i];
+      shape.classindex = entry->classindex[i];
+      shape.tileindex = entry->tileindex ? entry->tileindex[i] : -1;
+      shape.resultindex = -1; /* fetched back by shape index */
+      shape.bounds = entry->bounds[i];
+      if(addResult(lp->resultcache, &shape) != MS_SUCCESS)
+        return MS_FAILURE;
+    }
+    if(countmaxfeatures)
+      --map->query.maxfeatures;
+
+    if(lp->maxfeatures > 0 && lp->maxfeatures == lp->resultcache->numresults)
+      break;
+  }
+
+  return MS_SUCCESS;
+}
+
+/*
+** Look for a live entry and apply it to the layer. Returns MS_SUCCESS on a
+** hit, MS_DONE on a miss.
+*/
+static int msQueryCacheLookup(mapObj *map, layerObj *lp, const char *key, int countmaxfeatures)
+{
+  queryCacheEntryObj *entry, *prev = NULL;
+  time_t now = time(NULL);
+  int status = MS_DONE;
+
+  msAcquireLock(TLOCK_QUERYCACHE);
+  for(entry=queryCache; entry; prev=entry, entry=entry->next) {
+    if(strcmp(entry->key, key) != 0) continue;
+
+    if(entry->expires <= now) { /* stale, drop it */
+      if(prev) prev->next = entry->next;
+      else queryCache = entry->next;
+      msFreeQueryCacheEntry(entry);
+      break;
+    }
+
+    if(prev) { /* move to front */
+      prev->next = entry->next;
+      entry->next = queryCache;
+      queryCache = entry;
+    }
+    status = msQueryCacheApply(map, lp, entry, countmaxfeatures);
+    break;
+  }
+  msReleaseLock(TLOCK_QUERYCACHE);
+
+  if(status == MS_SUCCESS && lp->debug >= MS_DEBUGLEVEL_V)
+    msDebug("msQueryCacheLookup(): %d cached results reused for layer %s\n", lp->resultcache->numresults, lp->name);
+
+  return status;
+}
+
+/*
+** The result cache does not keep the bounds of each result, the query loops
+** collect them in a side array while a result set is being cached.
+*/
+static void msQueryCacheKeepBounds(rectObj **bounds, int *size, int i, rectObj *rect)
+{
+  if(i >= *size) {
+    *size = MS_MAX(2 * (*size), MS_RESULTCACHEINCREMENT);
+    *bounds = (rectObj *) msSmallRealloc(*bounds, (*size) * sizeof(rectObj));
+  }
+  (*bounds)[i] = *rect;
+}
+
+/*
+** Build an entry from the complete result set now in the layer result
+** cache, takes ownership of the bounds array.
+*/
+static queryCacheEntryObj *msQueryCacheCreateEntry(resultCacheObj *cache, const char *key, int ttl, rectObj *bounds)
+{
+  queryCacheEntryObj *entry;
+  int i, n = cache->numresults;
+
+  entry = (queryCacheEntryObj *) msSmallCalloc(1, sizeof(queryCacheEntryObj));
+  entry->key = msStrdup(key);
+  entry->expires = time(NULL) + ttl;
+  entry->numresults = n;
+  entry->bounds = bounds;
+  if(n > 0) {
+    entry->shapeindex = (long *) msSmallMalloc(n * sizeof(long));
+    entry->classindex = (int *) msSmallMalloc(n * sizeof(int));
+  }
+  for(i=0; i<n; i++) {
+    entry->shapeindex[i] = cache->results[i].shapeindex;
+    entry->classindex[i] = cache->results[i].classindex;
+    if(cache->results[i].tileindex != -1 && !entry->tileindex) {
+      int j;
+      entry->tileindex = (int *) msSmallMalloc(n * sizeof(int));
+      for(j=0; j<i; j++)
+        entry->tileindex[j] = -1;
+    }
+    if(entry->tileindex)
+      entry->tileindex[i] = cache->results[i].tileindex;
+  }
+
+  return entry;
+}
+
+static void msQueryCacheInsert(queryCacheEntryObj *entry)
+{
+  queryCacheEntryObj *prev;
+  int i;
+
+  if(entry->numresults > MS_QUERY_CACHE_MAX_RESULTS) {
+    msFreeQueryCacheEntry(entry);
+    return;
+  }
+
+  msAcquireLock(TLOCK_QUERYCACHE);
+  entry->next = queryCache;
+  queryCache = entry;
+  /* drop the least recently used entries */
+  for(i=1, prev=queryCache; prev->next; prev=prev->next, i++) {
+    if(i >= MS_QUERY_CACHE_MAX_ENTRIES) {
+      while(prev->next) {
+        queryCacheEntryObj *next = prev->next->next;
+        msFreeQueryCacheEntry(prev->next);
+        prev->next = next;
+      }
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_QUERYCACHE);
+}
+
+/*
+** Called once a query loop has collected the complete result set of a
+** layer: cache it and replace the layer results by the page that was
+** actually asked for.
+*/
+static int msQueryCacheComplete(mapObj *map, layerObj *lp, const char *key, int ttl, rectObj *bounds, int countmaxfeatures)
+{
+  queryCacheEntryObj *entry;
+  int status;
+
+  entry = msQueryCacheCreateEntry(lp->resultcache, key, ttl, bounds);
+  if(lp->resultcache->results) free(lp->resultcache->results);
+  free(lp->resultcache);
+  lp->resultcache = NULL;
+
+  status = msQueryCacheApply(map, lp, entry, countmaxfeatures);
+  msQueryCacheInsert(entry);
+  return status;
+}
+
+/*
+** On a cache hit the layer still has to be ready for msLayerGetShape().
+*/
+static int msQueryCacheOpenLayer(mapObj *map, layerObj *lp)
+{
+  if(!map->query.only_cache_result_count && lp->resultcache->numresults == 0) {
+    msLayerClose(lp); /* no need to keep the layer open */
+    return MS_SUCCESS;
+  }
+  msLayerClose(lp); /* reset */
+  if(msLayerOpen(lp) != MS_SUCCESS)
+    return MS_FAILURE;
+  return msLayerWhichItems(lp, MS_TRUE, NULL);
+}
+
 /*
 ** Serialize a query result set to disk.
 */
@@ -809,6 +1167,12 @@ int msQueryByFilter(mapObj *map)
   int *classgroup = NULL;
   double minfeaturesize = -1;
 
+  int qcachettl = 0, qboundssize = 0;
+  char *qcachekey = NULL;
+  rectObj *qbounds = NULL;
+  queryCachePagingObj qpaging = {MS_FALSE};
+  int qnocachelayer = -1;
+
   if(map->query.type != MS_QUERY_BY_FILTER) {
     msSetError(MS_QUERYERR, "The query is not properly defined.", "msQueryByFilter()");
     return(MS_FAILURE);
@@ -861,6 +1225,22 @@ int msQueryByFilter(mapObj *map)
       if((lp->mingeowidth > 0) && ((map->extent.maxx - map->extent.minx) < lp->mingeowidth)) continue;
     }
 
+    qcachettl = (l == qnocachelayer) ? 0 : msQueryCacheTTL(map, lp);
+    if(qcachettl > 0) {
+      msFree(qcachekey);
+      qcachekey = msQueryCacheKey(map, lp, &(map->query.rect));
+      if(msQueryCacheLookup(map, lp, qcachekey, MS_FALSE) == MS_SUCCESS) {
+        if(msQueryCacheOpenLayer(map, lp) != MS_SUCCESS) {
+          msFree(qcachekey);
+          return MS_FAILURE;
+        }
+        continue;
+      }
+
+      /* collect the complete result set, the requested page is taken from it afterwards */
+      msQueryCacheSavePaging(map, lp, &qpaging);
+    }
+
     initExpression(&old_filter);
     msCopyExpression(&old_filter, &lp->filter); /* save existing filter */
     if(msLayerSupportsCommonFilters(lp)) {
@@ -893,6 +1273,7 @@ int msQueryByFilter(mapObj *map)
 
     status = msLayerWhichShapes(lp, search_rect, MS_TRUE);
     if(status == MS_DONE) { /* no overlap */
+      msQueryCacheRestorePaging(map, lp, &qpaging); /* no overlap, restore the paging parameters */
       msLayerClose(lp);
       continue;
     } else if(status != MS_SUCCESS) goto query_error;
@@ -955,8 +1336,11 @@ int msQueryByFilter(mapObj *map)
     
       if( map->query.only_cache_result_count )
         lp->resultcache->numresults ++;
-      else
+      else {
         addResult(lp->resultcache, &shape);
+        if(qcachettl > 0)
+          msQueryCacheKeepBounds(&qbounds, &qboundssize, lp->resultcache->numresults-1, &shape.bounds);
+      }
       msFreeShape(&shape);
 
       /* check shape count */
@@ -964,6 +1348,11 @@ int msQueryByFilter(mapObj *map)
         status = MS_DONE;
         break;
       }
+
+      if(qcachettl > 0 && lp->resultcache->numresults > MS_QUERY_CACHE_MAX_RESULTS) {
+        status = MS_DONE; /* too many to be cached */
+        break;
+      }
     } /* next shape */
 
     if(classgroup) msFree(classgroup);
@@ -972,11 +1361,38 @@ int msQueryByFilter(mapObj *map)
     freeExpression(&old_filter);
 
     if(status != MS_DONE) goto query_error;
+
+    if(qcachettl > 0 && lp->resultcache->numresults > MS_QUERY_CACHE_MAX_RESULTS) {
+      msQueryCacheRestorePaging(map, lp, &qpaging);
+      msFree(qbounds);
+      qbounds = NULL;
+      qboundssize = 0;
+      if(lp->debug >= MS_DEBUGLEVEL_V)
+        msDebug("msQueryByFilter(): too many results to cache for layer %s, querying it again.\n", lp->name);
+      qnocachelayer = l;
+      l++; /* same layer again, without the cache */
+      continue;
+    }
+
+    if(qcachettl > 0) {
+      msQueryCacheRestorePaging(map, lp, &qpaging);
+      status = msQueryCacheComplete(map, lp, qcachekey, qcachettl, qbounds, MS_FALSE);
+      qbounds = NULL;
+      qboundssize = 0;
+      if(status != MS_SUCCESS) {
+        msFree(qcachekey);
+        msLayerClose(lp);
+        return MS_FAILURE;
+      }
+    }
+
     if(!map->query.only_cache_result_count &&
         lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
 
   } /* next layer */
 
+  msFree(qcachekey);
+
   /* was anything found? */
   for(l=start; l>=stop; l--) {
     if(GET_LAYER(map, l)->resultcache && GET_LAYER(map, l)->resultcache->numresults > 0)
@@ -987,9 +1403,12 @@ int msQueryByFilter(mapObj *map)
   return MS_FAILURE;
 
 query_error:
+  msQueryCacheRestorePaging(map, lp, &qpaging);
   msCopyExpression(&lp->filter, &old_filter); /* restore old filter */
   freeExpression(&old_filter);
   msLayerClose(lp);
+  msFree(qbounds);
+  msFree(qcachekey);
   return MS_FAILURE;
 }
 
@@ -1010,6 +1429,12 @@ int msQueryByRect(mapObj *map)
   int *classgroup = NULL;
   double minfeaturesize = -1;
 
+  int qcachettl, qboundssize = 0;
+  char *qcachekey = NULL;
+  rectObj *qbounds = NULL;
+  queryCachePagingObj qpaging = {MS_FALSE};
+  int qnocachelayer = -1;
+
   if(map->query.type != MS_QUERY_BY_RECT) {
     msSetError(MS_QUERYERR, "The query is not properly defined.", "msQueryByRect()");
     return(MS_FAILURE);
@@ -1087,9 +1512,30 @@ int msQueryByRect(mapObj *map)
 
     /* Paging could have been disabled before */
     paging = msLayerGetPaging(lp);
+
+    qcachettl = (l == qnocachelayer) ? 0 : msQueryCacheTTL(map, lp);
+    if(qcachettl > 0) {
+      msFree(qcachekey);
+      qcachekey = msQueryCacheKey(map, lp, &searchrect);
+      if(msQueryCacheLookup(map, lp, qcachekey, MS_TRUE) == MS_SUCCESS) {
+        if(msQueryCacheOpenLayer(map, lp) != MS_SUCCESS) {
+          msFree(qcachekey);
+          msFreeShape(&searchshape);
+          return(MS_FAILURE);
+        }
+        continue;
+      }
+
+      /* collect the complete result set, the requested page is taken from it afterwards */
+      msQueryCacheSavePaging(map, lp, &qpaging);
+      paging = MS_FALSE;
+    }
+
     msLayerClose(lp); /* reset */
     status = msLayerOpen(lp);
     if(status != MS_SUCCESS) {
+        msQueryCacheRestorePaging(map, lp, &qpaging);
+        msFree(qcachekey);
         msFreeShape(&searchshape);
         return(MS_FAILURE);
     }
@@ -1098,6 +1544,8 @@ int msQueryByRect(mapObj *map)
     /* build item list, we want *all* items */
     status = msLayerWhichItems(lp, MS_TRUE, NULL);
     if(status != MS_SUCCESS) {
+        msQueryCacheRestorePaging(map, lp, &qpaging);
+        msFree(qcachekey);
         msFreeShape(&searchshape);
         return(MS_FAILURE);
     }
@@ -1110,16 +1558,26 @@ int msQueryByRect(mapObj *map)
 #endif
     status = msLayerWhichShapes(lp, searchrect, MS_TRUE);
     if(status == MS_DONE) { /* no overlap */
+      msQueryCacheRestorePaging(map, lp, &qpaging); /* no overlap, restore the paging parameters */
       msLayerClose(lp);
       continue;
     } else if(status != MS_SUCCESS) {
+      msQueryCacheRestorePaging(map, lp, &qpaging);
       msLayerClose(lp);
+      msFree(qcachekey);
       msFreeShape(&searchshape);
       return(MS_FAILURE);
     }
 
     lp->resultcache = (resultCacheObj *)malloc(sizeof(resultCacheObj)); /* allocate and initialize the result cache */
-    MS_CHECK_ALLOC(lp->resultcache, sizeof(resultCacheObj), MS_FAILURE);
+    if(lp->resultcache == NULL) {
+      msSetError(MS_MEMERR, "%s: %d: Out of memory allocating %u bytes.\n", "msQueryByRect()",
+                 __FILE__, __LINE__, (unsigned int)sizeof(resultCacheObj));
+      msQueryCacheRestorePaging(map, lp, &qpaging);
+      msFree(qcachekey);
+      msFreeShape(&searchshape);
+      return(MS_FAILURE);
+    }
     initResultCache( lp->resultcache);
 
     nclasses = 0;
@@ -1187,8 +1645,19 @@ int msQueryByRect(mapObj *map)
         }
         if( map->query.only_cache_result_count )
             lp->resultcache->numresults ++;
-        else
+        else if( map->query.resultcallback ) {
+            countResult(lp->resultcache, &shape);
+            if(map->query.resultcallback(map, lp, &shape, map->query.resultcallbackdata) != MS_SUCCESS) {
+              msFreeShape(&shape);
+              status = MS_FAILURE;
+              break;
+            }
+        }
+        else {
             addResult(lp->resultcache, &shape);
+            if(qcachettl > 0)
+              msQueryCacheKeepBounds(&qbounds, &qboundssize, lp->resultcache->numresults-1, &shape.bounds);
+        }
         --map->query.maxfeatures;
       }
       msFreeShape(&shape);
@@ -1198,6 +1667,11 @@ int msQueryByRect(mapObj *map)
         status = MS_DONE;
         break;
       }
+
+      if(qcachettl > 0 && lp->resultcache->numresults > MS_QUERY_CACHE_MAX_RESULTS) {
+        status = MS_DONE; /* too many to be cached */
+        break;
+      }
       
     } /* next shape */
 
@@ -1205,14 +1679,42 @@ int msQueryByRect(mapObj *map)
       msFree(classgroup);
 
     if(status != MS_DONE) {
+        msQueryCacheRestorePaging(map, lp, &qpaging);
+        msFree(qbounds);
+        msFree(qcachekey);
+        msFreeShape(&searchshape);
+        return(MS_FAILURE);
+    }
+
+    if(qcachettl > 0 && lp->resultcache->numresults > MS_QUERY_CACHE_MAX_RESULTS) {
+      msQueryCacheRestorePaging(map, lp, &qpaging);
+      msFree(qbounds);
+      qbounds = NULL;
+      qboundssize = 0;
+      if(lp->debug >= MS_DEBUGLEVEL_V)
+        msDebug("msQueryByRect(): too many results to cache for layer %s, querying it again.\n", lp->name);
+      qnocachelayer = l;
+      l++; /* same layer again, without the cache */
+      continue;
+    }
+
+    if(qcachettl > 0) {
+      msQueryCacheRestorePaging(map, lp, &qpaging);
+      status = msQueryCacheComplete(map, lp, qcachekey, qcachettl, qbounds, MS_TRUE);
+      qbounds = NULL;
+      qboundssize = 0;
+      if(status != MS_SUCCESS) {
+        msFree(qcachekey);
         msFreeShape(&searchshape);
         return(MS_FAILURE);
+      }
     }
 
     if( !map->query.only_cache_result_count &&
         lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
   } /* next layer */
 
+  msFree(qcachekey);
   msFreeShape(&searchshape);
 
   /* was anything found? */
@@ -1246,6 +1748,7 @@ int msQueryByFeatures(mapObj *map)
 
   rectObj searchrect;
   shapeObj shape, selectshape;
+  edgeIndexObj *selectindex = NULL;
   int nclasses = 0;
   int *classgroup = NULL;
   double minfeaturesize = -1;
@@ -1404,6 +1907,10 @@ int msQueryByFeatures(mapObj *map)
       if (lp->minfeaturesize > 0)
         minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
+      /* index the selection shape edges once, they are tested against every candidate shape */
+      if(tolerance == 0)
+        selectindex = msCreateEdgeIndex(&selectshape);
+
       while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
 
         /* check for dups when there are multiple selection shapes */
@@ -1443,7 +1950,7 @@ int msQueryByFeatures(mapObj *map)
             switch(shape.type) { /* make sure shape actually intersects the selectshape */
               case MS_SHAPE_POINT:
                 if(tolerance == 0) /* just test for intersection */
-                  status = msIntersectMultipointPolygon(&shape, &selectshape);
+                  status = msIntersectMultipointPolygonIndexed(&shape, &selectshape, selectindex);
                 else { /* check distance, distance=0 means they intersect */
                   distance = msDistanceShapeToShape(&selectshape, &shape);
                   if(distance < tolerance) status = MS_TRUE;
@@ -1451,7 +1958,7 @@ int msQueryByFeatures(mapObj *map)
                 break;
               case MS_SHAPE_LINE:
                 if(tolerance == 0) { /* just test for intersection */
-                  status = msIntersectPolylinePolygon(&shape, &selectshape);
+                  status = msIntersectPolylinePolygonIndexed(&shape, &selectshape, selectindex);
                 } else { /* check distance, distance=0 means they intersect */
                   distance = msDistanceShapeToShape(&selectshape, &shape);
                   if(distance < tolerance) status = MS_TRUE;
@@ -1459,7 +1966,7 @@ int msQueryByFeatures(mapObj *map)
                 break;
               case MS_SHAPE_POLYGON:
                 if(tolerance == 0) /* just test for intersection */
-                  status = msIntersectPolygons(&shape, &selectshape);
+                  status = msIntersectPolygonsIndexed(&shape, &selectshape, selectindex);
                 else { /* check distance, distance=0 means they intersect */
                   distance = msDistanceShapeToShape(&selectshape, &shape);
                   if(distance < tolerance) status = MS_TRUE;
@@ -1483,7 +1990,7 @@ int msQueryByFeatures(mapObj *map)
                 break;
               case MS_SHAPE_LINE:
                 if(tolerance == 0) { /* just test for intersection */
-                  status = msIntersectPolylines(&shape, &selectshape);
+                  status = msIntersectPolylinesIndexed(&shape, &selectshape, selectindex);
                 } else { /* check distance, distance=0 means they intersect */
                   distance = msDistanceShapeToShape(&selectshape, &shape);
                   if(distance < tolerance) status = MS_TRUE;
@@ -1524,6 +2031,9 @@ int msQueryByFeatures(mapObj *map)
         }
       } /* next shape */
 
+      msFreeEdgeIndex(selectindex);
+      selectindex = NULL;
+
       if (classgroup)
         msFree(classgroup);
 
@@ -1559,215 +2069,547 @@ int msQueryByFeatures(mapObj *map)
  *     returned are the first ones found in each layer and are not necessarily
  *     the closest ones).
  */
-int msQueryByPoint(mapObj *map)
+/*
+** State of a point query on one layer. The query of a layer is split in
+** steps so that msQueryByPointThreaded() can fetch the shapes of several
+** layers concurrently: msQueryByPointLayerFetch() only touches the layer,
+** everything using shared state (projections, class expressions, the map
+** query) is done by the calling thread, in layer order.
+*/
+typedef struct {
+  double t; /* search tolerance, distance of the closest result in single mode */
+  rectObj searchrect; /* in the layer projection */
+  int paging;
+  int nclasses;
+  int *classgroup;
+  double minfeaturesize;
+
+  int qcachettl, qboundssize;
+  char *qcachekey;
+  rectObj *qbounds;
+
+  shapeObj *shapes; /* matching shapes collected by a worker thread */
+  double *distances;
+  int numshapes, maxshapes;
+  int maxcollect; /* number of shapes worth collecting, 0 for all */
+  int hasprojection;
+  projectionObj projection; /* worker thread copy of the map projection */
+} queryByPointStateObj;
+
+static void msQueryByPointStateFree(queryByPointStateObj *qs)
 {
-  int l;
-  int start, stop=0;
+  int i;
+
+  for(i=0; i<qs->numshapes; i++)
+    msFreeShape(&(qs->shapes[i]));
+  msFree(qs->shapes);
+  msFree(qs->distances);
+  if(qs->hasprojection)
+    msFreeProjection(&(qs->projection));
+  msFree(qs->classgroup);
+  msFree(qs->qcachekey);
+  msFree(qs->qbounds);
+  memset(qs, 0, sizeof(queryByPointStateObj));
+}
 
-  double d, t;
+/*
+** Layer checks, raster layers, search rectangle and query cache lookup.
+** Returns MS_SUCCESS if the shapes of the layer have to be fetched, MS_DONE
+** if there is nothing more to do for this layer.
+*/
+static int msQueryByPointLayerBegin(mapObj *map, layerObj *lp, queryByPointStateObj *qs)
+{
+  double t;
   double layer_tolerance;
+  rectObj rect;
 
-  layerObj *lp;
+  memset(qs, 0, sizeof(queryByPointStateObj));
+  qs->minfeaturesize = -1;
 
-  int paging;
-  char status;
-  rectObj rect, searchrect;
-  shapeObj shape;
-  int nclasses = 0;
-  int *classgroup = NULL;
-  double minfeaturesize = -1;
+  if(!msIsLayerQueryable(lp)) return(MS_DONE);
+  if(lp->status == MS_OFF) return(MS_DONE);
 
-  if(map->query.type != MS_QUERY_BY_POINT) {
-    msSetError(MS_QUERYERR, "The query is not properly defined.", "msQueryByPoint()");
-    return(MS_FAILURE);
+  if(map->scaledenom > 0) {
+    if((lp->maxscaledenom > 0) && (map->scaledenom > lp->maxscaledenom)) return(MS_DONE);
+    if((lp->minscaledenom > 0) && (map->scaledenom <= lp->minscaledenom)) return(MS_DONE);
   }
 
-  msInitShape(&shape);
-
-  if(map->query.layer < 0 || map->query.layer >= map->numlayers)
-    start = map->numlayers-1;
-  else
-    start = stop = map->query.layer;
+  if (lp->maxscaledenom <= 0 && lp->minscaledenom <= 0) {
+    if((lp->maxgeowidth > 0) && ((map->extent.maxx - map->extent.minx) > lp->maxgeowidth)) return(MS_DONE);
+    if((lp->mingeowidth > 0) && ((map->extent.maxx - map->extent.minx) < lp->mingeowidth)) return(MS_DONE);
+  }
 
-  for(l=start; l>=stop; l--) {
-    lp = (GET_LAYER(map, l));
-    if (map->query.maxfeatures == 0)
-      break; /* nothing else to do */
-    else if (map->query.maxfeatures > 0)
-      lp->maxfeatures = map->query.maxfeatures;
+  /* Raster layers are handled specially.  */
+  if( lp->type == MS_LAYER_RASTER ) {
+    if( msRasterQueryByPoint( map, lp, map->query.mode, map->query.point, map->query.buffer, map->query.maxresults ) == MS_FAILURE )
+      return(MS_FAILURE);
+    return(MS_DONE);
+  }
 
-    /* using mapscript, the map->query.startindex will be unset... */
-    if (lp->startindex > 1 && map->query.startindex < 0)
-      map->query.startindex = lp->startindex;
-    
-    /* conditions may have changed since this layer last drawn, so set
-       layer->project true to recheck projection needs (Bug #673) */
-    lp->project = MS_TRUE;
+  /* Get the layer tolerance default is 3 for point and line layers, 0 for others */
+  if(lp->tolerance == -1) {
+    if(lp->type == MS_LAYER_POINT || lp->type == MS_LAYER_LINE)
+      layer_tolerance = 3;
+    else
+      layer_tolerance = 0;
+  } else
+    layer_tolerance = lp->tolerance;
 
-    /* free any previous search results, do it now in case one of the next few tests fail */
-    if(lp->resultcache) {
-      if(lp->resultcache->results) free(lp->resultcache->results);
-      free(lp->resultcache);
-      lp->resultcache = NULL;
+  if(map->query.buffer <= 0) { /* use layer tolerance */
+    if(lp->toleranceunits == MS_PIXELS)
+      t = layer_tolerance * MS_MAX(MS_CELLSIZE(map->extent.minx, map->extent.maxx, map->width),
+                                   MS_CELLSIZE(map->extent.miny, map->extent.maxy, map->height));
+    else
+      t = layer_tolerance * (msInchesPerUnit(lp->toleranceunits,0)/msInchesPerUnit(map->units,0));
+  } else /* use buffer distance */
+    t = map->query.buffer;
+
+  rect.minx = map->query.point.x - t;
+  rect.maxx = map->query.point.x + t;
+  rect.miny = map->query.point.y - t;
+  rect.maxy = map->query.point.y + t;
+  qs->t = t;
+
+  /* skipped features aren't kept, only unskipped result sets are cached */
+  qs->qcachettl = (map->query.startindex > 1) ? 0 : msQueryCacheTTL(map, lp);
+  if(qs->qcachettl > 0) {
+    qs->qcachekey = msQueryCachePointKey(map, lp, &rect);
+    if(msQueryCacheLookup(map, lp, qs->qcachekey, MS_FALSE) == MS_SUCCESS) {
+      if(msQueryCacheOpenLayer(map, lp) != MS_SUCCESS)
+        return(MS_FAILURE);
+      return(MS_DONE);
     }
+  }
 
-    if(!msIsLayerQueryable(lp)) continue;
-    if(lp->status == MS_OFF) continue;
-
-    if(map->scaledenom > 0) {
-      if((lp->maxscaledenom > 0) && (map->scaledenom > lp->maxscaledenom)) continue;
-      if((lp->minscaledenom > 0) && (map->scaledenom <= lp->minscaledenom)) continue;
-    }
+  /* Paging could have been disabled before */
+  qs->paging = msLayerGetPaging(lp);
 
-    if (lp->maxscaledenom <= 0 && lp->minscaledenom <= 0) {
-      if((lp->maxgeowidth > 0) && ((map->extent.maxx - map->extent.minx) > lp->maxgeowidth)) continue;
-      if((lp->mingeowidth > 0) && ((map->extent.maxx - map->extent.minx) < lp->mingeowidth)) continue;
-    }
+  /* identify target shapes */
+  qs->searchrect = rect;
+#ifdef USE_PROJ
+  if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
+    msProjectRect(&(map->projection), &(lp->projection), &(qs->searchrect)); /* project the searchrect to source coords */
+  else
+    lp->project = MS_FALSE;
+#endif
 
-    /* Raster layers are handled specially.  */
-    if( lp->type == MS_LAYER_RASTER ) {
-      if( msRasterQueryByPoint( map, lp, map->query.mode, map->query.point, map->query.buffer, map->query.maxresults ) == MS_FAILURE )
-        return MS_FAILURE;
-      continue;
-    }
+  if (lp->classgroup && lp->numclasses > 0)
+    qs->classgroup = msAllocateValidClassGroups(lp, &(qs->nclasses));
 
-    /* Get the layer tolerance default is 3 for point and line layers, 0 for others */
-    if(lp->tolerance == -1) {
-      if(lp->type == MS_LAYER_POINT || lp->type == MS_LAYER_LINE)
-        layer_tolerance = 3;
-      else
-        layer_tolerance = 0;
-    } else
-      layer_tolerance = lp->tolerance;
+  if (lp->minfeaturesize > 0)
+    qs->minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
-    if(map->query.buffer <= 0) { /* use layer tolerance */
-      if(lp->toleranceunits == MS_PIXELS)
-        t = layer_tolerance * MS_MAX(MS_CELLSIZE(map->extent.minx, map->extent.maxx, map->width),
-                                     MS_CELLSIZE(map->extent.miny, map->extent.maxy, map->height));
-      else
-        t = layer_tolerance * (msInchesPerUnit(lp->toleranceunits,0)/msInchesPerUnit(map->units,0));
-    } else /* use buffer distance */
-      t = map->query.buffer;
+  return(MS_SUCCESS);
+}
 
-    rect.minx = map->query.point.x - t;
-    rect.maxx = map->query.point.x + t;
-    rect.miny = map->query.point.y - t;
-    rect.maxy = map->query.point.y + t;
+/*
+** Classify a shape and check it against the query point, the shape is
+** projected to the map projection. Returns MS_TRUE and the distance to
+** the point if it matches. Only uses the layer and the state, so it can
+** run on a worker thread once the state has its own map projection.
+*/
+static int msQueryByPointLayerMatch(mapObj *map, layerObj *lp, queryByPointStateObj *qs, shapeObj *shape, double *distance)
+{
+  shape->classindex = msShapeGetClass(lp, map, shape, qs->classgroup, qs->nclasses);
+  if(!(lp->template) && ((shape->classindex == -1) || (lp->class[shape->classindex]->status == MS_OFF))) /* not a valid shape */
+    return(MS_FALSE);
 
-    /* Paging could have been disabled before */
-    paging = msLayerGetPaging(lp);
-    msLayerClose(lp); /* reset */
-    status = msLayerOpen(lp);
-    if(status != MS_SUCCESS) return(MS_FAILURE);
-    msLayerEnablePaging(lp, paging);
+  if(!(lp->template) && !(lp->class[shape->classindex]->template)) /* no valid template */
+    return(MS_FALSE);
 
-    /* build item list, we want *all* items */
-    status = msLayerWhichItems(lp, MS_TRUE, NULL);
-    if(status != MS_SUCCESS) return(MS_FAILURE);
-
-    /* identify target shapes */
-    searchrect = rect;
 #ifdef USE_PROJ
-    if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
-      msProjectRect(&(map->projection), &(lp->projection), &searchrect); /* project the searchrect to source coords */
-    else
-      lp->project = MS_FALSE;
+  if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
+    msProjectShape(&(lp->projection), qs->hasprojection ? &(qs->projection) : &(map->projection), shape);
+  else
+    lp->project = MS_FALSE;
 #endif
-    status = msLayerWhichShapes(lp, searchrect, MS_TRUE);
-    if(status == MS_DONE) { /* no overlap */
-      msLayerClose(lp);
-      continue;
-    } else if(status != MS_SUCCESS) {
-      msLayerClose(lp);
-      return(MS_FAILURE);
-    }
 
-    lp->resultcache = (resultCacheObj *)malloc(sizeof(resultCacheObj)); /* allocate and initialize the result cache */
-    MS_CHECK_ALLOC(lp->resultcache, sizeof(resultCacheObj), MS_FAILURE);
-    initResultCache( lp->resultcache);
+  *distance = msDistancePointToShape(&(map->query.point), shape);
+  return(*distance <= qs->t);
+}
 
-    nclasses = 0;
-    classgroup = NULL;
-    if (lp->classgroup && lp->numclasses > 0)
-      classgroup = msAllocateValidClassGroups(lp, &nclasses);
+/*
+** Add a matching shape to the results, the shape is freed. Returns MS_DONE
+** once the layer has enough results.
+*/
+static int msQueryByPointLayerKeep(mapObj *map, layerObj *lp, queryByPointStateObj *qs, shapeObj *shape, double d)
+{
+  /* Should we skip this feature? */
+  if (!qs->paging && map->query.startindex > 1) {
+    --map->query.startindex;
+    msFreeShape(shape);
+    return(MS_SUCCESS);
+  }
 
-    if (lp->minfeaturesize > 0)
-      minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
+  if(map->query.mode == MS_QUERY_SINGLE) {
+    lp->resultcache->numresults = 0;
+    addResult(lp->resultcache, shape);
+    qs->t = d; /* next one must be closer */
+  } else {
+    addResult(lp->resultcache, shape);
+  }
 
-    while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
+  if(qs->qcachettl > 0) {
+    if(lp->resultcache->numresults > MS_QUERY_CACHE_MAX_RESULTS) { /* too many to be cached */
+      msFree(qs->qbounds);
+      qs->qbounds = NULL;
+      qs->qcachettl = 0;
+    } else
+      msQueryCacheKeepBounds(&(qs->qbounds), &(qs->qboundssize), lp->resultcache->numresults-1, &(shape->bounds));
+  }
 
-      /* Check if the shape size is ok to be drawn */
-      if ( (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) ) {
-        if (msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE) {
-          if( lp->debug >= MS_DEBUGLEVEL_V )
-            msDebug("msQueryByPoint(): Skipping shape (%ld) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape.index);
-          msFreeShape(&shape);
-          continue;
-        }
-      }
+  msFreeShape(shape);
 
-      shape.classindex = msShapeGetClass(lp, map, &shape, classgroup, nclasses);
-      if(!(lp->template) && ((shape.classindex == -1) || (lp->class[shape.classindex]->status == MS_OFF))) { /* not a valid shape */
-        msFreeShape(&shape);
-        continue;
-      }
+  if(map->query.mode == MS_QUERY_MULTIPLE && map->query.maxresults > 0 && lp->resultcache->numresults == map->query.maxresults)
+    return(MS_DONE);   /* got enough results for this layer */
 
-      if(!(lp->template) && !(lp->class[shape.classindex]->template)) { /* no valid template */
+  /* check shape count */
+  if(lp->maxfeatures > 0 && lp->maxfeatures == lp->resultcache->numresults)
+    return(MS_DONE);
+
+  return(MS_SUCCESS);
+}
+
+/*
+** Check a shape against the query point and keep it if it matches, the
+** shape is freed. Returns MS_DONE once the layer has enough results.
+*/
+static int msQueryByPointLayerAddShape(mapObj *map, layerObj *lp, queryByPointStateObj *qs, shapeObj *shape)
+{
+  double d;
+
+  if(msQueryByPointLayerMatch(map, lp, qs, shape, &d))
+    return msQueryByPointLayerKeep(map, lp, qs, shape, d);
+
+  msFreeShape(shape);
+  return(MS_SUCCESS);
+}
+
+/*
+** Keep a matching shape in the state of a worker thread, only as many as
+** the calling thread can use: the closest one in single mode, maxresults
+** or maxfeatures otherwise. Returns MS_DONE once that many are kept.
+*/
+static int msQueryByPointLayerCollect(mapObj *map, queryByPointStateObj *qs, shapeObj *shape, double d)
+{
+  if(map->query.mode == MS_QUERY_SINGLE) {
+    if(qs->numshapes > 0)
+      msFreeShape(&(qs->shapes[--qs->numshapes]));
+    qs->t = d; /* next one must be closer */
+  }
+
+  if(qs->numshapes == qs->maxshapes) {
+    qs->maxshapes = MS_MAX(2 * qs->maxshapes, 16);
+    qs->shapes = (shapeObj *) msSmallRealloc(qs->shapes, qs->maxshapes * sizeof(shapeObj));
+    qs->distances = (double *) msSmallRealloc(qs->distances, qs->maxshapes * sizeof(double));
+  }
+  qs->distances[qs->numshapes] = d;
+  qs->shapes[qs->numshapes++] = *shape; /* the shape now belongs to the state */
+  msInitShape(shape);
+
+  if(map->query.mode == MS_QUERY_MULTIPLE && qs->maxcollect > 0 && qs->numshapes >= qs->maxcollect)
+    return(MS_DONE);
+
+  return(MS_SUCCESS);
+}
+
+/*
+** Open the layer and step through the shapes of the search rectangle. With
+** collect set the matching shapes are only kept in the state for the
+** calling thread to add to the results (see msQueryByPointLayerCollect()),
+** nothing but the layer and the state is modified then. Returns MS_DONE if
+** the layer has no shape to check.
+*/
+static int msQueryByPointLayerFetch(mapObj *map, layerObj *lp, queryByPointStateObj *qs, int collect)
+{
+  int status;
+  shapeObj shape;
+
+  msLayerClose(lp); /* reset */
+  status = msLayerOpen(lp);
+  if(status != MS_SUCCESS) return(MS_FAILURE);
+  msLayerEnablePaging(lp, qs->paging);
+
+  /* build item list, we want *all* items */
+  status = msLayerWhichItems(lp, MS_TRUE, NULL);
+  if(status != MS_SUCCESS) return(MS_FAILURE);
+
+  status = msLayerWhichShapes(lp, qs->searchrect, MS_TRUE);
+  if(status == MS_DONE) { /* no overlap */
+    msLayerClose(lp);
+    return(MS_DONE);
+  } else if(status != MS_SUCCESS) {
+    msLayerClose(lp);
+    return(MS_FAILURE);
+  }
+
+  lp->resultcache = (resultCacheObj *)malloc(sizeof(resultCacheObj)); /* allocate and initialize the result cache */
+  MS_CHECK_ALLOC(lp->resultcache, sizeof(resultCacheObj), MS_FAILURE);
+  initResultCache( lp->resultcache);
+
+  msInitShape(&shape);
+  while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
+    double d;
+
+
+    /* Check if the shape size is ok to be drawn */
+    if ( (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (qs->minfeaturesize > 0) ) {
+      if (msShapeCheckSize(&shape, qs->minfeaturesize) == MS_FALSE) {
+        if( lp->debug >= MS_DEBUGLEVEL_V )
+          msDebug("msQueryByPoint(): Skipping shape (%ld) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape.index);
         msFreeShape(&shape);
         continue;
       }
+    }
 
-#ifdef USE_PROJ
-      if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
-        msProjectShape(&(lp->projection), &(map->projection), &shape);
+    if(collect) {
+      if(msQueryByPointLayerMatch(map, lp, qs, &shape, &d))
+        status = msQueryByPointLayerCollect(map, qs, &shape, d);
       else
-        lp->project = MS_FALSE;
-#endif
+        msFreeShape(&shape);
+      if(status != MS_SUCCESS)
+        break;
+      continue;
+    }
 
-      d = msDistancePointToShape(&(map->query.point), &shape);
-      if( d <= t ) { /* found one */
+    status = msQueryByPointLayerAddShape(map, lp, qs, &shape);
+    if(status != MS_SUCCESS)
+      break;
+  } /* next shape */
 
-        /* Should we skip this feature? */
-        if (!paging && map->query.startindex > 1) {
-          --map->query.startindex;
-          msFreeShape(&shape);
-          continue;
-        }
+  if(status != MS_DONE) return(MS_FAILURE);
 
-        if(map->query.mode == MS_QUERY_SINGLE) {
-          lp->resultcache->numresults = 0;
-          addResult(lp->resultcache, &shape);
-          t = d; /* next one must be closer */
-        } else {
-          addResult(lp->resultcache, &shape);
-        }
-      }
+  return(MS_SUCCESS);
+}
 
-      msFreeShape(&shape);
+/*
+** Add the shapes collected by msQueryByPointLayerFetch() to the results.
+*/
+static void msQueryByPointLayerAddShapes(mapObj *map, layerObj *lp, queryByPointStateObj *qs)
+{
+  int i;
 
-      if(map->query.mode == MS_QUERY_MULTIPLE && map->query.maxresults > 0 && lp->resultcache->numresults == map->query.maxresults) {
-        status = MS_DONE;   /* got enough results for this layer */
-        break;
-      }
+  for(i=0; i<qs->numshapes; i++) {
+    if(msQueryByPointLayerKeep(map, lp, qs, &(qs->shapes[i]), qs->distances[i]) != MS_SUCCESS)
+      break;
+  }
+}
 
-      /* check shape count */
-      if(lp->maxfeatures > 0 && lp->maxfeatures == lp->resultcache->numresults) {
-        status = MS_DONE;
-        break;
-      }
-    } /* next shape */
+static void msQueryByPointLayerEnd(layerObj *lp, queryByPointStateObj *qs)
+{
+  if(qs->qcachettl > 0) {
+    msQueryCacheInsert(msQueryCacheCreateEntry(lp->resultcache, qs->qcachekey, qs->qcachettl, qs->qbounds));
+    qs->qbounds = NULL; /* owned by the cache entry */
+  }
 
-    if (classgroup)
-      msFree(classgroup);
+  if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
+}
 
-    if(status != MS_DONE) return(MS_FAILURE);
+/*
+** Query a single layer by point, the body of msQueryByPoint() for one layer.
+*/
+static int msQueryByPointLayer(mapObj *map, layerObj *lp)
+{
+  queryByPointStateObj qs;
+  int status;
 
-    if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
+  status = msQueryByPointLayerBegin(map, lp, &qs);
+  if(status == MS_SUCCESS) {
+    status = msQueryByPointLayerFetch(map, lp, &qs, MS_FALSE);
+    if(status == MS_SUCCESS)
+      msQueryByPointLayerEnd(lp, &qs);
+  }
+  msQueryByPointStateFree(&qs);
+
+  return (status == MS_FAILURE) ? MS_FAILURE : MS_SUCCESS;
+}
+
+typedef struct {
+  mapObj *map;
+  int layerindex;
+  int fetch; /* MS_FALSE: layer queried by the calling thread */
+  queryByPointStateObj state;
+  int status;
+  int thread_id;
+  int errorcode;
+  char routine[ROUTINELENGTH];
+  char message[MESSAGELENGTH];
+} queryLayerJobObj;
+
+/*
+** msRunThreadJobs() callback, errors are kept in the job since each worker
+** thread has its own error context.
+*/
+static void msQueryByPointJob(void *pJobData, int iJob)
+{
+  queryLayerJobObj *job = ((queryLayerJobObj *) pJobData) + iJob;
+
+  if(!job->fetch)
+    return;
+
+  job->status = msQueryByPointLayerFetch(job->map, GET_LAYER(job->map, job->layerindex), &(job->state), MS_TRUE);
+  if(job->status == MS_FAILURE) {
+    errorObj *ms_error = msGetErrorObj();
+    job->thread_id = msGetThreadId();
+    job->errorcode = ms_error->code;
+    strlcpy(job->routine, ms_error->routine, sizeof(job->routine));
+    strlcpy(job->message, ms_error->message, sizeof(job->message));
+  }
+}
+
+int msQueryByPoint(mapObj *map)
+{
+  return msQueryByPointThreaded(map, 1);
+}
+
+/*
+** Can the shapes of a layer be read on a worker thread? Not if reading it
+** uses other layers of the map (tile index layers, union and kernel
+** density layers, clusters), which another worker may be reading too.
+** Raster layers are queried by the calling thread as well.
+*/
+static int msQueryByPointLayerIsThreadable(layerObj *lp)
+{
+  return lp->type != MS_LAYER_RASTER && lp->tileindex == NULL && lp->cluster.region == NULL
+         && !IS_THIRDPARTY_LAYER_CONNECTIONTYPE(lp->connectiontype);
+}
+
+/*
+** Same as msQueryByPoint() but the shapes of vector layers are read
+** concurrently on up to nthreads worker threads (each getting its own
+** pooled connection). Everything else, including the layers for which
+** msQueryByPointLayerIsThreadable() is false, runs in the calling thread
+** in layer order, so the results are the same as with msQueryByPoint().
+** Single result queries with no maxresults stay sequential since they
+** stop at the first layer with a match, and so do queries skipping
+** results with startindex, which counts the skipped shapes across layers.
+*/
+int msQueryByPointThreaded(mapObj *map, int nthreads)
+{
+  int l, i, status = MS_SUCCESS;
+  int start, stop=0;
+
+  layerObj *lp;
+
+  queryLayerJobObj *jobs = NULL;
+  int njobs = 0, nfetch = 0;
 
-    if((lp->resultcache->numresults > 0) && (map->query.mode == MS_QUERY_SINGLE) && (map->query.maxresults == 0))
+  if(map->query.type != MS_QUERY_BY_POINT) {
+    msSetError(MS_QUERYERR, "The query is not properly defined.", "msQueryByPoint()");
+    return(MS_FAILURE);
+  }
+
+  if(map->query.layer < 0 || map->query.layer >= map->numlayers)
+    start = map->numlayers-1;
+  else
+    start = stop = map->query.layer;
+
+  if(nthreads > 1 && start > stop && !(map->query.mode == MS_QUERY_SINGLE && map->query.maxresults == 0)) {
+    int skip = (map->query.startindex > 1);
+    for(l=start; l>=stop && !skip; l--)
+      skip = (GET_LAYER(map, l)->startindex > 1 && map->query.startindex < 0);
+    if(!skip)
+      jobs = (queryLayerJobObj *) msSmallCalloc(start-stop+1, sizeof(queryLayerJobObj));
+  }
+
+  for(l=start; l>=stop; l--) {
+    lp = (GET_LAYER(map, l));
+    if (map->query.maxfeatures == 0)
+      break; /* nothing else to do */
+    else if (map->query.maxfeatures > 0)
+      lp->maxfeatures = map->query.maxfeatures;
+
+    /* using mapscript, the map->query.startindex will be unset... */
+    if (lp->startindex > 1 && map->query.startindex < 0)
+      map->query.startindex = lp->startindex;
+    
+    /* conditions may have changed since this layer last drawn, so set
+       layer->project true to recheck projection needs (Bug #673) */
+    lp->project = MS_TRUE;
+
+    /* free any previous search results, do it now in case one of the next few tests fail */
+    if(lp->resultcache) {
+      if(lp->resultcache->results) free(lp->resultcache->results);
+      free(lp->resultcache);
+      lp->resultcache = NULL;
+    }
+
+    if(jobs) { /* queried below */
+      queryLayerJobObj *job = jobs + njobs;
+      job->map = map;
+      job->layerindex = l;
+      job->status = MS_SUCCESS;
+      if(msQueryByPointLayerIsThreadable(lp)) {
+        job->status = msQueryByPointLayerBegin(map, lp, &(job->state));
+        if(job->status == MS_FAILURE) {
+          msQueryByPointStateFree(&(job->state));
+          status = MS_FAILURE;
+          break;
+        }
+        if(job->status == MS_DONE) { /* nothing to fetch */
+          msQueryByPointStateFree(&(job->state));
+          continue;
+        }
+        /* the worker projects the shapes with its own projection objects */
+        if(lp->project) {
+          msInitProjection(&(job->state.projection));
+          job->state.hasprojection = MS_TRUE;
+          if(msCopyProjection(&(job->state.projection), &(map->projection)) != MS_SUCCESS) {
+            msQueryByPointStateFree(&(job->state));
+            status = MS_FAILURE;
+            break;
+          }
+        }
+        if(map->query.maxresults > 0)
+          job->state.maxcollect = map->query.maxresults;
+        if(lp->maxfeatures > 0 && (job->state.maxcollect == 0 || lp->maxfeatures < job->state.maxcollect))
+          job->state.maxcollect = lp->maxfeatures;
+        job->fetch = MS_TRUE;
+        nfetch++;
+      }
+      njobs++;
+      continue;
+    }
+
+    if(msQueryByPointLayer(map, lp) != MS_SUCCESS)
+      return(MS_FAILURE);
+
+    if(lp->resultcache && (lp->resultcache->numresults > 0) && (map->query.mode == MS_QUERY_SINGLE) && (map->query.maxresults == 0))
       break;   /* no need to search any further */
   } /* next layer */
 
+  if(jobs) {
+    if(status == MS_SUCCESS && nfetch > 0) {
+      if(map->debug >= MS_DEBUGLEVEL_DEBUG)
+        msDebug("msQueryByPointThreaded(): reading %d layers with up to %d threads.\n", nfetch, nthreads);
+      msRunThreadJobs(njobs, nthreads, msQueryByPointJob, jobs);
+    }
+
+    /* check the shapes in layer order, as msQueryByPoint() does */
+    for(i=0; i<njobs; i++) {
+      queryLayerJobObj *job = jobs + i;
+      lp = GET_LAYER(map, job->layerindex);
+
+      if(status == MS_SUCCESS) {
+        if(!job->fetch)
+          status = msQueryByPointLayer(map, lp);
+        else if(job->status == MS_FAILURE) {
+          if(job->thread_id != msGetThreadId())
+            msSetError(job->errorcode, "%s", job->routine, job->message);
+          status = MS_FAILURE;
+        } else if(job->status == MS_SUCCESS) {
+          msQueryByPointLayerAddShapes(map, lp, &(job->state));
+          msQueryByPointLayerEnd(lp, &(job->state));
+        }
+      }
+      msQueryByPointStateFree(&(job->state));
+    }
+    msFree(jobs);
+
+    if(status != MS_SUCCESS)
+      return(MS_FAILURE);
+  }
+
   /* was anything found? */
   for(l=start; l>=stop; l--) {
     if(GET_LAYER(map, l)->resultcache && GET_LAYER(map, l)->resultcache->numresults > 0)
@@ -1782,6 +2624,7 @@ int msQueryByShape(mapObj *map)
 {
   int start, stop=0, l;
   shapeObj shape, *qshape=NULL;
+  edgeIndexObj *qindex=NULL;
   layerObj *lp;
   char status;
   double distance, tolerance, layer_tolerance;
@@ -1916,6 +2759,10 @@ int msQueryByShape(mapObj *map)
     if (lp->minfeaturesize > 0)
       minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
+    /* index the query shape edges once, they are tested against every candidate shape */
+    if(tolerance == 0 && qshape->type != MS_SHAPE_POINT)
+      qindex = msCreateEdgeIndex(qshape);
+
     while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
 
       /* Check if the shape size is ok to be drawn */
@@ -1951,7 +2798,7 @@ int msQueryByShape(mapObj *map)
           switch(shape.type) { /* make sure shape actually intersects the shape */
             case MS_SHAPE_POINT:
               if(tolerance == 0) /* just test for intersection */
-                status = msIntersectMultipointPolygon(&shape, qshape);
+                status = msIntersectMultipointPolygonIndexed(&shape, qshape, qindex);
               else { /* check distance, distance=0 means they intersect */
                 distance = msDistanceShapeToShape(qshape, &shape);
                 if(distance < tolerance) status = MS_TRUE;
@@ -1959,7 +2806,7 @@ int msQueryByShape(mapObj *map)
               break;
             case MS_SHAPE_LINE:
               if(tolerance == 0) { /* just test for intersection */
-                status = msIntersectPolylinePolygon(&shape, qshape);
+                status = msIntersectPolylinePolygonIndexed(&shape, qshape, qindex);
               } else { /* check distance, distance=0 means they intersect */
                 distance = msDistanceShapeToShape(qshape, &shape);
                 if(distance < tolerance) status = MS_TRUE;
@@ -1967,7 +2814,7 @@ int msQueryByShape(mapObj *map)
               break;
             case MS_SHAPE_POLYGON:
               if(tolerance == 0) /* just test for intersection */
-                status = msIntersectPolygons(&shape, qshape);
+                status = msIntersectPolygonsIndexed(&shape, qshape, qindex);
               else { /* check distance, distance=0 means they intersect */
                 distance = msDistanceShapeToShape(qshape, &shape);
                 if(distance < tolerance) status = MS_TRUE;
@@ -1990,7 +2837,7 @@ int msQueryByShape(mapObj *map)
               break;
             case MS_SHAPE_LINE:
               if(tolerance == 0) { /* just test for intersection */
-                status = msIntersectPolylines(&shape, qshape);
+                status = msIntersectPolylinesIndexed(&shape, qshape, qindex);
               } else { /* check distance, distance=0 means they intersect */
                 distance = msDistanceShapeToShape(qshape, &shape);
                 if(distance < tolerance) status = MS_TRUE;
@@ -2037,6 +2884,9 @@ int msQueryByShape(mapObj *map)
       }
     } /* next shape */
 
+    msFreeEdgeIndex(qindex);
+    qindex = NULL;
+
     if(status != MS_DONE) {
       free(classgroup);
       return(MS_FAILURE);
@@ -413,6 +413,7 @@ msRasterQueryByRectLow(mapObj *map, layerObj *layer, GDALDatasetH hDS,
   int         nRXSize, nRYSize;
   float       *pafRaster;
   int         nBandCount, *panBandMap, iPixel, iLine;
+  int         nBlockXSize, nBlockYSize, nStripYOff, nStripYSize, iStripLine;
   CPLErr      eErr;
   rasterLayerInfo *rlinfo;
   rectObj     searchrect;
@@ -510,29 +511,20 @@ msRasterQueryByRectLow(mapObj *map, layerObj *layer, GDALDatasetH hDS,
   }
 
   /* -------------------------------------------------------------------- */
-  /*      Try to load the raster data.  For now we just load the first    */
-  /*      band in the file.  Later we will deal with the various band     */
-  /*      selection criteria.                                             */
+  /*      The raster data is loaded in strips following the block         */
+  /*      layout of the file, so that each read is served by (and         */
+  /*      fills) the GDAL block cache of the shared dataset, and we       */
+  /*      stop reading as soon as we have enough results.                 */
   /* -------------------------------------------------------------------- */
+  GDALGetBlockSize( GDALGetRasterBand( hDS, panBandMap[0] ),
+                    &nBlockXSize, &nBlockYSize );
+  if( nBlockYSize < 1 )
+    nBlockYSize = 1;
+
   pafRaster = (float *)
-              calloc(sizeof(float),nWinXSize*nWinYSize*nBandCount);
-  MS_CHECK_ALLOC(pafRaster, sizeof(float)*nWinXSize*nWinYSize*nBandCount, -1);
-
-  eErr = GDALDatasetRasterIO( hDS, GF_Read,
-                              nWinXOff, nWinYOff, nWinXSize, nWinYSize,
-                              pafRaster, nWinXSize, nWinYSize, GDT_Float32,
-                              nBandCount, panBandMap,
-                              4 * nBandCount,
-                              4 * nBandCount * nWinXSize,
-                              4 );
-
-  if( eErr != CE_None ) {
-    msSetError( MS_IOERR, "GDALDatasetRasterIO() failed: %s",
-                "msRasterQueryByRectLow()", CPLGetLastErrorMsg() );
-
-    free( pafRaster );
-    return -1;
-  }
+              calloc(sizeof(float),
+                     nWinXSize*MIN(nBlockYSize,nWinYSize)*nBandCount);
+  MS_CHECK_ALLOC(pafRaster, sizeof(float)*nWinXSize*MIN(nBlockYSize,nWinYSize)*nBandCount, -1);
 
   /* -------------------------------------------------------------------- */
   /*      Fetch color table for intepreting colors if needed.             */
@@ -540,8 +532,6 @@ msRasterQueryByRectLow(mapObj *map, layerObj *layer, GDALDatasetH hDS,
   rlinfo->hCT = GDALGetRasterColorTable(
                   GDALGetRasterBand( hDS, panBandMap[0] ) );
 
-  free( panBandMap );
-
   /* -------------------------------------------------------------------- */
   /*      When computing whether pixels are within range we do it         */
   /*      based on the center of the pixel to the target point but        */
@@ -561,79 +551,105 @@ msRasterQueryByRectLow(mapObj *map, layerObj *layer, GDALDatasetH hDS,
   /* -------------------------------------------------------------------- */
   /*      Loop over all pixels determining which are "in".                */
   /* -------------------------------------------------------------------- */
-  for( iLine = 0; iLine < nWinYSize; iLine++ ) {
-    for( iPixel = 0; iPixel < nWinXSize; iPixel++ ) {
-      pointObj  sPixelLocation,sReprojectedPixelLocation;
-
-      if( rlinfo->query_results == rlinfo->query_result_hard_max )
-        break;
+  for( iLine = 0; iLine < nWinYSize
+       && rlinfo->query_results < rlinfo->query_result_hard_max;
+       iLine += nStripYSize ) {
+
+    nStripYOff = nWinYOff + iLine;
+    nStripYSize = MIN(nBlockYSize - nStripYOff % nBlockYSize,
+                      nWinYSize - iLine);
+
+    eErr = GDALDatasetRasterIO( hDS, GF_Read,
+                                nWinXOff, nStripYOff, nWinXSize, nStripYSize,
+                                pafRaster, nWinXSize, nStripYSize, GDT_Float32,
+                                nBandCount, panBandMap,
+                                4 * nBandCount,
+                                4 * nBandCount * nWinXSize,
+                                4 );
+
+    if( eErr != CE_None ) {
+      msSetError( MS_IOERR, "GDALDatasetRasterIO() failed: %s",
+                  "msRasterQueryByRectLow()", CPLGetLastErrorMsg() );
+
+      free( pafRaster );
+      free( panBandMap );
+      return -1;
+    }
 
-      /* transform pixel/line to georeferenced */
-      sPixelLocation.x =
-        GEO_TRANS(adfGeoTransform,
-                  iPixel + nWinXOff + 0.5, iLine + nWinYOff + 0.5 );
-      sPixelLocation.y =
-        GEO_TRANS(adfGeoTransform+3,
-                  iPixel + nWinXOff + 0.5, iLine + nWinYOff + 0.5 );
-
-      /* If projections differ, convert this back into the map  */
-      /* projection for distance testing, and comprison to the  */
-      /* search shape.  Save the original pixel location coordinates */
-      /* in sPixelLocationInLayerSRS, so that we can return those */
-      /* coordinates if we have a hit */
-      sReprojectedPixelLocation = sPixelLocation;
-      if( needReproject )
-        msProjectPoint( &(layer->projection), &(map->projection),
-                        &sReprojectedPixelLocation);
-
-      /* If we are doing QueryByShape, check against the shape now */
-      if( rlinfo->searchshape != NULL ) {
-        if( rlinfo->shape_tolerance == 0.0
-            && rlinfo->searchshape->type == MS_SHAPE_POLYGON ) {
-          if( msIntersectPointPolygon(
-                &sReprojectedPixelLocation, rlinfo->searchshape ) == MS_FALSE )
-            continue;
-        } else {
-          shapeObj  tempShape;
-          lineObj   tempLine;
-
-          memset( &tempShape, 0, sizeof(shapeObj) );
-          tempShape.type = MS_SHAPE_POINT;
-          tempShape.numlines = 1;
-          tempShape.line = &tempLine;
-          tempLine.numpoints = 1;
-          tempLine.point = &sReprojectedPixelLocation;
-
-          if( msDistanceShapeToShape(rlinfo->searchshape, &tempShape)
-              > rlinfo->shape_tolerance )
-            continue;
+    for( iStripLine = 0; iStripLine < nStripYSize; iStripLine++ ) {
+      for( iPixel = 0; iPixel < nWinXSize; iPixel++ ) {
+        pointObj  sPixelLocation,sReprojectedPixelLocation;
+
+        if( rlinfo->query_results == rlinfo->query_result_hard_max )
+          break;
+
+        /* transform pixel/line to georeferenced */
+        sPixelLocation.x =
+          GEO_TRANS(adfGeoTransform,
+                    iPixel + nWinXOff + 0.5, iStripLine + nStripYOff + 0.5 );
+        sPixelLocation.y =
+          GEO_TRANS(adfGeoTransform+3,
+                    iPixel + nWinXOff + 0.5, iStripLine + nStripYOff + 0.5 );
+
+        /* If projections differ, convert this back into the map  */
+        /* projection for distance testing, and comprison to the  */
+        /* search shape.  Save the original pixel location coordinates */
+        /* in sPixelLocationInLayerSRS, so that we can return those */
+        /* coordinates if we have a hit */
+        sReprojectedPixelLocation = sPixelLocation;
+        if( needReproject )
+          msProjectPoint( &(layer->projection), &(map->projection),
+                          &sReprojectedPixelLocation);
+
+        /* If we are doing QueryByShape, check against the shape now */
+        if( rlinfo->searchshape != NULL ) {
+          if( rlinfo->shape_tolerance == 0.0
+              && rlinfo->searchshape->type == MS_SHAPE_POLYGON ) {
+            if( msIntersectPointPolygon(
+                  &sReprojectedPixelLocation, rlinfo->searchshape ) == MS_FALSE )
+              continue;
+          } else {
+            shapeObj  tempShape;
+            lineObj   tempLine;
+
+            memset( &tempShape, 0, sizeof(shapeObj) );
+            tempShape.type = MS_SHAPE_POINT;
+            tempShape.numlines = 1;
+            tempShape.line = &tempLine;
+            tempLine.numpoints = 1;
+            tempLine.point = &sReprojectedPixelLocation;
+
+            if( msDistanceShapeToShape(rlinfo->searchshape, &tempShape)
+                > rlinfo->shape_tolerance )
+              continue;
+          }
         }
-      }
 
-      if( rlinfo->range_mode >= 0 ) {
-        double dist;
+        if( rlinfo->range_mode >= 0 ) {
+          double dist;
 
-        dist = (rlinfo->target_point.x - sReprojectedPixelLocation.x)
-               * (rlinfo->target_point.x - sReprojectedPixelLocation.x)
-               + (rlinfo->target_point.y - sReprojectedPixelLocation.y)
-               * (rlinfo->target_point.y - sReprojectedPixelLocation.y);
+          dist = (rlinfo->target_point.x - sReprojectedPixelLocation.x)
+                 * (rlinfo->target_point.x - sReprojectedPixelLocation.x)
+                 + (rlinfo->target_point.y - sReprojectedPixelLocation.y)
+                 * (rlinfo->target_point.y - sReprojectedPixelLocation.y);
 
-        if( dist >= dfAdjustedRange )
-          continue;
+          if( dist >= dfAdjustedRange )
+            continue;
 
-        /* If we can only have one feature, trim range and clear */
-        /* previous result.  */
-        if( rlinfo->range_mode == MS_QUERY_SINGLE ) {
-          rlinfo->range_dist = dist;
-          rlinfo->query_results = 0;
+          /* If we can only have one feature, trim range and clear */
+          /* previous result.  */
+          if( rlinfo->range_mode == MS_QUERY_SINGLE ) {
+            rlinfo->range_dist = dist;
+            rlinfo->query_results = 0;
+          }
         }
-      }
 
-      msRasterQueryAddPixel( layer,
-			                       &sPixelLocation, // return coords in layer SRS
-                             &sReprojectedPixelLocation,
-                             pafRaster
-                             + (iLine*nWinXSize + iPixel) * nBandCount );
+        msRasterQueryAddPixel( layer,
+  			                       &sPixelLocation, // return coords in layer SRS
+                               &sReprojectedPixelLocation,
+                               pafRaster
+                               + (iStripLine*nWinXSize + iPixel) * nBandCount );
+      }
     }
   }
 
@@ -641,6 +657,7 @@ msRasterQueryByRectLow(mapObj *map, layerObj *layer, GDALDatasetH hDS,
   /*      Cleanup.                                                        */
   /* -------------------------------------------------------------------- */
   free( pafRaster );
+  free( panBandMap );
 
   return MS_SUCCESS;
 }
@@ -755,6 +772,7 @@ int msRasterQueryByRect(mapObj *map, layerObj *layer, rectObj queryRect)
 
     GDALDatasetH  hDS;
     char *decrypted_path = NULL;
+    const char *close_connection;
 
     /* -------------------------------------------------------------------- */
     /*      Get filename.                                                   */
@@ -791,7 +809,7 @@ int msRasterQueryByRect(mapObj *map, layerObj *layer, rectObj queryRect)
     }
 
     msAcquireLock( TLOCK_GDAL );
-    hDS = GDALOpen(decrypted_path, GA_ReadOnly );
+    hDS = GDALOpenShared( decrypted_path, GA_ReadOnly );
 
     if( hDS == NULL ) {
       int ignore_missing = msMapIgnoreMissingData( map );
@@ -824,6 +842,7 @@ int msRasterQueryByRect(mapObj *map, layerObj *layer, rectObj queryRect)
 
     if( msDrawRasterLoadProjection(layer, hDS, filename, tilesrsindex, tilesrsname) != MS_SUCCESS )
     {
+        GDALClose( hDS );
         msReleaseLock( TLOCK_GDAL );
         status = MS_FAILURE;
         goto cleanup;
@@ -835,7 +854,23 @@ int msRasterQueryByRect(mapObj *map, layerObj *layer, rectObj queryRect)
     if( status == MS_SUCCESS )
       status = msRasterQueryByRectLow( map, layer, hDS, queryRect );
 
-    GDALClose( hDS );
+    /* -------------------------------------------------------------------- */
+    /*      Keep the dataset (and its block cache) open for the next        */
+    /*      queries and draws, as msDrawRasterLayerLow() does.  Default     */
+    /*      to keeping it open for single data files, and to closing it     */
+    /*      for tile indexes.                                               */
+    /* -------------------------------------------------------------------- */
+    close_connection = msLayerGetProcessingKey( layer, "CLOSE_CONNECTION" );
+
+    if( close_connection == NULL && layer->tileindex == NULL )
+      close_connection = "DEFER";
+
+    if( close_connection != NULL
+        && strcasecmp(close_connection,"DEFER") == 0 ) {
+      GDALDereferenceDataset( hDS );
+    } else {
+      GDALClose( hDS );
+    }
     msReleaseLock( TLOCK_GDAL );
 
   } /* next tile */
@@ -964,6 +964,178 @@ int msDrawMarkerSymbol(mapObj *map, imageObj *image, pointObj *p, styleObj *styl
   return ret;
 }
 
+/*
+** Render tile t of a marker sprite at its subpixel offset and record the
+** bounds of its non transparent pixels.
+*/
+static int renderMarkerSpriteTile(markerSpriteObj *sprite, int t)
+{
+  int x, y;
+  pointObj center;
+  imageObj *tile;
+  rasterBufferObj *rb = &sprite->rb[t];
+
+  tile = msImageCreate(sprite->size, sprite->size, sprite->format, NULL, NULL,
+                       sprite->resolution, sprite->map->defresolution, NULL);
+  if(UNLIKELY(!tile))
+    return MS_FAILURE;
+  sprite->tiles[t] = tile;
+
+  center.x = sprite->size / 2 + sprite->phasex[t];
+  center.y = sprite->size / 2 + sprite->phasey[t];
+  if(UNLIKELY(MS_FAILURE == msDrawMarkerSymbol(sprite->map, tile, &center, sprite->style, sprite->scalefactor)))
+    return MS_FAILURE;
+  if(UNLIKELY(MS_FAILURE == MS_IMAGE_RENDERER(tile)->getRasterBufferHandle(tile, rb)))
+    return MS_FAILURE;
+  if(rb->type != MS_BUFFER_BYTE_RGBA) {
+    msSetError(MS_RENDERERERR, "unsupported raster buffer type", "renderMarkerSpriteTile()");
+    return MS_FAILURE;
+  }
+
+  /* an empty tile is flagged with minx > maxx */
+  sprite->minx[t] = sprite->miny[t] = sprite->size;
+  sprite->maxx[t] = sprite->maxy[t] = -1;
+  for(y=0; y<rb->height; y++) {
+    unsigned char *pix = rb->data.rgba.pixels + y * rb->data.rgba.row_step;
+    for(x=0; x<rb->width; x++, pix += rb->data.rgba.pixel_step) {
+      if(pix[0] || pix[1] || pix[2] || pix[3]) {
+        sprite->minx[t] = MS_MIN(sprite->minx[t], x);
+        sprite->maxx[t] = MS_MAX(sprite->maxx[t], x);
+        sprite->miny[t] = MS_MIN(sprite->miny[t], y);
+        sprite->maxy[t] = MS_MAX(sprite->maxy[t], y);
+      }
+    }
+  }
+  return MS_SUCCESS;
+}
+
+/*
+** Prepare a marker sprite for drawing style at many points. Returns MS_DONE
+** if the marker can't be represented as a sprite, in which case the caller
+** must use msDrawMarkerSymbol() instead.
+*/
+int msInitMarkerSprite(markerSpriteObj *sprite, mapObj *map, imageObj *image, styleObj *style, double scalefactor)
+{
+  double sx, sy, margin;
+  int t;
+
+  memset(sprite, 0, sizeof(markerSpriteObj));
+  sprite->map = map;
+  sprite->style = style;
+  sprite->scalefactor = scalefactor;
+  sprite->format = image->format;
+  sprite->resolution = image->resolution;
+
+  if(!MS_RENDERER_PLUGIN(image->format) || !image->format->vtable->supports_pixel_buffer ||
+      !image->format->vtable->mergeRasterBuffer)
+    return MS_DONE;
+
+  if(style->symbol >= map->symbolset.numsymbols || style->symbol <= 0 ||
+      !msScaleInBounds(map->scaledenom, style->minscaledenom, style->maxscaledenom)) {
+    sprite->empty = MS_TRUE;
+    return MS_SUCCESS;
+  }
+
+  if(UNLIKELY(MS_FAILURE == msGetMarkerSize(map, style, &sx, &sy, scalefactor)))
+    return MS_FAILURE;
+
+  /* room for rotation, outlines, offsets and antialiasing */
+  margin = (fabs(style->offsetx) + fabs(style->offsety) + fabs(style->polaroffsetpixel) + style->outlinewidth) * scalefactor;
+  sprite->size = (int)ceil((sqrt(sx*sx + sy*sy) + 2 * margin) * image->resolutionfactor) + 4;
+  if(sprite->size > MS_MARKER_SPRITE_MAXSIZE)
+    return MS_DONE;
+
+  sprite->numtiles = 1; /* offset (0,0) */
+  if(UNLIKELY(MS_FAILURE == renderMarkerSpriteTile(sprite, 0)))
+    return MS_FAILURE;
+  if(sprite->minx[0] > sprite->maxx[0]) {
+    sprite->empty = MS_TRUE;
+    return MS_SUCCESS;
+  }
+  /* the size estimate was too small, the marker would be clipped */
+  t = sprite->size - 1;
+  if(sprite->minx[0] == 0 || sprite->miny[0] == 0 || sprite->maxx[0] == t || sprite->maxy[0] == t)
+    return MS_DONE;
+
+  return MS_SUCCESS;
+}
+
+/*
+** Stamp a marker sprite centered on p (in image coordinates). The tile is
+** rendered at the exact subpixel offset of p, so antialiasing matches
+** msDrawMarkerSymbol(). Returns MS_DONE if the offset has no tile and all
+** MS_MARKER_SPRITE_TILES are taken, the caller must draw the marker itself.
+*/
+int msDrawMarkerSprite(imageObj *image, markerSpriteObj *sprite, pointObj *p)
+{
+  double ox, oy, fx, fy;
+  int ix, iy, t;
+  int srcx, srcy, dstx, dsty, w, h;
+
+  if(sprite->empty)
+    return MS_SUCCESS;
+
+  ox = p->x - sprite->size / 2;
+  oy = p->y - sprite->size / 2;
+  ix = (int)floor(ox);
+  iy = (int)floor(oy);
+  fx = ox - ix;
+  fy = oy - iy;
+
+  /* cheap rejection before rendering a tile we may not need */
+  if(ix + sprite->size <= 0 || iy + sprite->size <= 0 || ix >= image->width || iy >= image->height)
+    return MS_SUCCESS;
+
+  for(t=0; t<sprite->numtiles; t++) {
+    if(sprite->phasex[t] == fx && sprite->phasey[t] == fy)
+      break;
+  }
+  if(t == sprite->numtiles) {
+    if(t == MS_MARKER_SPRITE_TILES)
+      return MS_DONE;
+    sprite->phasex[t] = fx;
+    sprite->phasey[t] = fy;
+    sprite->numtiles++;
+    if(UNLIKELY(MS_FAILURE == renderMarkerSpriteTile(sprite, t)))
+      return MS_FAILURE;
+  }
+  if(sprite->minx[t] > sprite->maxx[t])
+    return MS_SUCCESS;
+
+  srcx = sprite->minx[t];
+  srcy = sprite->miny[t];
+  dstx = ix + srcx;
+  dsty = iy + srcy;
+  w = sprite->maxx[t] - srcx + 1;
+  h = sprite->maxy[t] - srcy + 1;
+  if(dstx < 0) {
+    srcx -= dstx;
+    w += dstx;
+    dstx = 0;
+  }
+  if(dsty < 0) {
+    srcy -= dsty;
+    h += dsty;
+    dsty = 0;
+  }
+  w = MS_MIN(w, image->width - dstx);
+  h = MS_MIN(h, image->height - dsty);
+  if(w <= 0 || h <= 0)
+    return MS_SUCCESS;
+
+  return MS_IMAGE_RENDERER(image)->mergeRasterBuffer(image, &sprite->rb[t], 1.0, srcx, srcy, dstx, dsty, w, h);
+}
+
+void msFreeMarkerSprite(markerSpriteObj *sprite)
+{
+  int t;
+  for(t=0; t<MS_MARKER_SPRITE_TILES; t++) {
+    if(sprite->tiles[t])
+      msFreeImage(sprite->tiles[t]);
+    sprite->tiles[t] = NULL;
+  }
+}
+
 
 int msDrawLabelBounds(mapObj *map, imageObj *image, label_bounds *bnds, styleObj *style, double scalefactor)
 {
@@ -309,6 +309,270 @@ int msIntersectPolygons(shapeObj *p1, shapeObj *p2)
   return(MS_FALSE);
 }
 
+/*
+** Edge index: the edges of a (large) selection shape are bucketed into
+** horizontal bands so that the point in polygon and segment intersection
+** tests run against it for every candidate feature of a query only look
+** at the edges near the tested coordinates instead of at all of them.
+** The tests below give the same answers as the brute force versions above.
+*/
+#define MS_EDGEINDEX_MINEDGES 32
+#define MS_EDGEINDEX_MAXBANDS 4096
+
+typedef struct {
+  int line;
+  int vertex; /* edge from the previous vertex (last one for 0) to this one */
+  int firstband;
+} edgeRefObj;
+
+struct edgeIndexObj {
+  shapeObj *shape; /* not owned */
+  double miny, maxy;
+  double bandheight;
+  int numbands;
+  int *bandstart; /* numbands+1 offsets into edges */
+  edgeRefObj *edges;
+};
+
+static int msEdgeIndexBand(edgeIndexObj *index, double y)
+{
+  double band;
+
+  if(y <= index->miny) return 0;
+  band = (y - index->miny) / index->bandheight;
+  if(band >= index->numbands) return index->numbands - 1;
+  return (int) band;
+}
+
+static void msEdgeIndexEdge(shapeObj *shape, int l, int v, pointObj **pi, pointObj **pj)
+{
+  lineObj *line = &(shape->line[l]);
+
+  *pi = &(line->point[v]);
+  *pj = &(line->point[(v == 0) ? line->numpoints-1 : v-1]);
+}
+
+/*
+** Returns NULL if the shape has too few edges for an index to pay off,
+** callers then simply use the brute force tests.
+*/
+edgeIndexObj *msCreateEdgeIndex(shapeObj *shape)
+{
+  edgeIndexObj *index;
+  int l, v, b, numedges = 0, numentries;
+  double miny = 0, maxy = 0;
+  pointObj *pi, *pj;
+
+  if(!shape) return NULL;
+
+  for(l=0; l<shape->numlines; l++) {
+    if(shape->line[l].numpoints < 2) continue;
+    for(v=0; v<shape->line[l].numpoints; v++) {
+      double y = shape->line[l].point[v].y;
+      if(numedges == 0 && v == 0) miny = maxy = y;
+      else if(y < miny) miny = y;
+      else if(y > maxy) maxy = y;
+    }
+    numedges += shape->line[l].numpoints;
+  }
+  if(numedges < MS_EDGEINDEX_MINEDGES || !(maxy > miny))
+    return NULL;
+
+  index = (edgeIndexObj *) msSmallCalloc(1, sizeof(edgeIndexObj));
+  index->shape = shape;
+  index->miny = miny;
+  index->maxy = maxy;
+  index->numbands = MS_MIN(numedges / 4, MS_EDGEINDEX_MAXBANDS);
+
+  /* long edges are referenced from every band they cross, keep the total reasonable */
+  for(;;) {
+    index->bandheight = (maxy - miny) / index->numbands;
+    numentries = 0;
+    for(l=0; l<shape->numlines; l++) {
+      if(shape->line[l].numpoints < 2) continue;
+      for(v=0; v<shape->line[l].numpoints; v++) {
+        msEdgeIndexEdge(shape, l, v, &pi, &pj);
+        numentries += msEdgeIndexBand(index, MS_MAX(pi->y, pj->y)) - msEdgeIndexBand(index, MS_MIN(pi->y, pj->y)) + 1;
+      }
+    }
+    if(numentries <= 16 * numedges || index->numbands == 1) break;
+    index->numbands = MS_MAX(1, index->numbands / 4);
+  }
+
+  index->bandstart = (int *) msSmallCalloc(index->numbands + 1, sizeof(int));
+  index->edges = (edgeRefObj *) msSmallMalloc(numentries * sizeof(edgeRefObj));
+
+  /* count the edges of each band, then place them */
+  for(l=0; l<shape->numlines; l++) {
+    if(shape->line[l].numpoints < 2) continue;
+    for(v=0; v<shape->line[l].numpoints; v++) {
+      int b0, b1;
+      msEdgeIndexEdge(shape, l, v, &pi, &pj);
+      b0 = msEdgeIndexBand(index, MS_MIN(pi->y, pj->y));
+      b1 = msEdgeIndexBand(index, MS_MAX(pi->y, pj->y));
+      for(b=b0; b<=b1; b++)
+        index->bandstart[b+1]++;
+    }
+  }
+  for(b=0; b<index->numbands; b++)
+    index->bandstart[b+1] += index->bandstart[b];
+
+  {
+    int *fill = (int *) msSmallMalloc(index->numbands * sizeof(int));
+    memcpy(fill, index->bandstart, index->numbands * sizeof(int));
+    for(l=0; l<shape->numlines; l++) {
+      if(shape->line[l].numpoints < 2) continue;
+      for(v=0; v<shape->line[l].numpoints; v++) {
+        int b0, b1;
+        msEdgeIndexEdge(shape, l, v, &pi, &pj);
+        b0 = msEdgeIndexBand(index, MS_MIN(pi->y, pj->y));
+        b1 = msEdgeIndexBand(index, MS_MAX(pi->y, pj->y));
+        for(b=b0; b<=b1; b++) {
+          edgeRefObj *edge = &(index->edges[fill[b]++]);
+          edge->line = l;
+          edge->vertex = v;
+          edge->firstband = b0;
+        }
+      }
+    }
+    free(fill);
+  }
+
+  return index;
+}
+
+void msFreeEdgeIndex(edgeIndexObj *index)
+{
+  if(!index) return;
+  free(index->bandstart);
+  free(index->edges);
+  free(index);
+}
+
+/*
+** Same crossing count as msIntersectPointPolygon() (parity over all the
+** parts), restricted to the edges of the band containing the point.
+*/
+static int msIntersectPointPolygonIndexed(pointObj *p, edgeIndexObj *index)
+{
+  int e, band, status = MS_FALSE;
+  pointObj *pi, *pj;
+
+  if(!(p->y >= index->miny && p->y <= index->maxy))
+    return MS_FALSE;
+
+  band = msEdgeIndexBand(index, p->y);
+  for(e=index->bandstart[band]; e<index->bandstart[band+1]; e++) {
+    msEdgeIndexEdge(index->shape, index->edges[e].line, index->edges[e].vertex, &pi, &pj);
+    if ((((pi->y<=p->y) && (p->y<pj->y)) || ((pj->y<=p->y) && (p->y<pi->y))) && (p->x < (pj->x - pi->x) * (p->y - pi->y) / (pj->y - pi->y) + pi->x))
+      status = !status;
+  }
+  return status;
+}
+
+/*
+** Does any segment of line1 cross an edge of the indexed shape (as
+** msIntersectPolylines(line1, index->shape)).
+*/
+int msIntersectPolylinesIndexed(shapeObj *line1, shapeObj *line2, edgeIndexObj *index)
+{
+  int c1, v1, b, b0, b1, e;
+  pointObj *a, *pb, *c, *d;
+  double ymin, ymax;
+
+  if(!index || index->shape != line2)
+    return msIntersectPolylines(line1, line2);
+
+  for(c1=0; c1<line1->numlines; c1++) {
+    for(v1=1; v1<line1->line[c1].numpoints; v1++) {
+      a = &(line1->line[c1].point[v1-1]);
+      pb = &(line1->line[c1].point[v1]);
+      ymin = MS_MIN(a->y, pb->y);
+      ymax = MS_MAX(a->y, pb->y);
+      if(ymax < index->miny || ymin > index->maxy)
+        continue;
+
+      b0 = msEdgeIndexBand(index, ymin);
+      b1 = msEdgeIndexBand(index, ymax);
+      for(b=b0; b<=b1; b++) {
+        for(e=index->bandstart[b]; e<index->bandstart[b+1]; e++) {
+          edgeRefObj *edge = &(index->edges[e]);
+          if(edge->vertex == 0) continue; /* closing edge, only used for point in polygon */
+          if(MS_MAX(b0, edge->firstband) != b) continue; /* already tested in a previous band */
+          msEdgeIndexEdge(index->shape, edge->line, edge->vertex, &d, &c);
+          if(MS_MAX(c->y, d->y) < ymin || MS_MIN(c->y, d->y) > ymax ||
+              MS_MAX(c->x, d->x) < MS_MIN(a->x, pb->x) || MS_MIN(c->x, d->x) > MS_MAX(a->x, pb->x))
+            continue;
+          if(msIntersectSegments(a, pb, c, d) == MS_TRUE)
+            return(MS_TRUE);
+        }
+      }
+    }
+  }
+
+  return(MS_FALSE);
+}
+
+int msIntersectMultipointPolygonIndexed(shapeObj *multipoint, shapeObj *poly, edgeIndexObj *index)
+{
+  int i,j;
+
+  if(!index || index->shape != poly)
+    return msIntersectMultipointPolygon(multipoint, poly);
+
+  for(i=0; i<multipoint->numlines; i++ ) {
+    for(j=0; j<multipoint->line[i].numpoints; j++) {
+      if(msIntersectPointPolygonIndexed(&(multipoint->line[i].point[j]), index) == MS_TRUE)
+        return(MS_TRUE);
+    }
+  }
+
+  return(MS_FALSE);
+}
+
+int msIntersectPolylinePolygonIndexed(shapeObj *line, shapeObj *poly, edgeIndexObj *index)
+{
+  int i;
+
+  if(!index || index->shape != poly)
+    return msIntersectPolylinePolygon(line, poly);
+
+  /* STEP 1: polygon might competely contain the polyline or one of it's parts */
+  for(i=0; i<line->numlines; i++) {
+    if(line->line[i].numpoints > 0 && msIntersectPointPolygonIndexed(&(line->line[i].point[0]), index) == MS_TRUE)
+      return(MS_TRUE);
+  }
+
+  /* STEP 2: look for intersecting line segments */
+  return msIntersectPolylinesIndexed(line, poly, index);
+}
+
+/*
+** As msIntersectPolygons(p1, p2) with p2 indexed.
+*/
+int msIntersectPolygonsIndexed(shapeObj *p1, shapeObj *p2, edgeIndexObj *index)
+{
+  int i;
+
+  if(!index || index->shape != p2)
+    return msIntersectPolygons(p1, p2);
+
+  /* STEP 1: polygon 1 completely contains 2 (only need to check one point from each part) */
+  for(i=0; i<p2->numlines; i++) {
+    if(msIntersectPointPolygon(&(p2->line[i].point[0]), p1) == MS_TRUE)
+      return(MS_TRUE);
+  }
+
+  /* STEP 2: polygon 2 completely contains 1 */
+  for(i=0; i<p1->numlines; i++) {
+    if(p1->line[i].numpoints > 0 && msIntersectPointPolygonIndexed(&(p1->line[i].point[0]), index) == MS_TRUE)
+      return(MS_TRUE);
+  }
+
+  /* STEP 3: look for intersecting line segments */
+  return msIntersectPolylinesIndexed(p1, p2, index);
+}
+
 
 /*
 ** Distance computations
@@ -112,6 +112,8 @@ typedef uint32_t        ms_uint32;
 /*forward declaration of rendering object*/
 typedef struct rendererVTableObj rendererVTableObj;
 typedef struct tileCacheObj tileCacheObj;
+typedef struct markerSpriteObj markerSpriteObj;
+typedef struct edgeIndexObj edgeIndexObj;
 typedef struct textPathObj textPathObj;
 typedef struct textRunObj textRunObj;
 typedef struct glyph_element glyph_element;
@@ -384,6 +386,7 @@ extern "C" {
 #define MS_RENDER_WITH_IMAGEMAP 5
 #define MS_RENDER_WITH_TEMPLATE 8 /* query results only */
 #define MS_RENDER_WITH_OGR 16
+#define MS_RENDER_WITH_FEATURES 17 /* query results only, GEOJSON */
 
 #define MS_RENDER_WITH_PLUGIN 100
 #define MS_RENDER_WITH_CAIRO_RASTER   101
@@ -402,6 +405,7 @@ extern "C" {
 #define MS_RENDERER_TEMPLATE(format) ((format)->renderer == MS_RENDER_WITH_TEMPLATE)
 #define MS_RENDERER_KML(format) ((format)->renderer == MS_RENDER_WITH_KML)
 #define MS_RENDERER_OGR(format) ((format)->renderer == MS_RENDER_WITH_OGR)
+#define MS_RENDERER_FEATURES(format) ((format)->renderer == MS_RENDER_WITH_FEATURES)
 
 #define MS_RENDERER_PLUGIN(format) ((format)->renderer > MS_RENDER_WITH_PLUGIN)
 
@@ -827,6 +831,11 @@ extern "C" {
     int  maxfeatures; /* global maxfeatures */    
     int  startindex;
     int  only_cache_result_count; /* set to 1 sometimes by WFS 2.0 GetFeature request */
+
+    /* if set, msQueryByRect() passes each result shape (in map projection) to this */
+    /* callback instead of storing its id, only the result count and bounds are kept */
+    int (*resultcallback)(mapObj *map, layerObj *lp, shapeObj *shape, void *data);
+    void *resultcallbackdata;
     
     char *item; /* by attribute */
     char *str;
@@ -1712,6 +1721,7 @@ extern "C" {
 
 #ifndef SWIG
     sortByClause sortBy;
+    int prefetchstatus; /* WhichShapes() status from the msDrawMap() prefetch, -1 if none */
 #endif
   };
 
@@ -1814,6 +1824,7 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
     char *mappath; /* path of the mapfile, all path are relative to this path */
 
 #ifndef SWIG
+    char *mapfile; /* full path of the mapfile, NULL when loaded from a string */
     paletteObj palette; /* holds a map palette */
 #endif /*SWIG*/
     colorObj imagecolor; /* holds the initial image color value */
@@ -2069,6 +2080,7 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   MS_DLL_EXPORT void msOGRInitialize(void);
   MS_DLL_EXPORT void msOGRCleanup(void);
   MS_DLL_EXPORT void msGDALCleanup(void);
+  MS_DLL_EXPORT void msContourCleanup(void);
   MS_DLL_EXPORT void msGDALInitialize(void);
 
   MS_DLL_EXPORT imageObj *msDrawScalebar(mapObj *map); /* in mapscale.c */
@@ -2106,16 +2118,26 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   MS_DLL_EXPORT int msIntersectPolylinePolygon(shapeObj *line, shapeObj *poly);
   MS_DLL_EXPORT int msIntersectPolygons(shapeObj *p1, shapeObj *p2);
   MS_DLL_EXPORT int msIntersectPolylines(shapeObj *line1, shapeObj *line2);
+#ifndef SWIG
+  MS_DLL_EXPORT edgeIndexObj *msCreateEdgeIndex(shapeObj *shape);
+  MS_DLL_EXPORT void msFreeEdgeIndex(edgeIndexObj *index);
+  MS_DLL_EXPORT int msIntersectMultipointPolygonIndexed(shapeObj *multipoint, shapeObj *poly, edgeIndexObj *index);
+  MS_DLL_EXPORT int msIntersectPolylinePolygonIndexed(shapeObj *line, shapeObj *poly, edgeIndexObj *index);
+  MS_DLL_EXPORT int msIntersectPolygonsIndexed(shapeObj *p1, shapeObj *p2, edgeIndexObj *index);
+  MS_DLL_EXPORT int msIntersectPolylinesIndexed(shapeObj *line1, shapeObj *line2, edgeIndexObj *index);
+#endif
 
   MS_DLL_EXPORT int msInitQuery(queryObj *query); /* in mapquery.c */
   MS_DLL_EXPORT void msFreeQuery(queryObj *query);
   MS_DLL_EXPORT int msSaveQuery(mapObj *map, char *filename, int results);
   MS_DLL_EXPORT int msLoadQuery(mapObj *map, char *filename);
   MS_DLL_EXPORT int msExecuteQuery(mapObj *map);
+  MS_DLL_EXPORT void msQueryCacheCleanup(void);
 
   MS_DLL_EXPORT int msQueryByIndex(mapObj *map); /* various query methods, all rely on the queryObj hung off the mapObj */
   MS_DLL_EXPORT int msQueryByAttributes(mapObj *map);
   MS_DLL_EXPORT int msQueryByPoint(mapObj *map);
+  MS_DLL_EXPORT int msQueryByPointThreaded(mapObj *map, int nthreads);
   MS_DLL_EXPORT int msQueryByRect(mapObj *map);
   MS_DLL_EXPORT int msQueryByFeatures(mapObj *map);
   MS_DLL_EXPORT int msQueryByShape(mapObj *map);
@@ -2163,6 +2185,7 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   MS_DLL_EXPORT void msDecodeHTMLEntities(const char *string);
   MS_DLL_EXPORT int msIsXMLTagValid(const char *string);
   MS_DLL_EXPORT char *msStringConcatenate(char *pszDest, const char *pszSrc);
+  MS_DLL_EXPORT int msFormatDouble(char *buffer, size_t bufsize, double value, int precision);
   MS_DLL_EXPORT char *msJoinStrings(char **array, int arrayLength, const char *delimeter);
   MS_DLL_EXPORT char *msHashString(const char *pszStr);
   MS_DLL_EXPORT char *msCommifyString(char *str);
@@ -2432,6 +2455,7 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   MS_DLL_EXPORT int msSDELayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msOGRLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msPostGISLayerInitializeVirtualTable(layerObj *layer);
+  MS_DLL_EXPORT char *msPostGISBuildSQLSpatialFilter(layerObj *layer, const char *pszOperator, const char *pszWKT, double dfDistance);
   MS_DLL_EXPORT int msOracleSpatialLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msWFSLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msGraticuleLayerInitializeVirtualTable(layerObj *layer);
@@ -2480,6 +2504,11 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   MS_DLL_EXPORT int msValueToRange(styleObj *style, double fieldVal, colorspace cs);
 
   MS_DLL_EXPORT int WARN_UNUSED msDrawMarkerSymbol(mapObj *map, imageObj *image, pointObj *p, styleObj *style, double scalefactor);
+#ifndef SWIG
+  MS_DLL_EXPORT int msInitMarkerSprite(markerSpriteObj *sprite, mapObj *map, imageObj *image, styleObj *style, double scalefactor);
+  MS_DLL_EXPORT int WARN_UNUSED msDrawMarkerSprite(imageObj *image, markerSpriteObj *sprite, pointObj *p);
+  MS_DLL_EXPORT void msFreeMarkerSprite(markerSpriteObj *sprite);
+#endif
   MS_DLL_EXPORT int WARN_UNUSED msDrawLineSymbol(mapObj *map, imageObj *image, shapeObj *p, styleObj *style, double scalefactor);
   MS_DLL_EXPORT int WARN_UNUSED msDrawShadeSymbol(mapObj *map, imageObj *image, shapeObj *p, styleObj *style, double scalefactor);
   MS_DLL_EXPORT int WARN_UNUSED msCircleDrawLineSymbol(mapObj *map, imageObj *image, pointObj *p, double r, styleObj *style, double scalefactor);
@@ -2700,6 +2729,13 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   MS_DLL_EXPORT int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format,
                                          int sendheaders );
 
+  /* ==================================================================== */
+  /*      prototypes for functions in mapfeatureoutput.c                  */
+  /* ==================================================================== */
+  MS_DLL_EXPORT int msInitDefaultFeatureOutputFormat( outputFormatObj *format );
+  MS_DLL_EXPORT int msWriteFeaturesFromQuery( mapObj *map, outputFormatObj *format,
+                                              int sendheaders );
+
   /* ==================================================================== */
   /*      Public prototype for mapogr.cpp functions.                      */
   /* ==================================================================== */
@@ -2738,11 +2774,27 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   /* ==================================================================== */
   /*      mappool.c: connection pooling API.                              */
   /* ==================================================================== */
+  typedef struct {
+    int open;        /* connections currently in the pool */
+    int busy;        /* ... of which referenced by a layer */
+    int requests;    /* msConnPoolRequest() calls */
+    int hits;        /* requests satisfied from the pool */
+    int waits;       /* requests that waited for POOL_MAX_CONNECTIONS */
+    int timeouts;    /* waits that gave up after POOL_WAIT_TIMEOUT */
+    int invalid;     /* pooled connections that failed validation */
+    int reaped;      /* connections closed after POOL_IDLE_TIMEOUT */
+  } connPoolStatsObj;
+
   MS_DLL_EXPORT void *msConnPoolRequest( layerObj *layer );
   MS_DLL_EXPORT void msConnPoolRelease( layerObj *layer, void * );
   MS_DLL_EXPORT void msConnPoolRegister( layerObj *layer,
                                          void *conn_handle,
                                          void (*close)( void * ) );
+  MS_DLL_EXPORT void msConnPoolRegisterValidated( layerObj *layer,
+      void *conn_handle,
+      void (*close)( void * ),
+      int (*validate)( void * ) );
+  MS_DLL_EXPORT void msConnPoolGetStats( connPoolStatsObj *stats );
   MS_DLL_EXPORT void msConnPoolCloseUnreferenced( void );
   MS_DLL_EXPORT void msConnPoolFinalCleanup( void );
 
@@ -2942,6 +2994,33 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
     tileCacheObj *next;
   };
 
+  /*
+   * markerSpriteObj: a point marker pre-rendered into small RGBA tiles that are
+   * stamped into the target image instead of rasterizing the symbol for every
+   * point. Tiles are rendered lazily for the exact subpixel offsets met, up to
+   * MS_MARKER_SPRITE_TILES of them.
+   */
+#define MS_MARKER_SPRITE_TILES 64
+#define MS_MARKER_SPRITE_MAXSIZE 128
+  struct markerSpriteObj {
+    mapObj *map;
+    styleObj *style;
+    double scalefactor;
+    outputFormatObj *format;
+    double resolution;
+    int size; /* width and height of each tile */
+    int empty; /* MS_TRUE if the style draws nothing */
+    int numtiles;
+    double phasex[MS_MARKER_SPRITE_TILES]; /* subpixel offset of each tile, in [0,1) */
+    double phasey[MS_MARKER_SPRITE_TILES];
+    imageObj *tiles[MS_MARKER_SPRITE_TILES];
+    rasterBufferObj rb[MS_MARKER_SPRITE_TILES];
+    int minx[MS_MARKER_SPRITE_TILES]; /* non transparent area of each tile */
+    int miny[MS_MARKER_SPRITE_TILES];
+    int maxx[MS_MARKER_SPRITE_TILES];
+    int maxy[MS_MARKER_SPRITE_TILES];
+  };
+
 
   /*
    * labelStyleObj
@@ -2997,6 +3076,7 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l, char
   int msSaveRasterBuffer(mapObj *map, rasterBufferObj *data, FILE *stream, outputFormatObj *format);
   int msSaveRasterBufferToBuffer(rasterBufferObj *data, bufferObj *buffer, outputFormatObj *format);
   int msLoadMSRasterBufferFromFile(char *path, rasterBufferObj *rb);
+  int msLoadMSRasterBufferFromMemory(const unsigned char *data, int size, rasterBufferObj *rb);
 
   void msBufferInit(bufferObj *buffer);
   void msBufferResize(bufferObj *buffer, size_t target_size);
@@ -1414,6 +1414,64 @@ char *msStringConcatenate(char *pszDest, const char *pszSrc)
   return pszDest;
 }
 
+/*
+** Equivalent of snprintf(buffer, bufsize, "%.*f", precision, value) without
+** going through the stdio formatting machinery for the usual coordinate and
+** attribute values. Values that cannot be formatted exactly with double
+** arithmetic (huge values, precisions above 9, ties too close to call) are
+** left to snprintf(), so the output is always identical to printf's.
+** Returns the length of the formatted string, like snprintf().
+*/
+int msFormatDouble(char *buffer, size_t bufsize, double value, int precision)
+{
+  static const double powers[] = { 1.0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+  static const long long ipowers[] = { 1, 10, 100, 1000, 10000, 100000, 1000000,
+                                       10000000, 100000000, 1000000000
+                                     };
+  char tmp[64], *p = tmp + sizeof(tmp);
+  double scaled_value, floor_value, frac;
+  long long scaled, intpart;
+  int i, len, negative;
+
+  if(precision < 0 || precision > 9 || !(value > -1e12 && value < 1e12))
+    return snprintf(buffer, bufsize, "%.*f", precision, value);
+
+  negative = (value < 0 || (value == 0 && 1.0/value < 0)); /* -0.0 too */
+  scaled_value = fabs(value) * powers[precision];
+  floor_value = floor(scaled_value);
+  frac = scaled_value - floor_value;
+
+  /* the product is only exact to half an ulp, don't guess at (near) ties */
+  if(scaled_value >= 4503599627370496.0 /* 2^52 */ ||
+      fabs(frac - 0.5) <= scaled_value * 2.220446049250313e-16 /* 2^-52 */)
+    return snprintf(buffer, bufsize, "%.*f", precision, value);
+
+  scaled = (long long) floor_value;
+  if(frac > 0.5)
+    scaled++;
+  intpart = scaled / ipowers[precision];
+  scaled %= ipowers[precision];
+
+  for(i = 0; i < precision; ++i, scaled /= 10)
+    *--p = '0' + (char)(scaled % 10);
+  if(precision > 0)
+    *--p = '.';
+  do {
+    *--p = '0' + (char)(intpart % 10);
+    intpart /= 10;
+  } while(intpart > 0);
+  if(negative)
+    *--p = '-';
+
+  len = (int)(tmp + sizeof(tmp) - p);
+  if(bufsize > 0) {
+    size_t n = ((size_t)len < bufsize) ? (size_t)len : bufsize - 1;
+    memcpy(buffer, p, n);
+    buffer[n] = '\0';
+  }
+  return len;
+}
+
 char *msJoinStrings(char **array, int arrayLength, const char *delimeter)
 {
   char *string;
@@ -262,6 +262,15 @@ int msReturnTemplateQuery(mapservObj *mapserv, char *queryFormat, char **papszBu
       return status;
     }
 
+    if( MS_RENDERER_FEATURES(outputFormat) ) {
+      if( mapserv != NULL )
+        checkWebScale(mapserv);
+
+      status = msWriteFeaturesFromQuery(map, outputFormat, mapserv == NULL || mapserv->sendheaders);
+
+      return status;
+    }
+
     if( !MS_RENDERER_TEMPLATE(outputFormat) ) { /* got an image format, return the query results that way */
       outputFormatObj *tempOutputFormat = map->outputformat; /* save format */
 
@@ -1912,6 +1921,32 @@ static int processDateTag(char **line)
 
 }
 
+/*
+** Helpers for processShpxyTag(), the coordinate string is built in a growing
+** buffer rather than by reallocating it for every vertex.
+*/
+static void shpxyAppendString(bufferObj *coords, const char *string)
+{
+  if(*string) msBufferAppend(coords, (void *) string, strlen(string));
+}
+
+static void shpxyAppendPoint(bufferObj *coords, double x, double y, int precision,
+                             const char *xh, const char *xf, const char *yh, const char *yf, const char *cs)
+{
+  char value[512];
+  int len;
+
+  shpxyAppendString(coords, xh);
+  len = msFormatDouble(value, sizeof(value), x, precision);
+  msBufferAppend(coords, value, MS_MIN(len, (int) sizeof(value) - 1));
+  shpxyAppendString(coords, xf);
+  shpxyAppendString(coords, yh);
+  len = msFormatDouble(value, sizeof(value), y, precision);
+  msBufferAppend(coords, value, MS_MIN(len, (int) sizeof(value) - 1));
+  shpxyAppendString(coords, yf);
+  if(cs) shpxyAppendString(coords, cs);
+}
+
 /*
 ** Function to process a [shpxy ...] tag: line contains the tag, shape holds the coordinates.
 **
@@ -1930,8 +1965,6 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
   int tagOffset, tagLength;
 
   char *argValue=NULL;
-  char *pointFormat1=NULL, *pointFormat2=NULL;
-  int pointFormatLength;
 
   /*
   ** Pointers to static strings, naming convention is:
@@ -1954,7 +1987,7 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
   char *projectionString=NULL;
 
   shapeObj tShape;
-  char *coords=NULL, point[128];
+  bufferObj coords;
 
 
   if(!*line) {
@@ -2063,13 +2096,6 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
       if(argValue) projectionString = argValue;
     }
 
-    /* build the per point format strings (version 1 contains the coordinate seperator, version 2 doesn't) */
-    pointFormatLength = strlen(xh) + strlen(xf) + strlen(yh) + strlen(yf) + strlen(cs) + 12 + 1;
-    pointFormat1 = (char *) msSmallMalloc(pointFormatLength);
-    snprintf(pointFormat1, pointFormatLength, "%s%%.%dlf%s%s%%.%dlf%s%s", xh, precision, xf, yh, precision, yf, cs);
-    pointFormat2 = (char *) msSmallMalloc(pointFormatLength);
-    snprintf(pointFormat2, pointFormatLength, "%s%%.%dlf%s%s%%.%dlf%s", xh, precision, xf, yh, precision, yf);
-
     /* make a copy of the original shape or compute a centroid if necessary */
     msInitShape(&tShape);
     if(centroid == MS_TRUE) {
@@ -2093,8 +2119,6 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
 
       bufferShape = msGEOSBuffer(shape, buffer);
       if(!bufferShape) {
-        free(pointFormat1);
-        free(pointFormat2);
         return(MS_FAILURE); /* buffer failed */
       }
       msCopyShape(bufferShape, &tShape);
@@ -2104,8 +2128,6 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
     else {
       status = msCopyShape(shape, &tShape);
       if(status != 0) {
-        free(pointFormat1);
-        free(pointFormat2);
         return(MS_FAILURE); /* copy failed */
       }
     }
@@ -2169,8 +2191,9 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
     /*
     ** build the coordinate string
     */
+    msBufferInit(&coords);
 
-    if(strlen(sh) > 0) coords = msStringConcatenate(coords, sh);
+    shpxyAppendString(&coords, sh);
 
     /* do we need to handle inner/outer rings */
     if(tShape.type == MS_SHAPE_POLYGON && strlen(orh) > 0 && strlen(irh) > 0) {
@@ -2183,34 +2206,33 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
         int *inners;
         if( outers[i] ) {
           /* this is an outer ring */
-          if((!firstPart) && (strlen(ps) > 0)) coords = msStringConcatenate(coords, ps);
+          if(!firstPart) shpxyAppendString(&coords, ps);
           firstPart = 0;
-          if(strlen(ph) > 0) coords = msStringConcatenate(coords, ph);
-          coords = msStringConcatenate(coords, orh);
+          shpxyAppendString(&coords, ph);
+          shpxyAppendString(&coords, orh);
           for(p=0; p<tShape.line[i].numpoints-1; p++) {
-            snprintf(point, sizeof(point), pointFormat1, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y);
-            coords = msStringConcatenate(coords, point);
+            shpxyAppendPoint(&coords, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y,
+                             precision, xh, xf, yh, yf, cs);
           }
-          snprintf(point, sizeof(point), pointFormat2, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y);
-          coords = msStringConcatenate(coords, point);
-          coords = msStringConcatenate(coords, orf);
+          shpxyAppendPoint(&coords, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y,
+                           precision, xh, xf, yh, yf, NULL);
+          shpxyAppendString(&coords, orf);
 
           inners = msGetInnerList(&tShape, i, outers);
           /* loop over rings looking for inners to this outer */
           for(j=0; j<tShape.numlines; j++) {
             if( inners[j] ) {
               /* j is an inner ring of i */
-              coords = msStringConcatenate(coords, irh);
+              shpxyAppendString(&coords, irh);
               for(p=0; p<tShape.line[j].numpoints-1; p++) {
-                snprintf(point, sizeof(point), pointFormat1, scale_x*tShape.line[j].point[p].x, scale_y*tShape.line[j].point[p].y);
-                coords = msStringConcatenate(coords, point);
+                shpxyAppendPoint(&coords, scale_x*tShape.line[j].point[p].x, scale_y*tShape.line[j].point[p].y,
+                                 precision, xh, xf, yh, yf, cs);
               }
-              snprintf(point, sizeof(point), pointFormat2, scale_x*tShape.line[j].point[p].x, scale_y*tShape.line[j].point[p].y);
-              coords = msStringConcatenate(coords, irf);
+              shpxyAppendString(&coords, irf);
             }
           }
           free( inners );
-          if(strlen(pf) > 0) coords = msStringConcatenate(coords, pf);
+          shpxyAppendString(&coords, pf);
         }
       } /* end of loop over outer rings */
       free( outers );
@@ -2223,21 +2245,23 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
             (tShape.type == MS_SHAPE_POLYGON && tShape.line[i].numpoints < 3))
           continue;
 
-        if(strlen(ph) > 0) coords = msStringConcatenate(coords, ph);
+        shpxyAppendString(&coords, ph);
 
         for(p=0; p<tShape.line[i].numpoints-1; p++) {
-          snprintf(point, sizeof(point), pointFormat1, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y);
-          coords = msStringConcatenate(coords, point);
+          shpxyAppendPoint(&coords, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y,
+                           precision, xh, xf, yh, yf, cs);
         }
-        snprintf(point, sizeof(point), pointFormat2, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y);
-        coords = msStringConcatenate(coords, point);
+        shpxyAppendPoint(&coords, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y,
+                         precision, xh, xf, yh, yf, NULL);
 
-        if(strlen(pf) > 0) coords = msStringConcatenate(coords, pf);
+        shpxyAppendString(&coords, pf);
 
-        if((i < tShape.numlines-1) && (strlen(ps) > 0)) coords = msStringConcatenate(coords, ps);
+        if(i < tShape.numlines-1) shpxyAppendString(&coords, ps);
       }
     }
-    if(strlen(sf) > 0) coords = msStringConcatenate(coords, sf);
+    shpxyAppendString(&coords, sf);
+
+    msBufferAppend(&coords, "", 1); /* nul terminate */
 
     msFreeShape(&tShape);
 
@@ -2251,19 +2275,14 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
     strlcpy(tag, tagStart, tagLength+1);
 
     /* do the replacement */
-    *line = msReplaceSubstring(*line, tag, coords);
+    *line = msReplaceSubstring(*line, tag, (char *) coords.data);
 
     /* clean up */
     free(tag);
     tag = NULL;
     msFreeHashTable(tagArgs);
     tagArgs=NULL;
-    free(pointFormat1);
-    pointFormat1 = NULL;
-    free(pointFormat2);
-    pointFormat2 = NULL;
-    free(coords);
-    coords = NULL;
+    msBufferFree(&coords);
 
     if((*line)[tagOffset] != '\0')
       tagStart = findTag(*line+tagOffset+1, "shpxy");
@@ -59,6 +59,13 @@ possible to implement for other thread libraries if needed.
         Releases the indicated mutex.  If the lock id is invalid, or if the
         mutex is not currently held by this thread then results are undefined.
 
+  int msRunThreadJobs(int nJobs, int nMaxThreads, msThreadJobFunc, void *):
+        Runs a batch of independent jobs on up to nMaxThreads short lived
+        worker threads and returns once they are all done.  Each worker
+        has its own error and debug context, so jobs must record their own
+        failures in the job data.  Without thread support, or if no thread
+        can be started, the jobs run in the calling thread.
+
 It is incredibly important to ensure that any mutex that is acquired is
 released as soon as possible.  Any flow of control that could result in a
 mutex not being release is going to be a disaster.
@@ -144,10 +151,46 @@ static int thread_debug = 0;
 
 static char *lock_names[] = {
   NULL, "PARSER", "GDAL", "ERROROBJ", "PROJ", "TTF", "POOL", "SDE",
-  "ORACLE", "OWS", "LAYER_VTABLE", "IOCONTEXT", "TMPFILE", "DEBUGOBJ", "OGR", "TIME", "FRIBIDI", "WXS", "GEOS", NULL
+  "ORACLE", "OWS", "LAYER_VTABLE", "IOCONTEXT", "TMPFILE", "DEBUGOBJ", "OGR", "TIME", "FRIBIDI", "WXS", "GEOS", "CONTOUR", "QUERYCACHE", "THREADJOBS", "SLDCACHE", "HTTPSHARE", "HTTPDNS", "HTTPSSL", "HTTPCACHE", "POSTGIS", "OGRSCHEMA", NULL
 };
 #endif
 
+/************************************************************************/
+/*                          threadJobsObj                               */
+/*                                                                      */
+/*      Shared state of one msRunThreadJobs() batch.                    */
+/************************************************************************/
+
+typedef struct {
+  int nJobs;
+  int nNextJob;
+  msThreadJobFunc pfnJob;
+  void *pJobData;
+} threadJobsObj;
+
+/************************************************************************/
+/*                          msThreadJobsWork()                          */
+/*                                                                      */
+/*      Pull jobs from the batch until none are left.                   */
+/************************************************************************/
+
+static void msThreadJobsWork(threadJobsObj *jobs)
+
+{
+  int iJob;
+
+  for( ;; ) {
+    msAcquireLock( TLOCK_THREADJOBS );
+    iJob = (jobs->nNextJob < jobs->nJobs) ? jobs->nNextJob++ : -1;
+    msReleaseLock( TLOCK_THREADJOBS );
+
+    if( iJob < 0 )
+      break;
+
+    jobs->pfnJob( jobs->pJobData, iJob );
+  }
+}
+
 /************************************************************************/
 /* ==================================================================== */
 /*                               PTHREADS                               */
@@ -227,6 +270,63 @@ void msReleaseLock( int nLockId )
   pthread_mutex_unlock( mutex_locks + nLockId );
 }
 
+/************************************************************************/
+/*                          msThreadJobsMain()                          */
+/************************************************************************/
+
+static void *msThreadJobsMain( void *pData )
+
+{
+  msThreadJobsWork( (threadJobsObj *) pData );
+
+  /* drop the error and debug contexts of this worker thread */
+  msResetErrorList();
+  msDebugCleanup();
+
+  return NULL;
+}
+
+/************************************************************************/
+/*                          msRunThreadJobs()                           */
+/************************************************************************/
+
+int msRunThreadJobs( int nJobs, int nMaxThreads, msThreadJobFunc pfnJob,
+                     void *pJobData )
+
+{
+  threadJobsObj jobs;
+  pthread_t *threads;
+  int i, nThreads = 0;
+
+  jobs.nJobs = nJobs;
+  jobs.nNextJob = 0;
+  jobs.pfnJob = pfnJob;
+  jobs.pJobData = pJobData;
+
+  if( nMaxThreads > nJobs )
+    nMaxThreads = nJobs;
+
+  if( nMaxThreads > 1 ) {
+    if( mutexes_initialized == 0 )
+      msThreadInit();
+
+    threads = (pthread_t *) msSmallMalloc( sizeof(pthread_t) * nMaxThreads );
+    for( i = 0; i < nMaxThreads; i++ ) {
+      if( pthread_create( threads + nThreads, NULL, msThreadJobsMain, &jobs ) == 0 )
+        nThreads++;
+    }
+
+    for( i = 0; i < nThreads; i++ )
+      pthread_join( threads[i], NULL );
+    free( threads );
+  }
+
+  /* anything left over (no threads wanted or none could be started) */
+  msThreadJobsWork( &jobs );
+
+  return MS_SUCCESS;
+}
+
 #endif /* defined(USE_THREAD) && !defined(_WIN32) */
 
 /************************************************************************/
@@ -315,4 +415,94 @@ void msReleaseLock( int nLockId )
   ReleaseMutex( mutex_locks[nLockId] );
 }
 
+/************************************************************************/
+/*                          msThreadJobsMain()                          */
+/************************************************************************/
+
+static DWORD WINAPI msThreadJobsMain( LPVOID pData )
+
+{
+  msThreadJobsWork( (threadJobsObj *) pData );
+
+  /* drop the error and debug contexts of this worker thread */
+  msResetErrorList();
+  msDebugCleanup();
+
+  return 0;
+}
+
+/************************************************************************/
+/*                          msRunThreadJobs()                           */
+/************************************************************************/
+
+int msRunThreadJobs( int nJobs, int nMaxThreads, msThreadJobFunc pfnJob,
+                     void *pJobData )
+
+{
+  threadJobsObj jobs;
+  HANDLE *threads;
+  int i, nThreads = 0;
+
+  jobs.nJobs = nJobs;
+  jobs.nNextJob = 0;
+  jobs.pfnJob = pfnJob;
+  jobs.pJobData = pJobData;
+
+  if( nMaxThreads > nJobs )
+    nMaxThreads = nJobs;
+
+  if( nMaxThreads > 1 ) {
+    if( mutexes_initialized == 0 )
+      msThreadInit();
+
+    threads = (HANDLE *) msSmallMalloc( sizeof(HANDLE) * nMaxThreads );
+    for( i = 0; i < nMaxThreads; i++ ) {
+      threads[nThreads] = CreateThread( NULL, 0, msThreadJobsMain, &jobs, 0, NULL );
+      if( threads[nThreads] != NULL )
+        nThreads++;
+    }
+
+    for( i = 0; i < nThreads; i++ ) {
+      WaitForSingleObject( threads[i], INFINITE );
+      CloseHandle( threads[i] );
+    }
+    free( threads );
+  }
+
+  /* anything left over (no threads wanted or none could be started) */
+  msThreadJobsWork( &jobs );
+
+  return MS_SUCCESS;
+}
+
 #endif /* defined(USE_THREAD) && defined(_WIN32) */
+
+/************************************************************************/
+/* ==================================================================== */
+/*                          NO THREAD SUPPORT                           */
+/* ==================================================================== */
+/************************************************************************/
+
+#if !defined(USE_THREAD)
+
+/************************************************************************/
+/*                          msRunThreadJobs()                           */
+/************************************************************************/
+
+int msRunThreadJobs( int nJobs, int nMaxThreads, msThreadJobFunc pfnJob,
+                     void *pJobData )
+
+{
+  threadJobsObj jobs;
+
+  jobs.nJobs = nJobs;
+  jobs.nNextJob = 0;
+  jobs.pfnJob = pfnJob;
+  jobs.pJobData = pJobData;
+
+  msThreadJobsWork( &jobs );
+
+  return MS_SUCCESS;
+}
+
+#endif /* !defined(USE_THREAD) */
@@ -46,6 +46,14 @@ extern "C" {
 #define msReleaseLock(x)
 #endif
 
+  /*
+  ** Runs pfnJob(pJobData, i) for i in 0..nJobs-1 on up to nMaxThreads
+  ** worker threads and waits for all of them.  Without USE_THREAD the
+  ** jobs simply run in the calling thread.
+  */
+  typedef void (*msThreadJobFunc)(void *pJobData, int iJob);
+  int msRunThreadJobs(int nJobs, int nMaxThreads, msThreadJobFunc pfnJob, void *pJobData);
+
   /*
   ** lock ids - note there is a corresponding lock_names[] array in
   ** mapthread.c that needs to be extended when new ids are added.
@@ -69,8 +77,18 @@ extern "C" {
 #define TLOCK_FRIBIDI   16
 #define TLOCK_WxS       17
 #define TLOCK_GEOS       18
-
-#define TLOCK_STATIC_MAX 20
+#define TLOCK_CONTOUR    19
+#define TLOCK_QUERYCACHE 20
+#define TLOCK_THREADJOBS 21
+#define TLOCK_SLDCACHE   22
+#define TLOCK_HTTPSHARE  23
+#define TLOCK_HTTPDNS    24
+#define TLOCK_HTTPSSL    25
+#define TLOCK_HTTPCACHE  26
+#define TLOCK_POSTGIS    27
+#define TLOCK_OGRSCHEMA  28
+
+#define TLOCK_STATIC_MAX 29
 #define TLOCK_MAX       100
 
 #ifdef __cplusplus
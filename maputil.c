@@ -37,6 +37,7 @@
 #include "maptime.h"
 #include "mapthread.h"
 #include "mapcopy.h"
+#include "mapogcsld.h"
 
 #if defined(_WIN32) && !defined(__CYGWIN__)
 # include <windows.h>
@@ -682,12 +683,12 @@ char *msEvalTextExpressionInternal(expressionObj *expr, shapeObj *shape, int bJS
 
 char *msEvalTextExpressionJSonEscape(expressionObj *expr, shapeObj *shape)
 {
-    return msEvalTextExpressionInternal(expr, shape, TRUE);
+    return msEvalTextExpressionInternal(expr, shape, MS_TRUE);
 }
 
 char *msEvalTextExpression(expressionObj *expr, shapeObj *shape)
 {
-    return msEvalTextExpressionInternal(expr, shape, FALSE);
+    return msEvalTextExpressionInternal(expr, shape, MS_FALSE);
 }
 
 char* msShapeGetLabelAnnotation(layerObj *layer, shapeObj *shape, labelObj *lbl) {
@@ -1928,6 +1929,15 @@ void msCleanup(int signal)
   }
   msyylex_destroy();
 
+  msOWSCapabilitiesCacheCleanup();
+  msQueryCacheCleanup();
+  msSLDCacheCleanup();
+  msWFSSchemaCacheCleanup();
+
+#ifdef USE_GDAL
+  /* cached contour datasources must be closed while OGR is still around */
+  msContourCleanup();
+#endif
 #ifdef USE_OGR
   msOGRCleanup();
 #endif
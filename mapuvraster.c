@@ -76,8 +76,11 @@ typedef struct {
 
   /* double   shape_tolerance; */
 
-  float **u; /* u values */
-  float **v; /* v values */
+  float *u; /* u values, one per cell (row major) */
+  float *v; /* v values, one per cell (row major) */
+  double *angle; /* vector angle in degrees, one per cell */
+  float *length; /* vector length (scaled by UV_SIZE_SCALE), one per cell */
+  int *cells; /* cell index of each non null vector, in shape order */
   int width;
   int height;
   rectObj extent;
@@ -163,6 +166,9 @@ static void msUVRasterLayerInfoInitialize(layerObj *layer)
   /* uvlinfo->shape_tolerance = 0.0; */
   uvlinfo->u = NULL;
   uvlinfo->v = NULL;
+  uvlinfo->angle = NULL;
+  uvlinfo->length = NULL;
+  uvlinfo->cells = NULL;
   uvlinfo->width = 0;
   uvlinfo->height = 0;
 
@@ -180,24 +186,15 @@ static void msUVRasterLayerInfoFree( layerObj *layer )
 
 {
   uvRasterLayerInfo *uvlinfo = (uvRasterLayerInfo *) layer->layerinfo;
-  int i;
 
   if( uvlinfo == NULL )
     return;
 
-  if (uvlinfo->u) {
-    for (i=0; i<uvlinfo->width; ++i) {
-      free(uvlinfo->u[i]);
-    }
-    free(uvlinfo->u);
-  }
-
-  if (uvlinfo->v) {
-    for (i=0; i<uvlinfo->width; ++i) {
-      free(uvlinfo->v[i]);
-    }
-    free(uvlinfo->v);
-  }
+  /* v, when set, points into the u buffer */
+  msFree(uvlinfo->u);
+  msFree(uvlinfo->angle);
+  msFree(uvlinfo->length);
+  msFree(uvlinfo->cells);
 
   free( uvlinfo );
 
@@ -261,18 +258,33 @@ int msUVRASTERLayerGetItems(layerObj *layer)
   return msUVRASTERLayerInitItemInfo(layer);
 }
 
+/**********************************************************************
+ *                     msUVRASTERFormatValue()
+ *
+ * Same output as snprintf("%f"): msFormatDouble() formats the common
+ * values itself and leaves the ones it cannot round exactly to snprintf().
+ **********************************************************************/
+static char *msUVRASTERFormatValue(double value)
+{
+  char tmp[100];
+
+  msFormatDouble(tmp, sizeof(tmp), value, 6);
+  return msStrdup(tmp);
+}
+
 /**********************************************************************
  *                     msUVRASTERGetValues()
  *
  * Special attribute names are used to return some UV params: uv_angle,
- * uv_length, u and v.
+ * uv_length, u and v. The numeric values have been computed for all the
+ * cells in msUVRASTERLayerWhichShapes(), only the formatting of the
+ * requested items is left.
  **********************************************************************/
-static char **msUVRASTERGetValues(layerObj *layer, float *u, float *v)
+static char **msUVRASTERGetValues(layerObj *layer, uvRasterLayerInfo *uvlinfo,
+                                  int cell)
 {
   char **values;
   int i = 0;
-  char tmp[100];
-  float size_scale;
   int *itemindexes = (int*)layer->iteminfo;
 
   if(layer->numitems == 0)
@@ -287,42 +299,23 @@ static char **msUVRASTERGetValues(layerObj *layer, float *u, float *v)
     return(NULL);
   }
 
-  /* -------------------------------------------------------------------- */
-  /*    Determine desired size_scale.  Default to 1 if not otherwise set  */
-  /* -------------------------------------------------------------------- */
-  size_scale = 1;
-  if( CSLFetchNameValue( layer->processing, "UV_SIZE_SCALE" ) != NULL ) {
-    size_scale =
-      atof(CSLFetchNameValue( layer->processing, "UV_SIZE_SCALE" ));
-  }
-
   for(i=0; i<layer->numitems; i++) {
     if (itemindexes[i] == MSUVRASTER_ANGLEINDEX) {
-      snprintf(tmp, 100, "%f", (atan2((double)*v, (double)*u) * 180 / MS_PI));
-      values[i] = msStrdup(tmp);
+      values[i] = msUVRASTERFormatValue(uvlinfo->angle[cell]);
     } else if (itemindexes[i] == MSUVRASTER_MINUSANGLEINDEX) {
       double minus_angle;
-      minus_angle = (atan2((double)*v, (double)*u) * 180 / MS_PI)+180;
+      minus_angle = uvlinfo->angle[cell]+180;
       if (minus_angle >= 360)
         minus_angle -= 360;
-      snprintf(tmp, 100, "%f", minus_angle);
-      values[i] = msStrdup(tmp);
-    } else if ( (itemindexes[i] == MSUVRASTER_LENGTHINDEX) ||
-                (itemindexes[i] == MSUVRASTER_LENGTH2INDEX) ) {
-      float length = sqrt((*u**u)+(*v**v))*size_scale;
-
-      if (itemindexes[i] == MSUVRASTER_LENGTHINDEX)
-        snprintf(tmp, 100, "%f", length);
-      else
-        snprintf(tmp, 100, "%f", length/2);
-
-      values[i] = msStrdup(tmp);
+      values[i] = msUVRASTERFormatValue(minus_angle);
+    } else if (itemindexes[i] == MSUVRASTER_LENGTHINDEX) {
+      values[i] = msUVRASTERFormatValue(uvlinfo->length[cell]);
+    } else if (itemindexes[i] == MSUVRASTER_LENGTH2INDEX) {
+      values[i] = msUVRASTERFormatValue(uvlinfo->length[cell]/2);
     } else if (itemindexes[i] == MSUVRASTER_UINDEX) {
-      snprintf(tmp, 100, "%f",*u);
-      values[i] = msStrdup(tmp);
+      values[i] = msUVRASTERFormatValue(uvlinfo->u[cell]);
     } else if (itemindexes[i] == MSUVRASTER_VINDEX) {
-      snprintf(tmp, 100, "%f",*v);
-      values[i] = msStrdup(tmp);
+      values[i] = msUVRASTERFormatValue(uvlinfo->v[cell]);
     }
   }
 
@@ -337,7 +330,9 @@ int msUVRASTERLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
   mapObj *map_tmp;
   double map_cellsize;
   unsigned int spacing;
-  int width, height, u_src_off, v_src_off, i, x, y;
+  float size_scale;
+  float *u, *v;
+  int width, height, cell_count, i, x, y;
   char   **alteredProcessing = NULL, *saved_layer_mask;
   char **savedProcessing = NULL;
 
@@ -468,43 +463,48 @@ int msUVRASTERLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
     CSLDestroy(alteredProcessing);
   }
 
-  /* free old query arrays */
-  if (uvlinfo->u) {
-    for (i=0; i<uvlinfo->width; ++i) {
-      free(uvlinfo->u[i]);
-    }
-    free(uvlinfo->u);
+  /* -------------------------------------------------------------------- */
+  /*    Determine desired size_scale.  Default to 1 if not otherwise set  */
+  /* -------------------------------------------------------------------- */
+  size_scale = 1;
+  if( CSLFetchNameValue( layer->processing, "UV_SIZE_SCALE" ) != NULL ) {
+    size_scale =
+      atof(CSLFetchNameValue( layer->processing, "UV_SIZE_SCALE" ));
   }
 
-  if (uvlinfo->v) {
-    for (i=0; i<uvlinfo->height; ++i) {
-      free(uvlinfo->v[i]);
-    }
-    free(uvlinfo->v);
-  }
+  /* free old query arrays */
+  msFree(uvlinfo->u);
+  msFree(uvlinfo->angle);
+  msFree(uvlinfo->length);
+  msFree(uvlinfo->cells);
 
   /* Update our uv layer structure */
   uvlinfo->width = width;
   uvlinfo->height = height;
-  uvlinfo->query_results = width*height;
+  cell_count = width*height;
 
-  uvlinfo->u = (float **)msSmallMalloc(sizeof(float *)*width);
-  uvlinfo->v = (float **)msSmallMalloc(sizeof(float *)*width);
+  /* the raw image holds the u band followed by the v band */
+  uvlinfo->u = u = (float *)msSmallMalloc(sizeof(float)*cell_count*2);
+  uvlinfo->v = v = u + cell_count;
+  memcpy(u, image_tmp->img.raw_float, sizeof(float)*cell_count*2);
 
-  for (x = 0; x < width; ++x) {
-    uvlinfo->u[x] = (float *)msSmallMalloc(height * sizeof(float));
-    uvlinfo->v[x] = (float *)msSmallMalloc(height * sizeof(float));
-
-    for (y = 0; y < height; ++y) {
-      u_src_off = v_src_off = x + y * width;
-      v_src_off += width*height;
+  uvlinfo->angle = (double *)msSmallMalloc(sizeof(double)*cell_count);
+  uvlinfo->length = (float *)msSmallMalloc(sizeof(float)*cell_count);
+  uvlinfo->cells = (int *)msSmallMalloc(sizeof(int)*cell_count);
 
-      uvlinfo->u[x][y] = image_tmp->img.raw_float[u_src_off];
-      uvlinfo->v[x][y] = image_tmp->img.raw_float[v_src_off];
+  /* compute the vector attributes of all the cells in one go */
+  for (i = 0; i < cell_count; ++i) {
+    uvlinfo->angle[i] = atan2((double)v[i], (double)u[i]) * 180 / MS_PI;
+    uvlinfo->length[i] = sqrt((u[i]*u[i])+(v[i]*v[i]))*size_scale;
+  }
 
-      /* null vector? update the number of results  */
-      if (uvlinfo->u[x][y] == 0 && uvlinfo->v[x][y] == 0)
-        --uvlinfo->query_results;
+  /* index the non null vectors, column by column */
+  uvlinfo->query_results = 0;
+  for (x = 0; x < width; ++x) {
+    for (y = 0; y < height; ++y) {
+      i = x + y * width;
+      if (u[i] != 0 || v[i] != 0)
+        uvlinfo->cells[uvlinfo->query_results++] = i;
     }
   }
 
@@ -521,7 +521,7 @@ int msUVRASTERLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
   uvRasterLayerInfo *uvlinfo = (uvRasterLayerInfo *) layer->layerinfo;
   lineObj line ;
   pointObj point;
-  int i, j, k, x=0, y=0;
+  int cell, x, y;
   long shapeindex = record->shapeindex;
 
   msFreeShape(shape);
@@ -536,14 +536,9 @@ int msUVRASTERLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
     return MS_FAILURE;
   }
 
-  /* loop to the next non null vector */
-  k = 0;
-  for (i=0, x=-1; i<uvlinfo->width && k<=shapeindex; ++i, ++x) {
-    for (j=0, y=-1; j<uvlinfo->height && k<=shapeindex; ++j, ++k, ++y) {
-      if (uvlinfo->u[i][j] == 0 && uvlinfo->v[i][j] == 0)
-        --k;
-    }
-  }
+  cell = uvlinfo->cells[shapeindex];
+  x = cell % uvlinfo->width;
+  y = cell / uvlinfo->width;
 
   point.x = Pix2Georef(x, 0, uvlinfo->width-1,
                        uvlinfo->extent.minx, uvlinfo->extent.maxx, MS_FALSE);
@@ -564,7 +559,7 @@ int msUVRASTERLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
   msComputeBounds( shape );
 
   shape->numvalues = layer->numitems;
-  shape->values = msUVRASTERGetValues(layer, &uvlinfo->u[x][y], &uvlinfo->v[x][y]);
+  shape->values = msUVRASTERGetValues(layer, uvlinfo, cell);
 
   return MS_SUCCESS;
 
@@ -1601,6 +1601,120 @@ static int msWCSWriteDocument20(mapObj* map, xmlDocPtr psDoc)
   return MS_SUCCESS;
 }
 
+/************************************************************************/
+/*                   msWCSWriteVSIFiles20()                             */
+/*                                                                      */
+/*      Streams the files written under the /vsimem directory           */
+/*      base_dir, primary file filename first, and frees both names.    */
+/************************************************************************/
+
+static int msWCSWriteVSIFiles20(mapObj* map, char *base_dir, char *filename, int multipart)
+{
+  char **all_files = CPLReadDir( base_dir );
+  int count = CSLCount(all_files);
+  int i;
+
+  if( msIO_needBinaryStdout() == MS_FAILURE )
+    return MS_FAILURE;
+
+  /* -------------------------------------------------------------------- */
+  /*      When potentially listing multiple files, we take great care     */
+  /*      to identify the "primary" file and list it first.  In fact      */
+  /*      it is the only file listed in the coverages document.           */
+  /* -------------------------------------------------------------------- */
+
+  msAcquireLock( TLOCK_GDAL );
+  for( i = count-1; i >= 0; i-- ) {
+    const char *this_file = all_files[i];
+
+    if( EQUAL(this_file,".") || EQUAL(this_file,"..") ) {
+      all_files = CSLRemoveStrings( all_files, i, 1, NULL );
+      continue;
+    }
+
+    if( i > 0 && EQUAL(this_file,CPLGetFilename(filename)) ) {
+      all_files = CSLRemoveStrings( all_files, i, 1, NULL );
+      all_files = CSLInsertString(all_files,0,CPLGetFilename(filename));
+      i++;
+    }
+  }
+
+  /* -------------------------------------------------------------------- */
+  /*      Dump all the files in the memory directory as mime sections.    */
+  /* -------------------------------------------------------------------- */
+  count = CSLCount(all_files);
+
+  if(count > 1 && multipart == MS_FALSE) {
+    msDebug( "msWCSWriteVSIFiles20(): force multipart output without gml summary because we have multiple files in the result.\n" );
+
+    multipart = MS_TRUE;
+    msIO_setHeader("Content-Type","multipart/related; boundary=wcs");
+    msIO_sendHeaders();
+  }
+
+  for( i = 0; i < count; i++ ) {
+    const char *mimetype = NULL;
+    GByte *data;
+    vsi_l_offset data_length = 0;
+
+    if( i == 0
+        && !EQUAL(MS_IMAGE_MIME_TYPE(map->outputformat), "unknown") )
+      mimetype = MS_IMAGE_MIME_TYPE(map->outputformat);
+
+    if( mimetype == NULL )
+      mimetype = "application/octet-stream";
+    if(multipart) {
+      msIO_fprintf( stdout, "\r\n--wcs\r\n" );
+      msIO_fprintf(
+        stdout,
+        "Content-Type: %s\r\n"
+        "Content-Description: coverage data\r\n"
+        "Content-Transfer-Encoding: binary\r\n"
+        "Content-ID: coverage/%s\r\n"
+        "Content-Disposition: INLINE; filename=%s\r\n\r\n",
+        mimetype,
+        all_files[i],
+        all_files[i]);
+    } else {
+      msIO_setHeader("Content-Type","%s",mimetype);
+      msIO_setHeader("Content-Description","coverage data");
+      msIO_setHeader("Content-Transfer-Encoding","binary");
+      msIO_setHeader("Content-ID","coverage/%s",all_files[i]);
+      msIO_setHeader("Content-Disposition","INLINE; filename=%s",all_files[i]);
+      msIO_sendHeaders();
+    }
+
+
+    /* take over the memory file buffer rather than copying it out */
+    data = VSIGetMemFileBuffer( CPLFormFilename(base_dir, all_files[i], NULL),
+                                &data_length, TRUE );
+    if( data == NULL ) {
+      msSetError( MS_MISCERR,
+                  "Failed to open %s for streaming to stdout.",
+                  "msWCSWriteVSIFiles20()", all_files[i] );
+      msFree(base_dir);
+      msFree(filename);
+      CSLDestroy( all_files );
+      msReleaseLock( TLOCK_GDAL );
+      /* the output has started, at least terminate the multipart stream */
+      if(multipart)
+        msIO_fprintf( stdout, "\r\n--wcs--\r\n" );
+      return MS_FAILURE;
+    }
+
+    msIO_fwrite( data, 1, (size_t) data_length, stdout );
+    CPLFree( data );
+  }
+
+  msFree(base_dir);
+  msFree(filename);
+  CSLDestroy( all_files );
+  msReleaseLock( TLOCK_GDAL );
+  if(multipart)
+    msIO_fprintf( stdout, "\r\n--wcs--\r\n" );
+  return MS_SUCCESS;
+}
+
 /************************************************************************/
 /*                   msWCSWriteFile20()                                 */
 /*                                                                      */
@@ -1614,7 +1728,6 @@ static int msWCSWriteFile20(mapObj* map, imageObj* image, wcs20ParamsObjPtr para
   char* filename = NULL;
   char *base_dir = NULL;
   const char *fo_filename;
-  int i;
 
   fo_filename = msGetOutputFormatOption( image->format, "FILENAME", NULL );
 
@@ -1715,109 +1828,216 @@ static int msWCSWriteFile20(mapObj* map, imageObj* image, wcs20ParamsObjPtr para
     return MS_SUCCESS;
   }
 
-  /* -------------------------------------------------------------------- */
-  /*      When potentially listing multiple files, we take great care     */
-  /*      to identify the "primary" file and list it first.  In fact      */
-  /*      it is the only file listed in the coverages document.           */
-  /* -------------------------------------------------------------------- */
-  {
-    char **all_files = CPLReadDir( base_dir );
-    int count = CSLCount(all_files);
+  return msWCSWriteVSIFiles20(map, base_dir, filename, multipart);
+}
 
-    if( msIO_needBinaryStdout() == MS_FAILURE )
-      return MS_FAILURE;
+/************************************************************************/
+/*                   msWCSGetCoverage20_StripRows()                     */
+/*                                                                      */
+/*      Returns the number of lines per strip if the coverage should    */
+/*      be rendered strip by strip ("wcs_strip_rows" layer metadata),   */
+/*      or 0 to render it in one piece.                                 */
+/************************************************************************/
 
-    msAcquireLock( TLOCK_GDAL );
-    for( i = count-1; i >= 0; i-- ) {
-      const char *this_file = all_files[i];
+static int msWCSGetCoverage20_StripRows(mapObj *map, layerObj *layer)
+{
+  const char *value;
+  int strip_rows;
+  GDALDriverH hDriver;
+
+  value = msOWSLookupMetadata(&(layer->metadata), "CO", "strip_rows");
+  if( value == NULL || (strip_rows = atoi(value)) < 2
+      || map->height <= strip_rows )
+    return 0;
+
+  /* only raw data written through a GDAL driver that supports Create() */
+  if( !map->outputformat || !MS_RENDERER_RAWDATA(map->outputformat)
+      || !EQUALN(map->outputformat->driver,"GDAL/",5)
+      || layer->mask || map->gt.need_geotransform )
+    return 0;
+
+  msGDALInitialize();
+
+  msAcquireLock( TLOCK_GDAL );
+  hDriver = GDALGetDriverByName( map->outputformat->driver+5 );
+  if( hDriver == NULL
+      || GDALGetMetadataItem( hDriver, GDAL_DCAP_CREATE, NULL ) == NULL
+      || GDALGetMetadataItem( hDriver, GDAL_DCAP_VIRTUALIO, NULL ) == NULL )
+    strip_rows = 0;
+  msReleaseLock( TLOCK_GDAL );
+
+  return strip_rows;
+}
 
-      if( EQUAL(this_file,".") || EQUAL(this_file,"..") ) {
-        all_files = CSLRemoveStrings( all_files, i, 1, NULL );
-        continue;
-      }
+/************************************************************************/
+/*                   msWCSRenderStrips20()                              */
+/*                                                                      */
+/*      Renders the coverage strip_rows lines at a time straight into   */
+/*      a GDAL dataset created under /vsimem, so the full coverage is   */
+/*      never held in an imageObj. Nothing is written to the output,    */
+/*      the result is streamed with msWCSWriteVSIFiles20() from the     */
+/*      returned base_dir and filename.                                 */
+/************************************************************************/
 
-      if( i > 0 && EQUAL(this_file,CPLGetFilename(filename)) ) {
-        all_files = CSLRemoveStrings( all_files, i, 1, NULL );
-        all_files = CSLInsertString(all_files,0,CPLGetFilename(filename));
-        i++;
-      }
-    }
+static int msWCSRenderStrips20(mapObj* map, layerObj *layer, int strip_rows,
+                               char **base_dir_out, char **filename_out)
+{
+  outputFormatObj *format = map->outputformat;
+  GDALDriverH hDriver;
+  GDALDatasetH hDS;
+  GDALDataType eDataType = GDT_Byte;
+  char **papszOptions = NULL;
+  char *base_dir, *filename, *pszWKT;
+  const char *fo_filename, *nullvalue;
+  const char *pszExtension = format->extension;
+  rectObj full_extent = map->extent, full_saved_extent = map->saved_extent;
+  geotransformObj full_gt = map->gt;
+  int full_height = map->height;
+  int block_xsize, block_ysize;
+  double cellheight;
+  int i, row, rows, status = MS_SUCCESS;
+
+  if( format->imagemode == MS_IMAGEMODE_INT16 )
+    eDataType = GDT_Int16;
+  else if( format->imagemode == MS_IMAGEMODE_FLOAT32 )
+    eDataType = GDT_Float32;
+
+  fo_filename = msGetOutputFormatOption( format, "FILENAME", NULL );
+  if( pszExtension == NULL )
+    pszExtension = "img.tmp";
+
+  msAcquireLock( TLOCK_GDAL );
+  hDriver = GDALGetDriverByName( format->driver+5 );
+
+  base_dir = msTmpFile(map, map->mappath, "/vsimem/wcsout", NULL);
+  if( fo_filename )
+    filename = msStrdup(CPLFormFilename(base_dir, fo_filename, NULL));
+  else
+    filename = msStrdup(CPLFormFilename(base_dir, "out", pszExtension));
+
+  for( i = 0; i < format->numformatoptions; i++ )
+    papszOptions = CSLAddString( papszOptions, format->formatoptions[i] );
+
+  if( EQUAL(format->driver+5, "GTiff") ) {
+    /* tiles get completed (and compressed) as the strips come in */
+    if( CSLFetchNameValue( papszOptions, "TILED" ) == NULL )
+      papszOptions = CSLSetNameValue( papszOptions, "TILED", "YES" );
+#if defined(GDAL_VERSION_NUM) && GDAL_VERSION_NUM >= 2010000
+    if( CSLFetchNameValue( papszOptions, "COMPRESS" ) != NULL
+        && CSLFetchNameValue( papszOptions, "NUM_THREADS" ) == NULL )
+      papszOptions = CSLSetNameValue( papszOptions, "NUM_THREADS", "ALL_CPUS" );
+#endif
+  }
 
-    /* -------------------------------------------------------------------- */
-    /*      Dump all the files in the memory directory as mime sections.    */
-    /* -------------------------------------------------------------------- */
-    count = CSLCount(all_files);
+  hDS = GDALCreate( hDriver, filename, map->width, map->height, format->bands,
+                    eDataType, papszOptions );
+  CSLDestroy( papszOptions );
+  if( hDS == NULL ) {
+    msReleaseLock( TLOCK_GDAL );
+    msSetError( MS_MISCERR, "Failed to create output %s file.\n%s",
+                "msWCSRenderStrips20()", format->driver+5,
+                CPLGetLastErrorMsg() );
+    msFree(base_dir);
+    msFree(filename);
+    return MS_FAILURE;
+  }
 
-    if(count > 1 && multipart == MS_FALSE) {
-      msDebug( "msWCSWriteFile20(): force multipart output without gml summary because we have multiple files in the result.\n" );
+  GDALSetGeoTransform( hDS, map->gt.geotransform );
+  pszWKT = msProjectionObj2OGCWKT( &(map->projection) );
+  if( pszWKT != NULL ) {
+    GDALSetProjection( hDS, pszWKT );
+    msFree( pszWKT );
+  }
 
-      multipart = MS_TRUE;
-      msIO_setHeader("Content-Type","multipart/related; boundary=wcs");
-      msIO_sendHeaders();
+  nullvalue = msGetOutputFormatOption( format, "NULLVALUE", NULL );
+  if( nullvalue != NULL ) {
+    for( i = 0; i < format->bands; i++ )
+      GDALSetRasterNoDataValue( GDALGetRasterBand( hDS, i+1 ), atof(nullvalue) );
+  }
+
+  /* same resolution tags as msSaveImageGDAL() */
+  if( map->resolution > 0 ) {
+    char res[30];
+
+    snprintf( res, sizeof(res), "%lf", map->resolution );
+    GDALSetMetadataItem( hDS, "TIFFTAG_XRESOLUTION", res, NULL );
+    GDALSetMetadataItem( hDS, "TIFFTAG_YRESOLUTION", res, NULL );
+    GDALSetMetadataItem( hDS, "TIFFTAG_RESOLUTIONUNIT", "2", NULL );
+  }
+
+  /* write whole blocks only, partial ones would be flushed and rewritten */
+  GDALGetBlockSize( GDALGetRasterBand( hDS, 1 ), &block_xsize, &block_ysize );
+  if( block_ysize > 1 && strip_rows % block_ysize != 0 )
+    strip_rows += block_ysize - strip_rows % block_ysize;
+  msReleaseLock( TLOCK_GDAL );
+
+  /* map extents are based on the center of the edge pixels */
+  cellheight = (full_extent.maxy - full_extent.miny) / (full_height - 1);
+
+  for( row = 0; row < full_height && status == MS_SUCCESS; row += rows ) {
+    imageObj *image;
+    void *pData;
+
+    rows = MS_MIN(strip_rows, full_height - row);
+    if( full_height - row - rows == 1 )
+      rows++; /* a single line strip has no extent */
+
+    map->height = rows;
+    map->extent.maxy = full_extent.maxy - row * cellheight;
+    map->extent.miny = map->extent.maxy - (rows - 1) * cellheight;
+    msMapComputeGeotransform(map);
+
+    image = msImageCreate(map->width, rows, format,
+                          map->web.imagepath, map->web.imageurl, map->resolution,
+                          map->defresolution, &map->imagecolor);
+    if( image == NULL ) {
+      status = MS_FAILURE;
+      break;
     }
 
-    for( i = 0; i < count; i++ ) {
-      const char *mimetype = NULL;
-      FILE *fp;
-      unsigned char block[4000];
-      int bytes_read;
-
-      if( i == 0
-          && !EQUAL(MS_IMAGE_MIME_TYPE(map->outputformat), "unknown") )
-        mimetype = MS_IMAGE_MIME_TYPE(map->outputformat);
-
-      if( mimetype == NULL )
-        mimetype = "application/octet-stream";
-      if(multipart) {
-        msIO_fprintf( stdout, "\r\n--wcs\r\n" );
-        msIO_fprintf(
-          stdout,
-          "Content-Type: %s\r\n"
-          "Content-Description: coverage data\r\n"
-          "Content-Transfer-Encoding: binary\r\n"
-          "Content-ID: coverage/%s\r\n"
-          "Content-Disposition: INLINE; filename=%s\r\n\r\n",
-          mimetype,
-          all_files[i],
-          all_files[i]);
-      } else {
-        msIO_setHeader("Content-Type","%s",mimetype);
-        msIO_setHeader("Content-Description","coverage data");
-        msIO_setHeader("Content-Transfer-Encoding","binary");
-        msIO_setHeader("Content-ID","coverage/%s",all_files[i]);
-        msIO_setHeader("Content-Disposition","INLINE; filename=%s",all_files[i]);
-        msIO_sendHeaders();
-      }
-
-
-      fp = VSIFOpenL(
-             CPLFormFilename(base_dir, all_files[i], NULL),
-             "rb" );
-      if( fp == NULL ) {
-        msReleaseLock( TLOCK_GDAL );
-        msSetError( MS_MISCERR,
-                    "Failed to open %s for streaming to stdout.",
-                    "msWCSWriteFile20()", all_files[i] );
-        return MS_FAILURE;
+    status = msDrawRasterLayerLow( map, layer, image, NULL );
+    if( status == MS_SUCCESS ) {
+      if( format->imagemode == MS_IMAGEMODE_INT16 )
+        pData = image->img.raw_16bit;
+      else if( format->imagemode == MS_IMAGEMODE_FLOAT32 )
+        pData = image->img.raw_float;
+      else
+        pData = image->img.raw_byte;
+
+      /* the raw buffers hold one band after the other */
+      msAcquireLock( TLOCK_GDAL );
+      if( GDALDatasetRasterIO( hDS, GF_Write, 0, row, map->width, rows,
+                               pData, map->width, rows, eDataType,
+                               format->bands, NULL, 0, 0, 0 ) != CE_None ) {
+        msSetError( MS_MISCERR, "Failed to write coverage strip.\n%s",
+                    "msWCSRenderStrips20()", CPLGetLastErrorMsg() );
+        status = MS_FAILURE;
       }
+      msReleaseLock( TLOCK_GDAL );
+    }
 
-      while( (bytes_read = VSIFReadL(block, 1, sizeof(block), fp)) > 0 )
-        msIO_fwrite( block, 1, bytes_read, stdout );
+    msFreeImage( image );
+  }
 
-      VSIFCloseL( fp );
+  map->extent = full_extent;
+  map->saved_extent = full_saved_extent;
+  map->height = full_height;
+  map->gt = full_gt;
 
-      VSIUnlink( CPLFormFilename(base_dir, all_files[i], NULL) );
-    }
+  msAcquireLock( TLOCK_GDAL );
+  GDALClose( hDS );
+  if( status != MS_SUCCESS )
+    VSIUnlink( filename );
+  msReleaseLock( TLOCK_GDAL );
 
+  if( status != MS_SUCCESS ) {
     msFree(base_dir);
     msFree(filename);
-    CSLDestroy( all_files );
-    msReleaseLock( TLOCK_GDAL );
-    if(multipart)
-      msIO_fprintf( stdout, "\r\n--wcs--\r\n" );
-    return MS_SUCCESS;
+    return MS_FAILURE;
   }
 
+  *base_dir_out = base_dir;
+  *filename_out = filename;
   return MS_SUCCESS;
 }
 
@@ -3120,7 +3340,8 @@ int msWCSGetCoverage20(mapObj *map, cgiRequestObj *request,
   rectObj subsets, bbox;
   projectionObj imageProj;
 
-  int status, i;
+  int status, i, strip_rows;
+  char *strip_base_dir = NULL, *strip_filename = NULL;
   double x_1, x_2, y_1, y_2;
   char *coverageName, *bandlist=NULL, numbands[8];
 
@@ -3491,6 +3712,9 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage20()", p
     msLayerSetProcessingKey(layer, "CLOSE_CONNECTION", "NORMAL");
   }
 
+  /* large coverages may be rendered strip by strip while writing */
+  strip_rows = msWCSGetCoverage20_StripRows(map, layer);
+
   /* create the image object  */
   if (!map->outputformat) {
     msWCSClearCoverageMetadata20(&cm);
@@ -3498,6 +3722,8 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage20()", p
     msSetError(MS_WCSERR, "The map outputformat is missing!",
                "msWCSGetCoverage20()");
     return msWCSException(map, NULL, NULL, params->version);
+  } else if (strip_rows > 0) {
+    image = NULL; /* see msWCSRenderStrips20() */
   } else if (MS_RENDERER_PLUGIN(map->outputformat)) {
     image = msImageCreate(map->width, map->height, map->outputformat,
                           map->web.imagepath, map->web.imageurl, map->resolution,
@@ -3514,7 +3740,7 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage20()", p
     return msWCSException(map, NULL, NULL, params->version);
   }
 
-  if (image == NULL) {
+  if (image == NULL && strip_rows == 0) {
     msFree(bandlist);
     msWCSClearCoverageMetadata20(&cm);
     return msWCSException(map, NULL, NULL, params->version);
@@ -3594,7 +3820,10 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage20()", p
   }
 
   /* Actually produce the "grid". */
-  if( MS_RENDERER_RAWDATA(map->outputformat) ) {
+  if( strip_rows > 0 ) {
+    /* before any output, so that failures can still be reported */
+    status = msWCSRenderStrips20( map, layer, strip_rows, &strip_base_dir, &strip_filename );
+  } else if( MS_RENDERER_RAWDATA(map->outputformat) ) {
     status = msDrawRasterLayerLow( map, layer, image, NULL );
   } else {
     rasterBufferObj rb;
@@ -3672,9 +3901,9 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage20()", p
     psRangeParameters = xmlNewChild(psFile, psGmlNs, BAD_CAST "rangeParameters", NULL);
 
     default_filename = msStrdup("out.");
-    default_filename = msStringConcatenate(default_filename, MS_IMAGE_EXTENSION(image->format));
+    default_filename = msStringConcatenate(default_filename, MS_IMAGE_EXTENSION(map->outputformat));
 
-    filename = msGetOutputFormatOption(image->format, "FILENAME", default_filename);
+    filename = msGetOutputFormatOption(map->outputformat, "FILENAME", default_filename);
     length = strlen("cid:coverage/") + strlen(filename) + 1;
     file_ref = msSmallMalloc(length);
     strlcpy(file_ref, "cid:coverage/", length);
@@ -3706,13 +3935,18 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage20()", p
     msIO_printf("\r\n--wcs\r\n");
 
     msWCSWriteDocument20(map, psDoc);
-    msWCSWriteFile20(map, image, params, 1);
+    if( strip_rows > 0 )
+      msWCSWriteVSIFiles20(map, strip_base_dir, strip_filename, 1);
+    else
+      msWCSWriteFile20(map, image, params, 1);
 
     msFree(file_ref);
     msFree(role);
     xmlFreeDoc(psDoc);
     xmlCleanupParser();
   /* just print out the file without gml */
+  } else if( strip_rows > 0 ) {
+    msWCSWriteVSIFiles20(map, strip_base_dir, strip_filename, 0);
   } else {
     msWCSWriteFile20(map, image, params, 0);
   }
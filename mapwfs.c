@@ -3195,6 +3195,47 @@ static int msWFSApplySortBy(mapObj* map, wfsParamsObj *paramsObj, layerObj* lp,
 /*
 ** msWFSGetFeature()
 */
+/*
+** msWFSSetGMLLayerMetadata()
+**
+** Install the GML_GROUPS, GML_INCLUDE_ITEMS and GML_GEOMETRIES overrides
+** derived from the PROPERTYNAME parameter in the layer metadata.
+*/
+static void msWFSSetGMLLayerMetadata(mapObj *map, char **papszGMLGroups,
+                                     char **papszGMLIncludeItems,
+                                     char **papszGMLGeometries)
+{
+  int i;
+  for(i=0;i<map->numlayers;i++)
+  {
+    layerObj* lp = GET_LAYER(map, i);
+    if( papszGMLGroups[i] )
+        msInsertHashTable(&(lp->metadata), "GML_GROUPS", papszGMLGroups[i]);
+    if( papszGMLIncludeItems[i] )
+        msInsertHashTable(&(lp->metadata), "GML_INCLUDE_ITEMS", papszGMLIncludeItems[i]);
+    if( papszGMLGeometries[i] )
+        msInsertHashTable(&(lp->metadata), "GML_GEOMETRIES", papszGMLGeometries[i]);
+  }
+}
+
+/*
+** msWFSCanStreamFeatures()
+**
+** GML features can be encoded while the query runs (instead of fetching them
+** again from the result cache afterwards) when wfs_stream_features is set and
+** the features of a single typename are retrieved with a plain BBOX query.
+*/
+static int msWFSCanStreamFeatures(mapObj *map, const wfsParamsObj *paramsObj,
+                                  int numlayers)
+{
+  const char* value = msOWSLookupMetadata(&(map->web.metadata), "F", "stream_features");
+  if( value == NULL || strcasecmp(value, "true") != 0 )
+    return MS_FALSE;
+
+  return numlayers == 1 && paramsObj->pszFilter == NULL &&
+         paramsObj->pszFeatureId == NULL && paramsObj->countGetFeatureById == 0;
+}
+
 static
 int msWFSGetFeature(mapObj *map, wfsParamsObj *paramsObj, cgiRequestObj *req,
                     owsRequestObj *ows_request, int nWFSVersion)
@@ -3223,6 +3264,15 @@ int msWFSGetFeature(mapObj *map, wfsParamsObj *paramsObj, cgiRequestObj *req,
   char** papszGMLGeometries = NULL;
   
   msIOContext* old_context = NULL;
+  gmlWFSQueryStreamObj* queryStream = NULL;
+
+  /* Would make sense for WFS 1.1.0 too ! See #3576 */
+  int bUseURN = (nWFSVersion == OWS_2_0_0);
+  const char* useurn = msOWSLookupMetadata(&(map->web.metadata), "F", "return_srs_as_urn");
+  if (useurn && strcasecmp(useurn, "true") == 0)
+    bUseURN = 1;
+  else if (useurn && strcasecmp(useurn, "false") == 0)
+    bUseURN = 0;
 
   /* Initialize gml options */
   msWFSInitGMLInfo(&gmlinfo);
@@ -3639,7 +3689,27 @@ int msWFSGetFeature(mapObj *map, wfsParamsObj *paramsObj, cgiRequestObj *req,
   {
       map->query.only_cache_result_count = MS_TRUE;
   }
-
+  else if( psFormat == NULL && maxfeatures != 0 &&
+           msWFSCanStreamFeatures(map, paramsObj, numlayers) )
+  {
+      queryStream = msGMLCreateWFSQueryStream(map, gmlinfo.user_namespace_prefix,
+                                              outputformat, nWFSVersion, bUseURN);
+      if( queryStream == NULL )
+      {
+          msFreeCharArray(layers, numlayers);
+          msFree(sBBoxSrs);
+          msFreeCharArray(papszGMLGroups, map->numlayers);
+          msFreeCharArray(papszGMLIncludeItems, map->numlayers);
+          msFreeCharArray(papszGMLGeometries, map->numlayers);
+          msWFSCleanupGMLInfo(&gmlinfo);
+          return msWFSException(map, "mapserv", MS_OWS_ERROR_NO_APPLICABLE_CODE,
+                                paramsObj->pszVersion);
+      }
+      msWFSSetGMLLayerMetadata(map, papszGMLGroups, papszGMLIncludeItems,
+                               papszGMLGeometries);
+      map->query.resultcallback = msGMLWFSQueryStreamAddShape;
+      map->query.resultcallbackdata = queryStream;
+  }
 
   status = msWFSRetrieveFeatures(map,
                                  ows_request,
@@ -3656,8 +3726,17 @@ int msWFSGetFeature(mapObj *map, wfsParamsObj *paramsObj, cgiRequestObj *req,
                            nWFSVersion,
                            &iNumberOfFeatures,
                            &bHasNextFeatures);
+  map->query.resultcallback = NULL;
+  map->query.resultcallbackdata = NULL;
+  if( status == MS_SUCCESS && queryStream != NULL &&
+      msGMLFinishWFSQueryStream(queryStream) != MS_SUCCESS )
+  {
+      status = msWFSException(map, "mapserv", MS_OWS_ERROR_NO_APPLICABLE_CODE,
+                              paramsObj->pszVersion);
+  }
   if( status != MS_SUCCESS )
   {
+      msGMLFreeWFSQueryStream(queryStream);
       msFreeCharArray(layers, numlayers);
       msFree(sBBoxSrs);
       msFreeCharArray(papszGMLGroups, map->numlayers);
@@ -3719,6 +3798,7 @@ int msWFSGetFeature(mapObj *map, wfsParamsObj *paramsObj, cgiRequestObj *req,
     if(status != MS_SUCCESS) {
       if( old_context != NULL )
           msIO_restoreOldStdoutContext(old_context);
+      msGMLFreeWFSQueryStream(queryStream);
       msWFSCleanupGMLInfo(&gmlinfo);
       msFreeCharArray(papszGMLGroups, map->numlayers);
       msFreeCharArray(papszGMLIncludeItems, map->numlayers);
@@ -3736,28 +3816,12 @@ int msWFSGetFeature(mapObj *map, wfsParamsObj *paramsObj, cgiRequestObj *req,
       int i;
       int bWFS2MultipleFeatureCollection = MS_FALSE;
 
-      /* Would make sense for WFS 1.1.0 too ! See #3576 */
-      int bUseURN = (nWFSVersion == OWS_2_0_0);
-      const char* useurn = msOWSLookupMetadata(&(map->web.metadata), "F", "return_srs_as_urn");
-      if (useurn && strcasecmp(useurn, "true") == 0)
-        bUseURN = 1;
-      else if (useurn && strcasecmp(useurn, "false") == 0)
-        bUseURN = 0;
-
-      for(i=0;i<map->numlayers;i++)
-      {
-        lp = GET_LAYER(map, i);
-        if( papszGMLGroups[i] )
-            msInsertHashTable(&(lp->metadata), "GML_GROUPS", papszGMLGroups[i]);
-        if( papszGMLIncludeItems[i] )
-            msInsertHashTable(&(lp->metadata), "GML_INCLUDE_ITEMS", papszGMLIncludeItems[i]);
-        if( papszGMLGeometries[i] )
-            msInsertHashTable(&(lp->metadata), "GML_GEOMETRIES", papszGMLGeometries[i]);
-      }
+      msWFSSetGMLLayerMetadata(map, papszGMLGroups, papszGMLIncludeItems,
+                               papszGMLGeometries);
 
       /* For WFS 2.0, when we request several types, we must present each type */
       /* in its own FeatureCollection (§ 11.3.3.5 ) */
-      if( nWFSVersion >= OWS_2_0_0 && iResultTypeHits != 1 )
+      if( nWFSVersion >= OWS_2_0_0 && iResultTypeHits != 1 && queryStream == NULL )
       {
           int nLayersWithFeatures = 0;
           for(i=0; i<map->numlayers; i++) {
@@ -3824,7 +3888,22 @@ int msWFSGetFeature(mapObj *map, wfsParamsObj *paramsObj, cgiRequestObj *req,
          }
       }
 
-      if( !bWFS2MultipleFeatureCollection )
+      status =  MS_SUCCESS;
+
+      if( queryStream != NULL )
+      {
+        /* The headers and the collection preamble are already out, an */
+        /* exception can't be sent anymore: the collection is closed as */
+        /* usual and the truncated output is logged. */
+        if( msGMLWriteWFSQueryStream(map, stdout, queryStream) != MS_SUCCESS ) {
+          char *errormsg = msGetErrorString("; ");
+          msDebug("msWFSGetFeature(): feature collection truncated: %s\n",
+                  errormsg ? errormsg : "");
+          msFree(errormsg);
+          msResetErrorList();
+        }
+      }
+      else if( !bWFS2MultipleFeatureCollection )
       {
         msGMLWriteWFSQuery(map, stdout,
                                     gmlinfo.user_namespace_prefix,
@@ -3833,8 +3912,6 @@ int msWFSGetFeature(mapObj *map, wfsParamsObj *paramsObj, cgiRequestObj *req,
                                     bUseURN,
                                     MS_FALSE);
       }
-
-      status =  MS_SUCCESS;
     }
   } else {
     mapservObj *mapserv = msAllocMapServObj();
@@ -3865,6 +3942,7 @@ int msWFSGetFeature(mapObj *map, wfsParamsObj *paramsObj, cgiRequestObj *req,
   msFreeCharArray(papszGMLGroups, map->numlayers);
   msFreeCharArray(papszGMLIncludeItems, map->numlayers);
   msFreeCharArray(papszGMLGeometries, map->numlayers);
+  msGMLFreeWFSQueryStream(queryStream);
 
   if( psFormat == NULL && status == MS_SUCCESS ) {
     msWFSGetFeature_GMLPostfix( map, req, &gmlinfo, paramsObj,
@@ -30,6 +30,7 @@
 #include "maperror.h"
 #include "mapows.h"
 #include "mapproject.h"
+#include "mapthread.h"
 
 #include <time.h>
 #include <assert.h>
@@ -475,6 +476,7 @@ typedef struct ms_wfs_layer_info_t {
   char        *pszGetUrl;
   int         nStatus;           /* HTTP status */
   int         bLayerHasValidGML;  /* False until msWFSLayerWhichShapes() is called and determines the result GML is valid with features*/
+  char        *pszXSDFilename;    /* Cached schema written next to the GML */
 } msWFSLayerInfo;
 
 
@@ -509,11 +511,166 @@ static void msFreeWFSLayerInfo(msWFSLayerInfo *psInfo)
       free(psInfo->pszGMLFilename);
     if (psInfo->pszGetUrl)
       free(psInfo->pszGetUrl);
+    if (psInfo->pszXSDFilename)
+      free(psInfo->pszXSDFilename);
 
     free(psInfo);
   }
 }
 
+
+/**********************************************************************
+ *                          WFS schema cache
+ *
+ * When wfs_schema_cache is set the DescribeFeatureType response of a
+ * layer is fetched once per process and kept here, keyed on the
+ * connection, version and typename.  It is written as an .xsd next to
+ * every downloaded GML file so the OGR GML driver takes the schema from
+ * it instead of prescanning the whole file to build a .gfs.
+ **********************************************************************/
+#define MS_WFS_SCHEMA_CACHE_MAX 32
+
+typedef struct wfs_schema_cache_entry_t {
+  char *key;
+  char *schema;
+  struct wfs_schema_cache_entry_t *next;
+} wfsSchemaCacheEntryObj;
+
+static wfsSchemaCacheEntryObj *wfsSchemaCache = NULL;
+
+static void msWFSFreeSchemaCacheEntry(wfsSchemaCacheEntryObj *entry)
+{
+  msFree(entry->key);
+  msFree(entry->schema);
+  msFree(entry);
+}
+
+/*
+** Fetches the DescribeFeatureType response for the layer.  Only done
+** when wfs_version and wfs_typename are set in the metadata.
+*/
+static char *msWFSFetchSchema(layerObj *lp, const char *pszVersion,
+                              const char *pszTypename)
+{
+  httpRequestObj asReqInfo[2];
+  char *pszOnlineResource, *pszURL, *pszSchema = NULL;
+  const char *pszTmp;
+  int nTimeout = 30;
+
+  if ((pszTmp = msOWSLookupMetadata2(&(lp->metadata), &(lp->map->web.metadata),
+                                    "FO", "connectiontimeout")) != NULL)
+    nTimeout = atoi(pszTmp);
+
+  pszOnlineResource = msOWSTerminateOnlineResource(lp->connection);
+  pszURL = msStrdup(pszOnlineResource);
+  msFree(pszOnlineResource);
+  pszURL = msStringConcatenate(pszURL, "&REQUEST=DescribeFeatureType&SERVICE=WFS&VERSION=");
+  pszURL = msStringConcatenate(pszURL, pszVersion);
+  pszURL = msStringConcatenate(pszURL, "&TYPENAME=");
+  pszURL = msStringConcatenate(pszURL, pszTypename);
+
+  msHTTPInitRequestObj(asReqInfo, 2);
+  asReqInfo[0].pszGetUrl = pszURL;
+  asReqInfo[0].nTimeout = nTimeout;
+  asReqInfo[0].debug = lp->debug;
+
+  if (msHTTPAuthProxySetup(&(lp->map->web.metadata), &(lp->metadata),
+                           asReqInfo, 0, lp->map, "FO") == MS_SUCCESS &&
+      msHTTPExecuteRequests(asReqInfo, 1, MS_FALSE) == MS_SUCCESS &&
+      asReqInfo[0].result_data != NULL) {
+    asReqInfo[0].result_data[asReqInfo[0].result_size] = '\0';
+    if (strstr(asReqInfo[0].result_data, "schema") &&
+        strstr(asReqInfo[0].result_data, "Exception") == NULL)
+      pszSchema = msStrdup(asReqInfo[0].result_data);
+  }
+
+  if (pszSchema == NULL && lp->debug)
+    msDebug("msWFSFetchSchema(): no usable DescribeFeatureType response for layer %s.\n",
+            lp->name ? lp->name : "(null)");
+
+  msHTTPFreeRequestObj(asReqInfo, 2);
+  return pszSchema;
+}
+
+/*
+** Writes the cached schema of the layer next to its GML file, fetching
+** it first if needed.  Failures are not fatal: OGR then falls back to
+** scanning the GML.
+*/
+static void msWFSWriteCachedSchema(layerObj *lp, msWFSLayerInfo *psInfo)
+{
+  const char *pszVersion, *pszTypename, *pszTmp;
+  wfsSchemaCacheEntryObj *entry, **ppsCur;
+  char *pszKey, *pszSchema = NULL, *pszXSDFilename;
+  FILE *fp;
+  int i, nLen;
+
+  if ((pszTmp = msOWSLookupMetadata(&(lp->metadata), "FO", "schema_cache")) == NULL ||
+      !(strcasecmp(pszTmp, "true") == 0 || strcasecmp(pszTmp, "on") == 0 ||
+        strcasecmp(pszTmp, "yes") == 0 || atoi(pszTmp) > 0))
+    return;
+
+  pszVersion = msOWSLookupMetadata(&(lp->metadata), "FO", "version");
+  pszTypename = msOWSLookupMetadata(&(lp->metadata), "FO", "typename");
+  nLen = strlen(psInfo->pszGMLFilename);
+  if (pszVersion == NULL || pszTypename == NULL || lp->connection == NULL ||
+      nLen < 4 || strcasecmp(psInfo->pszGMLFilename+nLen-4, ".gml") != 0)
+    return;
+
+  pszKey = msStrdup(lp->connection);
+  pszKey = msStringConcatenate(pszKey, "|");
+  pszKey = msStringConcatenate(pszKey, pszVersion);
+  pszKey = msStringConcatenate(pszKey, "|");
+  pszKey = msStringConcatenate(pszKey, pszTypename);
+
+  msAcquireLock(TLOCK_OWS);
+  for (entry = wfsSchemaCache; entry; entry = entry->next) {
+    if (strcmp(entry->key, pszKey) == 0) {
+      pszSchema = msStrdup(entry->schema);
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_OWS);
+
+  if (pszSchema == NULL) {
+    pszSchema = msWFSFetchSchema(lp, pszVersion, pszTypename);
+    if (pszSchema == NULL) {
+      msFree(pszKey);
+      return;
+    }
+
+    entry = (wfsSchemaCacheEntryObj *) msSmallCalloc(1, sizeof(wfsSchemaCacheEntryObj));
+    entry->key = pszKey;
+    entry->schema = msStrdup(pszSchema);
+    pszKey = NULL;
+
+    msAcquireLock(TLOCK_OWS);
+    entry->next = wfsSchemaCache;
+    wfsSchemaCache = entry;
+    for (i = 1, ppsCur = &(entry->next); *ppsCur; i++) {
+      if (i >= MS_WFS_SCHEMA_CACHE_MAX || strcmp((*ppsCur)->key, entry->key) == 0) {
+        wfsSchemaCacheEntryObj *old = *ppsCur;
+        *ppsCur = old->next;
+        msWFSFreeSchemaCacheEntry(old);
+      } else
+        ppsCur = &((*ppsCur)->next);
+    }
+    msReleaseLock(TLOCK_OWS);
+  }
+  msFree(pszKey);
+
+  pszXSDFilename = msStrdup(psInfo->pszGMLFilename);
+  strcpy(pszXSDFilename+nLen-4, ".xsd");
+  if ((fp = fopen(pszXSDFilename, "wb")) != NULL) {
+    fwrite(pszSchema, 1, strlen(pszSchema), fp);
+    fclose(fp);
+    msFree(psInfo->pszXSDFilename);
+    psInfo->pszXSDFilename = pszXSDFilename;
+  } else
+    msFree(pszXSDFilename);
+
+  msFree(pszSchema);
+}
 #endif /* USE_WFS_LYR */
 
 /*====================================================================
@@ -654,6 +811,15 @@ int msPrepareWFSLayerRequest(int nLayerId, mapObj *map, layerObj *lp,
   pasReqInfo[(*numRequests)].bbox = bbox;
   pasReqInfo[(*numRequests)].debug = lp->debug;
 
+  /* Keep identical upstream responses for wfs_http_cache_ttl seconds */
+  if ((pszTmp = msOWSLookupMetadata2(&(lp->metadata), &(map->web.metadata),
+                                    "FO", "http_cache_ttl")) != NULL) {
+    pasReqInfo[(*numRequests)].nCacheMaxAge = atoi(pszTmp);
+    if ((pszTmp = msOWSLookupMetadata2(&(lp->metadata), &(map->web.metadata),
+                                      "FO", "http_cache_dir")) != NULL)
+      pasReqInfo[(*numRequests)].pszCacheDir = msStrdup(pszTmp);
+  }
+
   if (msHTTPAuthProxySetup(&(map->web.metadata), &(lp->metadata),
                            pasReqInfo, *numRequests, map, "FO") != MS_SUCCESS) {
     if (psParams) {
@@ -1172,8 +1338,10 @@ int msWFSLayerWhichShapes(layerObj *lp, rectObj rect, int isQuery)
 
 
   /* ------------------------------------------------------------------
-   * Open GML file using OGR.
+   * Open GML file using OGR, with the cached schema if there is one.
    * ------------------------------------------------------------------ */
+  msWFSWriteCachedSchema(lp, psInfo);
+
   if ((status = msOGRLayerOpen(lp, psInfo->pszGMLFilename)) != MS_SUCCESS)
     return status;
 
@@ -1217,6 +1385,9 @@ int msWFSLayerClose(layerObj *lp)
    * ------------------------------------------------------------------ */
   /* __TODO__ unlink()  .gml file and OGR's schema file if they exist */
   /* unlink( */
+  if (lp->wfslayerinfo && !lp->debug &&
+      ((msWFSLayerInfo*)lp->wfslayerinfo)->pszXSDFilename)
+    unlink(((msWFSLayerInfo*)lp->wfslayerinfo)->pszXSDFilename);
 
   msFreeWFSLayerInfo(lp->wfslayerinfo);
   lp->wfslayerinfo = NULL;
@@ -1296,3 +1467,20 @@ msWFSLayerInitializeVirtualTable(layerObj *layer)
   return MS_SUCCESS;
 }
 
+/**********************************************************************
+ *                          msWFSSchemaCacheCleanup()
+ *
+ * Frees the cached DescribeFeatureType schemas.
+ **********************************************************************/
+void msWFSSchemaCacheCleanup(void)
+{
+#ifdef USE_WFS_LYR
+  msAcquireLock(TLOCK_OWS);
+  while (wfsSchemaCache) {
+    wfsSchemaCacheEntryObj *next = wfsSchemaCache->next;
+    msWFSFreeSchemaCacheEntry(wfsSchemaCache);
+    wfsSchemaCache = next;
+  }
+  msReleaseLock(TLOCK_OWS);
+#endif
+}
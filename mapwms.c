@@ -3810,12 +3810,19 @@ int msWMSFeatureInfo(mapObj *map, int nVersion, char **names, char **values, int
   char ***nestedGroups = NULL;
   int *numNestedGroups = NULL;
   int *isUsedInNestedGroup = NULL;
+  int query_threads = 1;
+  const char *value;
 
   nestedGroups = (char***)msSmallCalloc(map->numlayers, sizeof(char**));
   numNestedGroups = (int*)msSmallCalloc(map->numlayers, sizeof(int));
   isUsedInNestedGroup = (int*)msSmallCalloc(map->numlayers, sizeof(int));
   msWMSPrepareNestedGroups(map, nVersion, nestedGroups, numNestedGroups, isUsedInNestedGroup);
 
+  /* number of threads used to query the layers of a point request */
+  value = msOWSLookupMetadata(&(map->web.metadata), "MO", "feature_info_threads");
+  if(value != NULL && atoi(value) > 1)
+    query_threads = atoi(value);
+
   for(i=0; i<numentries; i++) {
     if(strcasecmp(names[i], "QUERY_LAYERS") == 0) {
       char **layers;
@@ -3973,7 +3980,7 @@ int msWMSFeatureInfo(mapObj *map, int nVersion, char **names, char **values, int
     map->query.buffer = 0;
     map->query.maxresults = feature_count;
 
-    if(msQueryByPoint(map) != MS_SUCCESS)
+    if(msQueryByPointThreaded(map, query_threads) != MS_SUCCESS)
       if((query_status=ms_error->code) != MS_NOTFOUND) return msWMSException(map, nVersion, NULL, wms_exception_format);
 
   } else { /* use_bbox == MS_TRUE */
@@ -1165,6 +1165,15 @@ int msPrepareWMSLayerRequest(int nLayerId, mapObj *map, layerObj *lp,
     pasReqInfo[(*numRequests)].height = bbox_height;
     pasReqInfo[(*numRequests)].debug = lp->debug;
 
+    /* Keep identical upstream responses for wms_http_cache_ttl seconds */
+    if ((pszTmp = msOWSLookupMetadata2(&(lp->metadata), &(map->web.metadata),
+                                      "MO", "http_cache_ttl")) != NULL) {
+      pasReqInfo[(*numRequests)].nCacheMaxAge = atoi(pszTmp);
+      if ((pszTmp = msOWSLookupMetadata2(&(lp->metadata), &(map->web.metadata),
+                                        "MO", "http_cache_dir")) != NULL)
+        pasReqInfo[(*numRequests)].pszCacheDir = msStrdup(pszTmp);
+    }
+
     if (msHTTPAuthProxySetup(&(map->web.metadata), &(lp->metadata),
                              pasReqInfo, *numRequests, map, "MO") != MS_SUCCESS)
       return MS_FAILURE;
@@ -1202,6 +1211,102 @@ int msPrepareWMSLayerRequest(int nLayerId, mapObj *map, layerObj *lp,
 
 }
 
+#ifdef USE_WMS_LYR
+/**********************************************************************
+ *                          msDrawWMSLayerDirect()
+ *
+ * Fast path for msDrawWMSLayerLow(): when the remote image is already
+ * in the map projection and covers exactly the map extent and size, and
+ * the layer needs no raster processing, decode the PNG/JPEG response
+ * straight from memory and merge it into the output image.  This skips
+ * the GDAL dataset, the temporary file and the resampling pass.
+ *
+ * Returns MS_SUCCESS if the layer was drawn, MS_DONE if the regular
+ * path must be used instead, and MS_FAILURE on error.
+ **********************************************************************/
+static int msDrawWMSLayerDirect(mapObj *map, layerObj *lp, imageObj *img,
+                                httpRequestObj *psReq)
+{
+  rendererVTableObj *renderer;
+  rasterBufferObj rb;
+  unsigned char *data = NULL;
+  int size = 0, status;
+  double dfTolerance = map->cellsize * 0.001;
+
+  if (!MS_RENDERER_PLUGIN(img->format) ||
+      !MS_IMAGE_RENDERER(img)->supports_pixel_buffer ||
+      !MS_IMAGE_RENDERER(img)->mergeRasterBuffer)
+    return MS_DONE;
+
+  if (msProjectionsDiffer(&(map->projection), &(lp->projection)) ||
+      lp->numprocessing > 0 || lp->mask != NULL || lp->offsite.red != -1 ||
+      (lp->numclasses > 0 &&
+       !msOWSLookupMetadata(&(lp->metadata), "MO", "sld_body") &&
+       !msOWSLookupMetadata(&(lp->metadata), "MO", "sld_url")))
+    return MS_DONE;
+
+  /* The request covers the map extent (pixel edges) at the map size? */
+  if (psReq->width != img->width || psReq->height != img->height ||
+      fabs(psReq->bbox.minx - (map->extent.minx - map->cellsize*0.5)) > dfTolerance ||
+      fabs(psReq->bbox.miny - (map->extent.miny - map->cellsize*0.5)) > dfTolerance ||
+      fabs(psReq->bbox.maxx - (map->extent.maxx + map->cellsize*0.5)) > dfTolerance ||
+      fabs(psReq->bbox.maxy - (map->extent.maxy + map->cellsize*0.5)) > dfTolerance)
+    return MS_DONE;
+
+  if (!msLayerIsVisible(map, lp) || lp->opacity == 0)
+    return MS_SUCCESS;
+
+  if (psReq->pszOutputFile) {
+    FILE *fp = fopen(psReq->pszOutputFile, "rb");
+    if (fp == NULL)
+      return MS_DONE;
+    fseek(fp, 0, SEEK_END);
+    size = (int) ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data = (unsigned char *) msSmallMalloc(size > 0 ? size : 1);
+    if (size <= 0 || fread(data, 1, size, fp) != (size_t)size) {
+      fclose(fp);
+      free(data);
+      return MS_DONE;
+    }
+    fclose(fp);
+  } else {
+    data = (unsigned char *) psReq->result_data;
+    size = psReq->result_size;
+  }
+
+  /* Only PNG and JPEG are handled here, leave anything else to GDAL */
+  status = MS_FAILURE;
+  memset(&rb, 0, sizeof(rasterBufferObj));
+  if (size > 8 && ((data[0] == 0x89 && data[1] == 'P') ||
+                   (data[0] == 0xFF && data[1] == 0xD8)))
+    status = msLoadMSRasterBufferFromMemory(data, size, &rb);
+  if (psReq->pszOutputFile)
+    free(data);
+  if (status != MS_SUCCESS)
+    return MS_DONE;
+
+  if (rb.width != img->width || rb.height != img->height) {
+    free(rb.data.rgba.pixels);
+    return MS_DONE;
+  }
+
+  if (lp->debug)
+    msDebug("msDrawWMSLayerDirect(): merging %dx%d image for layer '%s' without resampling.\n",
+            rb.width, rb.height, lp->name ? lp->name : "(null)");
+
+  renderer = MS_IMAGE_RENDERER(img);
+  status = renderer->mergeRasterBuffer(img, &rb, lp->opacity*0.01, 0, 0, 0, 0,
+                                       rb.width, rb.height);
+  free(rb.data.rgba.pixels);
+
+  if (psReq->pszOutputFile && !lp->debug)
+    unlink(psReq->pszOutputFile);
+
+  return status;
+}
+#endif /* USE_WMS_LYR */
+
 /**********************************************************************
  *                          msDrawWMSLayerLow()
  *
@@ -1301,6 +1406,14 @@ int msDrawWMSLayerLow(int nLayerId, httpRequestObj *pasReqInfo,
     return MS_SUCCESS;
   }
 
+  /* ------------------------------------------------------------------
+   * Merge the image directly if it needs no reprojection/resampling.
+   * ------------------------------------------------------------------ */
+  status = msDrawWMSLayerDirect(map, lp, img, &(pasReqInfo[iReq]));
+  if (status != MS_DONE)
+    return status;
+  status = MS_SUCCESS;
+
   /* ------------------------------------------------------------------
    * If the output was written to a memory buffer, then we will need
    * to attach a "VSI" name to this buffer.